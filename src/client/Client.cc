@@ -60,6 +60,7 @@ using namespace std;
 #include "osdc/Filer.h"
 #include "osdc/Objecter.h"
 #include "osdc/ObjectCacher.h"
+#include "ObjecterWriteback.h"
 
 #include "common/Cond.h"
 #include "common/Mutex.h"
@@ -150,9 +151,10 @@ Client::Client(Messenger *m, MonClient *mc)
   mdsmap = new MDSMap;
   objecter = new Objecter(cct, messenger, monclient, osdmap, client_lock, timer);
   objecter->set_client_incarnation(0);  // client always 0, for now.
-  objectcacher = new ObjectCacher(cct, objecter, client_lock, 
+  writeback_handler = new ObjecterWriteback(objecter);
+  objectcacher = new ObjectCacher(cct, "client", *writeback_handler, client_lock,
 				  client_flush_set_callback,    // all commit callback
-				  (void*)this);
+				  (void*)this, objecter);
   filer = new Filer(objecter);
 }
 
@@ -167,6 +169,10 @@ Client::~Client()
     delete objectcacher; 
     objectcacher = 0; 
   }
+  if (writeback_handler) {
+    delete writeback_handler;
+    writeback_handler = 0;
+  }
 
   if (filer) { delete filer; filer = 0; }
   if (objecter) { delete objecter; objecter = 0; }
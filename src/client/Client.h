@@ -66,6 +66,7 @@ class InodeStat;
 class Filer;
 class Objecter;
 class ObjectCacher;
+class WritebackHandler;
 
 class PerfCounters;
 
@@ -263,6 +264,7 @@ public:
 protected:
   Filer                 *filer;     
   ObjectCacher          *objectcacher;
+  WritebackHandler      *writeback_handler;
   Objecter              *objecter;     // (non-blocking) osd interface
   
   // cache
@@ -0,0 +1,35 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_CLIENT_OBJECTERWRITEBACK_H
+#define CEPH_CLIENT_OBJECTERWRITEBACK_H
+
+#include "osdc/Objecter.h"
+#include "osdc/WritebackHandler.h"
+
+class ObjecterWriteback : public WritebackHandler {
+ public:
+  ObjecterWriteback(Objecter *o) : objecter(o) {}
+  virtual ~ObjecterWriteback() {}
+
+  virtual void read(const object_t& oid, const object_locator_t& oloc,
+		    loff_t off, uint64_t len, snapid_t snapid,
+		    bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+		    Context *onfinish) {
+    objecter->read_trunc(oid, oloc, off, len, snapid, pbl, 0,
+			 trunc_size, trunc_seq, onfinish);
+  }
+
+  virtual tid_t write(const object_t& oid, const object_locator_t& oloc,
+		      loff_t off, uint64_t len, const SnapContext& snapc,
+		      const bufferlist &bl, utime_t mtime,
+		      uint64_t trunc_size, __u32 trunc_seq,
+		      Context *oncommit) {
+    return objecter->write_trunc(oid, oloc, off, len, snapc, bl, mtime, 0,
+				 trunc_size, trunc_seq, NULL, oncommit);
+  }
+
+ private:
+  Objecter *objecter;
+};
+
+#endif
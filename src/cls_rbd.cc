@@ -7,11 +7,12 @@
 #include <errno.h>
 
 #include "include/types.h"
+#include "include/intarith.h"
 #include "objclass/objclass.h"
 
 #include "include/rbd_types.h"
 
-CLS_VER(1,3)
+CLS_VER(1,4)
 CLS_NAME(rbd)
 
 cls_handle_t h_class;
@@ -20,6 +21,7 @@ cls_method_handle_t h_snapshot_add;
 cls_method_handle_t h_snapshot_remove;
 cls_method_handle_t h_snapshot_revert;
 cls_method_handle_t h_assign_bid;
+cls_method_handle_t h_objmap_update;
 cls_method_handle_t h_test_exec;
 
 static int snap_read_header(cls_method_context_t hctx, bufferlist& bl)
@@ -367,6 +369,66 @@ int rbd_assign_bid(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
   return out->length();
 }
 
+/*
+ * set or clear the bits for objects [start, end) in an object map.
+ * bit n is (1 << (n % 8)) in byte n / 8; bytes past the end of the map
+ * are clear.  a map that doesn't exist isn't created: the image either
+ * has none, or lost it, and a map holding only the bits set since then
+ * would claim everything else is missing.
+ */
+int objmap_update(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t start, end;
+  __u8 exists;
+  bufferlist::iterator iter = in->begin();
+  try {
+    ::decode(start, iter);
+    ::decode(end, iter);
+    ::decode(exists, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+  if (start >= end)
+    return 0;
+
+  uint64_t size;
+  int rc = cls_cxx_stat(hctx, &size, NULL);
+  if (rc < 0)
+    return rc;
+
+  uint64_t byte_start = start / 8;
+  uint64_t byte_end = (end + 7) / 8;
+  if (!exists) {
+    if (byte_start >= size)
+      return 0;
+    if (byte_end > size)
+      byte_end = size;
+  }
+
+  bufferptr bp(byte_end - byte_start);
+  bp.zero();
+  if (byte_start < size) {
+    bufferlist bl;
+    rc = cls_cxx_read(hctx, byte_start, MIN(byte_end, size) - byte_start, &bl);
+    if (rc < 0)
+      return rc;
+    bl.copy(0, bl.length(), bp.c_str());
+  }
+
+  unsigned char *bits = (unsigned char *)bp.c_str();
+  uint64_t last = MIN(end, byte_end * 8);
+  for (uint64_t i = start; i < last; i++) {
+    if (exists)
+      bits[i / 8 - byte_start] |= 1 << (i % 8);
+    else
+      bits[i / 8 - byte_start] &= ~(1 << (i % 8));
+  }
+
+  bufferlist newbl;
+  newbl.push_back(bp);
+  return cls_cxx_write(hctx, byte_start, newbl.length(), &newbl);
+}
+
 /* Used for testing rados_exec */
 static int test_exec(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 {
@@ -389,6 +451,9 @@ void __cls_init()
   /* assign a unique block id for rbd blocks */
   cls_register_cxx_method(h_class, "assign_bid", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, rbd_assign_bid, &h_assign_bid);
 
+  /* object existence maps, kept next to each image's data objects */
+  cls_register_cxx_method(h_class, "objmap_update", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, objmap_update, &h_objmap_update);
+
   cls_register_cxx_method(h_class, "test_exec", CLS_METHOD_RD | CLS_METHOD_PUBLIC, test_exec, &h_test_exec);
 
   return;
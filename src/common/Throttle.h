@@ -3,6 +3,7 @@
 
 #include "Mutex.h"
 #include "Cond.h"
+#include <errno.h>
 #include <list>
 
 class Throttle {
@@ -115,5 +116,52 @@ public:
   }
 };
 
+/*
+ * Caps how many asynchronous operations one caller has outstanding, and
+ * remembers the first error among them.  Call start_op() before issuing
+ * each op (it blocks while max are in flight), end_op() from each op's
+ * completion, and wait_for_ret() once everything has been issued.
+ */
+class SimpleThrottle {
+  Mutex lock;
+  Cond cond;
+  uint64_t max, current;
+  int ret;
+  bool ignore_enoent;
+
+public:
+  SimpleThrottle(uint64_t m, bool ignore_enoent_)
+    : lock("SimpleThrottle::lock"), max(m ? m : 1), current(0), ret(0),
+      ignore_enoent(ignore_enoent_) {}
+  ~SimpleThrottle() {
+    assert(current == 0);
+  }
+
+  void start_op() {
+    Mutex::Locker l(lock);
+    while (current >= max)
+      cond.Wait(lock);
+    ++current;
+  }
+  void end_op(int r) {
+    Mutex::Locker l(lock);
+    assert(current > 0);
+    --current;
+    if (r < 0 && ret == 0 && !(ignore_enoent && r == -ENOENT))
+      ret = r;
+    cond.Signal();
+  }
+  // error so far, without waiting; lets callers stop issuing early
+  int get_ret() {
+    Mutex::Locker l(lock);
+    return ret;
+  }
+  int wait_for_ret() {
+    Mutex::Locker l(lock);
+    while (current > 0)
+      cond.Wait(lock);
+    return ret;
+  }
+};
 
 #endif
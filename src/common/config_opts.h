@@ -141,6 +141,11 @@ OPTION(client_oc, OPT_BOOL, true)
 OPTION(client_oc_size, OPT_INT, 1024*1024* 200)    // MB * n
 OPTION(client_oc_max_dirty, OPT_INT, 1024*1024* 100)    // MB * n  (dirty OR tx.. bigish)
 OPTION(client_oc_target_dirty, OPT_INT, 1024*1024* 8) // target dirty (keep this smallish)
+OPTION(client_oc_max_dirty_age, OPT_DOUBLE, 1.0) // seconds dirty data may sit before the flusher writes it back
+OPTION(client_oc_max_dirty_delay, OPT_DOUBLE, 0.5) // max seconds a single write is paced while dirty is between target and max
+OPTION(client_oc_policy, OPT_STR, "lru")  // replacement policy for clean data: lru, or 2q to resist scans
+OPTION(client_oc_2q_recent_ratio, OPT_DOUBLE, .25)  // 2q: share of client_oc_size for data used only once
+OPTION(client_oc_2q_ghost_ratio, OPT_DOUBLE, 1.0)   // 2q: remember evictions covering this share of client_oc_size
 // note: the max amount of "in flight" dirty data is roughly (max - target)
 OPTION(client_oc_max_sync_write, OPT_U64, 128*1024)   // sync writes >= this use wrlock
 OPTION(fuse_use_invalidate_cb, OPT_BOOL, false) // use fuse 2.8+ invalidate callback to keep page cache consistent
@@ -148,6 +153,11 @@ OPTION(objecter_tick_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_mon_retry_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_timeout, OPT_DOUBLE, 10.0)    // before we ask for a map
 OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) //max in-flight data (both directions)
+OPTION(objecter_list_concurrent_pgs, OPT_INT, 4)   // pgs queried at once by a pool listing
+OPTION(objecter_batch_window, OPT_DOUBLE, 0)   // seconds reads may wait to be sent with others on the same object; 0 = off
+OPTION(objecter_batch_max_ops, OPT_INT, 16)    // send a read batch once it has this many ops
+OPTION(rados_aio_completion_threads, OPT_INT, 1)   // threads running aio callbacks; 0 = call them from the messenger thread
+OPTION(rados_aio_completion_order, OPT_STR, "none")  // keep callbacks in order per "object" or per "ioctx"; "none" only per completion
 OPTION(journaler_allow_split_entries, OPT_BOOL, true)
 OPTION(journaler_write_head_interval, OPT_INT, 15)
 OPTION(journaler_prefetch_periods, OPT_INT, 10)   // * journal object size
@@ -254,9 +264,15 @@ OPTION(osd_pool_default_pg_num, OPT_INT, 8)
 OPTION(osd_pool_default_pgp_num, OPT_INT, 8)
 OPTION(osd_map_cache_max, OPT_INT, 250)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
+OPTION(osd_map_full_interval, OPT_INT, 20)  // store a full map every n epochs; others are rebuilt from incrementals
+OPTION(osd_map_pg_mapping, OPT_BOOL, false)  // clients and mons keep a precomputed pg -> osd table with the current osdmap (osds always do)
+OPTION(osd_map_pg_mapping_threads, OPT_INT, 1)  // threads used for full builds of that table
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_subop_batch_max, OPT_INT, 16)  // max replication sub ops/replies per message to a peer; <= 1 disables batching
+OPTION(osd_subop_batch_delay, OPT_FLOAT, 0)  // hold queued sub ops this long (sec) for others to join them
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
+OPTION(osd_load_pgs_threads, OPT_INT, 4)  // threads reading pg state off disk at startup
 OPTION(osd_recover_clone_overlap, OPT_BOOL, false)   // preserve clone_overlap during recovery/migration
 OPTION(osd_backfill_scan_min, OPT_INT, 64)
 OPTION(osd_backfill_scan_max, OPT_INT, 512)
@@ -264,6 +280,8 @@ OPTION(osd_op_thread_timeout, OPT_INT, 30)
 OPTION(osd_backlog_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_recovery_thread_timeout, OPT_INT, 30)
 OPTION(osd_snap_trim_thread_timeout, OPT_INT, 60*60*1)
+OPTION(osd_snap_trim_max, OPT_INT, 16)  // clones trimmed per batch; the pg is requeued between batches
+OPTION(osd_snap_trim_sleep, OPT_FLOAT, 0)  // pause (sec) after each snap trim batch
 OPTION(osd_scrub_thread_timeout, OPT_INT, 60)
 OPTION(osd_scrub_finalize_thread_timeout, OPT_INT, 60*10)
 OPTION(osd_remove_thread_timeout, OPT_INT, 60*60)
@@ -276,6 +294,7 @@ OPTION(osd_heartbeat_grace, OPT_INT, 20)
 OPTION(osd_mon_report_interval_max, OPT_INT, 120)
 OPTION(osd_mon_report_interval_min, OPT_INT, 5)  // pg stats, failures, up_thru, boot.
 OPTION(osd_mon_ack_timeout, OPT_INT, 30) // time out a mon if it doesn't ack stats
+OPTION(osd_mon_report_ack_ratio, OPT_FLOAT, 10) // stretch pg stat interval to this many mon ack latencies
 OPTION(osd_min_down_reporters, OPT_INT, 1)   // number of OSDs who need to report a down OSD for it to count
 OPTION(osd_min_down_reports, OPT_INT, 3)     // number of times a down OSD must be reported for it to count
 OPTION(osd_default_data_pool_replay_window, OPT_INT, 45)
@@ -284,7 +303,15 @@ OPTION(osd_auto_mark_unfound_lost, OPT_BOOL, false)
 OPTION(osd_recovery_delay_start, OPT_FLOAT, 15)
 OPTION(osd_recovery_max_active, OPT_INT, 5)
 OPTION(osd_recovery_max_chunk, OPT_U64, 1<<20)  // max size of push chunk
+OPTION(osd_recovery_delta, OPT_BOOL, true)   // push only logged dirty extents to replicas with an older copy
+OPTION(osd_recovery_push_window, OPT_INT, 4)    // push chunks in flight per object per peer
+OPTION(osd_recovery_max_bytes_per_sec, OPT_U64, 0)  // recovery bandwidth budget; 0 = unlimited
+OPTION(osd_recovery_min_bytes_per_sec, OPT_U64, 4<<20)  // floor when backing off for client latency
+OPTION(osd_recovery_client_latency_target, OPT_FLOAT, 0)  // back off recovery above this client op latency (sec); 0 = off
 OPTION(osd_recovery_forget_lost_objects, OPT_BOOL, false)   // off for now
+OPTION(osd_copy_max_active, OPT_INT, 5)       // copy-from reads in flight per osd
+OPTION(osd_copy_max_chunk, OPT_U64, 8<<20)    // max size of a copy-from read
+OPTION(osd_copy_max_bytes, OPT_U64, 256<<20)  // copy-from data buffered per osd
 OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
 OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
@@ -300,6 +327,8 @@ OPTION(osd_max_notify_timeout, OPT_U32, 30) // max notify timeout in seconds
 OPTION(osd_kill_backfill_at, OPT_INT, 0)
 OPTION(osd_min_pg_log_entries, OPT_U32, 1000) // number of entries to keep in the pg log when trimming it
 OPTION(osd_op_complaint_time, OPT_FLOAT, 30) // how many seconds old makes an op complaint-worthy
+OPTION(osd_op_history_size, OPT_U32, 20)    // max number of completed ops to track
+OPTION(osd_op_history_duration, OPT_U32, 600) // oldest completed op to track
 OPTION(osd_command_max_records, OPT_INT, 256)
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
@@ -328,8 +357,10 @@ OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
 OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
+OPTION(filestore_inline_max_bytes, OPT_U64, 0) // keep objects up to this size in the omap store rather than in their file (0 = never)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+OPTION(filestore_index_list_cache_objects, OPT_U64, 65536) // objects in cached subdir listings (for partial collection lists)
 OPTION(filestore_update_collections, OPT_BOOL, false)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(journal_dio, OPT_BOOL, true)
@@ -373,6 +404,13 @@ OPTION(rgw_intent_log_object_name, OPT_STR, "%Y-%m-%d-%i-%n")  // man date to se
 OPTION(rgw_intent_log_object_name_utc, OPT_BOOL, false)
 OPTION(rgw_init_timeout, OPT_INT, 30) // time in seconds
 OPTION(rbd_writeback_window, OPT_INT, 0 /*8 << 20*/) // rbd writeback window size, bytes
+OPTION(rbd_cache, OPT_BOOL, false) // cache image data in the client with an ObjectCacher
+OPTION(rbd_cache_size, OPT_LONGLONG, 32<<20)         // cache size, bytes
+OPTION(rbd_cache_max_dirty, OPT_LONGLONG, 24<<20)    // dirty limit, bytes; 0 for write-through
+OPTION(rbd_cache_target_dirty, OPT_LONGLONG, 16<<20) // dirty bytes at which writeback starts
+OPTION(rbd_cache_max_dirty_age, OPT_DOUBLE, 1.0)     // seconds dirty data may sit before writeback
+OPTION(rbd_concurrent_management_ops, OPT_INT, 10) // objects in flight for copy, remove, resize, rollback, import and export
+OPTION(rbd_object_map, OPT_BOOL, false) // new images track which objects exist; older clients refuse to open them
 OPTION(rgw_mime_types_file, OPT_STR, "/etc/mime.types")
 
 // This will be set to true when it is safe to start threads.
@@ -337,8 +337,6 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
     ::decode(bucket->items[j], blp);
   }
 
-  bucket->perm = (__u32*)calloc(1, bucket->size * sizeof(__s32));
-  bucket->perm_n = 0;
 
   switch (bucket->alg) {
   case CRUSH_BUCKET_UNIFORM:
@@ -392,8 +392,10 @@ public:
   void do_rule(int rule, int x, vector<int>& out, int maxout, int forcefeed,
 	       const vector<__u32>& weight) const {
     int rawout[maxout];
+    struct crush_work work = { 0, 0, 0, 0, NULL };
     int numrep = crush_do_rule(crush, rule, x, rawout, maxout,
-			       forcefeed, &weight[0]);
+			       forcefeed, &weight[0], &work);
+    free(work.perm);
     if (numrep < 0)
       numrep = 0;   // e.g., when forcefed device dne.
     out.resize(numrep);
@@ -179,7 +179,6 @@ crush_make_uniform_bucket(int hash, int type, int size,
 	bucket->item_weight = item_weight;
 
 	bucket->h.items = malloc(sizeof(__u32)*size);
-	bucket->h.perm = malloc(sizeof(__u32)*size);
 	for (i=0; i<size; i++)
 		bucket->h.items[i] = items[i];
 
@@ -206,7 +205,6 @@ crush_make_list_bucket(int hash, int type, int size,
 	bucket->h.size = size;
 
 	bucket->h.items = malloc(sizeof(__u32)*size);
-	bucket->h.perm = malloc(sizeof(__u32)*size);
 	bucket->item_weights = malloc(sizeof(__u32)*size);
 	bucket->sum_weights = malloc(sizeof(__u32)*size);
 	w = 0;
@@ -276,7 +274,6 @@ crush_make_tree_bucket(int hash, int type, int size,
 	bucket->h.size = size;
 
 	bucket->h.items = malloc(sizeof(__u32)*size);
-	bucket->h.perm = malloc(sizeof(__u32)*size);
 
 	/* calc tree depth */
 	depth = calc_depth(size);
@@ -401,7 +398,6 @@ crush_make_straw_bucket(int hash,
 	bucket->h.size = size;
 
 	bucket->h.items = malloc(sizeof(__u32)*size);
-	bucket->h.perm = malloc(sizeof(__u32)*size);
 	bucket->item_weights = malloc(sizeof(__u32)*size);
 	bucket->straws = malloc(sizeof(__u32)*size);
 
@@ -454,7 +450,6 @@ int crush_add_uniform_bucket_item(struct crush_bucket_uniform *bucket, int item,
 	int newsize = bucket->h.size + 1;
 
 	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 
 	bucket->h.items[newsize-1] = item;
 	bucket->h.weight += weight;
@@ -468,7 +463,6 @@ int crush_add_list_bucket_item(struct crush_bucket_list *bucket, int item, int w
 	int newsize = bucket->h.size + 1;
 
 	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 	bucket->item_weights = realloc(bucket->item_weights, sizeof(__u32)*newsize);
 	bucket->sum_weights = realloc(bucket->sum_weights, sizeof(__u32)*newsize);
 
@@ -493,7 +487,6 @@ int crush_add_tree_bucket_item(struct crush_bucket_tree *bucket, int item, int w
 
 	bucket->num_nodes = 1 << depth;
 	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 	bucket->node_weights = realloc(bucket->node_weights, sizeof(__u32)*bucket->num_nodes);
 	
 	node = crush_calc_tree_node(newsize-1);
@@ -515,7 +508,6 @@ int crush_add_straw_bucket_item(struct crush_bucket_straw *bucket, int item, int
 	int newsize = bucket->h.size + 1;
 	
 	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 	bucket->item_weights = realloc(bucket->item_weights, sizeof(__u32)*newsize);
 	bucket->straws = realloc(bucket->straws, sizeof(__u32)*newsize);
 
@@ -530,9 +522,6 @@ int crush_add_straw_bucket_item(struct crush_bucket_straw *bucket, int item, int
 
 int crush_bucket_add_item(struct crush_bucket *b, int item, int weight)
 {
-	/* invalidate perm cache */
-	b->perm_n = 0;
-
 	switch (b->alg) {
 	case CRUSH_BUCKET_UNIFORM:
 		return crush_add_uniform_bucket_item((struct crush_bucket_uniform *)b, item, weight);
@@ -567,7 +556,6 @@ int crush_remove_uniform_bucket_item(struct crush_bucket_uniform *bucket, int it
 	bucket->h.weight -= bucket->item_weight;
 
 	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 	return 0;
 }
 
@@ -593,7 +581,6 @@ int crush_remove_list_bucket_item(struct crush_bucket_list *bucket, int item)
 	newsize = --bucket->h.size;
 	
 	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 	bucket->item_weights = realloc(bucket->item_weights, sizeof(__u32)*newsize);
 	bucket->sum_weights = realloc(bucket->sum_weights, sizeof(__u32)*newsize);
 	return 0;
@@ -640,7 +627,6 @@ int crush_remove_tree_bucket_item(struct crush_bucket_tree *bucket, int item)
 		int olddepth, newdepth;
 
 		bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-		bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 
 		olddepth = calc_depth(bucket->h.size);
 		newdepth = calc_depth(newsize);
@@ -675,7 +661,6 @@ int crush_remove_straw_bucket_item(struct crush_bucket_straw *bucket, int item)
 		return -ENOENT;
 	
 	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
-	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
 	bucket->item_weights = realloc(bucket->item_weights, sizeof(__u32)*newsize);
 	bucket->straws = realloc(bucket->straws, sizeof(__u32)*newsize);
 
@@ -684,9 +669,6 @@ int crush_remove_straw_bucket_item(struct crush_bucket_straw *bucket, int item)
 
 int crush_bucket_remove_item(struct crush_bucket *b, int item)
 {
-	/* invalidate perm cache */
-	b->perm_n = 0;
-
 	switch (b->alg) {
 	case CRUSH_BUCKET_UNIFORM:
 		return crush_remove_uniform_bucket_item((struct crush_bucket_uniform *)b, item);
@@ -20,6 +20,7 @@
 
 #include "crush.h"
 #include "hash.h"
+#include "mapper.h"
 
 /*
  * Implement the core CRUSH mapping algorithm.
@@ -65,59 +66,60 @@ int crush_find_rule(const struct crush_map *map, int ruleset, int type, int size
  * Since this is expensive, we optimize for the r=0 case, which
  * captures the vast majority of calls.
  */
-static int bucket_perm_choose(struct crush_bucket *bucket,
+static int bucket_perm_choose(const struct crush_bucket *bucket,
+			      struct crush_work *work,
 			      int x, int r)
 {
 	unsigned pr = r % bucket->size;
 	unsigned i, s;
 
-	/* start a new permutation if @x has changed */
-	if (bucket->perm_x != (__u32)x || bucket->perm_n == 0) {
+	/* optimize common r=0 case */
+	if (pr == 0) {
+		s = crush_hash32_3(bucket->hash, x, bucket->id, 0) %
+			bucket->size;
+		goto out;
+	}
+
+	/* start a new permutation if the bucket or @x has changed */
+	if (work->perm_bucket != bucket->id || work->perm_x != (__u32)x ||
+	    work->perm_n == 0) {
 		dprintk("bucket %d new x=%d\n", bucket->id, x);
-		bucket->perm_x = x;
-
-		/* optimize common r=0 case */
-		if (pr == 0) {
-			s = crush_hash32_3(bucket->hash, x, bucket->id, 0) %
-				bucket->size;
-			bucket->perm[0] = s;
-			bucket->perm_n = 0xffff;   /* magic value, see below */
-			goto out;
+		if (work->perm_max < bucket->size) {
+			kfree(work->perm);
+			work->perm = kmalloc(sizeof(__u32) * bucket->size,
+					     GFP_NOFS);
+			BUG_ON(!work->perm);
+			work->perm_max = bucket->size;
 		}
-
+		work->perm_bucket = bucket->id;
+		work->perm_x = x;
 		for (i = 0; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm_n = 0;
-	} else if (bucket->perm_n == 0xffff) {
-		/* clean up after the r=0 case above */
-		for (i = 1; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm[bucket->perm[0]] = 0;
-		bucket->perm_n = 1;
+			work->perm[i] = i;
+		work->perm_n = 0;
 	}
 
 	/* calculate permutation up to pr */
-	for (i = 0; i < bucket->perm_n; i++)
-		dprintk(" perm_choose have %d: %d\n", i, bucket->perm[i]);
-	while (bucket->perm_n <= pr) {
-		unsigned p = bucket->perm_n;
+	for (i = 0; i < work->perm_n; i++)
+		dprintk(" perm_choose have %d: %d\n", i, work->perm[i]);
+	while (work->perm_n <= pr) {
+		unsigned p = work->perm_n;
 		/* no point in swapping the final entry */
 		if (p < bucket->size - 1) {
 			i = crush_hash32_3(bucket->hash, x, bucket->id, p) %
 				(bucket->size - p);
 			if (i) {
-				unsigned t = bucket->perm[p + i];
-				bucket->perm[p + i] = bucket->perm[p];
-				bucket->perm[p] = t;
+				unsigned t = work->perm[p + i];
+				work->perm[p + i] = work->perm[p];
+				work->perm[p] = t;
 			}
 			dprintk(" perm_choose swap %d with %d\n", p, p+i);
 		}
-		bucket->perm_n++;
+		work->perm_n++;
 	}
 	for (i = 0; i < bucket->size; i++)
-		dprintk(" perm_choose  %d: %d\n", i, bucket->perm[i]);
+		dprintk(" perm_choose  %d: %d\n", i, work->perm[i]);
 
-	s = bucket->perm[pr];
+	s = work->perm[pr];
 out:
 	dprintk(" perm_choose %d sz=%d x=%d r=%d (%d) s=%d\n", bucket->id,
 		bucket->size, x, r, pr, s);
@@ -126,9 +128,9 @@ out:
 
 /* uniform */
 static int bucket_uniform_choose(struct crush_bucket_uniform *bucket,
-				 int x, int r)
+				 struct crush_work *work, int x, int r)
 {
-	return bucket_perm_choose(&bucket->h, x, r);
+	return bucket_perm_choose(&bucket->h, work, x, r);
 }
 
 /* list */
@@ -236,13 +238,14 @@ static int bucket_straw_choose(struct crush_bucket_straw *bucket,
 	return bucket->h.items[high];
 }
 
-static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
+static int crush_bucket_choose(struct crush_bucket *in, struct crush_work *work,
+			       int x, int r)
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
 	BUG_ON(in->size == 0);
 	switch (in->alg) {
 	case CRUSH_BUCKET_UNIFORM:
-		return bucket_uniform_choose((struct crush_bucket_uniform *)in,
+		return bucket_uniform_choose((struct crush_bucket_uniform *)in, work,
 					  x, r);
 	case CRUSH_BUCKET_LIST:
 		return bucket_list_choose((struct crush_bucket_list *)in,
@@ -287,6 +290,7 @@ static int is_out(const struct crush_map *map, const __u32 *weight, int item, in
  * @param firstn true if choosing "first n" items, false if choosing "indep"
  * @param recurseto_leaf: true if we want one device under each item of given type
  * @param out2 second output vector for leaf items (if @a recurse_to_leaf)
+ * @param work scratch space for this mapping
  */
 static int crush_choose(const struct crush_map *map,
 			struct crush_bucket *bucket,
@@ -294,7 +298,7 @@ static int crush_choose(const struct crush_map *map,
 			int x, int numrep, int type,
 			int *out, int outpos,
 			int firstn, int recurse_to_leaf,
-			int *out2)
+			int *out2, struct crush_work *work)
 {
 	int rep;
 	unsigned int ftotal, flocal;
@@ -352,9 +356,9 @@ static int crush_choose(const struct crush_map *map,
 				}
 				if (flocal >= (in->size>>1) &&
 				    flocal > orig_tries)
-					item = bucket_perm_choose(in, x, r);
+					item = bucket_perm_choose(in, work, x, r);
 				else
-					item = crush_bucket_choose(in, x, r);
+					item = crush_bucket_choose(in, work, x, r);
 				if (item >= map->max_devices) {
 					dprintk("   bad item %d\n", item);
 					skip_rep = 1;
@@ -398,7 +402,7 @@ static int crush_choose(const struct crush_map *map,
 							 x, outpos+1, 0,
 							 out2, outpos,
 							 firstn, 0,
-							 NULL) <= outpos)
+							 NULL, work) <= outpos)
 							/* didn't get leaf */
 							reject = 1;
 					} else {
@@ -464,10 +468,12 @@ reject:
  * @param result pointer to result vector
  * @param resultmax: maximum result size
  * @param force force initial replica choice; -1 for none
+ * @param weight device weights
+ * @param work scratch space; see struct crush_work
  */
 int crush_do_rule(const struct crush_map *map,
 		  int ruleno, int x, int *result, int result_max,
-		  int force, const __u32 *weight)
+		  int force, const __u32 *weight, struct crush_work *work)
 {
 	int result_len;
 	int force_context[CRUSH_MAX_DEPTH];
@@ -588,7 +594,8 @@ int crush_do_rule(const struct crush_map *map,
 						      curstep->arg2,
 						      o+osize, j,
 						      firstn,
-						      recurse_to_leaf, c+osize);
+						      recurse_to_leaf, c+osize,
+						      work);
 			}
 
 			if (recurse_to_leaf)
@@ -10,11 +10,27 @@
 
 #include "crush.h"
 
+/*
+ * scratch space for one crush_do_rule call: the random permutation
+ * used for uniform buckets and for the linear search fallback of the
+ * other bucket types.  it used to be cached in the bucket, which kept
+ * the map from being used by several mappings at once.  start zeroed,
+ * and kfree perm when done.
+ */
+struct crush_work {
+	int perm_bucket;  /* id of the bucket perm is for; 0 for none */
+	__u32 perm_x;     /* @x for which perm is defined */
+	__u32 perm_n;     /* num elements of perm that are permuted/defined */
+	__u32 perm_max;   /* num elements perm has room for */
+	__u32 *perm;
+};
+
 extern int crush_find_rule(const struct crush_map *map, int ruleset, int type, int size);
 extern int crush_do_rule(const struct crush_map *map,
 			 int ruleno,
 			 int x, int *result, int result_max,
 			 int forcefeed,    /* -1 for none */
-			 const __u32 *weights);
+			 const __u32 *weights,
+			 struct crush_work *work);
 
 #endif
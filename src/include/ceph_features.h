@@ -18,6 +18,9 @@
 #define CEPH_FEATURE_PGPOOL3        (1<<11)
 #define CEPH_FEATURE_OSDREPLYMUX    (1<<12)
 #define CEPH_FEATURE_OSDENC         (1<<13)
+#define CEPH_FEATURE_OSD_DELTA_RECOVERY (1<<14)
+#define CEPH_FEATURE_OSD_SUBOP_BATCH (1<<15)
+#define CEPH_FEATURE_OSD_SNAPMAPPER  (1<<16)
 
 /*
  * Features supported.  Should be everything above.
@@ -36,6 +39,9 @@
 	 CEPH_FEATURE_INCSUBOSDMAP |	 \
 	 CEPH_FEATURE_PGPOOL3 |		 \
 	 CEPH_FEATURE_OSDREPLYMUX |	 \
-	 CEPH_FEATURE_OSDENC)
+	 CEPH_FEATURE_OSDENC |		 \
+	 CEPH_FEATURE_OSD_DELTA_RECOVERY |	 \
+	 CEPH_FEATURE_OSD_SUBOP_BATCH |	 \
+	 CEPH_FEATURE_OSD_SNAPMAPPER)
 
 #endif
@@ -97,7 +97,8 @@ typedef void *rados_ioctx_t;
  *
  * An iterator for listing the objects in a pool.
  * Used with rados_objects_list_open(),
- * rados_objects_list_next(), and
+ * rados_objects_list_open_shard(), rados_objects_list_next(),
+ * rados_objects_list_seek(), and
  * rados_objects_list_close().
  */
 typedef void *rados_list_ctx_t;
@@ -578,6 +579,52 @@ void rados_ioctx_locator_set_key(rados_ioctx_t io, const char *key);
  */
 int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *ctx);
 
+/**
+ * Start listing one shard of the objects in a pool
+ *
+ * The pool's placement groups are split into num_shards contiguous
+ * ranges, and only objects in the shard'th range are listed, so that
+ * several clients can list a pool between them.  The split follows
+ * the pool's current pg_num.
+ *
+ * Listings read several placement groups at once; see the
+ * objecter_list_concurrent_pgs option.
+ *
+ * @param io the pool to list from
+ * @param shard which shard to list, less than num_shards
+ * @param num_shards how many shards the pool is split into
+ * @param ctx the handle to store list context in
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_objects_list_open_shard(rados_ioctx_t io, uint32_t shard, uint32_t num_shards,
+				  rados_list_ctx_t *ctx);
+
+/**
+ * Return the placement group position of a listing
+ *
+ * The position is the index of the placement group (0 to pg_num - 1)
+ * the listing is in, not an object hash.  It can be passed to
+ * rados_objects_list_seek() on a new listing of the same pool (and
+ * shard) to resume it.  Objects in the placement group the position
+ * points at may be listed again.
+ *
+ * @param ctx iterator marking where you are in the listing
+ * @returns current pg index
+ */
+uint32_t rados_objects_list_get_pg_position(rados_list_ctx_t ctx);
+
+/**
+ * Reposition a listing to a placement group position
+ *
+ * The next rados_objects_list_next() call returns the first object at
+ * or after the position.
+ *
+ * @param ctx iterator marking where you are in the listing
+ * @param pos pg index to move to
+ * @returns actual (clamped to the listing's range) position
+ */
+uint32_t rados_objects_list_seek(rados_list_ctx_t ctx, uint32_t pos);
+
 /**
  * Get the next object name and locator in the pool
  *
@@ -1316,6 +1363,163 @@ int rados_aio_read(rados_ioctx_t io, const char *oid,
 		   rados_completion_t completion,
 		   char *buf, size_t len, uint64_t off);
 
+/**
+ * Asynchronously get object stats (size/mtime)
+ *
+ * The return value of the completion will be 0 on success, negative
+ * error code on failure.  psize and pmtime are filled in by then.
+ *
+ * @param io ioctx
+ * @param o object name
+ * @param completion what to do when the stat is complete
+ * @param psize where to store object size
+ * @param pmtime where to store modification time
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_stat(rados_ioctx_t io, const char *o,
+		   rados_completion_t completion,
+		   uint64_t *psize, time_t *pmtime);
+
+/**
+ * Asynchronously delete an object
+ *
+ * The return value of the completion will be 0 on success, negative
+ * error code on failure.
+ *
+ * @param io the pool to delete the object from
+ * @param oid the name of the object to delete
+ * @param completion what to do when the remove is safe and complete
+ * @returns 0 on success, -EROFS if the io context specifies a snap_seq
+ * other than CEPH_NOSNAP
+ */
+int rados_aio_remove(rados_ioctx_t io, const char *oid,
+		     rados_completion_t completion);
+
+/**
+ * Asynchronously resize an object
+ *
+ * @param io the context in which to truncate
+ * @param oid the name of the object
+ * @param completion what to do when the truncate is safe and complete
+ * @param size the new size of the object in bytes
+ * @returns 0 on success, -EROFS if the io context specifies a snap_seq
+ * other than CEPH_NOSNAP
+ */
+int rados_aio_trunc(rados_ioctx_t io, const char *oid,
+		    rados_completion_t completion, uint64_t size);
+
+/**
+ * Asynchronously get the value of an extended attribute on an object
+ *
+ * The return value of the completion will be the length of the value
+ * on success, -ERANGE if it does not fit in buf, or another negative
+ * error code on failure.
+ *
+ * @param io the context in which the attribute is read
+ * @param o name of the object
+ * @param completion what to do when the getxattr is complete
+ * @param name which extended attribute to read
+ * @param buf where to store the result
+ * @param len size of buf in bytes
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_getxattr(rados_ioctx_t io, const char *o,
+		       rados_completion_t completion,
+		       const char *name, char *buf, size_t len);
+
+/**
+ * Asynchronously start iterating over xattrs on an object
+ *
+ * The iterator may only be used once the completion is complete,
+ * and must be freed with rados_getxattrs_end() in any case.
+ *
+ * @param io the context in which to list xattrs
+ * @param oid name of the object
+ * @param completion what to do when the getxattrs is complete
+ * @param iter where to store the iterator
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_getxattrs(rados_ioctx_t io, const char *oid,
+			rados_completion_t completion,
+			rados_xattrs_iter_t *iter);
+
+/**
+ * Asynchronously set an extended attribute on an object
+ *
+ * @param io the context in which xattr is set
+ * @param o name of the object
+ * @param completion what to do when the setxattr is safe and complete
+ * @param name which extended attribute to set
+ * @param buf what to store in the xattr
+ * @param len the number of bytes in buf
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_setxattr(rados_ioctx_t io, const char *o,
+		       rados_completion_t completion,
+		       const char *name, const char *buf, size_t len);
+
+/**
+ * Asynchronously delete an extended attribute from an object
+ *
+ * @param io the context in which to delete the xattr
+ * @param o the name of the object
+ * @param completion what to do when the rmxattr is safe and complete
+ * @param name which xattr to delete
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_rmxattr(rados_ioctx_t io, const char *o,
+		      rados_completion_t completion, const char *name);
+
+/**
+ * Asynchronously update a tmap (trivial map)
+ *
+ * See rados_tmap_update() for the command format.
+ *
+ * @param io ioctx
+ * @param o object name
+ * @param completion what to do when the update is safe and complete
+ * @param cmdbuf command buffer
+ * @param cmdbuflen command buffer length in bytes
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_tmap_update(rados_ioctx_t io, const char *o,
+			  rados_completion_t completion,
+			  const char *cmdbuf, size_t cmdbuflen);
+
+/**
+ * Asynchronously store a complete tmap (trivial map) object
+ *
+ * See rados_tmap_put() for the format.
+ *
+ * @param io ioctx
+ * @param o object name
+ * @param completion what to do when the put is safe and complete
+ * @param buf buffer
+ * @param buflen buffer length in bytes
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_tmap_put(rados_ioctx_t io, const char *o,
+		       rados_completion_t completion,
+		       const char *buf, size_t buflen);
+
+/**
+ * Asynchronously fetch a complete tmap (trivial map) object
+ *
+ * The return value of the completion will be the length of the tmap
+ * on success, -ERANGE if it does not fit in buf, or another negative
+ * error code on failure.
+ *
+ * @param io ioctx
+ * @param o object name
+ * @param completion what to do when the read is complete
+ * @param buf buffer
+ * @param buflen buffer length in bytes
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_tmap_get(rados_ioctx_t io, const char *o,
+		       rados_completion_t completion,
+		       char *buf, size_t buflen);
+
 /**
  * Block until all pending writes in an io context are safe
  *
@@ -68,6 +68,10 @@ namespace librados
     const std::pair<std::string, std::string>* operator->() const;
     ObjectIterator &operator++(); // Preincrement
     ObjectIterator operator++(int); // Postincrement
+    /// move to a pg index, returning the (clamped) new position
+    uint32_t seek(uint32_t pos);
+    /// position to seek() a new iterator to in order to resume listing
+    uint32_t get_pg_position() const;
     friend class IoCtx;
   private:
     void get_next();
@@ -171,6 +175,20 @@ namespace librados
     void clone_range(uint64_t dst_off,
                      const std::string& src_oid, uint64_t src_off,
                      size_t len);
+    /**
+     * Replace this object with a copy of src_oid, read from src_ioctx
+     * at its current read snapshot.  The data never passes through the
+     * client.
+     *
+     * @param src_version version of the source to copy, or 0 for any
+     */
+    void copy_from(const std::string& src_oid, const IoCtx& src_ioctx,
+                   uint64_t src_version);
+    /**
+     * Roll this object back to a self-managed snapshot, like
+     * IoCtx::selfmanaged_snap_rollback(), but usable with aio_operate().
+     */
+    void selfmanaged_snap_rollback(uint64_t snapid);
 
     friend class IoCtx;
   };
@@ -285,6 +303,8 @@ namespace librados
     int selfmanaged_snap_rollback(const std::string& oid, uint64_t snapid);
 
     ObjectIterator objects_begin();
+    /// list only the shard'th of num_shards slices of the pool's pgs
+    ObjectIterator objects_begin(uint32_t shard, uint32_t num_shards);
     const ObjectIterator& objects_end() const;
 
     uint64_t get_last_version();
@@ -305,6 +325,23 @@ namespace librados
     int aio_exec(const std::string& oid, AioCompletion *c, const char *cls, const char *method,
 	         bufferlist& inbl, bufferlist *outbl);
 
+    /*
+     * asynchronous versions of the metadata calls above.  Output
+     * arguments are filled in by the time the completion is complete;
+     * getxattr and tmap_get return the length of the value.
+     */
+    int aio_stat(const std::string& oid, AioCompletion *c, uint64_t *psize, time_t *pmtime);
+    int aio_remove(const std::string& oid, AioCompletion *c);
+    int aio_trunc(const std::string& oid, AioCompletion *c, uint64_t size);
+    int aio_getxattr(const std::string& oid, AioCompletion *c, const char *name, bufferlist& bl);
+    int aio_getxattrs(const std::string& oid, AioCompletion *c,
+		      std::map<std::string, bufferlist>& attrset);
+    int aio_setxattr(const std::string& oid, AioCompletion *c, const char *name, bufferlist& bl);
+    int aio_rmxattr(const std::string& oid, AioCompletion *c, const char *name);
+    int aio_tmap_update(const std::string& oid, AioCompletion *c, bufferlist& cmdbl);
+    int aio_tmap_put(const std::string& oid, AioCompletion *c, bufferlist& bl);
+    int aio_tmap_get(const std::string& oid, AioCompletion *c, bufferlist& bl);
+
     // compound object operations
     int operate(const std::string& oid, ObjectWriteOperation *op);
     int operate(const std::string& oid, ObjectReadOperation *op, bufferlist *pbl);
@@ -336,6 +373,7 @@ namespace librados
     IoCtx(IoCtxImpl *io_ctx_impl_);
 
     friend class Rados; // Only Rados can use our private constructor to create IoCtxes.
+    friend class ObjectWriteOperation;
 
     IoCtxImpl *io_ctx_impl;
   };
@@ -67,6 +67,12 @@ void rbd_version(int *major, int *minor, int *extra);
 /* images */
 int rbd_list(rados_ioctx_t io, char *names, size_t *size);
 int rbd_create(rados_ioctx_t io, const char *name, uint64_t size, int *order);
+/* spread data over stripe_count objects at a time, stripe_unit bytes
+ * to each in turn.  stripe_unit must divide the object size; 0 for
+ * either gives the usual linear layout.  striped images can't be used
+ * by older clients. */
+int rbd_create_striped(rados_ioctx_t io, const char *name, uint64_t size,
+		       int *order, uint64_t stripe_unit, uint64_t stripe_count);
 int rbd_remove(rados_ioctx_t io, const char *name);
 int rbd_remove_with_progress(rados_ioctx_t io, const char *name,
 			     librbd_progress_fn_t cb, void *cbdata);
@@ -78,6 +84,11 @@ int rbd_resize(rbd_image_t image, uint64_t size);
 int rbd_resize_with_progress(rbd_image_t image, uint64_t size,
 			     librbd_progress_fn_t cb, void *cbdata);
 int rbd_stat(rbd_image_t image, rbd_image_info_t *info, size_t infosize);
+/* bytes in the objects backing the image (or snapshot), whole objects
+ * at a time; quick for images with an object map */
+int rbd_used_size(rbd_image_t image, uint64_t *used);
+int rbd_get_stripe_unit(rbd_image_t image, uint64_t *stripe_unit);
+int rbd_get_stripe_count(rbd_image_t image, uint64_t *stripe_count);
 int rbd_copy(rbd_image_t image, rados_ioctx_t dest_io_ctx, const char *destname);
 int rbd_copy_with_progress(rbd_image_t image, rados_ioctx_t dest_p, const char *destname,
 			   librbd_progress_fn_t cb, void *cbdata);
@@ -25,6 +25,10 @@
  *   foo.00000000
  *   foo.00000001
  *   ...          - data
+ *
+ * images created with RBD_FLAG_OBJECT_MAP also have
+ *   <block_name>.objmap           - which data objects may exist
+ *   <block_name>.objmap.<snapid>  - the same, as of each snapshot
  */
 
 #define RBD_SUFFIX	 	".rbd"
@@ -43,6 +47,29 @@
 #define RBD_HEADER_SIGNATURE	"RBD"
 #define RBD_HEADER_VERSION	"001.005"
 
+/*
+ * images striped more finely than one object per 2^order bytes carry
+ * this text instead, so that clients which would read them linearly
+ * refuse to open them.  the stripe unit and count (two encoded __u64s)
+ * are in the header object's RBD_STRIPING_XATTR.
+ */
+#define RBD_HEADER_TEXT_STRIPED	"<<< Rados Block Device Striped >>>\n"
+#define RBD_STRIPING_XATTR	"rbd.striping"
+
+/*
+ * unstriped images with an object map carry this text, so that
+ * clients which would write without updating the map refuse to open
+ * them.  (striped images already have a text those clients refuse.)
+ */
+#define RBD_HEADER_TEXT_OBJECT_MAP "<<< Rados Block Device ObjMap >>>\n"
+
+/*
+ * bits in rbd_obj_header_ondisk.reserved.  clients that predate a flag
+ * ignore it, so a flag that needs their cooperation must come with a
+ * header text they refuse.
+ */
+#define RBD_FLAG_OBJECT_MAP	1
+
 struct rbd_info {
 	__le64 max_id;
 } __attribute__ ((packed));
@@ -33,8 +33,11 @@ using namespace std;
 #include "msg/SimpleMessenger.h"
 
 #include "common/ceph_argparse.h"
+#include "common/Finisher.h"
 #include "common/Timer.h"
 #include "common/common_init.h"
+#include "common/perf_counters.h"
+#include "include/ceph_hash.h"
 
 #include "mon/MonClient.h"
 
@@ -54,6 +57,15 @@ using namespace std;
 
 static atomic_t rados_instance;
 
+enum {
+  l_librados_first = 123300,
+  l_librados_aio_cb,
+  l_librados_aio_cb_queue,
+  l_librados_aio_cb_wait,
+  l_librados_aio_cb_lat,
+  l_librados_last,
+};
+
 
 /*
  * Structure of this file
@@ -281,6 +293,21 @@ void librados::ObjectWriteOperation::setxattr(const char *name, const bufferlist
   o->setxattr(name, v);
 }
 
+void librados::ObjectWriteOperation::copy_from(const std::string& src_oid,
+					       const IoCtx& src_ioctx,
+					       uint64_t src_version)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  IoCtxImpl *src = src_ioctx.io_ctx_impl;
+  o->copy_from(object_t(src_oid), src->snap_seq, src->oloc, src_version);
+}
+
+void librados::ObjectWriteOperation::selfmanaged_snap_rollback(uint64_t snapid)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  o->rollback(snapid);
+}
+
 void librados::ObjectWriteOperation::tmap_update(const bufferlist& cmdbl)
 {
   ::ObjectOperation *o = (::ObjectOperation *)impl;
@@ -321,11 +348,16 @@ struct librados::AioCompletionImpl {
   tid_t aio_write_seq;
   xlist<AioCompletionImpl*>::item aio_write_list_item;
 
+  // where to run the user callbacks; NULL means inline
+  RadosClient *client;
+  Finisher *finisher;
+
   AioCompletionImpl() : lock("AioCompletionImpl lock"),
 			ref(1), rval(0), released(false), ack(false), safe(false),
 			callback_complete(0), callback_safe(0), callback_arg(0),
 			pbl(0), buf(0), maxlen(0),
-			io(NULL), aio_write_seq(0), aio_write_list_item(this) { }
+			io(NULL), aio_write_seq(0), aio_write_list_item(this),
+			client(NULL), finisher(NULL) { }
 
   int set_complete_callback(void *cb_arg, rados_callback_t cb) {
     lock.Lock();
@@ -442,9 +474,7 @@ struct librados::ObjListCtx {
   Objecter::ListContext *lc;
 
   ObjListCtx(IoCtxImpl *c, Objecter::ListContext *l) : ctx(c), lc(l) {}
-  ~ObjListCtx() {
-    delete lc;
-  }
+  ~ObjListCtx();
 };
 
 struct librados::PoolAsyncCompletionImpl {
@@ -550,12 +580,36 @@ private:
   Cond cond;
   SafeTimer timer;
 
+  /*
+   * aio callbacks run on a pool of finishers, so that a slow
+   * application callback doesn't hold up reply processing for every
+   * other op.  callbacks that need to stay in order (per completion,
+   * and per object or per ioctx if so configured) always go to the
+   * same finisher.
+   */
+  enum {
+    AIO_ORDER_NONE,
+    AIO_ORDER_OBJECT,
+    AIO_ORDER_IOCTX,
+  };
+  vector<Finisher*> aio_finishers;
+  int aio_order;
+  atomic_t aio_next_finisher;
+  atomic_t aio_cb_queued;
+  PerfCounters *logger;
+
+  void start_aio_finishers();
+  void stop_aio_finishers();
+  void set_aio_finisher(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c);
+
 public:
   RadosClient(CephContext *cct_) : Dispatcher(cct_),
 		  cct(cct_), conf(cct_->_conf),
 		  state(DISCONNECTED), monclient(cct_),
 		  messenger(NULL), objecter(NULL),
-		  lock("radosclient"), timer(cct, lock), max_watch_cookie(0)
+		  lock("radosclient"), timer(cct, lock),
+		  aio_order(AIO_ORDER_NONE), logger(NULL),
+		  max_watch_cookie(0)
   {
   }
 
@@ -633,12 +687,37 @@ public:
   int pool_change_auid_async(rados_ioctx_t io, unsigned long long auid, PoolAsyncCompletionImpl *c);
 
   int list(Objecter::ListContext *context, int max_entries);
+  uint32_t list_seek(Objecter::ListContext *context, uint32_t pos);
+  void list_close(Objecter::ListContext *context);
 
   int operate(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o, time_t *pmtime);
   int operate_read(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o, bufferlist *pbl);
   int aio_operate(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c);
   int aio_operate_read(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c, bufferlist *pbl);
 
+  void queue_aio_callback(AioCompletionImpl *c, rados_callback_t cb, void *cb_arg,
+			  bool safe);
+  void finish_aio_callback(utime_t queued, utime_t start);
+
+  struct C_aio_Callback : public Context {
+    AioCompletionImpl *c;
+    rados_callback_t cb;
+    void *cb_arg;
+    bool safe;
+    utime_t queued;
+    C_aio_Callback(AioCompletionImpl *_c, rados_callback_t _cb, void *_cb_arg,
+		   bool _safe, utime_t q)
+      : c(_c), cb(_cb), cb_arg(_cb_arg), safe(_safe), queued(q) {}
+    void finish(int r) {
+      utime_t start = ceph_clock_now(c->client->cct);
+      cb(c, cb_arg);
+      c->client->finish_aio_callback(queued, start);
+      if (safe)
+	c->io->complete_aio_write(c);
+      c->put();
+    }
+  };
+
   struct C_aio_Ack : public Context {
     AioCompletionImpl *c;
     void finish(int r) {
@@ -659,9 +738,13 @@ public:
       if (c->callback_complete) {
 	rados_callback_t cb = c->callback_complete;
 	void *cb_arg = c->callback_arg;
-	c->lock.Unlock();
-	cb(c, cb_arg);
-	c->lock.Lock();
+	if (c->finisher) {
+	  c->client->queue_aio_callback(c, cb, cb_arg, false);
+	} else {
+	  c->lock.Unlock();
+	  cb(c, cb_arg);
+	  c->lock.Lock();
+	}
       }
 
       c->put_unlock();
@@ -691,9 +774,13 @@ public:
       if (c->callback_complete) {
 	rados_callback_t cb = c->callback_complete;
 	void *cb_arg = c->callback_arg;
-	c->lock.Unlock();
-	cb(c, cb_arg);
-	c->lock.Lock();
+	if (c->finisher) {
+	  c->client->queue_aio_callback(c, cb, cb_arg, false);
+	} else {
+	  c->lock.Unlock();
+	  cb(c, cb_arg);
+	  c->lock.Lock();
+	}
       }
 
       c->put_unlock();
@@ -714,6 +801,13 @@ public:
       c->safe = true;
       c->cond.Signal();
 
+      if (c->callback_safe && c->finisher) {
+	// the callback completes the write once it has run, so that
+	// flush still waits for it
+	c->client->queue_aio_callback(c, c->callback_safe, c->callback_arg, true);
+	c->put_unlock();
+	return;
+      }
       if (c->callback_safe) {
 	rados_callback_t cb = c->callback_safe;
 	void *cb_arg = c->callback_arg;
@@ -731,6 +825,37 @@ public:
     }
   };
 
+  /*
+   * for ops whose result is a buffer (xattr, tmap): the return value is
+   * its length, or -ERANGE if it doesn't fit the caller's char buffer
+   */
+  struct C_aio_bl_Ack : public C_aio_Ack {
+    void finish(int r) {
+      if (r >= 0) {
+	if (c->buf && c->bl.length() > c->maxlen) {
+	  c->bl.clear();
+	  r = -ERANGE;
+	} else {
+	  r = c->bl.length();
+	}
+      }
+      C_aio_Ack::finish(r);
+    }
+    C_aio_bl_Ack(AioCompletionImpl *_c) : C_aio_Ack(_c) {}
+  };
+
+  struct C_aio_stat_Ack : public C_aio_Ack {
+    time_t *pmtime;
+    utime_t mtime;
+    uint64_t size;
+    void finish(int r) {
+      if (r >= 0 && pmtime)
+	*pmtime = mtime.sec();
+      C_aio_Ack::finish(r);
+    }
+    C_aio_stat_Ack(AioCompletionImpl *_c, time_t *pm) : C_aio_Ack(_c), pmtime(pm) {}
+  };
+
   int aio_read(IoCtxImpl& io, const object_t oid, AioCompletionImpl *c,
 			  bufferlist *pbl, size_t len, uint64_t off);
   int aio_read(IoCtxImpl& io, object_t oid, AioCompletionImpl *c,
@@ -746,6 +871,28 @@ public:
 		     const bufferlist& bl);
   int aio_exec(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
                const char *cls, const char *method, bufferlist& inbl, bufferlist *outbl);
+  int aio_stat(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+	       uint64_t *psize, time_t *pmtime);
+  int aio_remove(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c);
+  int aio_trunc(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c, uint64_t size);
+  int aio_getxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		   const char *name, bufferlist *pbl);
+  int aio_getxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		   const char *name, char *buf, size_t len);
+  int aio_getxattrs(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		    map<string, bufferlist>& attrset);
+  int aio_setxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		   const char *name, const bufferlist& bl);
+  int aio_rmxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		  const char *name);
+  int aio_tmap_update(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		      bufferlist& cmdbl);
+  int aio_tmap_put(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		   bufferlist& bl);
+  int aio_tmap_get(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		   bufferlist *pbl);
+  int aio_tmap_get(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+		   char *buf, size_t len);
 
   struct C_PoolAsync_Safe : public Context {
     PoolAsyncCompletionImpl *c;
@@ -917,6 +1064,97 @@ int librados::IoCtxImpl::set_snap_write_context(snapid_t seq, vector<snapid_t>&
   return 0;
 }
 
+void librados::RadosClient::start_aio_finishers()
+{
+  if (!logger) {
+    PerfCountersBuilder plb(cct, "librados", l_librados_first, l_librados_last);
+    plb.add_u64_counter(l_librados_aio_cb, "aio_cb");
+    plb.add_u64(l_librados_aio_cb_queue, "aio_cb_queue");
+    plb.add_fl_avg(l_librados_aio_cb_wait, "aio_cb_wait");
+    plb.add_fl_avg(l_librados_aio_cb_lat, "aio_cb_lat");
+    logger = plb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(logger);
+  }
+
+  const string& order = conf->rados_aio_completion_order;
+  if (order == "object")
+    aio_order = AIO_ORDER_OBJECT;
+  else if (order == "ioctx")
+    aio_order = AIO_ORDER_IOCTX;
+  else {
+    if (order != "none")
+      lderr(cct) << "unknown rados_aio_completion_order '" << order
+		 << "', using 'none'" << dendl;
+    aio_order = AIO_ORDER_NONE;
+  }
+
+  for (int i = 0; i < conf->rados_aio_completion_threads; i++) {
+    Finisher *f = new Finisher(cct);
+    f->start();
+    aio_finishers.push_back(f);
+  }
+  ldout(cct, 10) << "started " << aio_finishers.size() << " aio finishers, order "
+		 << order << dendl;
+}
+
+void librados::RadosClient::stop_aio_finishers()
+{
+  for (vector<Finisher*>::iterator p = aio_finishers.begin();
+       p != aio_finishers.end();
+       ++p) {
+    (*p)->wait_for_empty();
+    (*p)->stop();
+    delete *p;
+  }
+  aio_finishers.clear();
+
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+    logger = NULL;
+  }
+}
+
+void librados::RadosClient::set_aio_finisher(IoCtxImpl& io, const object_t& oid,
+					     AioCompletionImpl *c)
+{
+  c->client = this;
+  if (aio_finishers.empty()) {
+    c->finisher = NULL;
+    return;
+  }
+  unsigned h;
+  switch (aio_order) {
+  case AIO_ORDER_OBJECT:
+    h = ceph_str_hash_linux(oid.name.c_str(), oid.name.length());
+    break;
+  case AIO_ORDER_IOCTX:
+    h = io.poolid ^ (uintptr_t)&io;
+    break;
+  default:
+    h = aio_next_finisher.inc();
+  }
+  c->finisher = aio_finishers[h % aio_finishers.size()];
+}
+
+/* called with c->lock held */
+void librados::RadosClient::queue_aio_callback(AioCompletionImpl *c, rados_callback_t cb,
+					       void *cb_arg, bool safe)
+{
+  c->ref++;  // for the callback
+  logger->set(l_librados_aio_cb_queue, aio_cb_queued.inc());
+  c->finisher->queue(new C_aio_Callback(c, cb, cb_arg, safe, ceph_clock_now(cct)));
+}
+
+void librados::RadosClient::finish_aio_callback(utime_t queued, utime_t start)
+{
+  utime_t end = ceph_clock_now(cct);
+  logger->set(l_librados_aio_cb_queue, aio_cb_queued.dec());
+  logger->inc(l_librados_aio_cb);
+  logger->finc(l_librados_aio_cb_wait, (double)(start - queued));
+  logger->finc(l_librados_aio_cb_lat, (double)(end - start));
+}
+
 int librados::RadosClient::connect()
 {
   common_init_finish(cct);
@@ -956,9 +1194,12 @@ int librados::RadosClient::connect()
   if (!objecter)
     goto out;
   objecter->set_balanced_budget();
+  objecter->set_unlocked_io();
 
   monclient.set_messenger(messenger);
 
+  start_aio_finishers();
+
   messenger->add_dispatcher_head(this);
 
   nonce = getpid() + (1000000 * (uint64_t)rados_instance.inc());
@@ -1025,6 +1266,7 @@ void librados::RadosClient::shutdown()
     messenger->shutdown();
     messenger->wait();
   }
+  stop_aio_finishers();
   ldout(cct, 1) << "shutdown" << dendl;
 }
 
@@ -1043,6 +1285,15 @@ bool librados::RadosClient::ms_dispatch(Message *m)
 {
   bool ret;
 
+  // osd op replies are handled without the client lock so that io
+  // completions don't serialize with everything else (see
+  // Objecter::set_unlocked_io()); the objecter drops them itself if
+  // it isn't running.
+  if (m->get_type() == CEPH_MSG_OSD_OPREPLY) {
+    objecter->handle_osd_op_reply((class MOSDOpReply*)m);
+    return true;
+  }
+
   lock.Lock();
   if (state == DISCONNECTED) {
     ldout(cct, 10) << "disconnected, discarding " << *m << dendl;
@@ -1079,9 +1330,6 @@ bool librados::RadosClient::_dispatch(Message *m)
 {
   switch (m->get_type()) {
   // OSD
-  case CEPH_MSG_OSD_OPREPLY:
-    objecter->handle_osd_op_reply((class MOSDOpReply*)m);
-    break;
   case CEPH_MSG_OSD_MAP:
     objecter->handle_osd_map((MOSDMap*)m);
     cond.Signal();
@@ -1236,10 +1484,8 @@ int librados::RadosClient::selfmanaged_snap_rollback_object(rados_ioctx_t io,
   bool done;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &reply);
 
-  lock.Lock();
   objecter->rollback_object(oid, ctx->oloc, snapc, snapid,
 		     ceph_clock_now(cct), onack, NULL);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done) cond.Wait(mylock);
@@ -1466,9 +1712,7 @@ int librados::RadosClient::list(Objecter::ListContext *context, int max_entries)
 
   context->max_entries = max_entries;
 
-  lock.Lock();
   objecter->list_objects(context, new C_SafeCond(&mylock, &cond, &done, &r));
-  lock.Unlock();
 
   mylock.Lock();
   while(!done)
@@ -1478,6 +1722,22 @@ int librados::RadosClient::list(Objecter::ListContext *context, int max_entries)
   return r;
 }
 
+uint32_t librados::RadosClient::list_seek(Objecter::ListContext *context, uint32_t pos)
+{
+  objecter->list_objects_seek(context, pos);
+  return context->current_pg;
+}
+
+void librados::RadosClient::list_close(Objecter::ListContext *context)
+{
+  objecter->list_objects_close(context);
+}
+
+librados::ObjListCtx::~ObjListCtx()
+{
+  ctx->client->list_close(lc);
+}
+
 int librados::RadosClient::create(IoCtxImpl& io, const object_t& oid, bool exclusive)
 {
   utime_t ut = ceph_clock_now(cct);
@@ -1494,11 +1754,9 @@ int librados::RadosClient::create(IoCtxImpl& io, const object_t& oid, bool exclu
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock.Lock();
   objecter->create(oid, io.oloc,
 		  io.snapc, ut, 0, (exclusive ? CEPH_OSD_OP_FLAG_EXCL : 0),
 		  onack, NULL, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1530,9 +1788,7 @@ int librados::RadosClient::create(IoCtxImpl& io, const object_t& oid, bool exclu
   ::ObjectOperation o;
   o.create(exclusive ? CEPH_OSD_OP_FLAG_EXCL : 0, category);
 
-  lock.Lock();
   objecter->mutate(oid, io.oloc, o, io.snapc, ut, 0, onack, NULL, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1592,11 +1848,9 @@ int librados::RadosClient::write(IoCtxImpl& io, const object_t& oid, bufferlist&
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
   
-  lock.Lock();
   objecter->write(oid, io.oloc,
 		  off, len, io.snapc, bl, ut, 0,
 		  onack, NULL, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1630,11 +1884,9 @@ int librados::RadosClient::append(IoCtxImpl& io, const object_t& oid, bufferlist
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->append(oid, io.oloc,
 		  len, io.snapc, bl, ut, 0,
 		  onack, NULL, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1669,11 +1921,9 @@ int librados::RadosClient::write_full(IoCtxImpl& io, const object_t& oid, buffer
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->write_full(oid, io.oloc,
 		  io.snapc, bl, ut, 0,
 		  onack, NULL, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1705,12 +1955,10 @@ int librados::RadosClient::clone_range(IoCtxImpl& io,
 
   bufferlist outbl;
 
-  lock.Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&io, &wr);
   wr.clone_range(src_oid, src_offset, len, dst_offset);
   objecter->mutate(dst_oid, io.oloc, wr, io.snapc, ut, 0, onack, NULL, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1747,11 +1995,9 @@ int librados::RadosClient::operate(IoCtxImpl& io, const object_t& oid,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock.Lock();
   objecter->mutate(oid, io.oloc,
 	           *o, io.snapc, ut, 0,
 	           onack, NULL, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1777,11 +2023,9 @@ int librados::RadosClient::operate_read(IoCtxImpl& io, const object_t& oid,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock.Lock();
   objecter->read(oid, io.oloc,
 	           *o, io.snap_seq, pbl, 0,
 	           onack, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1797,11 +2041,11 @@ int librados::RadosClient::aio_operate_read(IoCtxImpl& io, const object_t &oid,
 					    ::ObjectOperation *o,
 					    AioCompletionImpl *c, bufferlist *pbl)
 {
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
 
   c->pbl = pbl;
 
-  Mutex::Locker l(lock);
   objecter->read(oid, io.oloc,
 		 *o, io.snap_seq, pbl, 0,
 		 onack, 0);
@@ -1816,12 +2060,12 @@ int librados::RadosClient::aio_operate(IoCtxImpl& io, const object_t& oid,
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
   Context *oncommit = new C_aio_Safe(c);
 
   io.queue_aio_write(c);
 
-  Mutex::Locker l(lock);
   objecter->mutate(oid, io.oloc, *o, io.snapc, ut, 0, onack, oncommit, &c->objver);
 
   return 0;
@@ -1831,12 +2075,12 @@ int librados::RadosClient::aio_read(IoCtxImpl& io, const object_t oid, AioComple
 				    bufferlist *pbl, size_t len, uint64_t off)
 {
 
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
   eversion_t ver;
 
   c->pbl = pbl;
 
-  Mutex::Locker l(lock);
   objecter->read(oid, io.oloc,
 		 off, len, io.snap_seq, &c->bl, 0,
 		 onack, &c->objver);
@@ -1846,12 +2090,12 @@ int librados::RadosClient::aio_read(IoCtxImpl& io, const object_t oid, AioComple
 int librados::RadosClient::aio_read(IoCtxImpl& io, const object_t oid, AioCompletionImpl *c,
 				    char *buf, size_t len, uint64_t off)
 {
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
 
   c->buf = buf;
   c->maxlen = len;
 
-  Mutex::Locker l(lock);
   objecter->read(oid, io.oloc,
 		 off, len, io.snap_seq, &c->bl, 0,
 		 onack, &c->objver);
@@ -1864,6 +2108,7 @@ int librados::RadosClient::aio_sparse_read(IoCtxImpl& io, const object_t oid,
 					   bufferlist *data_bl, size_t len, uint64_t off)
 {
 
+  set_aio_finisher(io, oid, c);
   C_aio_sparse_read_Ack *onack = new C_aio_sparse_read_Ack(c);
   onack->m = m;
   onack->data_bl = data_bl;
@@ -1871,7 +2116,6 @@ int librados::RadosClient::aio_sparse_read(IoCtxImpl& io, const object_t oid,
 
   c->pbl = NULL;
 
-  Mutex::Locker l(lock);
   objecter->sparse_read(oid, io.oloc,
 		 off, len, io.snap_seq, &c->bl, 0,
 		 onack);
@@ -1889,10 +2133,10 @@ int librados::RadosClient::aio_write(IoCtxImpl& io, const object_t &oid, AioComp
 
   io.queue_aio_write(c);
 
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(lock);
   objecter->write(oid, io.oloc,
 		  off, len, io.snapc, bl, ut, 0,
 		  onack, onsafe, &c->objver);
@@ -1911,10 +2155,10 @@ int librados::RadosClient::aio_append(IoCtxImpl& io, const object_t &oid, AioCom
 
   io.queue_aio_write(c);
 
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(lock);
   objecter->append(oid, io.oloc,
 		  len, io.snapc, bl, ut, 0,
 		  onack, onsafe, &c->objver);
@@ -1933,10 +2177,10 @@ int librados::RadosClient::aio_write_full(IoCtxImpl& io, const object_t &oid,
 
   io.queue_aio_write(c);
 
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(lock);
   objecter->write_full(oid, io.oloc,
 		  io.snapc, bl, ut, 0,
 		  onack, onsafe, &c->objver);
@@ -1962,11 +2206,9 @@ int librados::RadosClient::remove(IoCtxImpl& io, const object_t& oid)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->remove(oid, io.oloc,
 		  io.snapc, ut, 0,
 		  onack, NULL, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1997,12 +2239,10 @@ int librados::RadosClient::trunc(IoCtxImpl& io, const object_t& oid, uint64_t si
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->trunc(oid, io.oloc,
 		  io.snapc, ut, 0,
 		  size, 0,
 		  onack, NULL, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2031,12 +2271,10 @@ int librados::RadosClient::tmap_update(IoCtxImpl& io, const object_t& oid, buffe
 
   bufferlist outbl;
 
-  lock.Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&io, &wr);
   wr.tmap_update(cmdbl);
   objecter->mutate(oid, io.oloc, wr, io.snapc, ut, 0, onack, NULL, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2065,12 +2303,10 @@ int librados::RadosClient::tmap_put(IoCtxImpl& io, const object_t& oid, bufferli
 
   bufferlist outbl;
 
-  lock.Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&io, &wr);
   wr.tmap_put(bl);
   objecter->mutate(oid, io.oloc, wr, io.snapc, ut, 0, onack, NULL, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2097,12 +2333,10 @@ int librados::RadosClient::tmap_get(IoCtxImpl& io, const object_t& oid, bufferli
 
   bufferlist outbl;
 
-  lock.Lock();
   ::ObjectOperation rd;
   prepare_assert_ops(&io, &rd);
   rd.tmap_get(&bl, NULL);
   objecter->read(oid, io.oloc, rd, io.snap_seq, 0, 0, onack, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2127,12 +2361,10 @@ int librados::RadosClient::exec(IoCtxImpl& io, const object_t& oid,
   eversion_t ver;
 
 
-  lock.Lock();
   ::ObjectOperation rd;
   prepare_assert_ops(&io, &rd);
   rd.call(cls, method, inbl);
   objecter->read(oid, io.oloc, rd, io.snap_seq, &outbl, 0, onack, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2148,9 +2380,9 @@ int librados::RadosClient::aio_exec(IoCtxImpl& io, const object_t& oid, AioCompl
 				const char *cls, const char *method,
 				bufferlist& inbl, bufferlist *outbl)
 {
+  set_aio_finisher(io, oid, c);
   Context *onack = new C_aio_Ack(c);
 
-  Mutex::Locker l(lock);
   ::ObjectOperation rd;
   prepare_assert_ops(&io, &rd);
   rd.call(cls, method, inbl);
@@ -2159,6 +2391,192 @@ int librados::RadosClient::aio_exec(IoCtxImpl& io, const object_t& oid, AioCompl
   return 0;
 }
 
+int librados::RadosClient::aio_stat(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+				    uint64_t *psize, time_t *pmtime)
+{
+  set_aio_finisher(io, oid, c);
+  C_aio_stat_Ack *onack = new C_aio_stat_Ack(c, pmtime);
+
+  if (!psize)
+    psize = &onack->size;
+
+  objecter->stat(oid, io.oloc,
+		 io.snap_seq, psize, &onack->mtime, 0,
+		 onack, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_remove(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c)
+{
+  utime_t ut = ceph_clock_now(cct);
+
+  /* can't write to a snapshot */
+  if (io.snap_seq != CEPH_NOSNAP)
+    return -EROFS;
+
+  io.queue_aio_write(c);
+
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_Ack(c);
+  Context *onsafe = new C_aio_Safe(c);
+
+  objecter->remove(oid, io.oloc,
+		   io.snapc, ut, 0,
+		   onack, onsafe, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_trunc(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+				     uint64_t size)
+{
+  utime_t ut = ceph_clock_now(cct);
+
+  /* can't write to a snapshot */
+  if (io.snap_seq != CEPH_NOSNAP)
+    return -EROFS;
+
+  io.queue_aio_write(c);
+
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_Ack(c);
+  Context *onsafe = new C_aio_Safe(c);
+
+  objecter->trunc(oid, io.oloc,
+		  io.snapc, ut, 0,
+		  size, 0,
+		  onack, onsafe, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_getxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+					const char *name, bufferlist *pbl)
+{
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_bl_Ack(c);
+
+  c->pbl = pbl;
+
+  objecter->getxattr(oid, io.oloc,
+		     name, io.snap_seq, &c->bl, 0,
+		     onack, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_getxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+					const char *name, char *buf, size_t len)
+{
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_bl_Ack(c);
+
+  c->buf = buf;
+  c->maxlen = len;
+
+  objecter->getxattr(oid, io.oloc,
+		     name, io.snap_seq, &c->bl, 0,
+		     onack, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_getxattrs(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+					 map<string, bufferlist>& attrset)
+{
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_Ack(c);
+
+  attrset.clear();
+  objecter->getxattrs(oid, io.oloc, io.snap_seq,
+		      attrset,
+		      0, onack, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_setxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+					const char *name, const bufferlist& bl)
+{
+  utime_t ut = ceph_clock_now(cct);
+
+  /* can't write to a snapshot */
+  if (io.snap_seq != CEPH_NOSNAP)
+    return -EROFS;
+
+  io.queue_aio_write(c);
+
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_Ack(c);
+  Context *onsafe = new C_aio_Safe(c);
+
+  objecter->setxattr(oid, io.oloc, name,
+		     io.snapc, bl, ut, 0,
+		     onack, onsafe, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_rmxattr(IoCtxImpl& io, const object_t& oid, AioCompletionImpl *c,
+				       const char *name)
+{
+  utime_t ut = ceph_clock_now(cct);
+
+  /* can't write to a snapshot */
+  if (io.snap_seq != CEPH_NOSNAP)
+    return -EROFS;
+
+  io.queue_aio_write(c);
+
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_Ack(c);
+  Context *onsafe = new C_aio_Safe(c);
+
+  objecter->removexattr(oid, io.oloc, name,
+			io.snapc, ut, 0,
+			onack, onsafe, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_tmap_update(IoCtxImpl& io, const object_t& oid,
+					   AioCompletionImpl *c, bufferlist& cmdbl)
+{
+  ::ObjectOperation wr;
+  wr.tmap_update(cmdbl);
+  return aio_operate(io, oid, &wr, c);
+}
+
+int librados::RadosClient::aio_tmap_put(IoCtxImpl& io, const object_t& oid,
+					AioCompletionImpl *c, bufferlist& bl)
+{
+  ::ObjectOperation wr;
+  wr.tmap_put(bl);
+  return aio_operate(io, oid, &wr, c);
+}
+
+int librados::RadosClient::aio_tmap_get(IoCtxImpl& io, const object_t& oid,
+					AioCompletionImpl *c, bufferlist *pbl)
+{
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_bl_Ack(c);
+
+  c->pbl = pbl;
+
+  ::ObjectOperation rd;
+  rd.tmap_get(&c->bl, NULL);
+  objecter->read(oid, io.oloc, rd, io.snap_seq, 0, 0, onack, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_tmap_get(IoCtxImpl& io, const object_t& oid,
+					AioCompletionImpl *c, char *buf, size_t len)
+{
+  set_aio_finisher(io, oid, c);
+  Context *onack = new C_aio_bl_Ack(c);
+
+  c->buf = buf;
+  c->maxlen = len;
+
+  ::ObjectOperation rd;
+  rd.tmap_get(&c->bl, NULL);
+  objecter->read(oid, io.oloc, rd, io.snap_seq, 0, 0, onack, &c->objver);
+  return 0;
+}
+
 int librados::RadosClient::read(IoCtxImpl& io, const object_t& oid,
 				bufferlist& bl, size_t len, uint64_t off)
 {
@@ -2173,11 +2591,9 @@ int librados::RadosClient::read(IoCtxImpl& io, const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->read(oid, io.oloc,
 	      off, len, io.snap_seq, &bl, 0,
               onack, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2210,11 +2626,9 @@ int librados::RadosClient::mapext(IoCtxImpl& io, const object_t& oid,
   int r;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock.Lock();
   objecter->mapext(oid, io.oloc,
 	      off, len, io.snap_seq, &bl, 0,
               onack);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2244,11 +2658,9 @@ int librados::RadosClient::sparse_read(IoCtxImpl& io, const object_t& oid,
   int r;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock.Lock();
   objecter->sparse_read(oid, io.oloc,
 	      off, len, io.snap_seq, &bl, 0,
               onack);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2284,11 +2696,9 @@ int librados::RadosClient::stat(IoCtxImpl& io, const object_t& oid, uint64_t *ps
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->stat(oid, io.oloc,
 	      io.snap_seq, psize, &mtime, 0,
               onack, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2319,11 +2729,9 @@ int librados::RadosClient::getxattr(IoCtxImpl& io, const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->getxattr(oid, io.oloc,
 	      name, io.snap_seq, &bl, 0,
               onack, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2358,11 +2766,9 @@ int librados::RadosClient::rmxattr(IoCtxImpl& io, const object_t& oid, const cha
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->removexattr(oid, io.oloc, name,
 		  io.snapc, ut, 0,
 		  onack, NULL, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2397,11 +2803,9 @@ int librados::RadosClient::setxattr(IoCtxImpl& io, const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&io, &op);
 
-  lock.Lock();
   objecter->setxattr(oid, io.oloc, name,
 		  io.snapc, bl, ut, 0,
 		  onack, NULL, &ver, pop);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2431,12 +2835,10 @@ int librados::RadosClient::getxattrs(IoCtxImpl& io, const object_t& oid,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock.Lock();
   map<string, bufferlist> aset;
   objecter->getxattrs(oid, io.oloc, io.snap_seq,
 		      aset,
 		      0, onack, &ver, pop);
-  lock.Unlock();
 
   attrset.clear();
 
@@ -2537,14 +2939,13 @@ int librados::RadosClient::unwatch(IoCtxImpl& io, const object_t& oid, uint64_t
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
   eversion_t ver;
   lock.Lock();
-
   unregister_watcher(cookie);
+  lock.Unlock();
 
   ::ObjectOperation rd;
   prepare_assert_ops(&io, &rd);
   rd.watch(cookie, 0, 0);
   objecter->read(oid, io.oloc, rd, io.snap_seq, &outbl, 0, onack, &ver);
-  lock.Unlock();
 
   mylock.Lock();
   while (!done)
@@ -2649,6 +3050,19 @@ librados::ObjectIterator librados::ObjectIterator::operator++(int)
   return ret;
 }
 
+uint32_t librados::ObjectIterator::seek(uint32_t pos)
+{
+  uint32_t r = rados_objects_list_seek(ctx.get(), pos);
+  get_next();
+  return r;
+}
+
+uint32_t librados::ObjectIterator::get_pg_position() const
+{
+  assert(ctx.get());
+  return rados_objects_list_get_pg_position(ctx.get());
+}
+
 void librados::ObjectIterator::get_next()
 {
   const char *entry, *key;
@@ -3051,6 +3465,20 @@ librados::ObjectIterator librados::IoCtx::objects_begin()
   return iter;
 }
 
+librados::ObjectIterator librados::IoCtx::objects_begin(uint32_t shard, uint32_t num_shards)
+{
+  rados_list_ctx_t listh;
+  int r = rados_objects_list_open_shard(io_ctx_impl, shard, num_shards, &listh);
+  if (r < 0) {
+    ostringstream oss;
+    oss << "rados returned " << cpp_strerror(r);
+    throw std::runtime_error(oss.str());
+  }
+  ObjectIterator iter((ObjListCtx*)listh);
+  iter.get_next();
+  return iter;
+}
+
 const librados::ObjectIterator& librados::IoCtx::objects_end() const
 {
   return ObjectIterator::__EndObjectIterator;
@@ -3075,6 +3503,74 @@ int librados::IoCtx::aio_exec(const std::string& oid, librados::AioCompletion *c
   return io_ctx_impl->client->aio_exec(*io_ctx_impl, obj, c->pc, cls, method, inbl, outbl);
 }
 
+int librados::IoCtx::aio_stat(const std::string& oid, librados::AioCompletion *c,
+			      uint64_t *psize, time_t *pmtime)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_stat(*io_ctx_impl, obj, c->pc, psize, pmtime);
+}
+
+int librados::IoCtx::aio_remove(const std::string& oid, librados::AioCompletion *c)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_remove(*io_ctx_impl, obj, c->pc);
+}
+
+int librados::IoCtx::aio_trunc(const std::string& oid, librados::AioCompletion *c, uint64_t size)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_trunc(*io_ctx_impl, obj, c->pc, size);
+}
+
+int librados::IoCtx::aio_getxattr(const std::string& oid, librados::AioCompletion *c,
+				  const char *name, bufferlist& bl)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_getxattr(*io_ctx_impl, obj, c->pc, name, &bl);
+}
+
+int librados::IoCtx::aio_getxattrs(const std::string& oid, librados::AioCompletion *c,
+				   std::map<std::string, bufferlist>& attrset)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_getxattrs(*io_ctx_impl, obj, c->pc, attrset);
+}
+
+int librados::IoCtx::aio_setxattr(const std::string& oid, librados::AioCompletion *c,
+				  const char *name, bufferlist& bl)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_setxattr(*io_ctx_impl, obj, c->pc, name, bl);
+}
+
+int librados::IoCtx::aio_rmxattr(const std::string& oid, librados::AioCompletion *c,
+				 const char *name)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_rmxattr(*io_ctx_impl, obj, c->pc, name);
+}
+
+int librados::IoCtx::aio_tmap_update(const std::string& oid, librados::AioCompletion *c,
+				     bufferlist& cmdbl)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_tmap_update(*io_ctx_impl, obj, c->pc, cmdbl);
+}
+
+int librados::IoCtx::aio_tmap_put(const std::string& oid, librados::AioCompletion *c,
+				  bufferlist& bl)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_tmap_put(*io_ctx_impl, obj, c->pc, bl);
+}
+
+int librados::IoCtx::aio_tmap_get(const std::string& oid, librados::AioCompletion *c,
+				  bufferlist& bl)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_tmap_get(*io_ctx_impl, obj, c->pc, &bl);
+}
+
 int librados::IoCtx::aio_sparse_read(const std::string& oid, librados::AioCompletion *c,
 				     std::map<uint64_t,uint64_t> *m, bufferlist *data_bl,
 				     size_t len, uint64_t off)
@@ -3903,7 +4399,7 @@ extern "C" int rados_getxattr(rados_ioctx_t io, const char *o, const char *name,
 class RadosXattrsIter {
 public:
   RadosXattrsIter()
-    : val(NULL)
+    : val(NULL), started(true)
   {
     i = attrset.end();
   }
@@ -3915,6 +4411,7 @@ public:
   std::map<std::string, bufferlist> attrset;
   std::map<std::string, bufferlist>::iterator i;
   char *val;
+  bool started;
 };
 
 extern "C" int rados_getxattrs(rados_ioctx_t io, const char *oid,
@@ -3942,6 +4439,10 @@ extern "C" int rados_getxattrs_next(rados_xattrs_iter_t iter,
 				    const char **name, const char **val, size_t *len)
 {
   RadosXattrsIter *it = (RadosXattrsIter*)iter;
+  if (!it->started) {
+    it->i = it->attrset.begin();
+    it->started = true;
+  }
   if (it->i == it->attrset.end()) {
     *name = NULL;
     *val = NULL;
@@ -4056,6 +4557,39 @@ extern "C" int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *listh
   return 0;
 }
 
+extern "C" int rados_objects_list_open_shard(rados_ioctx_t io, uint32_t shard, uint32_t num_shards,
+					     rados_list_ctx_t *listh)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  if (num_shards == 0 || shard >= num_shards)
+    return -EINVAL;
+  Objecter::ListContext *h = new Objecter::ListContext;
+  h->pool_id = ctx->poolid;
+  h->pool_snap_seq = ctx->snap_seq;
+  h->shard = shard;
+  h->num_shards = num_shards;
+  // find our pg range
+  ctx->client->list_seek(h, 0);
+  *listh = (void *)new librados::ObjListCtx(ctx, h);
+  return 0;
+}
+
+extern "C" uint32_t rados_objects_list_get_pg_position(rados_list_ctx_t listctx)
+{
+  librados::ObjListCtx *lh = (librados::ObjListCtx *)listctx;
+  Objecter::ListContext *h = lh->lc;
+  Mutex::Locker l(h->lock);
+  if (!h->list.empty())
+    return h->list_pg;
+  return h->current_pg;
+}
+
+extern "C" uint32_t rados_objects_list_seek(rados_list_ctx_t listctx, uint32_t pos)
+{
+  librados::ObjListCtx *lh = (librados::ObjListCtx *)listctx;
+  return lh->ctx->client->list_seek(lh->lc, pos);
+}
+
 extern "C" void rados_objects_list_close(rados_list_ctx_t h)
 {
   librados::ObjListCtx *lh = (librados::ObjListCtx *)h;
@@ -4185,6 +4719,119 @@ extern "C" int rados_aio_write_full(rados_ioctx_t io, const char *o,
 	      (librados::AioCompletionImpl*)completion, bl);
 }
 
+extern "C" int rados_aio_stat(rados_ioctx_t io, const char *o,
+			      rados_completion_t completion,
+			      uint64_t *psize, time_t *pmtime)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  return ctx->client->aio_stat(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, psize, pmtime);
+}
+
+extern "C" int rados_aio_remove(rados_ioctx_t io, const char *o,
+				rados_completion_t completion)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  return ctx->client->aio_remove(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion);
+}
+
+extern "C" int rados_aio_trunc(rados_ioctx_t io, const char *o,
+			       rados_completion_t completion, uint64_t size)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  return ctx->client->aio_trunc(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, size);
+}
+
+extern "C" int rados_aio_getxattr(rados_ioctx_t io, const char *o,
+				  rados_completion_t completion,
+				  const char *name, char *buf, size_t len)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  return ctx->client->aio_getxattr(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, name, buf, len);
+}
+
+extern "C" int rados_aio_getxattrs(rados_ioctx_t io, const char *o,
+				   rados_completion_t completion,
+				   rados_xattrs_iter_t *iter)
+{
+  RadosXattrsIter *it = new RadosXattrsIter();
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  // the attrs arrive later; rados_getxattrs_next() starts at the
+  // beginning on its first call
+  it->started = false;
+  int ret = ctx->client->aio_getxattrs(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, it->attrset);
+  if (ret) {
+    delete it;
+    return ret;
+  }
+  *iter = it;
+  return 0;
+}
+
+extern "C" int rados_aio_setxattr(rados_ioctx_t io, const char *o,
+				  rados_completion_t completion,
+				  const char *name, const char *buf, size_t len)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  bufferlist bl;
+  bl.append(buf, len);
+  return ctx->client->aio_setxattr(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, name, bl);
+}
+
+extern "C" int rados_aio_rmxattr(rados_ioctx_t io, const char *o,
+				 rados_completion_t completion, const char *name)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  return ctx->client->aio_rmxattr(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, name);
+}
+
+extern "C" int rados_aio_tmap_update(rados_ioctx_t io, const char *o,
+				     rados_completion_t completion,
+				     const char *cmdbuf, size_t cmdbuflen)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  bufferlist cmdbl;
+  cmdbl.append(cmdbuf, cmdbuflen);
+  return ctx->client->aio_tmap_update(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, cmdbl);
+}
+
+extern "C" int rados_aio_tmap_put(rados_ioctx_t io, const char *o,
+				  rados_completion_t completion,
+				  const char *buf, size_t buflen)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  bufferlist bl;
+  bl.append(buf, buflen);
+  return ctx->client->aio_tmap_put(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, bl);
+}
+
+extern "C" int rados_aio_tmap_get(rados_ioctx_t io, const char *o,
+				  rados_completion_t completion,
+				  char *buf, size_t buflen)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t oid(o);
+  return ctx->client->aio_tmap_get(*ctx, oid,
+	      (librados::AioCompletionImpl*)completion, buf, buflen);
+}
+
 extern "C" int rados_aio_flush(rados_ioctx_t io)
 {
   librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
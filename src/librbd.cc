@@ -15,8 +15,13 @@
 #include "common/Cond.h"
 #include "common/dout.h"
 #include "common/errno.h"
+#include "common/Finisher.h"
 #include "common/snap_types.h"
+#include "common/Throttle.h"
+#include "include/atomic.h"
 #include "include/rbd/librbd.hpp"
+#include "osdc/ObjectCacher.h"
+#include "osdc/WritebackHandler.h"
 
 #include <errno.h>
 #include <inttypes.h>
@@ -36,6 +41,7 @@ namespace librbd {
   void rados_cb(rados_completion_t cb, void *arg);
   void rados_buffered_cb(rados_completion_t cb, void *arg);
   void rados_aio_sparse_read_cb(rados_completion_t cb, void *arg);
+  void rados_ctx_cb(rados_completion_t cb, void *arg);
 
   class WatchCtx;
 
@@ -45,6 +51,151 @@ namespace librbd {
     SnapInfo(snap_t _id, uint64_t _size) : id(_id), size(_size) {};
   };
 
+  /*
+   * which of an image's data objects may exist, as kept in
+   * <block_name>.objmap (or .objmap.<snapid> for a snapshot).  a bit is
+   * set before the first write to its object and cleared only after the
+   * object is removed, so after a crash the map can list objects that
+   * are missing but never miss one that is there.  with no map to go on
+   * (!valid), every object may exist.
+   */
+  struct ObjectMap {
+    bool valid;
+    std::vector<bool> bits;
+
+    ObjectMap() : valid(false) {}
+
+    bool may_exist(uint64_t objno) const {
+      return !valid || (objno < bits.size() && bits[objno]);
+    }
+    void set(uint64_t start, uint64_t end, bool exists) {
+      if (end > bits.size())
+	bits.resize(end);
+      for (uint64_t i = start; i < end; i++)
+	bits[i] = exists;
+    }
+    void clear() {
+      valid = false;
+      bits.clear();
+    }
+    int load(IoCtx& io_ctx, const std::string& oid);
+    int save(IoCtx& io_ctx, const std::string& oid) const;
+  };
+
+  /*
+   * how image bytes map onto objects, as in the Filer: stripe units go
+   * round-robin over a set of stripe_count objects until those are
+   * full, then on to the next set.  an unstriped image has one stripe
+   * unit per object and one object per set, so object n holds bytes
+   * [n << order, (n + 1) << order).
+   */
+  struct ImageLayout {
+    uint64_t object_size;
+    uint64_t stripe_unit;
+    uint64_t stripe_count;
+
+    ImageLayout() : object_size(0), stripe_unit(0), stripe_count(1) {}
+
+    void init(int order) {
+      object_size = 1ull << order;
+      stripe_unit = object_size;
+      stripe_count = 1;
+    }
+    bool is_striped() const {
+      return stripe_unit != object_size || stripe_count != 1;
+    }
+    uint64_t set_size() const {
+      return object_size * stripe_count;
+    }
+
+    /*
+     * find image offset off: object *objectno, at *obj_off.  returns
+     * how much of len, starting there, stays in that object.
+     */
+    uint64_t map_extent(uint64_t off, uint64_t len,
+			uint64_t *objectno, uint64_t *obj_off) const {
+      uint64_t blockno = off / stripe_unit;
+      uint64_t stripeno = blockno / stripe_count;
+      uint64_t stripepos = blockno % stripe_count;
+      uint64_t stripes_per_object = object_size / stripe_unit;
+      uint64_t su_off = off % stripe_unit;
+      *objectno = (stripeno / stripes_per_object) * stripe_count + stripepos;
+      *obj_off = (stripeno % stripes_per_object) * stripe_unit + su_off;
+      return MIN(len, stripe_unit - su_off);
+    }
+
+    // objects [*start, *end) that hold any of off~len
+    void object_range(uint64_t off, uint64_t len,
+		      uint64_t *start, uint64_t *end) const {
+      uint64_t objectno, obj_off;
+      map_extent(off, len, &objectno, &obj_off);
+      *start = *end = objectno;
+      for (uint64_t done = 0; done < len; ) {
+	done += map_extent(off + done, len - done, &objectno, &obj_off);
+	*start = MIN(*start, objectno);
+	*end = MAX(*end, objectno);
+      }
+      (*end)++;
+    }
+
+    // one object's share of an image range
+    struct Extent {
+      uint64_t objectno;
+      uint64_t offset;
+      uint64_t length;
+      vector<pair<uint64_t,uint64_t> > buffer_extents; // off~len in the range
+      Extent(uint64_t o, uint64_t off) : objectno(o), offset(off), length(0) {}
+    };
+
+    /*
+     * split off~len by object, like Filer::file_to_extents.  the part
+     * of a contiguous range that lands in one object is contiguous
+     * there, so each object needs a single op; buffer_extents says
+     * which pieces of the range it holds, in object order.
+     */
+    void map_extents(uint64_t off, uint64_t len, vector<Extent>& extents) const {
+      map<uint64_t, size_t> by_object;
+      for (uint64_t done = 0; done < len; ) {
+	uint64_t objectno, obj_off;
+	uint64_t n = map_extent(off + done, len - done, &objectno, &obj_off);
+	map<uint64_t, size_t>::iterator p = by_object.find(objectno);
+	if (p == by_object.end()) {
+	  p = by_object.insert(make_pair(objectno, extents.size())).first;
+	  extents.push_back(Extent(objectno, obj_off));
+	}
+	Extent& ex = extents[p->second];
+	assert(ex.offset + ex.length == obj_off);
+	ex.length += n;
+	ex.buffer_extents.push_back(make_pair(done, n));
+	done += n;
+      }
+    }
+
+    // objects that hold any of the first size bytes
+    uint64_t num_objects(uint64_t size) const {
+      uint64_t n = (size / set_size()) * stripe_count;
+      uint64_t rest = size % set_size();
+      if (rest)
+	n += MIN(stripe_count, (rest + stripe_unit - 1) / stripe_unit);
+      return n;
+    }
+
+    // how much of object objectno lies within the first size bytes
+    uint64_t object_extent(uint64_t objectno, uint64_t size) const {
+      uint64_t set_start = (objectno / stripe_count) * set_size();
+      if (size <= set_start)
+	return 0;
+      uint64_t rel = size - set_start;
+      if (rel >= set_size())
+	return object_size;
+      uint64_t row = stripe_unit * stripe_count;
+      uint64_t pos_start = (objectno % stripe_count) * stripe_unit;
+      uint64_t rest = rel % row;
+      uint64_t partial = rest > pos_start ? MIN(stripe_unit, rest - pos_start) : 0;
+      return (rel / row) * stripe_unit + partial;
+    }
+  };
+
   struct AioCompletion;
 
   struct AioBlockCompletion {
@@ -53,6 +204,7 @@ namespace librbd {
     uint64_t ofs;
     size_t len;
     char *buf;
+    vector<pair<uint64_t,uint64_t> > buffer_extents; // where reads land in buf
     map<uint64_t,uint64_t> m;
     bufferlist data_bl;
 
@@ -63,6 +215,28 @@ namespace librbd {
     void complete(ssize_t r);
   };
 
+  // finishes a block of an aio request that went through the cache
+  struct C_CacheBlock : public Context {
+    AioBlockCompletion *req;
+    C_CacheBlock(AioBlockCompletion *r) : req(r) {}
+    void finish(int r) {
+      // reads come back whole, holes zeroed
+      if (r >= 0 && req->buf)
+	req->m[req->ofs] = req->data_bl.length();
+      req->complete(r);
+      delete req;
+    }
+  };
+
+  // ends one op of a bulk operation
+  struct C_SimpleThrottle : public Context {
+    SimpleThrottle *throttle;
+    C_SimpleThrottle(SimpleThrottle *t) : throttle(t) {}
+    void finish(int r) {
+      throttle->end_op(r);
+    }
+  };
+
   struct ImageCtx;
 
   struct AioBufferedCompletion {
@@ -75,9 +249,142 @@ namespace librbd {
       : ictx(i), block_completion(bc), len(l) {}
   };
 
+  /*
+   * Sends ObjectCacher i/o to the image's data pool.  librados completes
+   * it without the cache lock, so take it before handing the result
+   * back.  Read errors go to the cacher, which passes them on to the
+   * reader; a missing object is a hole.  The cacher does not see write
+   * errors; they are kept here until the next flush() (or, in
+   * write-through mode, the write itself) picks them up.  The cacher
+   * also needs an object's commits in tid order, which librados only
+   * promises with a single callback thread, so commits that come back
+   * early are held until the ones before them arrive.
+   */
+  class LibrbdWriteback : public WritebackHandler {
+  public:
+    LibrbdWriteback(IoCtx& io, Mutex& l, Finisher& f)
+      : data_ctx(io), lock(l), finisher(f), last_tid(0), write_rval(0) {}
+    virtual ~LibrbdWriteback() {}
+
+    virtual void read(const object_t& oid, const object_locator_t& oloc,
+		      loff_t off, uint64_t len, snapid_t snapid,
+		      bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+		      Context *onfinish) {
+      // reads come from the snap data_ctx is set to, which the cache is
+      // invalidated for whenever it changes
+      Context *req = new C_Request(this, onfinish);
+      librados::AioCompletion *rados_completion =
+	Rados::aio_create_completion(req, rados_ctx_cb, NULL);
+      int r = data_ctx.aio_read(oid.name, rados_completion, pbl, len, off);
+      rados_completion->release();
+      if (r < 0)
+	finisher.queue(req, r);  // we hold the cache lock; can't complete here
+    }
+
+    virtual tid_t write(const object_t& oid, const object_locator_t& oloc,
+			loff_t off, uint64_t len, const SnapContext& snapc,
+			const bufferlist &bl, utime_t mtime,
+			uint64_t trunc_size, __u32 trunc_seq,
+			Context *oncommit) {
+      // data_ctx carries the image's write snap context, and the cache is
+      // flushed before it changes, so snapc matches it already
+      tid_t tid = ++last_tid;
+      writes_in_flight[oid].push_back(tid);
+      Context *req = new C_Request(this, oncommit, oid, tid);
+      librados::AioCompletion *rados_completion =
+	Rados::aio_create_completion(req, NULL, rados_ctx_cb);
+      int r = data_ctx.aio_write(oid.name, rados_completion, bl, len, off);
+      rados_completion->release();
+      if (r < 0)
+	finisher.queue(req, r);
+      return tid;
+    }
+
+    // first write error since the last call; needs the cache lock
+    int get_write_rval() {
+      int r = write_rval;
+      write_rval = 0;
+      return r;
+    }
+
+  private:
+    class C_Request : public Context {
+      LibrbdWriteback *wb;
+      Context *ctx;
+      object_t oid;
+      tid_t tid;  // 0 for reads
+    public:
+      C_Request(LibrbdWriteback *w, Context *c)
+	: wb(w), ctx(c), tid(0) {}
+      C_Request(LibrbdWriteback *w, Context *c, const object_t& o, tid_t t)
+	: wb(w), ctx(c), oid(o), tid(t) {}
+      void finish(int r) {
+	Mutex::Locker l(wb->lock);
+	if (!tid) {
+	  ctx->complete(r);
+	  return;
+	}
+	if (r < 0 && wb->write_rval == 0)
+	  wb->write_rval = r;
+	wb->write_committed(oid, tid, ctx, r);
+      }
+    };
+
+    // deliver oid's commits up to the first one still outstanding
+    void write_committed(const object_t& oid, tid_t tid, Context *ctx, int r) {
+      writes_done[tid] = make_pair(ctx, r);
+      map<object_t, list<tid_t> >::iterator p = writes_in_flight.find(oid);
+      assert(p != writes_in_flight.end());
+      while (!p->second.empty()) {
+	map<tid_t, pair<Context*, int> >::iterator q =
+	  writes_done.find(p->second.front());
+	if (q == writes_done.end())
+	  break;
+	p->second.pop_front();
+	Context *c = q->second.first;
+	int cr = q->second.second;
+	writes_done.erase(q);
+	c->complete(cr);
+      }
+      if (p->second.empty())
+	writes_in_flight.erase(p);
+    }
+
+    IoCtx& data_ctx;
+    Mutex& lock;
+    Finisher& finisher;
+    tid_t last_tid;
+    int write_rval;
+    map<object_t, list<tid_t> > writes_in_flight; // per object, in tid order
+    map<tid_t, pair<Context*, int> > writes_done;  // committed out of order
+  };
+
+  /*
+   * completes a write-through write once its data is on disk, with the
+   * error from writing it back, if any.  an error from another write
+   * committed alongside it may be reported here instead.
+   */
+  struct C_WriteThrough : public Context {
+    LibrbdWriteback *wb;
+    Mutex *cache_lock;
+    Context *onfinish;
+    C_WriteThrough(LibrbdWriteback *w, Mutex *l, Context *c)
+      : wb(w), cache_lock(l), onfinish(c) {}
+    void finish(int r) {
+      if (r >= 0) {
+	Mutex::Locker l(*cache_lock);
+	r = wb->get_write_rval();
+      }
+      onfinish->complete(r);
+    }
+  };
+
+  struct ObjectMapWrite;
+
   struct ImageCtx {
     CephContext *cct;
     struct rbd_obj_header_ondisk header;
+    ImageLayout layout;
     ::SnapContext snapc;
     vector<snap_t> snaps;
     std::map<std::string, struct SnapInfo> snaps_by_name;
@@ -95,6 +402,25 @@ namespace librbd {
     uint64_t tx_unsafe_bytes, tx_pending_bytes, tx_window;
     int tx_rval;
 
+    // loaded for snapid on refresh; protected by lock
+    ObjectMap object_map;
+    // aio writes waiting for their objects to be marked in the map, and
+    // any submitted after them, in order; protected by lock
+    list<ObjectMapWrite*> object_map_writes;
+    bool object_map_sending;
+    Cond object_map_cond;
+
+    // client-side cache, if rbd_cache is set.  cache_lock may be taken
+    // with lock held, never the other way around.  Anything the cache
+    // completes is passed through cache_finisher, so user callbacks
+    // never run under cache_lock.
+    Mutex cache_lock;
+    bool cache_writethrough;
+    Finisher *cache_finisher;
+    LibrbdWriteback *writeback_handler;
+    ObjectCacher *object_cacher;
+    ObjectCacher::ObjectSet *object_set;
+
     ImageCtx(std::string imgname, IoCtx& p)
       : cct((CephContext*)p.cct()), snapid(CEPH_NOSNAP),
 	name(imgname),
@@ -102,14 +428,56 @@ namespace librbd {
 	refresh_lock("librbd::ImageCtx::refresh_lock"),
 	lock("librbd::ImageCtx::lock"),
 	tx_next(tx_queue.end()),
-	tx_unsafe_bytes(0), tx_pending_bytes(0), tx_window(0), tx_rval(0)
+	tx_unsafe_bytes(0), tx_pending_bytes(0), tx_window(0), tx_rval(0),
+	object_map_sending(false),
+	cache_lock("librbd::ImageCtx::cache_lock"),
+	cache_writethrough(false),
+	cache_finisher(NULL), writeback_handler(NULL),
+	object_cacher(NULL), object_set(NULL)
     {
       md_ctx.dup(p);
       data_ctx.dup(p);
+
+      const md_config_t *conf = cct->_conf;
+      if (conf->rbd_cache) {
+	cache_writethrough = (conf->rbd_cache_max_dirty == 0);
+	cache_finisher = new Finisher(cct);
+	cache_finisher->start();
+	writeback_handler = new LibrbdWriteback(data_ctx, cache_lock,
+						*cache_finisher);
+	// the name keys the cache's perf counters, which have to be
+	// unique even when one image is open several times
+	ostringstream cache_name;
+	cache_name << "librbd-" << data_ctx.get_id() << "-" << name
+		   << "-" << this;
+	object_cacher = new ObjectCacher(cct, cache_name.str(),
+					 *writeback_handler, cache_lock,
+					 NULL, NULL);
+	object_cacher->set_max_size(conf->rbd_cache_size);
+	object_cacher->set_max_dirty(conf->rbd_cache_max_dirty);
+	object_cacher->set_target_dirty(conf->rbd_cache_target_dirty);
+	object_cacher->set_max_dirty_age(conf->rbd_cache_max_dirty_age);
+	object_set = new ObjectCacher::ObjectSet(NULL, data_ctx.get_id(), 0);
+	object_cacher->start();
+	ldout(cct, 10) << "cache for " << name << ": size "
+		       << conf->rbd_cache_size << ", max dirty "
+		       << conf->rbd_cache_max_dirty
+		       << (cache_writethrough ? " (write-through)" : "")
+		       << dendl;
+      }
     }
 
     ~ImageCtx() {
       assert(tx_queue.empty());
+      if (object_cacher) {
+	// close_image() invalidated the cache already
+	object_cacher->stop();
+	delete object_set;
+	delete object_cacher;
+	delete writeback_handler;
+	cache_finisher->stop();
+	delete cache_finisher;
+      }
     }
 
     int snap_set(std::string snap_name)
@@ -172,6 +540,34 @@ namespace librbd {
       }
     }
 
+    /*
+     * objects [start, end) of the head are about to be written.  the
+     * map has to say so on disk before any of the data goes out.
+     */
+    int mark_objects_exist(uint64_t start, uint64_t end);
+    // whether any of objects [start, end) still needs marking
+    bool _object_map_needs_mark(uint64_t start, uint64_t end) {
+      assert(lock.is_locked());
+      if (!object_map.valid)
+	return false;
+      uint64_t i;
+      for (i = start; i < end && object_map.may_exist(i); i++) ;
+      return i < end;
+    }
+    /*
+     * another client may have written objects [start, end) since we
+     * loaded the map; re-read the bits we have as not existing
+     */
+    int refresh_object_map_bits(uint64_t start, uint64_t end);
+    // send the aio writes at the front of object_map_writes that are ready
+    void send_object_map_writes();
+    // wait for every queued aio write to be sent
+    void wait_for_object_map_writes() {
+      Mutex::Locker l(lock);
+      while (!object_map_writes.empty() || object_map_sending)
+	object_map_cond.Wait(lock);
+    }
+
     librados::AioCompletion *get_buffered_tx_completion(uint64_t len, AioBlockCompletion *abc) {
       assert(lock.is_locked());
       if (tx_window > 0) {
@@ -208,6 +604,105 @@ namespace librbd {
 	tx_rval = rval;  // user will see this on next flush().
     }
 
+    /*
+     * read len bytes of one object through the cache into bl.  onfinish
+     * gets the length, or an error; holes come back as zeroes.
+     */
+    void aio_read_from_cache(const object_t& oid, bufferlist *bl, size_t len,
+			     uint64_t off, Context *onfinish) {
+      assert(object_cacher);
+      lock.Lock();
+      ObjectCacher::OSDRead *rd = object_cacher->prepare_read(snapid, bl, 0);
+      lock.Unlock();
+      ObjectExtent extent(oid, off, len);
+      extent.oloc = object_locator_t(object_set->poolid);
+      extent.buffer_extents[0] = len;
+      rd->extents.push_back(extent);
+
+      Context *retry = new C_OnFinisher(onfinish, cache_finisher);
+      cache_lock.Lock();
+      int r = object_cacher->readx(rd, object_set, retry);
+      cache_lock.Unlock();
+      if (r > 0) {
+	// hit; the cache won't call us back
+	delete retry;
+	onfinish->complete(r);
+      }
+    }
+
+    /*
+     * write through the cache.  onfinish is completed once the data is
+     * in the cache, or, in write-through mode, once it is on disk, with
+     * any error writing it there.
+     */
+    void write_to_cache(const object_t& oid, bufferlist& bl, size_t len,
+			uint64_t off, Context *onfinish) {
+      assert(object_cacher);
+      lock.Lock();
+      ObjectCacher::OSDWrite *wr = object_cacher->prepare_write(snapc, bl,
+								utime_t(), 0);
+      lock.Unlock();
+      ObjectExtent extent(oid, off, len);
+      extent.oloc = object_locator_t(object_set->poolid);
+      extent.buffer_extents[0] = len;
+      wr->extents.push_back(extent);
+
+      bool done = true;
+      cache_lock.Lock();
+      object_cacher->wait_for_write(len, cache_lock);
+      object_cacher->writex(wr, object_set);
+      if (cache_writethrough) {
+	Context *writethrough = new C_WriteThrough(writeback_handler,
+						   &cache_lock, onfinish);
+	Context *oncommit = new C_OnFinisher(writethrough, cache_finisher);
+	done = object_cacher->flush_set(object_set, oncommit);
+	if (done) {
+	  delete oncommit;
+	  delete writethrough;
+	}
+      }
+      cache_lock.Unlock();
+      if (done)
+	onfinish->complete(0);
+    }
+
+    /*
+     * write back everything dirty and wait for it to commit.  errors are
+     * left for flush() to report.
+     */
+    void flush_cache() {
+      if (!object_cacher)
+	return;
+      Mutex mylock("librbd::ImageCtx::flush_cache");
+      Cond cond;
+      bool done;
+      Context *onfinish = new C_SafeCond(&mylock, &cond, &done);
+      cache_lock.Lock();
+      bool already_flushed = object_cacher->flush_set(object_set, onfinish);
+      cache_lock.Unlock();
+      if (already_flushed) {
+	delete onfinish;
+      } else {
+	mylock.Lock();
+	while (!done)
+	  cond.Wait(mylock);
+	mylock.Unlock();
+      }
+    }
+
+    // flush, then drop everything cached
+    void invalidate_cache() {
+      if (!object_cacher)
+	return;
+      flush_cache();
+      cache_lock.Lock();
+      loff_t unclean = object_cacher->release_set(object_set);
+      cache_lock.Unlock();
+      if (unclean)
+	lderr(cct) << "could not release all objects from cache: "
+		   << unclean << " bytes remain" << dendl;
+    }
+
     void do_buffered_tx_completions() {
       assert(lock.is_locked());
       ldout(cct, 20) << "do_buffered_tx_completions unsafe " << tx_unsafe_bytes 
@@ -336,11 +831,44 @@ namespace librbd {
     }
   };
 
+  /*
+   * an aio write held back until the object map says its objects
+   * exist, or queued behind one that is.  only used without the
+   * cache, so the data can be sent from a librados callback.
+   */
+  struct ObjectMapWrite {
+    struct Block {
+      string oid;
+      bufferlist bl;
+      uint64_t ofs;
+      AioBlockCompletion *completion;
+    };
+    list<Block> blocks;
+    bool ready;   // marked (or nothing to mark)
+    int rval;     // marking failed; fail the blocks with this
+    ObjectMapWrite() : ready(false), rval(0) {}
+  };
+
+  // marks objects [start, end) of an ObjectMapWrite, then sends it
+  struct C_ObjectMapMarked : public Context {
+    ImageCtx *ictx;
+    ObjectMapWrite *write;
+    uint64_t start, end;
+    bufferlist out;
+    C_ObjectMapMarked(ImageCtx *i, ObjectMapWrite *w, uint64_t s, uint64_t e)
+      : ictx(i), write(w), start(s), end(e) {}
+    void finish(int r);
+  };
+
   int snap_set(ImageCtx *ictx, const char *snap_name);
   int list(IoCtx& io_ctx, std::vector<string>& names);
   int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order);
+  int create_striped(IoCtx& io_ctx, const char *imgname, uint64_t size,
+		     int *order, uint64_t stripe_unit, uint64_t stripe_count);
   int rename(IoCtx& io_ctx, const char *srcname, const char *dstname);
   int info(ImageCtx *ictx, image_info_t& info, size_t image_size);
+  int get_stripe_unit(ImageCtx *ictx, uint64_t *stripe_unit);
+  int get_stripe_count(ImageCtx *ictx, uint64_t *stripe_count);
   int remove(IoCtx& io_ctx, const char *imgname, ProgressContext& prog_ctx);
   int resize(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx);
   int resize_helper(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx);
@@ -357,8 +885,9 @@ namespace librbd {
   int open_image(IoCtx& io_ctx, ImageCtx *ictx, const char *name, const char *snap_name);
   void close_image(ImageCtx *ictx);
 
-  void trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header, uint64_t newsize,
-		  ProgressContext& prog_ctx);
+  int trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header,
+		 const ImageLayout& layout, uint64_t newsize,
+		 ProgressContext& prog_ctx);
   int read_rbd_info(IoCtx& io_ctx, const string& info_oid, struct rbd_info *info);
 
   int touch_rbd_info(IoCtx& io_ctx, const string& info_oid);
@@ -366,21 +895,27 @@ namespace librbd {
   int read_header_bl(IoCtx& io_ctx, const string& md_oid, bufferlist& header, uint64_t *ver);
   int notify_change(IoCtx& io_ctx, const string& oid, uint64_t *pver, ImageCtx *ictx);
   int read_header(IoCtx& io_ctx, const string& md_oid, struct rbd_obj_header_ondisk *header, uint64_t *ver);
+  bool is_striped(const rbd_obj_header_ondisk &header);
+  int read_layout(IoCtx& io_ctx, const string& md_oid,
+		  const rbd_obj_header_ondisk &header, ImageLayout *layout);
   int write_header(IoCtx& io_ctx, const string& md_oid, bufferlist& header);
   int tmap_set(IoCtx& io_ctx, const string& imgname);
   int tmap_rm(IoCtx& io_ctx, const string& imgname);
   int rollback_image(ImageCtx *ictx, uint64_t snapid, ProgressContext& prog_ctx);
   void image_info(const ImageCtx& ictx, image_info_t& info, size_t info_size);
   string get_block_oid(const rbd_obj_header_ondisk &header, uint64_t num);
-  uint64_t get_max_block(uint64_t size, int obj_order);
-  uint64_t get_max_block(const rbd_obj_header_ondisk &header);
+  bool has_object_map(const rbd_obj_header_ondisk &header);
+  string get_object_map_oid(const rbd_obj_header_ondisk &header, snap_t snapid);
+  int object_map_update(IoCtx& io_ctx, const string& oid,
+			uint64_t start, uint64_t end, bool exists);
+  int refresh_object_map(ImageCtx *ictx);
+  int used_size(ImageCtx *ictx, uint64_t *used);
   uint64_t get_block_size(const rbd_obj_header_ondisk &header);
-  uint64_t get_block_num(const rbd_obj_header_ondisk &header, uint64_t ofs);
-  uint64_t get_block_ofs(const rbd_obj_header_ondisk &header, uint64_t ofs);
   int check_io(ImageCtx *ictx, uint64_t off, uint64_t len);
   int init_rbd_info(struct rbd_info *info);
   void init_rbd_header(struct rbd_obj_header_ondisk& ondisk,
-			      uint64_t size, int *order, uint64_t bid);
+			      uint64_t size, int *order, uint64_t bid,
+			      bool striped, bool object_map);
 
   int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *),
@@ -429,13 +964,19 @@ void WatchCtx::notify(uint8_t opcode, uint64_t ver, bufferlist& bl)
 }
 
 void init_rbd_header(struct rbd_obj_header_ondisk& ondisk,
-					uint64_t size, int *order, uint64_t bid)
+					uint64_t size, int *order, uint64_t bid,
+					bool striped, bool object_map)
 {
   uint32_t hi = bid >> 32;
   uint32_t lo = bid & 0xFFFFFFFF;
   memset(&ondisk, 0, sizeof(ondisk));
 
-  memcpy(&ondisk.text, RBD_HEADER_TEXT, sizeof(RBD_HEADER_TEXT));
+  if (striped)
+    memcpy(&ondisk.text, RBD_HEADER_TEXT_STRIPED, sizeof(RBD_HEADER_TEXT_STRIPED));
+  else if (object_map)
+    memcpy(&ondisk.text, RBD_HEADER_TEXT_OBJECT_MAP, sizeof(RBD_HEADER_TEXT_OBJECT_MAP));
+  else
+    memcpy(&ondisk.text, RBD_HEADER_TEXT, sizeof(RBD_HEADER_TEXT));
   memcpy(&ondisk.signature, RBD_HEADER_SIGNATURE, sizeof(RBD_HEADER_SIGNATURE));
   memcpy(&ondisk.version, RBD_HEADER_VERSION, sizeof(RBD_HEADER_VERSION));
 
@@ -450,7 +991,7 @@ void init_rbd_header(struct rbd_obj_header_ondisk& ondisk,
   ondisk.options.comp_type = RBD_COMP_NONE;
   ondisk.snap_seq = 0;
   ondisk.snap_count = 0;
-  ondisk.reserved = 0;
+  ondisk.reserved = object_map ? RBD_FLAG_OBJECT_MAP : 0;
   ondisk.snap_names_len = 0;
 }
 
@@ -474,36 +1015,237 @@ string get_block_oid(const rbd_obj_header_ondisk &header, uint64_t num)
   return o;
 }
 
-uint64_t get_max_block(uint64_t size, int obj_order)
+bool has_object_map(const rbd_obj_header_ondisk &header)
 {
-  uint64_t block_size = 1 << obj_order;
-  uint64_t numseg = (size + block_size - 1) >> obj_order;
-  return numseg;
+  return header.reserved & RBD_FLAG_OBJECT_MAP;
 }
 
-uint64_t get_max_block(const rbd_obj_header_ondisk &header)
+string get_object_map_oid(const rbd_obj_header_ondisk &header, snap_t snapid)
 {
-  return get_max_block(header.image_size, header.options.order);
+  char o[RBD_MAX_BLOCK_NAME_SIZE + 32];
+  if (snapid == CEPH_NOSNAP)
+    snprintf(o, sizeof(o), "%s.objmap", header.block_name);
+  else
+    snprintf(o, sizeof(o), "%s.objmap.%" PRIx64, header.block_name,
+	     (uint64_t)snapid);
+  return o;
 }
 
-uint64_t get_block_ofs(const rbd_obj_header_ondisk &header, uint64_t ofs)
+int ObjectMap::load(IoCtx& io_ctx, const std::string& oid)
 {
-  int obj_order = header.options.order;
-  uint64_t block_size = 1 << obj_order;
-  return ofs & (block_size - 1);
+  clear();
+  bufferlist bl;
+  int r = io_ctx.read(oid, bl, 0, 0);
+  if (r < 0)
+    return r;
+  bits.resize(bl.length() * 8);
+  const unsigned char *p = (const unsigned char *)bl.c_str();
+  for (uint64_t i = 0; i < bits.size(); i++)
+    bits[i] = p[i / 8] & (1 << (i % 8));
+  valid = true;
+  return 0;
 }
 
-uint64_t get_block_size(const rbd_obj_header_ondisk &header)
+int ObjectMap::save(IoCtx& io_ctx, const std::string& oid) const
 {
-  return 1 << header.options.order;
+  assert(valid);
+  bufferptr bp((bits.size() + 7) / 8);
+  bp.zero();
+  unsigned char *p = (unsigned char *)bp.c_str();
+  for (uint64_t i = 0; i < bits.size(); i++)
+    if (bits[i])
+      p[i / 8] |= 1 << (i % 8);
+  bufferlist bl;
+  bl.push_back(bp);
+  return io_ctx.write_full(oid, bl);
+}
+
+/*
+ * set or clear a range of bits in a map on disk.  a missing map stays
+ * missing (-ENOENT): bits set from now on wouldn't cover what's
+ * already there.
+ */
+int object_map_update(IoCtx& io_ctx, const string& oid,
+		      uint64_t start, uint64_t end, bool exists)
+{
+  bufferlist in, out;
+  __u8 e = exists;
+  ::encode(start, in);
+  ::encode(end, in);
+  ::encode(e, in);
+  return io_ctx.exec(oid, "rbd", "objmap_update", in, out);
 }
 
-uint64_t get_block_num(const rbd_obj_header_ondisk &header, uint64_t ofs)
+// load the map for the snapshot (or head) we're looking at
+int refresh_object_map(ImageCtx *ictx)
 {
-  int obj_order = header.options.order;
-  uint64_t num = ofs >> obj_order;
+  assert(ictx->lock.is_locked());
+  ictx->object_map.clear();
+  if (!has_object_map(ictx->header))
+    return 0;
 
-  return num;
+  string oid = get_object_map_oid(ictx->header, ictx->snapid);
+  int r = ictx->object_map.load(ictx->md_ctx, oid);
+  if (r == -ENOENT) {
+    ldout(ictx->cct, 2) << "object map " << oid << " is missing; "
+			<< "assuming every object exists" << dendl;
+    return 0;
+  }
+  if (r < 0)
+    lderr(ictx->cct) << "error reading object map " << oid << ": "
+		     << cpp_strerror(-r) << dendl;
+  return r;
+}
+
+int ImageCtx::mark_objects_exist(uint64_t start, uint64_t end)
+{
+  lock.Lock();
+  if (!_object_map_needs_mark(start, end)) {
+    lock.Unlock();
+    return 0;
+  }
+  string oid = get_object_map_oid(header, CEPH_NOSNAP);
+  lock.Unlock();
+
+  ldout(cct, 20) << "marking objects " << start << "~" << (end - start)
+		 << " in " << oid << dendl;
+  int r = object_map_update(md_ctx, oid, start, end, true);
+  Mutex::Locker l(lock);
+  if (r == -ENOENT) {
+    lderr(cct) << "object map " << oid << " disappeared; no longer using it"
+	       << dendl;
+    object_map.clear();
+    return 0;
+  }
+  if (r < 0) {
+    lderr(cct) << "error updating object map " << oid << ": "
+	       << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  if (object_map.valid)
+    object_map.set(start, end, true);
+  return 0;
+}
+
+int ImageCtx::refresh_object_map_bits(uint64_t start, uint64_t end)
+{
+  lock.Lock();
+  if (snapid != CEPH_NOSNAP || !object_map.valid) {
+    // a snapshot's map never changes
+    lock.Unlock();
+    return 0;
+  }
+  while (start < end && object_map.may_exist(start))
+    start++;
+  if (start == end) {
+    lock.Unlock();
+    return 0;
+  }
+  string oid = get_object_map_oid(header, CEPH_NOSNAP);
+  lock.Unlock();
+
+  uint64_t first = start / 8;
+  bufferlist bl;
+  int r = md_ctx.read(oid, bl, (end + 7) / 8 - first, first);
+  Mutex::Locker l(lock);
+  if (r == -ENOENT) {
+    lderr(cct) << "object map " << oid << " disappeared; no longer using it"
+	       << dendl;
+    object_map.clear();
+    return 0;
+  }
+  if (r < 0) {
+    lderr(cct) << "error reading object map " << oid << ": "
+	       << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  if (!object_map.valid || !bl.length())
+    return 0;
+  // objects only go away on resize and rollback, which notify us; just
+  // pick up the ones that were written
+  const unsigned char *p = (const unsigned char *)bl.c_str();
+  uint64_t last = MIN(end, (first + bl.length()) * 8);
+  for (uint64_t i = start; i < last; i++)
+    if (p[i / 8 - first] & (1 << (i % 8)))
+      object_map.set(i, i + 1, true);
+  return 0;
+}
+
+// send one object's part of an aio write
+static int aio_write_block(ImageCtx *ictx, const string& oid, bufferlist& bl,
+			   uint64_t block_ofs, AioBlockCompletion *block_completion)
+{
+  uint64_t write_len = bl.length();
+  if (ictx->object_cacher) {
+    ictx->write_to_cache(object_t(oid), bl, write_len, block_ofs,
+			 new C_CacheBlock(block_completion));
+    return 0;
+  }
+  ictx->lock.Lock();
+  librados::AioCompletion *rados_completion =
+    ictx->get_buffered_tx_completion(write_len, block_completion);
+  ictx->lock.Unlock();
+  int r = ictx->data_ctx.aio_write(oid, rados_completion, bl, write_len, block_ofs);
+  rados_completion->release();
+  return r;
+}
+
+void ImageCtx::send_object_map_writes()
+{
+  lock.Lock();
+  if (object_map_sending) {
+    // whoever is sending will get to ours
+    lock.Unlock();
+    return;
+  }
+  object_map_sending = true;
+  while (!object_map_writes.empty() && object_map_writes.front()->ready) {
+    ObjectMapWrite *w = object_map_writes.front();
+    object_map_writes.pop_front();
+    lock.Unlock();
+    for (std::list<ObjectMapWrite::Block>::iterator p = w->blocks.begin();
+	 p != w->blocks.end(); ++p) {
+      if (w->rval < 0) {
+	p->completion->complete(w->rval);
+	delete p->completion;
+	continue;
+      }
+      int r = aio_write_block(this, p->oid, p->bl, p->ofs, p->completion);
+      if (r < 0)
+	lderr(cct) << "error writing to " << p->oid << ": "
+		   << cpp_strerror(-r) << dendl;
+    }
+    delete w;
+    lock.Lock();
+  }
+  object_map_sending = false;
+  do_buffered_tx_completions();
+  if (object_map_writes.empty())
+    object_map_cond.SignalAll();
+  lock.Unlock();
+}
+
+void C_ObjectMapMarked::finish(int r)
+{
+  CephContext *cct = ictx->cct;
+  ictx->lock.Lock();
+  if (r == -ENOENT) {
+    lderr(cct) << "object map disappeared; no longer using it" << dendl;
+    ictx->object_map.clear();
+  } else if (r < 0) {
+    lderr(cct) << "error updating object map: " << cpp_strerror(-r) << dendl;
+    write->rval = r;
+  } else if (ictx->object_map.valid) {
+    ictx->object_map.set(start, end, true);
+  }
+  write->ready = true;
+  ictx->lock.Unlock();
+  ictx->send_object_map_writes();
+}
+
+uint64_t get_block_size(const rbd_obj_header_ondisk &header)
+{
+  return 1 << header.options.order;
 }
 
 int init_rbd_info(struct rbd_info *info)
@@ -512,19 +1254,76 @@ int init_rbd_info(struct rbd_info *info)
   return 0;
 }
 
-void trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header, uint64_t newsize,
-		ProgressContext& prog_ctx)
+int trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header,
+	       const ImageLayout& layout, uint64_t newsize,
+	       ProgressContext& prog_ctx)
 {
   CephContext *cct = (CephContext *)io_ctx.cct();
-  uint64_t bsize = get_block_size(header);
-  uint64_t numseg = get_max_block(header);
-  uint64_t start = get_block_num(header, newsize);
-  ldout(cct, 2) << "trimming image data from " << numseg << " to " << start << " objects..." << dendl;
-  for (uint64_t i=start; i<numseg; i++) {
+  uint64_t numseg = layout.num_objects(header.image_size);
+  uint64_t keep = layout.num_objects(newsize);
+  // objects before the set newsize falls in are untouched; the rest of
+  // that set is truncated, and everything past keep removed
+  uint64_t start = (newsize / layout.set_size()) * layout.stripe_count;
+  ldout(cct, 2) << "trimming image data from " << numseg << " to " << keep << " objects..." << dendl;
+
+  // removes go to the head, even if io_ctx is reading from a snapshot
+  IoCtx head_ctx;
+  head_ctx.dup(io_ctx);
+  head_ctx.snap_set_read(CEPH_NOSNAP);
+
+  ObjectMap object_map;
+  string map_oid;
+  if (has_object_map(header)) {
+    map_oid = get_object_map_oid(header, CEPH_NOSNAP);
+    int r = object_map.load(head_ctx, map_oid);
+    if (r < 0 && r != -ENOENT) {
+      lderr(cct) << "error reading object map: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
+
+  // objects that were never written aren't there to remove; without
+  // a map we can't tell which those are, so ignore ENOENT
+  SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, true);
+  for (uint64_t i = start; i < numseg; i++) {
+    if (!object_map.may_exist(i))
+      continue;
+    uint64_t extent = layout.object_extent(i, newsize);
+    if (extent == layout.object_size)
+      continue;
     string oid = get_block_oid(header, i);
-    io_ctx.remove(oid);
-    prog_ctx.update_progress(i * bsize, (numseg - start) * bsize);
+    throttle.start_op();
+    librados::AioCompletion *rados_completion =
+      Rados::aio_create_completion(new C_SimpleThrottle(&throttle), rados_ctx_cb, NULL);
+    int r;
+    if (extent)
+      r = head_ctx.aio_trunc(oid, rados_completion, extent);
+    else
+      r = head_ctx.aio_remove(oid, rados_completion);
+    rados_completion->release();
+    if (r < 0) {
+      throttle.end_op(r);
+      break;
+    }
+    prog_ctx.update_progress(i - start, numseg - start);
+    if (throttle.get_ret() < 0)
+      break;
+  }
+  int r = throttle.wait_for_ret();
+  if (r < 0) {
+    lderr(cct) << "error trimming image: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+
+  // only now that the objects are gone
+  if (object_map.valid && keep < numseg) {
+    r = object_map_update(head_ctx, map_oid, keep, numseg, false);
+    if (r < 0 && r != -ENOENT) {
+      lderr(cct) << "error updating object map: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
   }
+  return 0;
 }
 
 int read_rbd_info(IoCtx& io_ctx, const string& info_oid, struct rbd_info *info)
@@ -588,7 +1387,12 @@ int read_header_bl(IoCtx& io_ctx, const string& md_oid, bufferlist& header, uint
     off += r;
    } while (r == READ_SIZE);
 
-  if (memcmp(RBD_HEADER_TEXT, header.c_str(), sizeof(RBD_HEADER_TEXT))) {
+  if (header.length() < sizeof(RBD_HEADER_TEXT_STRIPED) ||
+      (memcmp(RBD_HEADER_TEXT, header.c_str(), sizeof(RBD_HEADER_TEXT)) &&
+       memcmp(RBD_HEADER_TEXT_STRIPED, header.c_str(),
+	      sizeof(RBD_HEADER_TEXT_STRIPED)) &&
+       memcmp(RBD_HEADER_TEXT_OBJECT_MAP, header.c_str(),
+	      sizeof(RBD_HEADER_TEXT_OBJECT_MAP)))) {
     CephContext *cct = (CephContext *)io_ctx.cct();
     lderr(cct) << "unrecognized header format" << dendl;
     return -ENXIO;
@@ -633,6 +1437,45 @@ int read_header(IoCtx& io_ctx, const string& md_oid, struct rbd_obj_header_ondis
   return 0;
 }
 
+bool is_striped(const rbd_obj_header_ondisk &header)
+{
+  return memcmp(RBD_HEADER_TEXT_STRIPED, header.text,
+		sizeof(RBD_HEADER_TEXT_STRIPED)) == 0;
+}
+
+int read_layout(IoCtx& io_ctx, const string& md_oid,
+		const rbd_obj_header_ondisk &header, ImageLayout *layout)
+{
+  layout->init(header.options.order);
+  if (!is_striped(header))
+    return 0;
+
+  CephContext *cct = (CephContext *)io_ctx.cct();
+  bufferlist bl;
+  int r = io_ctx.getxattr(md_oid, RBD_STRIPING_XATTR, bl);
+  if (r < 0) {
+    lderr(cct) << "error reading striping of " << md_oid << ": "
+	       << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  try {
+    bufferlist::iterator p = bl.begin();
+    ::decode(layout->stripe_unit, p);
+    ::decode(layout->stripe_count, p);
+  } catch (const buffer::error &err) {
+    lderr(cct) << "unrecognized striping for " << md_oid << dendl;
+    return -EIO;
+  }
+  if (!layout->stripe_unit || !layout->stripe_count ||
+      layout->object_size % layout->stripe_unit) {
+    lderr(cct) << "bad striping for " << md_oid << ": stripe unit "
+	       << layout->stripe_unit << ", count " << layout->stripe_count
+	       << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
 int write_header(IoCtx& io_ctx, const string& md_oid, bufferlist& header)
 {
   bufferlist bl;
@@ -665,19 +1508,65 @@ int tmap_rm(IoCtx& io_ctx, const string& imgname)
 int rollback_image(ImageCtx *ictx, uint64_t snapid, ProgressContext& prog_ctx)
 {
   assert(ictx->lock.is_locked());
-  uint64_t numseg = get_max_block(ictx->header);
+  CephContext *cct = ictx->cct;
+  uint64_t numseg = ictx->layout.num_objects(ictx->header.image_size);
   uint64_t bsize = get_block_size(ictx->header);
 
+  // rollback writes the head, whichever snapshot we are reading from
+  IoCtx head_ctx;
+  head_ctx.dup(ictx->data_ctx);
+  head_ctx.snap_set_read(CEPH_NOSNAP);
+
+  // an object that exists neither in the head nor in the snapshot has
+  // nothing to roll back
+  ObjectMap head_map, snap_map;
+  string head_map_oid = get_object_map_oid(ictx->header, CEPH_NOSNAP);
+  bool use_map = has_object_map(ictx->header);
+  if (use_map) {
+    int r = head_map.load(head_ctx, head_map_oid);
+    if (r < 0 && r != -ENOENT)
+      return r;
+    r = snap_map.load(head_ctx, get_object_map_oid(ictx->header, snapid));
+    if (r < 0 && r != -ENOENT)
+      return r;
+  }
+
+  SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, true);
   for (uint64_t i = 0; i < numseg; i++) {
-    int r;
+    if (!head_map.may_exist(i) && !snap_map.may_exist(i))
+      continue;
     string oid = get_block_oid(ictx->header, i);
-    r = ictx->data_ctx.selfmanaged_snap_rollback(oid, snapid);
-    ldout(ictx->cct, 10) << "selfmanaged_snap_rollback on " << oid << " to " << snapid << " returned " << r << dendl;
+    ldout(cct, 10) << "selfmanaged_snap_rollback on " << oid << " to " << snapid << dendl;
+    librados::ObjectWriteOperation op;
+    op.selfmanaged_snap_rollback(snapid);
+    throttle.start_op();
+    librados::AioCompletion *rados_completion =
+      Rados::aio_create_completion(new C_SimpleThrottle(&throttle), rados_ctx_cb, NULL);
+    int r = head_ctx.aio_operate(oid, rados_completion, &op);
+    rados_completion->release();
+    if (r < 0) {
+      throttle.end_op(r);
+      break;
+    }
     prog_ctx.update_progress(i * bsize, numseg * bsize);
-    if (r < 0 && r != -ENOENT)
-      return r;
+    if (throttle.get_ret() < 0)
+      break;
   }
-  return 0;
+  int r = throttle.wait_for_ret();
+  if (r < 0 || !use_map)
+    return r;
+
+  // the head now has exactly the snapshot's objects.  without the
+  // snapshot's map, any of them may be back.
+  if (snap_map.valid)
+    r = snap_map.save(head_ctx, head_map_oid);
+  else
+    r = object_map_update(head_ctx, head_map_oid, 0, numseg, true);
+  if (r == -ENOENT)
+    r = 0;
+  if (r < 0)
+    lderr(cct) << "error updating object map: " << cpp_strerror(-r) << dendl;
+  return r;
 }
 
 int list(IoCtx& io_ctx, std::vector<std::string>& names)
@@ -709,6 +1598,8 @@ int snap_create(ImageCtx *ictx, const char *snap_name)
     return r;
 
   Mutex::Locker l(ictx->lock);
+  // cached writes belong before the snapshot
+  ictx->flush_cache();
   r = add_snap(ictx, snap_name);
 
   if (r < 0)
@@ -741,15 +1632,46 @@ int snap_remove(ImageCtx *ictx, const char *snap_name)
   if (r < 0)
     return r;
 
+  if (has_object_map(ictx->header))
+    ictx->md_ctx.remove(get_object_map_oid(ictx->header, snapid));
+
   notify_change(ictx->md_ctx, ictx->md_oid(), NULL, ictx);
 
   return 0;
 }
 
 int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order)
+{
+  return create_striped(io_ctx, imgname, size, order, 0, 0);
+}
+
+/*
+ * a stripe unit of 0 means a whole object, and a count of 0 means 1;
+ * with both of those the image is laid out linearly, in the format
+ * every client understands.
+ */
+int create_striped(IoCtx& io_ctx, const char *imgname, uint64_t size,
+		   int *order, uint64_t stripe_unit, uint64_t stripe_count)
 {
   CephContext *cct = (CephContext *)io_ctx.cct();
-  ldout(cct, 20) << "create " << &io_ctx << " name = " << imgname << " size = " << size << dendl;
+  ldout(cct, 20) << "create " << &io_ctx << " name = " << imgname << " size = " << size
+		 << " stripe_unit = " << stripe_unit << " stripe_count = " << stripe_count << dendl;
+
+  if (!*order)
+    *order = RBD_DEFAULT_OBJ_ORDER;
+  ImageLayout layout;
+  layout.init(*order);
+  if (stripe_unit)
+    layout.stripe_unit = stripe_unit;
+  if (stripe_count)
+    layout.stripe_count = stripe_count;
+  if (layout.stripe_unit > layout.object_size ||
+      layout.object_size % layout.stripe_unit) {
+    lderr(cct) << "stripe unit " << layout.stripe_unit
+	       << " does not evenly divide the object size "
+	       << layout.object_size << dendl;
+    return -EINVAL;
+  }
 
   string md_oid = imgname;
   md_oid += RBD_SUFFIX;
@@ -770,7 +1692,19 @@ int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order)
   }
 
   struct rbd_obj_header_ondisk header;
-  init_rbd_header(header, size, order, bid);
+  init_rbd_header(header, size, order, bid, layout.is_striped(),
+		  cct->_conf->rbd_object_map);
+
+  if (cct->_conf->rbd_object_map) {
+    // an empty map: no objects yet.  it has to exist before the header
+    // that points to it.
+    string map_oid = get_object_map_oid(header, CEPH_NOSNAP);
+    r = io_ctx.create(map_oid, true);
+    if (r < 0) {
+      lderr(cct) << "error creating object map: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
 
   bufferlist bl;
   bl.append((const char *)&header, sizeof(header));
@@ -783,7 +1717,18 @@ int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order)
   }
 
   ldout(cct, 2) << "creating rbd image..." << dendl;
-  r = io_ctx.write(md_oid, bl, bl.length(), 0);
+  if (layout.is_striped()) {
+    // the striping has to be there as soon as the header is
+    bufferlist layout_bl;
+    ::encode(layout.stripe_unit, layout_bl);
+    ::encode(layout.stripe_count, layout_bl);
+    librados::ObjectWriteOperation op;
+    op.write_full(bl);
+    op.setxattr(RBD_STRIPING_XATTR, layout_bl);
+    r = io_ctx.operate(md_oid, &op);
+  } else {
+    r = io_ctx.write(md_oid, bl, bl.length(), 0);
+  }
   if (r < 0) {
     lderr(cct) << "error writing header: " << cpp_strerror(-r) << dendl;
     return r;
@@ -816,6 +1761,18 @@ int rename(IoCtx& io_ctx, const char *srcname, const char *dstname)
     lderr(cct) << "rbd image header " << dst_md_oid << " already exists" << dendl;
     return -EEXIST;
   }
+  if (is_striped(*(rbd_obj_header_ondisk *)header.c_str())) {
+    // bring the striping along first, so the new header is never
+    // without it
+    bufferlist layout_bl;
+    r = io_ctx.getxattr(md_oid, RBD_STRIPING_XATTR, layout_bl);
+    if (r >= 0)
+      r = io_ctx.setxattr(dst_md_oid, RBD_STRIPING_XATTR, layout_bl);
+    if (r < 0) {
+      lderr(cct) << "error copying striping to " << dst_md_oid << ": " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
   r = write_header(io_ctx, dst_md_oid, header);
   if (r < 0) {
     lderr(cct) << "error writing header: " << dst_md_oid << ": " << cpp_strerror(-r) << dendl;
@@ -853,6 +1810,32 @@ int info(ImageCtx *ictx, image_info_t& info, size_t infosize)
   return 0;
 }
 
+int get_stripe_unit(ImageCtx *ictx, uint64_t *stripe_unit)
+{
+  ldout(ictx->cct, 20) << "get_stripe_unit " << ictx << dendl;
+
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  Mutex::Locker l(ictx->lock);
+  *stripe_unit = ictx->layout.stripe_unit;
+  return 0;
+}
+
+int get_stripe_count(ImageCtx *ictx, uint64_t *stripe_count)
+{
+  ldout(ictx->cct, 20) << "get_stripe_count " << ictx << dendl;
+
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  Mutex::Locker l(ictx->lock);
+  *stripe_count = ictx->layout.stripe_count;
+  return 0;
+}
+
 bool has_snaps(IoCtx& io_ctx, const std::string& md_oid)
 {
   CephContext *cct((CephContext *)io_ctx.cct());
@@ -890,7 +1873,15 @@ int remove(IoCtx& io_ctx, const char *imgname, ProgressContext& prog_ctx)
       lderr(cct) << "image has snapshots - not removing" << dendl;
       return -EBUSY;
     }
-    trim_image(io_ctx, header, 0, prog_ctx);
+    ImageLayout layout;
+    r = read_layout(io_ctx, md_oid, header, &layout);
+    if (r < 0)
+      return r;
+    r = trim_image(io_ctx, header, layout, 0, prog_ctx);
+    if (r < 0)
+      return r;
+    if (has_object_map(header))
+      io_ctx.remove(get_object_map_oid(header, CEPH_NOSNAP));
     ldout(cct, 2) << "removing header..." << dendl;
     io_ctx.remove(md_oid);
   }
@@ -914,12 +1905,18 @@ int resize_helper(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx)
     return 0;
   }
 
+  // nothing cached may outlive the old size, or be written back past
+  // the new one after we trim
+  ictx->invalidate_cache();
+
   if (size > ictx->header.image_size) {
     ldout(cct, 2) << "expanding image " << size << " -> " << ictx->header.image_size << " objects" << dendl;
     ictx->header.image_size = size;
   } else {
     ldout(cct, 2) << "shrinking image " << size << " -> " << ictx->header.image_size << " objects" << dendl;
-    trim_image(ictx->data_ctx, ictx->header, size, prog_ctx);
+    int r = trim_image(ictx->data_ctx, ictx->header, ictx->layout, size, prog_ctx);
+    if (r < 0)
+      return r;
     ictx->header.image_size = size;
   }
 
@@ -950,7 +1947,9 @@ int resize(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx)
     return r;
 
   Mutex::Locker l(ictx->lock);
-  resize_helper(ictx, size, prog_ctx);
+  r = resize_helper(ictx, size, prog_ctx);
+  if (r < 0)
+    return r;
 
   ldout(cct, 2) << "done." << dendl;
 
@@ -1000,6 +1999,20 @@ int add_snap(ImageCtx *ictx, const char *snap_name)
     lderr(ictx->cct) << "rbd.snap_add execution failed failed: " << cpp_strerror(-r) << dendl;
     return r;
   }
+
+  if (has_object_map(ictx->header)) {
+    // copied after the snapshot is taken, so anything written since is
+    // in it too, which errs the safe way.  if this fails the snapshot
+    // just goes without a map.
+    ObjectMap snap_map;
+    r = snap_map.load(ictx->md_ctx, get_object_map_oid(ictx->header, CEPH_NOSNAP));
+    if (r == 0)
+      r = snap_map.save(ictx->md_ctx, get_object_map_oid(ictx->header, snap_id));
+    if (r < 0 && r != -ENOENT)
+      lderr(ictx->cct) << "failed to save object map for snapshot " << snap_name
+		       << ": " << cpp_strerror(-r) << dendl;
+  }
+
   notify_change(ictx->md_ctx, ictx->md_oid(), NULL, ictx);
 
   return 0;
@@ -1062,11 +2075,18 @@ int ictx_refresh(ImageCtx *ictx, const char *snap_name)
     ldout(cct, 20) << "ictx_refresh " << ictx << " no snap" << dendl;
   }
 
+  // the header changed under us (resize, rollback, snapshots); write
+  // back what we have and start over rather than trust cached data
+  ictx->invalidate_cache();
+
   int r = read_header(ictx->md_ctx, ictx->md_oid(), &(ictx->header), NULL);
   if (r < 0) {
     lderr(cct) << "Error reading header: " << cpp_strerror(-r) << dendl;
     return r;
   }
+  r = read_layout(ictx->md_ctx, ictx->md_oid(), ictx->header, &ictx->layout);
+  if (r < 0)
+    return r;
   r = ictx->md_ctx.exec(ictx->md_oid(), "rbd", "snap_list", bl, bl2);
   if (r < 0) {
     lderr(cct) << "Error listing snapshots: " << cpp_strerror(-r) << dendl;
@@ -1106,6 +2126,10 @@ int ictx_refresh(ImageCtx *ictx, const char *snap_name)
 
   ictx->data_ctx.selfmanaged_snap_set_write_ctx(ictx->snapc.seq, ictx->snaps);
 
+  r = refresh_object_map(ictx);
+  if (r < 0)
+    return r;
+
   ictx->refresh_lock.Lock();
   ictx->needs_refresh = false;
   ictx->refresh_lock.Unlock();
@@ -1161,6 +2185,9 @@ int snap_rollback(ImageCtx *ictx, const char *snap_name, ProgressContext& prog_c
     return -ENOENT;
   }
 
+  // nothing dirty from before the rollback may be written back over it
+  ictx->invalidate_cache();
+
   uint64_t new_size = ictx->get_image_size();
   ictx->get_snap_size(snap_name, &new_size);
   ldout(cct, 2) << "resizing to snapshot size..." << dendl;
@@ -1173,6 +2200,7 @@ int snap_rollback(ImageCtx *ictx, const char *snap_name, ProgressContext& prog_c
   }
 
   r = rollback_image(ictx, snapid, prog_ctx);
+  ictx->invalidate_cache();
   if (r < 0) {
     lderr(cct) << "Error rolling back image: " << cpp_strerror(-r) << dendl;
     return r;
@@ -1188,61 +2216,164 @@ int snap_rollback(ImageCtx *ictx, const char *snap_name, ProgressContext& prog_c
   return r;
 }
 
-struct CopyProgressCtx {
-  CopyProgressCtx(ProgressContext &p)
-	: prog_ctx(p)
-  {
-  }
-  ImageCtx *destictx;
-  uint64_t src_size;
-  ProgressContext &prog_ctx;
-};
-
-int do_copy_extent(uint64_t offset, size_t len, const char *buf, void *data)
-{
-  CopyProgressCtx *cp = reinterpret_cast<CopyProgressCtx*>(data);
-  cp->prog_ctx.update_progress(offset, cp->src_size);
-  int ret = 0;
-  if (buf) {
-    ret = write(cp->destictx, offset, len, buf);
-  }
-  return ret;
-}
-
 int copy(ImageCtx& ictx, IoCtx& dest_md_ctx, const char *destname,
 	 ProgressContext &prog_ctx)
 {
   CephContext *cct = (CephContext *)dest_md_ctx.cct();
-  CopyProgressCtx cp(prog_ctx);
   uint64_t src_size = ictx.get_image_size();
   int64_t r;
 
+  ictx.lock.Lock();
   int order = ictx.header.options.order;
-  r = create(dest_md_ctx, destname, src_size, &order);
+  ImageLayout layout = ictx.layout;
+  ictx.lock.Unlock();
+  r = create_striped(dest_md_ctx, destname, src_size, &order,
+		     layout.stripe_unit, layout.stripe_count);
   if (r < 0) {
     lderr(cct) << "header creation failed" << dendl;
     return r;
   }
 
-  cp.destictx = new librbd::ImageCtx(destname, dest_md_ctx);
-  cp.src_size = src_size;
-  r = open_image(dest_md_ctx, cp.destictx, destname, NULL);
+  ImageCtx *destictx = new librbd::ImageCtx(destname, dest_md_ctx);
+  r = open_image(dest_md_ctx, destictx, destname, NULL);
   if (r < 0) {
     lderr(cct) << "failed to read newly created header" << dendl;
     return r;
   }
 
-  r = read_iterate(&ictx, 0, src_size, do_copy_extent, &cp);
+  // the osds copy what they have, so anything cached has to be there
+  ictx.flush_cache();
+
+  // both images share an order and striping, so each source object
+  // maps onto exactly one destination object; have the osds copy them directly
+  // instead of streaming the data through us.  a missing source object
+  // is a hole, and the copy fails without creating the destination.
+  ictx.lock.Lock();
+  uint64_t block_size = get_block_size(ictx.header);
+  ObjectMap src_map = ictx.object_map;
+  ictx.lock.Unlock();
+  uint64_t numseg = layout.num_objects(src_size);
+
+  // the destination is new; its map starts out as a copy of ours, or
+  // with everything present if we have none
+  if (has_object_map(destictx->header)) {
+    ObjectMap dest_map = src_map;
+    if (!dest_map.valid) {
+      dest_map.valid = true;
+      dest_map.set(0, numseg, true);
+    }
+    dest_map.bits.resize(numseg);
+    r = dest_map.save(destictx->md_ctx,
+		      get_object_map_oid(destictx->header, CEPH_NOSNAP));
+    if (r < 0) {
+      lderr(cct) << "failed to write object map: " << cpp_strerror(-r) << dendl;
+      close_image(destictx);
+      return r;
+    }
+  }
 
-  if (r >= 0) {
-    // don't return total bytes read, which may not fit in an int
-    r = 0;
-    prog_ctx.update_progress(cp.src_size, cp.src_size);
+  SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, true);
+  for (uint64_t i = 0; i < numseg; i++) {
+    if (!src_map.may_exist(i))
+      continue;
+    ictx.lock.Lock();
+    string src_oid = get_block_oid(ictx.header, i);
+    ictx.lock.Unlock();
+    string dest_oid = get_block_oid(destictx->header, i);
+
+    librados::ObjectWriteOperation op;
+    op.copy_from(src_oid, ictx.data_ctx, 0);
+    throttle.start_op();
+    librados::AioCompletion *rados_completion =
+      Rados::aio_create_completion(new C_SimpleThrottle(&throttle), rados_ctx_cb, NULL);
+    r = destictx->data_ctx.aio_operate(dest_oid, rados_completion, &op);
+    rados_completion->release();
+    if (r < 0) {
+      throttle.end_op(r);
+      break;
+    }
+    prog_ctx.update_progress(i * block_size, src_size);
+    if (throttle.get_ret() < 0)
+      break;
   }
-  close_image(cp.destictx);
+  r = throttle.wait_for_ret();
+  if (r < 0)
+    lderr(cct) << "failed to copy image data: " << cpp_strerror(-r) << dendl;
+  else
+    prog_ctx.update_progress(src_size, src_size);
+  close_image(destictx);
   return r;
 }
 
+struct C_StatObject : public Context {
+  SimpleThrottle *throttle;
+  atomic_t *found;
+  C_StatObject(SimpleThrottle *t, atomic_t *f) : throttle(t), found(f) {}
+  void finish(int r) {
+    if (r == 0)
+      found->inc();
+    throttle->end_op(r);
+  }
+};
+
+/*
+ * space taken by the objects of the image (or snapshot), counting
+ * each object as a whole.  the map answers without asking the osds;
+ * without one, stat every object.
+ */
+int used_size(ImageCtx *ictx, uint64_t *used)
+{
+  CephContext *cct = ictx->cct;
+  ldout(cct, 20) << "used_size " << ictx << dendl;
+
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  ictx->lock.Lock();
+  uint64_t size = ictx->get_image_size();
+  uint64_t block_size = get_block_size(ictx->header);
+  uint64_t numseg = ictx->layout.num_objects(size);
+  ObjectMap object_map = ictx->object_map;
+  ictx->lock.Unlock();
+
+  uint64_t objects = 0;
+  if (object_map.valid) {
+    for (uint64_t i = 0; i < numseg; i++)
+      if (object_map.may_exist(i))
+	objects++;
+  } else {
+    // cached writes only count once they're written back
+    ictx->flush_cache();
+    atomic_t found;
+    SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, true);
+    for (uint64_t i = 0; i < numseg; i++) {
+      ictx->lock.Lock();
+      string oid = get_block_oid(ictx->header, i);
+      ictx->lock.Unlock();
+      throttle.start_op();
+      librados::AioCompletion *rados_completion =
+	Rados::aio_create_completion(new C_StatObject(&throttle, &found),
+				     rados_ctx_cb, NULL);
+      r = ictx->data_ctx.aio_stat(oid, rados_completion, NULL, NULL);
+      rados_completion->release();
+      if (r < 0) {
+	throttle.end_op(r);
+	break;
+      }
+      if (throttle.get_ret() < 0)
+	break;
+    }
+    r = throttle.wait_for_ret();
+    if (r < 0)
+      return r;
+    objects = found.read();
+  }
+
+  *used = MIN(objects * block_size, size);
+  return 0;
+}
+
 int snap_set(ImageCtx *ictx, const char *snap_name)
 {
   ldout(ictx->cct, 20) << "snap_set " << ictx << " snap = " << (snap_name ? snap_name : "NULL") << dendl;
@@ -1252,9 +2383,12 @@ int snap_set(ImageCtx *ictx, const char *snap_name)
     return r;
 
   Mutex::Locker l(ictx->lock);
+  ictx->invalidate_cache();
   if (snap_name) {
     r = ictx->snap_set(snap_name);
     if (r < 0) {
+      // we're back on the head; don't keep the snapshot's map for it
+      refresh_object_map(ictx);
       return r;
     }
   } else {
@@ -1263,7 +2397,7 @@ int snap_set(ImageCtx *ictx, const char *snap_name)
 
   ictx->data_ctx.snap_set_read(ictx->snapid);
 
-  return 0;
+  return refresh_object_map(ictx);
 }
 
 int open_image(IoCtx& io_ctx, ImageCtx *ictx, const char *name, const char *snap_name)
@@ -1296,6 +2430,7 @@ void close_image(ImageCtx *ictx)
 {
   ldout(ictx->cct, 20) << "close_image " << ictx << dendl;
   flush(ictx);
+  ictx->invalidate_cache();
   ictx->lock.Lock();
   ictx->wctx->invalidate();
   ictx->md_ctx.unwatch(ictx->md_oid(), ictx->wctx->cookie);
@@ -1304,11 +2439,106 @@ void close_image(ImageCtx *ictx)
   delete ictx;
 }
 
+/*
+ * one object's part of a read_iterate chunk.  these are issued ahead,
+ * up to rbd_concurrent_management_ops at a time, and handed to the
+ * callback in offset order as their chunks complete.
+ */
+struct ReadIterateBlock {
+  Mutex *lock;
+  Cond *cond;
+  bool cached;
+  uint64_t block_ofs;
+  size_t len;
+  vector<pair<uint64_t,uint64_t> > buffer_extents; // where it lands in the chunk
+  bufferlist bl;
+  map<uint64_t, uint64_t> m;
+  int r;
+  bool done;
+
+  ReadIterateBlock(Mutex *l, Cond *c, bool ca, uint64_t o, size_t n)
+    : lock(l), cond(c), cached(ca), block_ofs(o), len(n), r(0), done(false) {}
+
+  void complete(int rval) {
+    Mutex::Locker locker(*lock);
+    r = rval;
+    if (r == -ENOENT)
+      r = 0;  // a hole
+    if (r >= 0 && cached)
+      m[block_ofs] = bl.length();  // the cache fills holes with zeroes
+    done = true;
+    cond->Signal();
+  }
+};
+
+struct C_ReadIterateBlock : public Context {
+  ReadIterateBlock *block;
+  C_ReadIterateBlock(ReadIterateBlock *b) : block(b) {}
+  void finish(int r) {
+    block->complete(r);
+  }
+};
+
+// the part of a read_iterate within one object set
+struct ReadIterateChunk {
+  uint64_t off;    // from the start of the read
+  uint64_t len;
+  std::list<ReadIterateBlock*> blocks;
+  ReadIterateChunk(uint64_t o, uint64_t l) : off(o), len(l) {}
+  ~ReadIterateChunk() {
+    for (std::list<ReadIterateBlock*>::iterator p = blocks.begin();
+	 p != blocks.end(); ++p)
+      delete *p;
+  }
+};
+
+/*
+ * where the data and holes a block read land in its chunk: chunk
+ * offset -> length and data, or NULL for a hole
+ */
+static int read_iterate_pieces(ReadIterateBlock *block,
+			       map<uint64_t, pair<uint64_t, const char*> >& pieces)
+{
+  const char *data = block->bl.length() ? block->bl.c_str() : NULL;
+  uint64_t bl_ofs = 0;
+  uint64_t obj_ofs = block->block_ofs;
+  map<uint64_t, uint64_t>::const_iterator d = block->m.begin();
+  for (vector<pair<uint64_t,uint64_t> >::iterator b = block->buffer_extents.begin();
+       b != block->buffer_extents.end(); ++b) {
+    uint64_t buf_ofs = b->first, left = b->second;
+    while (left > 0) {
+      while (d != block->m.end() && d->first + d->second <= obj_ofs) {
+	bl_ofs += d->second;
+	++d;
+      }
+      uint64_t n;
+      const char *p = NULL;
+      if (d == block->m.end() || d->first >= obj_ofs + left) {
+	n = left;
+      } else if (d->first > obj_ofs) {
+	n = d->first - obj_ofs;
+      } else {
+	uint64_t skip = obj_ofs - d->first;
+	n = MIN(left, d->second - skip);
+	if (bl_ofs + skip + n > block->bl.length())
+	  return -EIO;
+	p = data + bl_ofs + skip;
+      }
+      pieces[buf_ofs] = make_pair(n, p);
+      buf_ofs += n;
+      obj_ofs += n;
+      left -= n;
+    }
+  }
+  return 0;
+}
+
 int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
 		     int (*cb)(uint64_t, size_t, const char *, void *),
 		     void *arg)
 {
-  ldout(ictx->cct, 20) << "read_iterate " << ictx << " off = " << off << " len = " << len << dendl;
+  CephContext *cct = ictx->cct;
+  ldout(cct, 20) << "read_iterate " << ictx << " off = " << off << " len = " << len << dendl;
 
   int r = ictx_check(ictx);
   if (r < 0)
@@ -1318,42 +2548,119 @@ int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
   if (r < 0)
     return r;
 
-  int64_t ret;
-  int64_t total_read = 0;
+  // holes are skipped without asking, so make sure they still are
+  uint64_t start_object, end_object;
   ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
+  ictx->layout.object_range(off, len, &start_object, &end_object);
   ictx->lock.Unlock();
-  uint64_t left = len;
-
-  for (uint64_t i = start_block; i <= end_block; i++) {
-    bufferlist bl;
-    ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_read);
-    ictx->lock.Unlock();
-    uint64_t read_len = min(block_size - block_ofs, left);
+  r = ictx->refresh_object_map_bits(start_object, end_object);
+  if (r < 0)
+    return r;
 
-    map<uint64_t, uint64_t> m;
-    r = ictx->data_ctx.sparse_read(oid, m, bl, read_len, block_ofs);
-    if (r < 0 && r == -ENOENT)
-      r = 0;
-    if (r < 0) {
-      return r;
+  int64_t ret = 0;
+  int64_t total_read = 0;
+  uint64_t issued = 0;
+
+  size_t max_in_flight = MAX(1, cct->_conf->rbd_concurrent_management_ops);
+  size_t blocks_in_flight = 0;
+  Mutex mylock("librbd::read_iterate::mylock");
+  Cond cond;
+  std::list<ReadIterateChunk*> in_flight;
+  while (true) {
+    // keep the window full.  each chunk is the run of the image that
+    // stays in one object set, so it needs one op per object
+    while (ret == 0 && issued < len && blocks_in_flight < max_in_flight) {
+      vector<ImageLayout::Extent> extents;
+      ictx->lock.Lock();
+      uint64_t set_size = ictx->layout.set_size();
+      uint64_t chunk_len = MIN(len - issued, set_size - (off + issued) % set_size);
+      ictx->layout.map_extents(off + issued, chunk_len, extents);
+      ictx->lock.Unlock();
+
+      ReadIterateChunk *chunk = new ReadIterateChunk(issued, chunk_len);
+      in_flight.push_back(chunk);
+      for (vector<ImageLayout::Extent>::iterator p = extents.begin();
+	   p != extents.end(); ++p) {
+	ictx->lock.Lock();
+	string oid = get_block_oid(ictx->header, p->objectno);
+	bool may_exist = ictx->object_map.may_exist(p->objectno);
+	ictx->lock.Unlock();
+
+	ReadIterateBlock *block = new ReadIterateBlock(&mylock, &cond,
+						       ictx->object_cacher != NULL,
+						       p->offset, p->length);
+	block->buffer_extents.swap(p->buffer_extents);
+	chunk->blocks.push_back(block);
+	blocks_in_flight++;
+	if (!may_exist) {
+	  // a hole, without asking
+	  block->cached = false;
+	  block->done = true;
+	  continue;
+	}
+	Context *ctx = new C_ReadIterateBlock(block);
+	if (ictx->object_cacher) {
+	  ictx->aio_read_from_cache(object_t(oid), &block->bl, p->length,
+				    p->offset, ctx);
+	} else {
+	  librados::AioCompletion *rados_completion =
+	    Rados::aio_create_completion(ctx, rados_ctx_cb, NULL);
+	  r = ictx->data_ctx.aio_sparse_read(oid, rados_completion,
+					     &block->m, &block->bl,
+					     p->length, p->offset);
+	  rados_completion->release();
+	  if (r < 0)
+	    ctx->complete(r);
+	}
+      }
+      issued += chunk_len;
     }
-
-    r = handle_sparse_read(ictx->cct, bl, block_ofs, m, total_read, read_len, cb, arg);
-    if (r < 0) {
-      return r;
+    if (in_flight.empty())
+      break;
+
+    // hand back the oldest
+    ReadIterateChunk *chunk = in_flight.front();
+    in_flight.pop_front();
+    map<uint64_t, pair<uint64_t, const char*> > pieces;
+    for (std::list<ReadIterateBlock*>::iterator p = chunk->blocks.begin();
+	 p != chunk->blocks.end(); ++p) {
+      ReadIterateBlock *block = *p;
+      mylock.Lock();
+      while (!block->done)
+	cond.Wait(mylock);
+      mylock.Unlock();
+      blocks_in_flight--;
+      if (ret == 0 && block->r < 0)
+	ret = block->r;
+      if (ret == 0)
+	ret = read_iterate_pieces(block, pieces);
     }
 
-    total_read += r;
-    left -= r;
+    map<uint64_t, pair<uint64_t, const char*> >::iterator q = pieces.begin();
+    while (ret == 0 && q != pieces.end()) {
+      uint64_t piece_ofs = q->first;
+      uint64_t piece_len = q->second.first;
+      const char *data = q->second.second;
+      ++q;
+      // one callback for a run of holes
+      while (!data && q != pieces.end() && !q->second.second) {
+	piece_len += q->second.first;
+	++q;
+      }
+      ldout(cct, 10) << (data ? "copying " : "zeroing ")
+		     << chunk->off + piece_ofs << "~" << piece_len << dendl;
+      r = cb(chunk->off + piece_ofs, piece_len, data, arg);
+      if (r < 0)
+	ret = r;
+    }
+    if (ret == 0)
+      total_read += chunk->len;
+    delete chunk;
   }
-  ret = total_read;
+  if (ret < 0)
+    return ret;
 
-  return ret;
+  return total_read;
 }
 
 static int simple_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
@@ -1390,28 +2697,70 @@ ssize_t write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf)
 
   size_t total_write = 0;
   ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
+  if (ictx->snapid != CEPH_NOSNAP) {
+    ictx->lock.Unlock();
+    return -EROFS;
+  }
+  uint64_t start_object, end_object;
+  ictx->layout.object_range(off, len, &start_object, &end_object);
+  ictx->lock.Unlock();
+  r = ictx->mark_objects_exist(start_object, end_object);
+  if (r < 0)
+    return r;
+  vector<ImageLayout::Extent> extents;
+  ictx->lock.Lock();
+  ictx->layout.map_extents(off, len, extents);
   ictx->lock.Unlock();
-  uint64_t left = len;
 
-  for (uint64_t i = start_block; i <= end_block; i++) {
+  // send each object its part of the write before waiting on any of
+  // them, so a striped write goes to its objects in parallel
+  std::list<librados::AioCompletion*> completions;
+  for (vector<ImageLayout::Extent>::iterator p = extents.begin();
+       p != extents.end(); ++p) {
     bufferlist bl;
+    for (vector<pair<uint64_t,uint64_t> >::iterator q = p->buffer_extents.begin();
+	 q != p->buffer_extents.end(); ++q)
+      bl.append(buf + q->first, q->second);
+    uint64_t write_len = p->length, block_ofs = p->offset;
     ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_write);
+    string oid = get_block_oid(ictx->header, p->objectno);
     ictx->lock.Unlock();
-    uint64_t write_len = min(block_size - block_ofs, left);
-    bl.append(buf + total_write, write_len);
-    r = ictx->data_ctx.write(oid, bl, write_len, block_ofs);
-    if (r < 0)
-      return r;
-    if ((uint64_t)r != write_len)
-      return -EIO;
+    if (ictx->object_cacher) {
+      Mutex mylock("librbd::write::mylock");
+      Cond cond;
+      bool done;
+      Context *onfinish = new C_SafeCond(&mylock, &cond, &done, &r);
+      ictx->write_to_cache(object_t(oid), bl, write_len, block_ofs, onfinish);
+      mylock.Lock();
+      while (!done)
+	cond.Wait(mylock);
+      mylock.Unlock();
+      if (r < 0)
+	return r;
+    } else {
+      librados::AioCompletion *rados_completion =
+	Rados::aio_create_completion(NULL, NULL, NULL);
+      r = ictx->data_ctx.aio_write(oid, rados_completion, bl, write_len,
+				   block_ofs);
+      if (r < 0) {
+	rados_completion->release();
+	break;
+      }
+      completions.push_back(rados_completion);
+    }
     total_write += write_len;
-    left -= write_len;
   }
+
+  for (std::list<librados::AioCompletion*>::iterator it = completions.begin();
+       it != completions.end(); ++it) {
+    (*it)->wait_for_complete();
+    int ret = (*it)->get_return_value();
+    if (r >= 0 && ret < 0)
+      r = ret;
+    (*it)->release();
+  }
+  if (r < 0)
+    return r;
   return total_write;
 }
 
@@ -1476,12 +2825,36 @@ ssize_t handle_sparse_read(CephContext *cct,
   return buf_len;
 }
 
+// copies part of an object extent to where its pieces go in the buffer
+static int scatter_read_cb(uint64_t ofs, size_t len, const char *src, void *arg)
+{
+  AioBlockCompletion *block = (AioBlockCompletion *)arg;
+  uint64_t pos = 0;
+  for (vector<pair<uint64_t,uint64_t> >::iterator p = block->buffer_extents.begin();
+       len && p != block->buffer_extents.end(); pos += p->second, ++p) {
+    if (ofs >= pos + p->second)
+      continue;
+    uint64_t skip = ofs - pos;
+    size_t n = MIN(len, p->second - skip);
+    char *dest = block->buf + p->first + skip;
+    if (src) {
+      memcpy(dest, src, n);
+      src += n;
+    } else {
+      memset(dest, 0, n);
+    }
+    ofs += n;
+    len -= n;
+  }
+  return 0;
+}
+
 void AioBlockCompletion::complete(ssize_t r)
 {
   ldout(cct, 10) << "AioBlockCompletion::complete()" << dendl;
   if ((r >= 0 || r == -ENOENT) && buf) { // this was a sparse_read operation
     ldout(cct, 10) << "ofs=" << ofs << " len=" << len << dendl;
-    r = handle_sparse_read(cct, data_bl, ofs, m, 0, len, simple_read_cb, buf);
+    r = handle_sparse_read(cct, data_bl, ofs, m, 0, len, scatter_read_cb, this);
   }
   completion->complete_block(this, r);
 }
@@ -1522,6 +2895,12 @@ void rados_buffered_cb(rados_completion_t c, void *arg)
   delete bc;
 }
 
+void rados_ctx_cb(rados_completion_t c, void *arg)
+{
+  Context *ctx = (Context *)arg;
+  ctx->complete(rados_aio_get_return_value(c));
+}
+
 int check_io(ImageCtx *ictx, uint64_t off, uint64_t len)
 {
   ictx->lock.Lock();
@@ -1542,7 +2921,10 @@ int flush(ImageCtx *ictx)
   if (r < 0)
     return r;
 
-  // flush any outstanding writes
+  // flush any outstanding writes, starting with those still waiting
+  // on the object map and those in the cache
+  ictx->wait_for_object_map_writes();
+  ictx->flush_cache();
   r = ictx->data_ctx.aio_flush();
 
   // collect any errors from buffered writes
@@ -1550,6 +2932,12 @@ int flush(ImageCtx *ictx)
     r =  ictx->tx_rval;
     ictx->tx_rval = 0;
   }
+  if (ictx->object_cacher) {
+    Mutex::Locker l(ictx->cache_lock);
+    int cache_rval = ictx->writeback_handler->get_write_rval();
+    if (cache_rval < 0)
+      r = cache_rval;
+  }
 
   if (r)
     ldout(cct, 10) << "aio_flush " << ictx << " r = " << r << dendl;
@@ -1570,40 +2958,98 @@ int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
   if (r < 0)
     return r;
 
-  size_t total_write = 0;
   ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
+  if (ictx->snapid != CEPH_NOSNAP) {
+    ictx->lock.Unlock();
+    return -EROFS;
+  }
   ictx->lock.Unlock();
-  uint64_t left = len;
 
   r = check_io(ictx, off, len);
   if (r < 0)
     return r;
 
+  uint64_t start_object, end_object;
+  vector<ImageLayout::Extent> extents;
+  ictx->lock.Lock();
+  ictx->layout.object_range(off, len, &start_object, &end_object);
+  ictx->layout.map_extents(off, len, extents);
+  bool mark = ictx->_object_map_needs_mark(start_object, end_object);
+  bool queue = !ictx->object_cacher &&
+    (mark || !ictx->object_map_writes.empty() || ictx->object_map_sending);
+  ictx->lock.Unlock();
+
+  if (ictx->object_cacher && mark) {
+    // writes into the cache may wait for writeback here anyway, and
+    // can't be made from a librados callback
+    r = ictx->mark_objects_exist(start_object, end_object);
+    if (r < 0)
+      return r;
+    mark = false;
+  }
+
+  // if the map has to be updated first, or an earlier write is still
+  // waiting for that, the data goes out from send_object_map_writes()
+  ObjectMapWrite *w = queue ? new ObjectMapWrite : NULL;
+
   c->get();
-  for (uint64_t i = start_block; i <= end_block; i++) {
+  for (vector<ImageLayout::Extent>::iterator p = extents.begin();
+       p != extents.end(); ++p) {
     AioBlockCompletion *block_completion = new AioBlockCompletion(cct, c, off, len, NULL);
     c->add_block_completion(block_completion);
 
     ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_write);
-    librados::AioCompletion *rados_completion = ictx->get_buffered_tx_completion(len, block_completion);
+    string oid = get_block_oid(ictx->header, p->objectno);
     ictx->lock.Unlock();
 
-    uint64_t write_len = min(block_size - block_ofs, left);
     bufferlist bl;
-    bl.append(buf + total_write, write_len);
-    r = ictx->data_ctx.aio_write(oid, rados_completion, bl, write_len, block_ofs);
-    rados_completion->release();
+    for (vector<pair<uint64_t,uint64_t> >::iterator q = p->buffer_extents.begin();
+	 q != p->buffer_extents.end(); ++q)
+      bl.append(buf + q->first, q->second);
+    if (w) {
+      w->blocks.push_back(ObjectMapWrite::Block());
+      ObjectMapWrite::Block& b = w->blocks.back();
+      b.oid = oid;
+      b.bl.claim(bl);
+      b.ofs = p->offset;
+      b.completion = block_completion;
+      continue;
+    }
+    r = aio_write_block(ictx, oid, bl, p->offset, block_completion);
     if (r < 0)
       goto done;
-    total_write += write_len;
-    left -= write_len;
   }
   r = 0;
+
+  if (w) {
+    ictx->lock.Lock();
+    ictx->object_map_writes.push_back(w);
+    if (mark) {
+      string oid = get_object_map_oid(ictx->header, CEPH_NOSNAP);
+      ldout(cct, 20) << "marking objects " << start_object << "~"
+		     << (end_object - start_object) << " in " << oid << dendl;
+      bufferlist in;
+      __u8 e = true;
+      ::encode(start_object, in);
+      ::encode(end_object, in);
+      ::encode(e, in);
+      C_ObjectMapMarked *ctx = new C_ObjectMapMarked(ictx, w, start_object,
+						     end_object);
+      librados::AioCompletion *rados_completion =
+	Rados::aio_create_completion(ctx, NULL, rados_ctx_cb);
+      r = ictx->md_ctx.aio_exec(oid, rados_completion, "rbd", "objmap_update",
+				in, &ctx->out);
+      rados_completion->release();
+      ictx->lock.Unlock();
+      if (r < 0)
+	ctx->complete(r);
+      r = 0;
+    } else {
+      w->ready = true;
+      ictx->lock.Unlock();
+      ictx->send_object_map_writes();
+    }
+  }
 done:
   c->finish_adding_completions();
   c->put();
@@ -1639,29 +3085,33 @@ int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
 
   int64_t ret;
   int total_read = 0;
+
+  vector<ImageLayout::Extent> extents;
   ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
+  ictx->layout.map_extents(off, len, extents);
   ictx->lock.Unlock();
-  uint64_t left = len;
 
   c->get();
-  for (uint64_t i = start_block; i <= end_block; i++) {
-    bufferlist bl;
+  for (vector<ImageLayout::Extent>::iterator p = extents.begin();
+       p != extents.end(); ++p) {
+    uint64_t read_len = p->length, block_ofs = p->offset;
     ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_read);
+    string oid = get_block_oid(ictx->header, p->objectno);
     ictx->lock.Unlock();
-    uint64_t read_len = min(block_size - block_ofs, left);
-
-    map<uint64_t,uint64_t> m;
-    map<uint64_t,uint64_t>::iterator iter;
 
     AioBlockCompletion *block_completion =
-	new AioBlockCompletion(ictx->cct, c, block_ofs, read_len, buf + total_read);
+	new AioBlockCompletion(ictx->cct, c, block_ofs, read_len, buf);
+    block_completion->buffer_extents.swap(p->buffer_extents);
     c->add_block_completion(block_completion);
 
+    if (ictx->object_cacher) {
+      ictx->aio_read_from_cache(object_t(oid), &block_completion->data_bl,
+				read_len, block_ofs,
+				new C_CacheBlock(block_completion));
+      total_read += read_len;
+      continue;
+    }
+
     librados::AioCompletion *rados_completion =
       Rados::aio_create_completion(block_completion, rados_aio_sparse_read_cb, NULL);
     r = ictx->data_ctx.aio_sparse_read(oid, rados_completion,
@@ -1675,7 +3125,6 @@ int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
       goto done;
     }
     total_read += read_len;
-    left -= read_len;
   }
   ret = total_read;
 done:
@@ -1725,6 +3174,13 @@ int RBD::create(IoCtx& io_ctx, const char *name, uint64_t size, int *order)
   return r;
 }
 
+int RBD::create_striped(IoCtx& io_ctx, const char *name, uint64_t size,
+			int *order, uint64_t stripe_unit, uint64_t stripe_count)
+{
+  return librbd::create_striped(io_ctx, name, size, order,
+				stripe_unit, stripe_count);
+}
+
 int RBD::remove(IoCtx& io_ctx, const char *name)
 {
   librbd::NoOpProgressContext prog_ctx;
@@ -1814,6 +3270,24 @@ int Image::stat(image_info_t& info, size_t infosize)
   return r;
 }
 
+int Image::used_size(uint64_t *used)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::used_size(ictx, used);
+}
+
+int Image::get_stripe_unit(uint64_t *stripe_unit)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::get_stripe_unit(ictx, stripe_unit);
+}
+
+int Image::get_stripe_count(uint64_t *stripe_count)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::get_stripe_count(ictx, stripe_count);
+}
+
 int Image::copy(IoCtx& dest_io_ctx, const char *destname)
 {
   ImageCtx *ictx = (ImageCtx *)ctx;
@@ -1966,6 +3440,16 @@ extern "C" int rbd_create(rados_ioctx_t p, const char *name, uint64_t size, int
   return librbd::create(io_ctx, name, size, order);
 }
 
+extern "C" int rbd_create_striped(rados_ioctx_t p, const char *name,
+				  uint64_t size, int *order,
+				  uint64_t stripe_unit, uint64_t stripe_count)
+{
+  librados::IoCtx io_ctx;
+  librados::IoCtx::from_rados_ioctx_t(p, io_ctx);
+  return librbd::create_striped(io_ctx, name, size, order,
+				stripe_unit, stripe_count);
+}
+
 extern "C" int rbd_remove(rados_ioctx_t p, const char *name)
 {
   librados::IoCtx io_ctx;
@@ -2050,6 +3534,24 @@ extern "C" int rbd_stat(rbd_image_t image, rbd_image_info_t *info, size_t infosi
   return librbd::info(ictx, *info, infosize);
 }
 
+extern "C" int rbd_used_size(rbd_image_t image, uint64_t *used)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::used_size(ictx, used);
+}
+
+extern "C" int rbd_get_stripe_unit(rbd_image_t image, uint64_t *stripe_unit)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::get_stripe_unit(ictx, stripe_unit);
+}
+
+extern "C" int rbd_get_stripe_count(rbd_image_t image, uint64_t *stripe_count)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::get_stripe_count(ictx, stripe_count);
+}
+
 /* snapshots */
 extern "C" int rbd_snap_create(rbd_image_t image, const char *snap_name)
 {
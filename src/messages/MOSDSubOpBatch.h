@@ -0,0 +1,58 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MOSDSUBOPBATCH_H
+#define CEPH_MOSDSUBOPBATCH_H
+
+#include "msg/Message.h"
+
+/*
+ * A run of MOSDSubOp/MOSDSubOpReply messages bound for the same osd,
+ * sent as one.  The receiver dispatches them in order, exactly as if
+ * they had arrived one by one on this connection.
+ */
+class MOSDSubOpBatch : public Message {
+public:
+  list<Message*> msgs;
+
+  MOSDSubOpBatch() : Message(MSG_OSD_SUBOP_BATCH) {}
+private:
+  ~MOSDSubOpBatch() {
+    for (list<Message*>::iterator p = msgs.begin(); p != msgs.end(); ++p)
+      (*p)->put();
+  }
+
+public:
+  void encode_payload(uint64_t features) {
+    __u32 n = msgs.size();
+    ::encode(n, payload);
+    for (list<Message*>::iterator p = msgs.begin(); p != msgs.end(); ++p)
+      encode_message(*p, features, payload);
+  }
+  void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    __u32 n;
+    ::decode(n, p);
+    while (n--) {
+      Message *m = decode_message(NULL, p);
+      assert(m);
+      msgs.push_back(m);
+    }
+  }
+
+  const char *get_type_name() const { return "osd_sub_op_batch"; }
+  void print(ostream& out) const {
+    out << "osd_sub_op_batch(" << msgs.size() << " msgs)";
+  }
+};
+
+#endif
@@ -18,10 +18,15 @@
 #include "osd/osd_types.h"
 
 class MPGStatsAck : public Message {
+  static const int HEAD_VERSION = 2;
+  static const int COMPAT_VERSION = 1;
 public:
   map<pg_t,eversion_t> pg_stat;
   
-  MPGStatsAck() : Message(MSG_PGSTATSACK) {}
+  MPGStatsAck() : Message(MSG_PGSTATSACK, HEAD_VERSION, COMPAT_VERSION) {}
+
+  /// the sender understands MPGStats::pg_stat_delta
+  bool accepts_delta() const { return header.version >= 2; }
 
 private:
   ~MPGStatsAck() {}
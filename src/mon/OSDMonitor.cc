@@ -62,6 +62,9 @@ OSDMonitor::OSDMonitor(Monitor *mn, Paxos *p)
 {
   // we need to trim this too
   p->add_extra_state_dir("osdmap_full");
+
+  if (g_conf->osd_map_pg_mapping)
+    osdmap.enable_pg_mapping(g_conf->osd_map_pg_mapping_threads);
 }
 
 
@@ -854,7 +857,9 @@ bool OSDMonitor::prepare_remove_snaps(MRemoveSnaps *m)
   for (map<int, vector<snapid_t> >::iterator p = m->snaps.begin(); 
        p != m->snaps.end();
        p++) {
-    pg_pool_t& pi = osdmap.pools[p->first];
+    if (!osdmap.have_pg_pool(p->first))
+      continue;
+    const pg_pool_t& pi = *osdmap.get_pg_pool(p->first);
     for (vector<snapid_t>::iterator q = p->second.begin();
 	 q != p->second.end();
 	 q++) {
@@ -1328,7 +1333,7 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	  ss << "got osdmap epoch " << p->get_epoch();
 	  r = 0;
 	} else if (cmd == "getcrushmap") {
-	  p->crush.encode(rdata);
+	  p->crush->encode(rdata);
 	  ss << "got crush map from osdmap epoch " << p->get_epoch();
 	  r = 0;
 	}
@@ -1406,8 +1411,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
       if (m->cmd.size() > 2) {
 	uid_pools = strtol(m->cmd[2].c_str(), NULL, 10);
       }
-      for (map<int64_t, pg_pool_t>::iterator p = osdmap.pools.begin();
-	   p != osdmap.pools.end();
+      for (map<int64_t, pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	   p != osdmap.get_pools().end();
 	   ++p) {
 	if (!uid_pools || p->second.auid == uid_pools) {
 	  ss << p->first << ' ' << osdmap.pool_name[p->first] << ',';
@@ -1560,7 +1565,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	if (pending_inc.crush.length())
 	  bl = pending_inc.crush;
 	else
-	  osdmap.crush.encode(bl);
+	  osdmap.crush->encode(bl);
 
 	CrushWrapper newcrush;
 	bufferlist::iterator p = bl.begin();
@@ -1591,7 +1596,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	if (pending_inc.crush.length())
 	  bl = pending_inc.crush;
 	else
-	  osdmap.crush.encode(bl);
+	  osdmap.crush->encode(bl);
 
 	CrushWrapper newcrush;
 	bufferlist::iterator p = bl.begin();
@@ -1620,7 +1625,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	if (pending_inc.crush.length())
 	  bl = pending_inc.crush;
 	else
-	  osdmap.crush.encode(bl);
+	  osdmap.crush->encode(bl);
 
 	CrushWrapper newcrush;
 	bufferlist::iterator p = bl.begin();
@@ -1647,10 +1652,10 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
     }
     else if (m->cmd[1] == "setmaxosd" && m->cmd.size() > 2) {
       int newmax = atoi(m->cmd[2].c_str());
-      if (newmax < osdmap.crush.get_max_devices()) {
+      if (newmax < osdmap.crush->get_max_devices()) {
 	err = -ERANGE;
 	ss << "cannot set max_osd to " << newmax << " which is < crush max_devices "
-	   << osdmap.crush.get_max_devices();
+	   << osdmap.crush->get_max_devices();
 	goto out;
       }
 
@@ -2079,7 +2084,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 		return true;
 	      }
 	    } else if (m->cmd[4] == "crush_ruleset") {
-	      if (osdmap.crush.rule_exists(n)) {
+	      if (osdmap.crush->rule_exists(n)) {
 		if (pending_inc.new_pools.count(pool) == 0)
 		  pending_inc.new_pools[pool] = *p;
 		pending_inc.new_pools[pool].crush_ruleset = n;
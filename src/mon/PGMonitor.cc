@@ -483,6 +483,38 @@ bool PGMonitor::pg_stats_have_changed(int from, const MPGStats *stats) const
   return false;
 }
 
+/*
+ * Turn each delta into a full pg_stat_t against the latest stats we
+ * have for the pg.  A delta whose base isn't what we have is dropped;
+ * it is left out of the ack, and the osd falls back to sending that
+ * pg in full.
+ */
+void PGMonitor::apply_pg_stat_deltas(MPGStats *stats) const
+{
+  for (map<pg_t,pg_stat_delta_t>::const_iterator p = stats->pg_stat_delta.begin();
+       p != stats->pg_stat_delta.end();
+       ++p) {
+    const pg_stat_t *cur = NULL;
+    map<pg_t,pg_stat_t>::const_iterator q = pending_inc.pg_stat_updates.find(p->first);
+    if (q != pending_inc.pg_stat_updates.end()) {
+      cur = &q->second;
+    } else {
+      hash_map<pg_t,pg_stat_t>::const_iterator t = pg_map.pg_stat.find(p->first);
+      if (t != pg_map.pg_stat.end())
+	cur = &t->second;
+    }
+    if (!cur || cur->reported != p->second.base) {
+      dout(15) << " dropping delta for " << p->first << " on " << p->second.base
+	       << ", have " << (cur ? cur->reported : eversion_t()) << dendl;
+      continue;
+    }
+    pg_stat_t s = *cur;
+    p->second.apply(s);
+    stats->pg_stat[p->first] = s;
+  }
+  stats->pg_stat_delta.clear();
+}
+
 bool PGMonitor::prepare_pg_stats(MPGStats *stats) 
 {
   dout(10) << "prepare_pg_stats " << *stats << " from " << stats->get_orig_source() << dendl;
@@ -504,9 +536,12 @@ bool PGMonitor::prepare_pg_stats(MPGStats *stats)
     return false;
   }
       
+  apply_pg_stat_deltas(stats);
+
   if (!pg_stats_have_changed(from, stats)) {
     dout(10) << " message contains no new osd|pg stats" << dendl;
     MPGStatsAck *ack = new MPGStatsAck;
+    ack->set_tid(stats->get_tid());
     for (map<pg_t,pg_stat_t>::const_iterator p = stats->pg_stat.begin();
 	 p != stats->pg_stat.end();
 	 ++p) {
@@ -675,7 +710,7 @@ void PGMonitor::check_osd_map(epoch_t epoch)
   send_pg_creates();
 }
 
-void PGMonitor::register_pg(pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool)
+void PGMonitor::register_pg(const pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool)
 {
   pg_t parent;
   int split_bits = 0;
@@ -722,13 +757,13 @@ bool PGMonitor::register_new_pgs()
   OSDMap *osdmap = &mon->osdmon()->osdmap;
 
   int created = 0;
-  for (map<int64_t,pg_pool_t>::iterator p = osdmap->pools.begin();
-       p != osdmap->pools.end();
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap->get_pools().begin();
+       p != osdmap->get_pools().end();
        p++) {
     int64_t poolid = p->first;
-    pg_pool_t &pool = p->second;
+    const pg_pool_t &pool = p->second;
     int ruleno = pool.get_crush_ruleset();
-    if (!osdmap->crush.rule_exists(ruleno)) 
+    if (!osdmap->crush->rule_exists(ruleno)) 
       continue;
 
     if (pool.get_last_change() <= pg_map.last_pg_scan ||
@@ -764,7 +799,7 @@ bool PGMonitor::register_new_pgs()
     }
   }
 
-  int max = MIN(osdmap->get_max_osd(), osdmap->crush.get_max_devices());
+  int max = MIN(osdmap->get_max_osd(), osdmap->crush->get_max_devices());
   int removed = 0;
   for (set<pg_t>::iterator p = pg_map.creating_pgs.begin();
        p != pg_map.creating_pgs.end();
@@ -809,7 +844,7 @@ void PGMonitor::send_pg_creates()
   utime_t now = ceph_clock_now(g_ceph_context);
   
   OSDMap *osdmap = &mon->osdmon()->osdmap;
-  int max = MIN(osdmap->get_max_osd(), osdmap->crush.get_max_devices());
+  int max = MIN(osdmap->get_max_osd(), osdmap->crush->get_max_devices());
 
   for (set<pg_t>::iterator p = pg_map.creating_pgs.begin();
        p != pg_map.creating_pgs.end();
@@ -65,6 +65,7 @@ private:
 
   bool preprocess_pg_stats(MPGStats *stats);
   bool pg_stats_have_changed(int from, const MPGStats *stats) const;
+  void apply_pg_stat_deltas(MPGStats *stats) const;
   bool prepare_pg_stats(MPGStats *stats);
   void _updated_stats(MPGStats *req, MPGStatsAck *ack);
 
@@ -92,7 +93,7 @@ private:
   // when we last received PG stats from each osd
   map<int,utime_t> last_osd_report;
 
-  void register_pg(pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool);
+  void register_pg(const pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool);
 
   /**
    * check latest osdmap for new pgs to register
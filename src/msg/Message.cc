@@ -58,6 +58,7 @@ using namespace std;
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
+#include "messages/MOSDSubOpBatch.h"
 #include "messages/MOSDMap.h"
 
 #include "messages/MOSDPGNotify.h"
@@ -416,6 +417,9 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
   case MSG_OSD_PG_BACKFILL:
     m = new MOSDPGBackfill;
     break;
+  case MSG_OSD_SUBOP_BATCH:
+    m = new MOSDSubOpBatch;
+    break;
    // auth
   case CEPH_MSG_AUTH:
     m = new MAuth;
@@ -29,6 +29,7 @@ const string DBObjectMap::SYS_PREFIX = "_SYS_";
 const string DBObjectMap::COMPLETE_PREFIX = "_COMPLETE_";
 const string DBObjectMap::HEADER_KEY = "HEADER";
 const string DBObjectMap::USER_HEADER_KEY = "USER_HEADER";
+const string DBObjectMap::INLINE_DATA_KEY = "INLINE_DATA";
 const string DBObjectMap::LEAF_PREFIX = "_LEAF_";
 const string DBObjectMap::GLOBAL_STATE_KEY = "HEADER";
 const string DBObjectMap::REVERSE_LEAF_PREFIX = "_REVLEAF_";
@@ -419,13 +420,19 @@ int DBObjectMap::get_header(const hobject_t &hoid,
 
 int DBObjectMap::_get_header(Header header,
 			     bufferlist *bl)
+{
+  return _get_sys_key(header, USER_HEADER_KEY, bl);
+}
+
+int DBObjectMap::_get_sys_key(Header header, const string &key,
+			      bufferlist *bl)
 {
   int r = 0;
   map<string, bufferlist> out;
   while (r == 0) {
     out.clear();
     set<string> to_get;
-    to_get.insert(USER_HEADER_KEY);
+    to_get.insert(key);
     int r = db->get(sys_prefix(header), to_get, &out);
     if (r == 0 && out.size())
       break;
@@ -442,6 +449,45 @@ int DBObjectMap::_get_header(Header header,
   return 0;
 }
 
+int DBObjectMap::get_inline_data(const hobject_t &hoid,
+				 CollectionIndex::IndexedPath path,
+				 bufferlist *bl)
+{
+  Header header = lookup_map_header(path->coll(), hoid);
+  if (!header)
+    return 0;
+  return _get_sys_key(header, INLINE_DATA_KEY, bl);
+}
+
+int DBObjectMap::set_inline_data(const hobject_t &hoid,
+				 CollectionIndex::IndexedPath path,
+				 const bufferlist &bl)
+{
+  KeyValueDB::Transaction t = db->get_transaction();
+  Header header;
+  if (bl.length()) {
+    header = lookup_create_map_header(path->coll(), hoid, t);
+  } else {
+    header = lookup_map_header(path->coll(), hoid);
+    if (!header)
+      return 0;
+  }
+  if (!header)
+    return -EINVAL;
+
+  if (!bl.length() && !header->parent) {
+    set<string> to_rm;
+    to_rm.insert(INLINE_DATA_KEY);
+    t->rmkeys(sys_prefix(header), to_rm);
+  } else {
+    // an empty value hides whatever a clone parent still holds
+    map<string, bufferlist> to_set;
+    to_set[INLINE_DATA_KEY] = bl;
+    t->set(sys_prefix(header), to_set);
+  }
+  return db->submit_transaction(t);
+}
+
 int DBObjectMap::clear(const hobject_t &hoid,
 		       CollectionIndex::IndexedPath path)
 {
@@ -542,6 +588,16 @@ int DBObjectMap::copy_up_header(Header header,
     return r;
 
   _set_header(header, bl, t);
+
+  bufferlist data;
+  r = _get_sys_key(header, INLINE_DATA_KEY, &data);
+  if (r < 0)
+    return r;
+  if (data.length()) {
+    map<string, bufferlist> to_set;
+    to_set[INLINE_DATA_KEY].claim(data);
+    t->set(sys_prefix(header), to_set);
+  }
   return 0;
 }
 
@@ -42,6 +42,8 @@
  * - USER_PREFIX + header_key(header->seq) + COMPLETE_PREFIX: see below
  * - USER_PREFIX + header_key(header->seq) + SYS_PREFIX
  *              : USER_HEADER_KEY - omap header for header->seq
+ *              : INLINE_DATA_KEY - object data stored inline for header->seq
+ *                                  (an empty value masks the parent's)
  *              : HEADER_KEY - encoding of header for header->seq
  *
  * For each node (represented by a header, not counting LEAF_PREFIX space), we
@@ -149,6 +151,18 @@ public:
     CollectionIndex::IndexedPath target_path
     );
 
+  int get_inline_data(
+    const hobject_t &hoid,
+    CollectionIndex::IndexedPath path,
+    bufferlist *bl
+    );
+
+  int set_inline_data(
+    const hobject_t &hoid,
+    CollectionIndex::IndexedPath path,
+    const bufferlist &bl
+    );
+
   /// Read initial state from backing store
   int init();
 
@@ -163,6 +177,7 @@ public:
   static const string COMPLETE_PREFIX;
   static const string HEADER_KEY;
   static const string USER_HEADER_KEY;
+  static const string INLINE_DATA_KEY;
   static const string LEAF_PREFIX;
   static const string GLOBAL_STATE_KEY;
   static const string REVERSE_LEAF_PREFIX;
@@ -367,6 +382,9 @@ private:
   /// Helpers
   int _get_header(Header header, bufferlist *bl);
 
+  /// Get sys key for header, falling back to its ancestors
+  int _get_sys_key(Header header, const string &key, bufferlist *bl);
+
   /// Scan keys in header into out_keys and out_values (if nonnull)
   int scan(Header header,
 	   const set<string> &in_keys,
@@ -388,7 +406,7 @@ private:
   /// 0 if the complete set now contains all of key space, < 0 on error, 1 else
   int need_parent(DBObjectMapIterator iter);
 
-  /// Copies header entry from parent @see rm_keys
+  /// Copies header and inline data entries from parent @see rm_keys
   int copy_up_header(Header header,
 		     KeyValueDB::Transaction t);
 
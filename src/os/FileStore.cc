@@ -669,6 +669,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev) :
   m_filestore_journal_writeahead(g_conf->filestore_journal_writeahead),
   m_filestore_dev(g_conf->filestore_dev),
   m_filestore_fiemap_threshold(g_conf->filestore_fiemap_threshold),
+  m_filestore_inline_max_bytes(g_conf->filestore_inline_max_bytes),
+  m_inline_used(false),
   m_filestore_sync_flush(g_conf->filestore_sync_flush),
   m_filestore_flusher_max_fds(g_conf->filestore_flusher_max_fds),
   m_filestore_max_sync_interval(g_conf->filestore_max_sync_interval),
@@ -718,6 +720,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev) :
   plb.add_fl_avg(l_os_commit_len, "commitcycle_interval");
   plb.add_fl_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
+  plb.add_u64_counter(l_os_inline_writes, "inline_writes");
+  plb.add_u64_counter(l_os_inline_promotions, "inline_promotions");
 
   logger = plb.create_perf_counters();
 }
@@ -1762,6 +1766,29 @@ int FileStore::mount()
     object_map.reset(dbomap);
   }
 
+  {
+    // once any object has been kept inline we have to keep looking for
+    // inline data, even with the option turned off; until then, empty
+    // files are just empty.
+    char inlinefn[PATH_MAX];
+    snprintf(inlinefn, sizeof(inlinefn), "%s/inline_data", current_fn.c_str());
+    if (m_filestore_inline_max_bytes) {
+      int fd = ::creat(inlinefn, 0644);
+      if (fd < 0) {
+	ret = -errno;
+	derr << "FileStore::mount: failed to create current/inline_data: "
+	     << cpp_strerror(ret) << dendl;
+	goto close_current_fd;
+      }
+      TEMP_FAILURE_RETRY(::close(fd));
+      ::fsync(current_fd);
+      m_inline_used = true;
+    } else {
+      struct stat st;
+      m_inline_used = (::stat(inlinefn, &st) == 0);
+    }
+  }
+
   // journal
   open_journal();
 
@@ -2637,7 +2664,7 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq)
 bool FileStore::exists(coll_t cid, const hobject_t& oid)
 {
   struct stat st;
-  if (stat(cid, oid, &st) == 0)
+  if (lfn_stat(cid, oid, &st) == 0)
     return true;
   else 
     return false;
@@ -2645,7 +2672,19 @@ bool FileStore::exists(coll_t cid, const hobject_t& oid)
   
 int FileStore::stat(coll_t cid, const hobject_t& oid, struct stat *st)
 {
-  int r = lfn_stat(cid, oid, st);
+  IndexedPath path;
+  int r = lfn_find(cid, oid, &path);
+  if (r == 0) {
+    r = ::stat(path->path(), st);
+    if (r < 0)
+      r = -errno;
+  }
+  if (r == 0 && st->st_size == 0 && m_inline_used) {
+    // an empty file may have its data inline
+    bufferlist data;
+    r = object_map->get_inline_data(oid, path, &data);
+    st->st_size = data.length();
+  }
   dout(10) << "stat " << cid << "/" << oid << " = " << r << " (size " << st->st_size << ")" << dendl;
   return r;
 }
@@ -2657,12 +2696,14 @@ int FileStore::read(coll_t cid, const hobject_t& oid,
 
   dout(15) << "read " << cid << "/" << oid << " " << offset << "~" << len << dendl;
 
-  int fd = lfn_open(cid, oid, O_RDONLY);
+  IndexedPath path;
+  int fd = lfn_open(cid, oid, O_RDONLY, 0, &path);
   if (fd < 0) {
     dout(10) << "FileStore::read(" << cid << "/" << oid << ") open error: " << cpp_strerror(fd) << dendl;
     return fd;
   }
 
+  size_t want = len;
   if (len == 0) {
     struct stat st;
     memset(&st, 0, sizeof(struct stat));
@@ -2677,6 +2718,26 @@ int FileStore::read(coll_t cid, const hobject_t& oid,
     TEMP_FAILURE_RETRY(::close(fd));
     return got;
   }
+  if (got == 0) {
+    bufferlist data;
+    int r = _inline_get(oid, path, fd, &data);
+    if (r < 0) {
+      TEMP_FAILURE_RETRY(::close(fd));
+      return r;
+    }
+    if (data.length() > offset) {
+      got = data.length() - offset;
+      if (want && want < (size_t)got)
+	got = want;
+      bufferlist sub;
+      sub.substr_of(data, offset, got);
+      bl.claim_append(sub);
+      TEMP_FAILURE_RETRY(::close(fd));
+      dout(10) << "FileStore::read " << cid << "/" << oid << " " << offset << "~"
+	       << got << "/" << want << " (inline)" << dendl;
+      return got;
+    }
+  }
   bptr.set_length(got);   // properly size the buffer
   bl.push_back(bptr);   // put it in the target bufferlist
   TEMP_FAILURE_RETRY(::close(fd));
@@ -2704,7 +2765,8 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
   dout(15) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << dendl;
 
   int r;
-  int fd = lfn_open(cid, oid, O_RDONLY);
+  IndexedPath path;
+  int fd = lfn_open(cid, oid, O_RDONLY, 0, &path);
   if (fd < 0) {
     r = fd;
     dout(10) << "read couldn't open " << cid << "/" << oid << ": " << cpp_strerror(r) << dendl;
@@ -2715,8 +2777,13 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
     if (r < 0)
       goto done;
 
-    if (fiemap->fm_mapped_extents == 0)
+    if (fiemap->fm_mapped_extents == 0) {
+      bufferlist data;
+      r = _inline_get(oid, path, fd, &data);
+      if (r >= 0 && data.length() > offset)
+	exomap[offset] = MIN(len, data.length() - offset);
       goto done;
+    }
 
     struct fiemap_extent *extent = &fiemap->fm_extents[0];
 
@@ -2775,7 +2842,44 @@ int FileStore::_remove(coll_t cid, const hobject_t& oid)
 int FileStore::_truncate(coll_t cid, const hobject_t& oid, uint64_t size)
 {
   dout(15) << "truncate " << cid << "/" << oid << " size " << size << dendl;
-  int r = lfn_truncate(cid, oid, size);
+  IndexedPath path;
+  bufferlist data;
+  int r;
+  int fd = lfn_open(cid, oid, O_WRONLY, 0, &path);
+  if (fd < 0) {
+    r = fd;
+    goto out;
+  }
+
+  r = _inline_get(oid, path, fd, &data);
+  if (r >= 0 && data.length()) {
+    if (size <= m_filestore_inline_max_bytes) {
+      if (size < data.length()) {
+	bufferlist head;
+	head.substr_of(data, 0, size);
+	data.swap(head);
+      } else {
+	data.append_zero(size - data.length());
+      }
+      r = object_map->set_inline_data(oid, path, data);
+      goto out_close;
+    }
+    r = _inline_promote(oid, path, fd, data);
+  }
+  if (r >= 0) {
+    r = ::ftruncate(fd, size);
+    if (r < 0)
+      r = -errno;
+  }
+  if (r >= 0 && size == 0 && m_inline_used) {
+    // drop anything left behind by an interrupted promotion
+    r = object_map->set_inline_data(oid, path, bufferlist());
+    if (r == -EOPNOTSUPP)
+      r = 0;
+  }
+ out_close:
+  TEMP_FAILURE_RETRY(::close(fd));
+ out:
   dout(10) << "truncate " << cid << "/" << oid << " size " << size << " = " << r << dendl;
   return r;
 }
@@ -2807,13 +2911,23 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
   int64_t actual;
 
   int flags = O_WRONLY|O_CREAT;
-  int fd = lfn_open(cid, oid, flags, 0644);
+  IndexedPath path;
+  int fd = lfn_open(cid, oid, flags, 0644, &path);
   if (fd < 0) {
     r = fd;
     dout(0) << "write couldn't open " << cid << "/" << oid << " flags " << flags << ": "
 	    << cpp_strerror(r) << dendl;
     goto out;
   }
+
+  // inline?
+  r = _inline_write(oid, path, fd, offset, bl);
+  if (r != 0) {
+    TEMP_FAILURE_RETRY(::close(fd));
+    if (r > 0)
+      r = bl.length();
+    goto out;
+  }
     
   // seek
   actual = ::lseek64(fd, offset, SEEK_SET);
@@ -3031,17 +3145,36 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
 
   int r;
   int o, n;
-  o = lfn_open(cid, oldoid, O_RDONLY);
+  IndexedPath from, to;
+  bufferlist data;
+  o = lfn_open(cid, oldoid, O_RDONLY, 0, &from);
   if (o < 0) {
     r = o;
     goto out2;
   }
-  n = lfn_open(cid, newoid, O_CREAT|O_WRONLY, 0644);
+  r = _inline_get(oldoid, from, o, &data);
+  if (r < 0)
+    goto out;
+  if (data.length()) {
+    // source is inline; this is just a (small) write.  whatever of the
+    // range lies past the source's end reads back as zeros.
+    bufferlist bl;
+    if (srcoff < data.length())
+      bl.substr_of(data, srcoff, MIN(len, data.length() - srcoff));
+    bl.append_zero(len - bl.length());
+    r = _write(cid, newoid, dstoff, len, bl);
+    goto out;
+  }
+  n = lfn_open(cid, newoid, O_CREAT|O_WRONLY, 0644, &to);
   if (n < 0) {
     r = n;
     goto out;
   }
-  r = _do_clone_range(o, n, srcoff, len, dstoff);
+  r = _inline_get(newoid, to, n, &data);
+  if (r >= 0 && data.length())
+    r = _inline_promote(newoid, to, n, data);
+  if (r >= 0)
+    r = _do_clone_range(o, n, srcoff, len, dstoff);
   TEMP_FAILURE_RETRY(::close(n));
  out:
   TEMP_FAILURE_RETRY(::close(o));
@@ -3051,6 +3184,101 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
   return r;
 }
 
+/*
+ * Objects no larger than filestore_inline_max_bytes keep their data in
+ * the object map instead of their file, which stays empty and still
+ * carries the name, xattrs and collection links.  An object's inline
+ * data only counts while its file is empty; once it grows past the
+ * limit the data is written to the file and the inline copy dropped.
+ */
+int FileStore::_inline_get(const hobject_t& oid, IndexedPath path, int fd,
+			   bufferlist *data)
+{
+  if (!m_inline_used)
+    return 0;
+  struct stat st;
+  int r = ::fstat(fd, &st);
+  if (r < 0)
+    return -errno;
+  if (st.st_size)
+    return 0;
+  return object_map->get_inline_data(oid, path, data);
+}
+
+int FileStore::_inline_promote(const hobject_t& oid, IndexedPath path, int fd,
+			       bufferlist& data)
+{
+  dout(15) << "inline_promote " << oid << " " << data.length() << " bytes" << dendl;
+  int r = safe_pwrite(fd, data.c_str(), data.length(), 0);
+  if (r < 0)
+    return r;
+  // the inline copy goes to leveldb on its own schedule, so the file
+  // has to be stable before we drop it.  if we crash in between, the
+  // file is non-empty and the stale inline copy is ignored (and cleared
+  // by the next truncate to 0); replaying the op finds the file already
+  // holding the data and doesn't promote again.
+  r = ::fdatasync(fd);
+  if (r < 0)
+    return -errno;
+  logger->inc(l_os_inline_promotions);
+  return object_map->set_inline_data(oid, path, bufferlist());
+}
+
+/// @return 1 if the write was applied inline, 0 if it belongs in the file
+int FileStore::_inline_write(const hobject_t& oid, IndexedPath path, int fd,
+			     uint64_t offset, const bufferlist& bl)
+{
+  // a non-empty file holds the data (promoted, or written before
+  // inlining was enabled), so writes to it go to the file
+  struct stat st;
+  int r = ::fstat(fd, &st);
+  if (r < 0)
+    return -errno;
+  if (st.st_size)
+    return 0;
+
+  bufferlist data;
+  r = _inline_get(oid, path, fd, &data);
+  if (r < 0)
+    return r;
+  uint64_t end = MAX((uint64_t)data.length(), offset + bl.length());
+  if (!data.length() && !m_filestore_inline_max_bytes)
+    return 0;
+
+  if (end <= m_filestore_inline_max_bytes) {
+    bufferlist n;
+    if (offset > data.length()) {
+      n.claim_append(data);
+      n.append_zero(offset - n.length());
+    } else if (offset) {
+      n.substr_of(data, 0, offset);
+    }
+    n.append(bl);
+    if (offset + bl.length() < data.length()) {
+      bufferlist tail;
+      tail.substr_of(data, offset + bl.length(),
+		     data.length() - offset - bl.length());
+      n.claim_append(tail);
+    }
+    r = object_map->set_inline_data(oid, path, n);
+    if (r == -EOPNOTSUPP)
+      return 0;
+    if (r < 0)
+      return r;
+    dout(20) << "inline_write " << oid << " " << offset << "~" << bl.length()
+	     << ", now " << n.length() << " bytes" << dendl;
+    logger->inc(l_os_inline_writes);
+    return 1;
+  }
+
+  if (data.length()) {
+    r = _inline_promote(oid, path, fd, data);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
 
 bool FileStore::queue_flusher(int fd, uint64_t off, uint64_t len)
 {
@@ -4102,7 +4330,17 @@ int FileStore::_omap_clear(coll_t cid, const hobject_t &hoid) {
   int r = lfn_find(cid, hoid, &path);
   if (r < 0)
     return r;
-  return object_map->clear(hoid, path);
+  // keep the object's inline data, if any
+  bufferlist data;
+  if (m_inline_used) {
+    r = object_map->get_inline_data(hoid, path, &data);
+    if (r < 0)
+      return r;
+  }
+  r = object_map->clear(hoid, path);
+  if (r < 0 || !data.length())
+    return r;
+  return object_map->set_inline_data(hoid, path, data);
 }
 int FileStore::_omap_setkeys(coll_t cid, const hobject_t &hoid,
 			     const map<string, bufferlist> &aset) {
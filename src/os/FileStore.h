@@ -327,6 +327,14 @@ public:
   int _do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff);
   int _remove(coll_t cid, const hobject_t& oid);
 
+  // inline objects
+  int _inline_write(const hobject_t& oid, IndexedPath path, int fd,
+		    uint64_t offset, const bufferlist& bl);
+  int _inline_promote(const hobject_t& oid, IndexedPath path, int fd,
+		      bufferlist& data);
+  int _inline_get(const hobject_t& oid, IndexedPath path, int fd,
+		  bufferlist *data);
+
   void _start_sync();
 
   void start_sync();
@@ -421,6 +429,8 @@ private:
   bool m_filestore_journal_writeahead;
   std::string m_filestore_dev;
   int m_filestore_fiemap_threshold;
+  uint64_t m_filestore_inline_max_bytes;
+  bool m_inline_used;  // some object may have its data inline
   bool m_filestore_sync_flush;
   int m_filestore_flusher_max_fds;
   double m_filestore_max_sync_interval;
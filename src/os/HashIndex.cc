@@ -24,6 +24,14 @@
 const string HashIndex::SUBDIR_ATTR = "contents";
 const string HashIndex::IN_PROGRESS_OP_TAG = "in_progress_op";
 
+Mutex HashIndex::contents_lock("HashIndex::contents_lock", false, false);
+map<string, HashIndex::CachedContents> HashIndex::contents_cache;
+list<string> HashIndex::contents_lru;
+uint64_t HashIndex::contents_cached_objs = 0;
+uint64_t HashIndex::contents_seq = 0;
+map<string, uint64_t> HashIndex::contents_changed;
+uint64_t HashIndex::contents_changed_floor = 0;
+
 int HashIndex::cleanup() {
   bufferlist bl;
   int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
@@ -48,6 +56,7 @@ int HashIndex::cleanup() {
 int HashIndex::_init() {
   subdir_info_s info;
   vector<string> path;
+  invalidate_all_dir_contents();
   return set_info(path, info);
 }
 
@@ -57,6 +66,7 @@ int HashIndex::_created(const vector<string> &path,
 			const string &mangled_name) {
   subdir_info_s info;
   int r;
+  invalidate_dir_contents(path);
   r = get_info(path, &info);
   if (r < 0)
     return r;
@@ -80,6 +90,7 @@ int HashIndex::_remove(const vector<string> &path,
 		       const string &mangled_name) {
   int r;
   r = remove_object(path, hoid);
+  invalidate_dir_contents(path);
   if (r < 0)
     return r;
   subdir_info_s info;
@@ -195,6 +206,7 @@ int HashIndex::initiate_merge(const vector<string> &path, subdir_info_s info) {
 }
 
 int HashIndex::complete_merge(const vector<string> &path, subdir_info_s info) {
+  invalidate_all_dir_contents();
   vector<string> dst = path;
   dst.pop_back();
   subdir_info_s dstinfo;
@@ -247,6 +259,7 @@ int HashIndex::initiate_split(const vector<string> &path, subdir_info_s info) {
 }
 
 int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
+  invalidate_all_dir_contents();
   int level = info.hash_level;
   map<string, hobject_t> objects;
   vector<string> dst = path;
@@ -386,54 +399,119 @@ uint32_t HashIndex::hash_prefix_to_hash(string prefix) {
   return hash;
 }
 
-int HashIndex::get_path_contents_by_hash(const vector<string> &path,
-					 const string *lower_bound,
-					 const hobject_t *next_object,
-					 const snapid_t *seq,
-					 set<string> *hash_prefixes,
-					 multimap<string, hobject_t> *objects) {
-  set<string> subdirs;
-  map<string, hobject_t> rev_objects;
-  int r;
-  string cur_prefix;
-  for (vector<string>::const_iterator i = path.begin();
-       i != path.end();
-       ++i) {
-    cur_prefix.append(*i);
+uint64_t HashIndex::last_change(const string &key, const string &base) {
+  assert(contents_lock.is_locked());
+  uint64_t seq = contents_changed_floor;
+  map<string, uint64_t>::iterator i = contents_changed.find(key);
+  if (i != contents_changed.end())
+    seq = MAX(seq, i->second);
+  i = contents_changed.find(base);
+  if (i != contents_changed.end())
+    seq = MAX(seq, i->second);
+  return seq;
+}
+
+void HashIndex::note_change(const string &key) {
+  assert(contents_lock.is_locked());
+  contents_changed[key] = ++contents_seq;
+  // forget old changes once there are many; everything not listed
+  // then counts as changed now, which only costs a relisting
+  if (contents_changed.size() > MAX(1024u, 2 * contents_cache.size())) {
+    contents_changed.clear();
+    contents_changed_floor = contents_seq;
   }
-  r = list_objects(path, 0, 0, &rev_objects);
-  if (r < 0)
-    return r;
-  for (map<string, hobject_t>::iterator i = rev_objects.begin();
-       i != rev_objects.end();
-       ++i) {
-    string hash_prefix = get_path_str(i->second);
-    if (lower_bound && hash_prefix < *lower_bound)
-      continue;
-    if (next_object && i->second < *next_object)
-      continue;
-    if (seq && i->second.snap < *seq)
-      continue;
-    hash_prefixes->insert(hash_prefix);
-    objects->insert(pair<string, hobject_t>(hash_prefix, i->second));
+  map<string, CachedContents>::iterator i = contents_cache.find(key);
+  if (i == contents_cache.end())
+    return;
+  contents_cached_objs -= i->second.contents->objects.size();
+  contents_lru.erase(i->second.lru);
+  contents_cache.erase(i);
+}
+
+int HashIndex::get_dir_contents(const vector<string> &path,
+				DirContentsRef *contents) {
+  string key = get_full_path_subdir(path);
+  const string &base = get_base_path();
+  uint64_t seq;
+  {
+    Mutex::Locker l(contents_lock);
+    map<string, CachedContents>::iterator i = contents_cache.find(key);
+    if (i != contents_cache.end() &&
+	i->second.seq >= last_change(key, base)) {
+      contents_lru.splice(contents_lru.begin(), contents_lru, i->second.lru);
+      *contents = i->second.contents;
+      return 0;
+    }
+    seq = contents_seq;
   }
-  r = list_subdirs(path, &subdirs);
+
+  map<string, hobject_t> objects;
+  int r = list_objects(path, 0, 0, &objects);
   if (r < 0)
     return r;
-  for (set<string>::iterator i = subdirs.begin();
-       i != subdirs.end();
-       ++i) {
-    string candidate = cur_prefix + *i;
-    if (lower_bound && candidate < lower_bound->substr(0, candidate.size()))
-      continue;
-    if (next_object &&
-	candidate < get_path_str(*next_object).substr(0, candidate.size()))
-      continue;
-    hash_prefixes->insert(cur_prefix + *i);
+  DirContents *c = new DirContents;
+  r = list_subdirs(path, &c->subdirs);
+  if (r < 0) {
+    delete c;
+    return r;
+  }
+  c->objects.reserve(objects.size());
+  for (map<string, hobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i)
+    c->objects.push_back(i->second);
+  sort(c->objects.begin(), c->objects.end());
+  contents->reset(c);
+
+  uint64_t max = g_conf->filestore_index_list_cache_objects;
+  if (c->objects.size() > max)
+    return 0;
+  Mutex::Locker l(contents_lock);
+  if (seq < last_change(key, base))
+    return 0;  // raced with a change; don't keep it
+  map<string, CachedContents>::iterator i = contents_cache.find(key);
+  if (i != contents_cache.end()) {
+    contents_cached_objs -= i->second.contents->objects.size();
+    contents_lru.erase(i->second.lru);
+    contents_cache.erase(i);
+  }
+  contents_lru.push_front(key);
+  CachedContents &e = contents_cache[key];
+  e.contents = *contents;
+  e.seq = seq;
+  e.lru = contents_lru.begin();
+  contents_cached_objs += c->objects.size();
+  while (contents_cached_objs > max) {
+    i = contents_cache.find(contents_lru.back());
+    contents_cached_objs -= i->second.contents->objects.size();
+    contents_cache.erase(i);
+    contents_lru.pop_back();
   }
   return 0;
 }
 
+void HashIndex::invalidate_dir_contents(const vector<string> &path) {
+  Mutex::Locker l(contents_lock);
+  note_change(get_full_path_subdir(path));
+}
+
+void HashIndex::invalidate_all_dir_contents() {
+  const string &base = get_base_path();
+  Mutex::Locker l(contents_lock);
+  note_change(base);
+  map<string, CachedContents>::iterator i = contents_cache.lower_bound(base);
+  while (i != contents_cache.end() &&
+	 i->first.compare(0, base.size(), base) == 0) {
+    if (i->first.size() > base.size() && i->first[base.size()] != '/') {
+      ++i;
+      continue;
+    }
+    contents_cached_objs -= i->second.contents->objects.size();
+    contents_lru.erase(i->second.lru);
+    contents_cache.erase(i++);
+  }
+}
+
 int HashIndex::list_by_hash(const vector<string> &path,
 			    int min_count,
 			    int max_count,
@@ -441,30 +519,54 @@ int HashIndex::list_by_hash(const vector<string> &path,
 			    hobject_t *next,
 			    vector<hobject_t> *out) {
   assert(out);
-  vector<string> next_path = path;
-  next_path.push_back("");
-  set<string> hash_prefixes;
-  multimap<string, hobject_t> objects;
-  int r = get_path_contents_by_hash(path,
-				    NULL,
-				    next,
-				    &seq,
-				    &hash_prefixes,
-				    &objects);
+  if (next && next->is_max())
+    return 0;
+
+  DirContentsRef contents;
+  int r = get_dir_contents(path, &contents);
   if (r < 0)
     return r;
-  dout(20) << " prefixes " << hash_prefixes << dendl;
-  for (set<string>::iterator i = hash_prefixes.begin();
-       i != hash_prefixes.end();
+
+  string cur_prefix;
+  for (vector<string>::const_iterator i = path.begin();
+       i != path.end();
        ++i) {
-    multimap<string, hobject_t>::iterator j = objects.find(*i);
-    if (j == objects.end()) {
+    cur_prefix.append(*i);
+  }
+
+  // skip straight to the first object and subdir at or after *next
+  vector<hobject_t>::const_iterator obj = contents->objects.begin();
+  set<string>::const_iterator sub = contents->subdirs.begin();
+  if (next) {
+    obj = lower_bound(contents->objects.begin(), contents->objects.end(),
+		      *next);
+    string next_str = get_path_str(*next);
+    while (sub != contents->subdirs.end()) {
+      string candidate = cur_prefix + *sub;
+      if (candidate >= next_str.substr(0, candidate.size()))
+	break;
+      ++sub;
+    }
+  }
+  dout(20) << "list_by_hash " << cur_prefix << " from "
+	   << (obj - contents->objects.begin()) << "/"
+	   << contents->objects.size() << " objects" << dendl;
+
+  vector<string> next_path = path;
+  next_path.push_back("");
+  while (obj != contents->objects.end() ||
+	 sub != contents->subdirs.end()) {
+    string sub_prefix;
+    if (sub != contents->subdirs.end())
+      sub_prefix = cur_prefix + *sub;
+    if (sub != contents->subdirs.end() &&
+	(obj == contents->objects.end() || sub_prefix <= get_path_str(*obj))) {
       if (min_count > 0 && out->size() > (unsigned)min_count) {
 	if (next)
-	  *next = hobject_t("", "", CEPH_NOSNAP, hash_prefix_to_hash(*i));
+	  *next = hobject_t("", "", CEPH_NOSNAP, hash_prefix_to_hash(sub_prefix));
 	return 0;
       }
-      *(next_path.rbegin()) = *(i->rbegin());
+      *(next_path.rbegin()) = *sub;
       hobject_t next_recurse;
       if (next)
 	next_recurse = *next;
@@ -474,7 +576,6 @@ int HashIndex::list_by_hash(const vector<string> &path,
 		       seq,
 		       &next_recurse,
 		       out);
-
       if (r < 0)
 	return r;
       if (!next_recurse.is_max()) {
@@ -482,18 +583,19 @@ int HashIndex::list_by_hash(const vector<string> &path,
 	  *next = next_recurse;
 	return 0;
       }
+      ++sub;
     } else {
-      while (j != objects.end() && j->first == *i) {
-	if (max_count > 0 && out->size() == (unsigned)max_count) {
-	  if (next)
-	    *next = j->second;
-	  return 0;
-	}
-	if (!next || j->second >= *next) {
-	  out->push_back(j->second);
-	}
-	++j;
+      if (obj->snap < seq) {
+	++obj;
+	continue;
+      }
+      if (max_count > 0 && out->size() == (unsigned)max_count) {
+	if (next)
+	  *next = *obj;
+	return 0;
       }
+      out->push_back(*obj);
+      ++obj;
     }
   }
   if (next)
@@ -17,6 +17,7 @@
 
 #include "include/buffer.h"
 #include "include/encoding.h"
+#include "common/Mutex.h"
 #include "LFNIndex.h"
 
 
@@ -125,7 +126,45 @@ private:
       ::decode(path, bl);
     }
   };
-    
+
+  /// Listing of a single subdir
+  struct DirContents {
+    vector<hobject_t> objects; ///< Objects in the subdir, in hobject_t order
+    set<string> subdirs;       ///< Names of child subdirs
+  };
+  typedef std::tr1::shared_ptr<const DirContents> DirContentsRef;
+
+  /// Cached listing of a subdir
+  struct CachedContents {
+    DirContentsRef contents;
+    uint64_t seq;                ///< contents_seq when the listing began
+    list<string>::iterator lru;  ///< Position in contents_lru
+  };
+
+  /**
+   * Subdir listings are cached across HashIndex instances so that a
+   * sequence of partial listings reads and sorts each subdir once
+   * rather than once per call.  Entries are keyed by full path.
+   *
+   * Every create or remove in a subdir, and every split or merge in a
+   * collection, bumps contents_seq and records it as the subdir's (or
+   * collection's) last change.  A listing is cached or used only if it
+   * began after the last change, so one that raced with a change is
+   * never kept.
+   */
+  static Mutex contents_lock;
+  static map<string, CachedContents> contents_cache;
+  static list<string> contents_lru;    ///< Cached paths, most recently used first
+  static uint64_t contents_cached_objs; ///< Objects in all cached listings
+  static uint64_t contents_seq;        ///< Bumped on every change
+  static map<string, uint64_t> contents_changed; ///< Path -> seq of last change
+  static uint64_t contents_changed_floor; ///< Last change of paths not in contents_changed
+
+  /// seq of the last change to key, a subdir of the collection at base
+  static uint64_t last_change(const string &key, const string &base);
+
+  /// Note a change to key and drop its cached listing
+  static void note_change(const string &key);
     
 public:
   /// Constructor.
@@ -258,16 +297,20 @@ private:
     string prefix ///< [in] string to convert
     ); ///< @return Hash
 
-  /// Get path contents by hash
-  int get_path_contents_by_hash(
-    const vector<string> &path,          /// [in] Path to list
-    const string *lower_bound,           /// [in] list > *lower_bound
-    const hobject_t *next_object,        /// [in] list > *next_object
-    const snapid_t *seq,                 /// [in] list >= *seq
-    set<string> *hash_prefixes,          /// [out] prefixes in dir
-    multimap<string, hobject_t> *objects /// [out] objects
+  /// Get sorted contents of path, from the listing cache if possible
+  int get_dir_contents(
+    const vector<string> &path, ///< [in] Path to list
+    DirContentsRef *contents    ///< [out] Contents of path
+    ); ///< @return Error Code, 0 on success
+
+  /// Drop the cached listing of path
+  void invalidate_dir_contents(
+    const vector<string> &path ///< [in] Path whose contents changed
     );
 
+  /// Drop cached listings of every subdir in this collection
+  void invalidate_all_dir_contents();
+
   /// List objects in collection in hobject_t order
   int list_by_hash(
     const vector<string> &path, /// [in] Path to list
@@ -201,6 +201,14 @@ protected:
 
   /* Non-virtual utility methods */
 
+  /// Gets the base path
+  const string &get_base_path(); ///< @return Index base_path
+
+  /// Get full path the subdir
+  string get_full_path_subdir(
+    const vector<string> &rel ///< [in] The subdir.
+    ); ///< @return Full path to rel.
+
   /// Sync a subdirectory
   int fsync_dir(
     const vector<string> &path ///< [in] Path to sync
@@ -431,14 +439,6 @@ private:
     ); ///< @return Hashed filename.
 
   /* other common methods */
-  /// Gets the base path
-  const string &get_base_path(); ///< @return Index base_path
-
-  /// Get full path the subdir
-  string get_full_path_subdir(
-    const vector<string> &rel ///< [in] The subdir.
-    ); ///< @return Full path to rel.
-
   /// Get full path to object
   string get_full_path(
     const vector<string> &rel, ///< [in] Path to object.
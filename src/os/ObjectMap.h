@@ -18,6 +18,7 @@
 #include <string>
 #include <vector>
 #include <tr1/memory>
+#include <errno.h>
 
 #include "CollectionIndex.h"
 
@@ -109,6 +110,20 @@ public:
     CollectionIndex::IndexedPath target_path ///< [in] path to target
     ) { return 0; }
 
+  /// Get data stored inline for hoid; bl is left empty if there is none
+  virtual int get_inline_data(
+    const hobject_t &hoid,             ///< [in] object
+    CollectionIndex::IndexedPath path, ///< [in] Path to hoid
+    bufferlist *bl                     ///< [out] inline data
+    ) { return 0; }
+
+  /// Store bl as hoid's inline data, or drop it if bl is empty
+  virtual int set_inline_data(
+    const hobject_t &hoid,             ///< [in] object
+    CollectionIndex::IndexedPath path, ///< [in] Path to hoid
+    const bufferlist &bl               ///< [in] inline data
+    ) { return -EOPNOTSUPP; }
+
   virtual bool check(std::ostream &out) { return true; }
 
   class ObjectMapIteratorImpl {
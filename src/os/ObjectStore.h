@@ -66,6 +66,8 @@ enum {
   l_os_commit_len,
   l_os_commit_lat,
   l_os_j_full,
+  l_os_inline_writes,
+  l_os_inline_promotions,
   l_os_last,
 };
 
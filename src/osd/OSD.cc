@@ -57,6 +57,7 @@
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
+#include "messages/MOSDSubOpBatch.h"
 #include "messages/MOSDBoot.h"
 #include "messages/MOSDPGTemp.h"
 
@@ -133,6 +134,7 @@ static CompatSet get_osd_compat_set() {
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_OLOC);
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_LEC);
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_CATEGORIES);
+  ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_MAP_CHECKPOINTS);
   return CompatSet(ceph_osd_feature_compat, ceph_osd_feature_ro_compat,
 		   ceph_osd_feature_incompat);
 }
@@ -551,26 +553,44 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   hbin_messenger(hbinm),
   hbout_messenger(hboutm),
   heartbeat_thread(this),
+  subop_send_lock("OSD::subop_send_lock"),
+  subop_batch_lock("OSD::subop_batch_lock"),
+  subop_batch_stop(false),
+  subop_batch_thread(this),
   heartbeat_dispatcher(this),
   stat_lock("OSD::stat_lock"),
   finished_lock("OSD::finished_lock"),
   ops_in_flight_lock("OSD::ops_in_flight_lock"),
   admin_ops_hook(NULL),
+  startup_timings_lock("OSD::startup_timings_lock"),
+  boot_noted(false),
+  admin_startup_hook(NULL),
   op_queue_len(0),
   op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
   map_cache_lock("OSD::map_cache_lock"),
+  map_cache_bytes(0),
   outstanding_pg_stats(false),
   up_thru_wanted(0), up_thru_pending(0),
   pg_stat_queue_lock("OSD::pg_stat_queue_lock"),
+  pg_stat_queue_urgent(false),
   osd_stat_updated(false),
   pg_stat_tid(0), pg_stat_tid_flushed(0),
+  pg_stat_ack_latency(0),
+  mon_accepts_pg_stat_delta(false),
   last_tid(0),
   tid_lock("OSD::tid_lock"),
   command_wq(this, g_conf->osd_command_thread_timeout, &command_tp),
   recovery_ops_active(0),
   recovery_wq(this, g_conf->osd_recovery_thread_timeout, &recovery_tp),
+  recovery_bw_lock("OSD::recovery_bw_lock"),
+  recovery_bw_interval_bytes(0),
+  recovery_bw_budget(g_conf->osd_recovery_max_bytes_per_sec),
+  recovery_client_lat(0),
+  recovery_inflight_bytes(0),
+  copy_lock("OSD::copy_lock"),
+  copy_bytes(0),
   remove_list_lock("OSD::remove_list_lock"),
   replay_queue_lock("OSD::replay_queue_lock"),
   snap_trim_wq(this, g_conf->osd_snap_trim_thread_timeout, &disk_tp),
@@ -635,7 +655,22 @@ public:
   OpsFlightSocketHook(OSD *o) : osd(o) {}
   bool call(std::string command, bufferlist& out) {
     stringstream ss;
-    osd->dump_ops_in_flight(ss);
+    if (command == "dump_historic_ops")
+      osd->dump_historic_ops(ss);
+    else
+      osd->dump_ops_in_flight(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+class StartupTimingsSocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  StartupTimingsSocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, bufferlist& out) {
+    stringstream ss;
+    osd->dump_startup_timings(ss);
     out.append(ss);
     return true;
   }
@@ -645,6 +680,8 @@ int OSD::init()
 {
   Mutex::Locker lock(osd_lock);
 
+  startup_start = ceph_clock_now(g_ceph_context);
+
   timer.init();
   watch_timer.init();
   watch = new Watch();
@@ -660,6 +697,7 @@ int OSD::init()
     return r;
   }
 
+  note_startup_phase("mount");
   dout(2) << "boot" << dendl;
 
   // read superblock
@@ -681,6 +719,7 @@ int OSD::init()
     return -EINVAL;
   }
   osdmap = get_map(superblock.current_epoch);
+  note_startup_phase("load_osdmap");
 
   bind_epoch = osdmap->get_epoch();
 
@@ -696,6 +735,8 @@ int OSD::init()
 
   // load up pgs (as they previously existed)
   load_pgs();
+  build_past_intervals();
+  note_startup_phase("build_past_intervals");
 
   dout(2) << "superblock: i am osd." << superblock.whoami << dendl;
   assert_warn(whoami == superblock.whoami);
@@ -707,6 +748,19 @@ int OSD::init()
 
   create_logger();
     
+  // copy-from reads we send to ourselves come back over the loopback
+  // connection, which is never authorized; give it a session as us.
+  Connection *loopback = cluster_messenger->get_connection(cluster_messenger->get_myinst());
+  if (loopback) {
+    Session *s = new Session;
+    s->entity_name = g_conf->name;
+    s->caps.set_allow_all(true);
+    s->caps.set_peer_type(CEPH_ENTITY_TYPE_OSD);
+    s->con = loopback;
+    loopback->set_priv(s);
+    loopback->put();
+  }
+
   // i'm ready!
   client_messenger->add_dispatcher_head(this);
   client_messenger->add_dispatcher_head(&clog);
@@ -745,6 +799,8 @@ int OSD::init()
   // start the heartbeat
   heartbeat_thread.create();
 
+  subop_batch_thread.create();
+
   // tick
   timer.add_event_after(g_conf->osd_heartbeat_interval, new C_Tick(this));
 
@@ -762,6 +818,15 @@ int OSD::init()
   r = admin_socket->register_command("dump_ops_in_flight", admin_ops_hook,
                                          "show the ops currently in flight");
   assert(r == 0);
+  r = admin_socket->register_command("dump_historic_ops", admin_ops_hook,
+				     "show the slowest recent ops");
+  assert(r == 0);
+  admin_startup_hook = new StartupTimingsSocketHook(this);
+  r = admin_socket->register_command("dump_startup_timings", admin_startup_hook,
+				     "show how long each phase of startup took");
+  assert(r == 0);
+
+  note_startup_phase("init");
 
   return 0;
 }
@@ -811,6 +876,10 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes");  // pushed bytes
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
+  osd_plb.add_u64_counter(l_osd_rbytes, "recovery_bytes");  // bytes pushed or pulled for recovery
+  osd_plb.add_u64_counter(l_osd_robj, "recovery_objects");  // objects recovered
+  osd_plb.add_u64(l_osd_rinflight, "recovery_inflight_bytes");  // pushed, not yet acked
+  osd_plb.add_u64(l_osd_rbudget, "recovery_bw_budget");     // current recovery bytes/sec allowance
 
   osd_plb.add_fl(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
@@ -824,6 +893,22 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
+  osd_plb.add_u64(l_osd_map_cache, "map_cache_maps");          // cached osdmaps
+  osd_plb.add_u64(l_osd_map_cache_bytes, "map_cache_bytes");   // their memory, shared parts counted once
+  osd_plb.add_fl_avg(l_osd_map_decode_lat, "map_decode_latency"); // full map decodes
+  osd_plb.add_u64_counter(l_osd_map_rebuild, "map_rebuilt_epochs"); // epochs rebuilt from incrementals
+  osd_plb.add_u64_counter(l_osd_pg_adv, "pg_advance_map");      // epochs handed to pgs
+  osd_plb.add_u64_counter(l_osd_pg_adv_skip, "pg_advance_map_skipped"); // epochs pgs did not need to see
+  osd_plb.add_fl_avg(l_osd_map_adv_lat, "map_advance_latency");  // advancing all pgs to a new map
+  osd_plb.add_u64_counter(l_osd_subop_batch, "subop_batch");     // batched sub op messages sent
+  osd_plb.add_u64_counter(l_osd_subop_batched, "subop_batched"); // sub ops/replies sent inside them
+
+  osd_plb.add_fl_avg(l_osd_op_stage_queue_lat, "op_stage_queue_latency");
+  osd_plb.add_fl_avg(l_osd_op_stage_pg_lat, "op_stage_pg_latency");
+  osd_plb.add_fl_avg(l_osd_op_stage_journal_lat, "op_stage_journal_latency");
+  osd_plb.add_fl_avg(l_osd_op_stage_apply_lat, "op_stage_apply_latency");
+  osd_plb.add_fl_avg(l_osd_op_stage_replica_lat, "op_stage_replica_latency");
+  osd_plb.add_fl_avg(l_osd_op_stage_reply_lat, "op_stage_reply_latency");
 
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
@@ -883,8 +968,12 @@ int OSD::shutdown()
   dout(10) << "no ops" << dendl;
 
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_historic_ops");
   delete admin_ops_hook;
   admin_ops_hook = NULL;
+  cct->get_admin_socket()->unregister_command("dump_startup_timings");
+  delete admin_startup_hook;
+  admin_startup_hook = NULL;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
@@ -949,6 +1038,13 @@ int OSD::shutdown()
   delete store;
   store = 0;
   dout(10) << "sync done" << dendl;
+
+  // send anything still queued for peers
+  subop_batch_lock.Lock();
+  subop_batch_stop = true;
+  subop_batch_cond.Signal();
+  subop_batch_lock.Unlock();
+  subop_batch_thread.join();
   osd_lock.Lock();
 
   clear_pg_stat_queue();
@@ -984,6 +1080,10 @@ void OSD::write_superblock(ObjectStore::Transaction& t)
   if (!superblock.compat_features.incompat.mask |
       CEPH_OSD_FEATURE_INCOMPAT_BASE.id)
     superblock.compat_features.incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_BASE);
+  // only checkpoint epochs have a full map on disk; older osds expect
+  // one for every epoch
+  superblock.compat_features.incompat.insert(
+    CEPH_OSD_FEATURE_INCOMPAT_MAP_CHECKPOINTS);
 
   bufferlist bl;
   ::encode(superblock, bl);
@@ -1108,8 +1208,9 @@ PG *OSD::_open_lock_pg(pg_t pgid, bool no_lockdep_check, bool hold_map_lock)
   PG *pg;
   hobject_t logoid = make_pg_log_oid(pgid);
   hobject_t infooid = make_pg_biginfo_oid(pgid);
+  hobject_t mapoid = make_pg_snap_mapper_oid(pgid);
   if (osdmap->get_pg_type(pgid) == pg_pool_t::TYPE_REP)
-    pg = new ReplicatedPG(this, pool, pgid, logoid, infooid);
+    pg = new ReplicatedPG(this, pool, pgid, logoid, infooid, mapoid);
   else 
     assert(0);
 
@@ -1190,6 +1291,43 @@ PG *OSD::lookup_lock_raw_pg(pg_t pgid)
 }
 
 
+/*
+ * Reads pg state off disk for load_pgs().  The pgs aren't reachable
+ * by anyone else yet, so different pgs can be read concurrently.
+ */
+struct LoadPGWQ : public ThreadPool::WorkQueue<PG> {
+  ObjectStore *store;
+  list<PG*> pgs;
+  LoadPGWQ(ObjectStore *s, time_t ti, ThreadPool *tp)
+    : ThreadPool::WorkQueue<PG>("OSD::LoadPGWQ", ti, 0, tp), store(s) {}
+
+  bool _enqueue(PG *pg) {
+    pgs.push_back(pg);
+    return true;
+  }
+  void _dequeue(PG *pg) {
+    assert(0);
+  }
+  bool _empty() {
+    return pgs.empty();
+  }
+  PG *_dequeue() {
+    if (pgs.empty())
+      return NULL;
+    PG *pg = pgs.front();
+    pgs.pop_front();
+    return pg;
+  }
+  void _process(PG *pg) {
+    pg->lock();
+    pg->read_state(store);
+    pg->unlock();
+  }
+  void _clear() {
+    pgs.clear();
+  }
+};
+
 void OSD::load_pgs()
 {
   assert(osd_lock.is_locked());
@@ -1202,6 +1340,7 @@ void OSD::load_pgs()
     derr << "failed to list pgs: " << cpp_strerror(-r) << dendl;
   }
 
+  vector<PG*> pgs;
   for (vector<coll_t>::iterator it = ls.begin();
        it != ls.end();
        it++) {
@@ -1224,14 +1363,41 @@ void OSD::load_pgs()
     }
 
     PG *pg = _open_lock_pg(pgid);
+    pg->unlock();
+    pgs.push_back(pg);
+  }
+  note_startup_phase("open_pgs");
 
-    // read pg state, log
-    pg->read_state(store);
+  // read pg state, log
+  {
+    ThreadPool load_tp(g_ceph_context, "OSD::load_tp",
+		       MAX(1, g_conf->osd_load_pgs_threads));
+    LoadPGWQ load_wq(store, g_conf->osd_op_thread_timeout, &load_tp);
+    load_tp.start();
+    for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p)
+      load_wq.queue(*p);
+    load_wq.drain();
+    load_tp.stop();
+  }
+  note_startup_phase("read_pg_state");
+
+  for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p) {
+    PG *pg = *p;
+    pg->lock();
 
     reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
+    {
+      ObjectStore::Transaction t;
+      pg->convert_snap_collections(t, true);
+      if (!t.empty()) {
+	int r = store->apply_transaction(t);
+	assert(r == 0);
+      }
+    }
+
     // generate state for current mapping
-    osdmap->pg_to_up_acting_osds(pgid, pg->up, pg->acting);
+    osdmap->pg_to_up_acting_osds(pg->info.pgid, pg->up, pg->acting);
     int role = osdmap->calc_pg_role(whoami, pg->acting);
     pg->set_role(role);
 
@@ -1241,8 +1407,145 @@ void OSD::load_pgs()
     dout(10) << "load_pgs loaded " << *pg << " " << pg->log << dendl;
     pg->unlock();
   }
+  note_startup_phase("init_pgs");
   dout(10) << "load_pgs done" << dendl;
 }
+
+/*
+ * Startup timings, for the dump_startup_timings admin socket
+ * command.  Each phase is timed from the end of the previous one.
+ */
+void OSD::note_startup_phase(const char *phase)
+{
+  Mutex::Locker l(startup_timings_lock);
+  utime_t now = ceph_clock_now(g_ceph_context);
+  utime_t since = startup_timings.empty() ? startup_start :
+    startup_timings.back().second.first;
+  startup_timings.push_back(make_pair(string(phase), make_pair(now, now - since)));
+  dout(1) << "startup phase " << phase << " took " << (now - since) << dendl;
+}
+
+void OSD::dump_startup_timings(ostream& ss)
+{
+  JSONFormatter jf(true);
+  Mutex::Locker l(startup_timings_lock);
+  jf.open_object_section("startup_timings");
+  jf.dump_float("started_at", startup_start);
+  jf.open_array_section("phases");
+  for (vector<pair<string,pair<utime_t,utime_t> > >::iterator p = startup_timings.begin();
+       p != startup_timings.end();
+       ++p) {
+    jf.open_object_section("phase");
+    jf.dump_string("name", p->first);
+    jf.dump_float("done_at", p->second.first - startup_start);
+    jf.dump_float("duration", p->second.second);
+    jf.close_section();
+  }
+  jf.close_section();
+  jf.close_section();
+  jf.flush(ss);
+}
+
+struct pistate {
+  epoch_t start, end;        // epochs still missing
+  epoch_t same_interval_since;
+  vector<int> up, acting;
+  OSDMapRef lastmap;
+};
+
+/*
+ * Fill in the past intervals missing from any of the loaded pgs.
+ *
+ * Doing this here instead of from each pg's peering means each old map
+ * is loaded once for all pgs, in epoch order, so that get_map() only
+ * has to apply a single incremental per step.
+ */
+void OSD::build_past_intervals()
+{
+  assert(osd_lock.is_locked());
+
+  map<PG*,pistate> pis;
+
+  epoch_t cur_epoch = osdmap->get_epoch();
+  epoch_t end_epoch = 0;
+  for (hash_map<pg_t,PG*>::iterator i = pg_map.begin();
+       i != pg_map.end();
+       i++) {
+    PG *pg = i->second;
+    pg->lock();
+    epoch_t start, end;
+    if (pg->get_missing_past_interval_epochs(&start, &end)) {
+      pistate& p = pis[pg];
+      p.start = start;
+      p.end = end;
+      p.same_interval_since = 0;
+      if (start < cur_epoch)
+	cur_epoch = start;
+      if (end > end_epoch)
+	end_epoch = end;
+    }
+    pg->unlock();
+  }
+  if (pis.empty()) {
+    dout(10) << "build_past_intervals nothing to build" << dendl;
+    return;
+  }
+
+  dout(10) << "build_past_intervals " << pis.size() << " pgs over epochs "
+	   << cur_epoch << "-" << end_epoch << dendl;
+  utime_t start_time = ceph_clock_now(g_ceph_context);
+
+  for (; cur_epoch <= end_epoch; cur_epoch++) {
+    OSDMapRef cur_map = get_map(cur_epoch);
+
+    for (map<PG*,pistate>::iterator i = pis.begin(); i != pis.end(); ++i) {
+      PG *pg = i->first;
+      pistate& p = i->second;
+      if (cur_epoch < p.start || cur_epoch > p.end)
+	continue;
+
+      vector<int> up, acting;
+      cur_map->pg_to_up_acting_osds(pg->info.pgid, up, acting);
+
+      if (p.same_interval_since && acting != p.acting) {
+	pg->lock();
+	pg->add_past_interval(p.same_interval_since, cur_epoch - 1,
+			      p.up, p.acting, p.lastmap);
+	pg->unlock();
+	p.same_interval_since = 0;
+      }
+      if (!p.same_interval_since)
+	p.same_interval_since = cur_epoch;
+      p.up.swap(up);
+      p.acting.swap(acting);
+      p.lastmap = cur_map;
+
+      if (cur_epoch == p.end) {
+	pg->lock();
+	pg->add_past_interval(p.same_interval_since, cur_epoch,
+			      p.up, p.acting, p.lastmap);
+	pg->unlock();
+	p.lastmap.reset();
+      }
+    }
+
+    // we only ever need the newest of these again
+    trim_map_cache(cur_epoch);
+  }
+
+  // write them out so that we never have to do this again
+  ObjectStore::Transaction t;
+  for (map<PG*,pistate>::iterator i = pis.begin(); i != pis.end(); ++i) {
+    PG *pg = i->first;
+    pg->lock();
+    pg->write_info(t);
+    pg->unlock();
+  }
+  store->apply_transaction(t);
+
+  dout(1) << "build_past_intervals " << pis.size() << " pgs took "
+	  << (ceph_clock_now(g_ceph_context) - start_time) << dendl;
+}
  
 
 /*
@@ -1817,6 +2120,9 @@ void OSD::tick()
   else if (now - last_mon_report > g_conf->osd_mon_report_interval_min) {
     do_mon_report();
   }
+  else {
+    send_pg_stats(now);  // pg state changes don't wait for the next report
+  }
 
   // remove stray pgs?
   remove_list_lock.Lock();
@@ -1828,7 +2134,7 @@ void OSD::tick()
 	 q++) {
       if (osdmap->is_up(q->first)) {
 	MOSDPGRemove *m = new MOSDPGRemove(p->first, q->second);
-	cluster_messenger->send_message(m, osdmap->get_cluster_inst(q->first));
+	send_cluster_message(m, osdmap->get_cluster_inst(q->first));
       }
     }
   remove_list.clear();
@@ -1836,6 +2142,9 @@ void OSD::tick()
 
   map_lock.put_read();
 
+  // pick up copy slots freed by cancelled reads
+  kick_copy_waiters();
+
   timer.add_event_after(1.0, new C_Tick(this));
 
   if (outstanding_pg_stats
@@ -1896,22 +2205,8 @@ void OSD::dump_ops_in_flight(ostream& ss)
   jf.open_array_section("ops"); // list of OpRequests
   utime_t now = ceph_clock_now(g_ceph_context);
   for (xlist<OpRequest*>::iterator p = ops_in_flight.begin(); !p.end(); ++p) {
-    stringstream name;
-    Message *m = (*p)->request;
-    m->print(name);
     jf.open_object_section("op");
-    jf.dump_string("description", name.str().c_str()); // this OpRequest
-    jf.dump_float("received_at", (*p)->received_time);
-    jf.dump_float("age", now - (*p)->received_time);
-    jf.dump_string("flag_point", (*p)->state_string());
-    if (m->get_orig_source().is_client()) {
-      jf.open_object_section("client_info");
-      stringstream client_name;
-      client_name << m->get_orig_source();
-      jf.dump_string("client", client_name.str());
-      jf.dump_int("tid", m->get_tid());
-      jf.close_section(); // client_info
-    }
+    (*p)->dump(now, &jf);
     jf.close_section(); // this OpRequest
   }
   jf.close_section(); // list of OpRequests
@@ -1919,6 +2214,26 @@ void OSD::dump_ops_in_flight(ostream& ss)
   jf.flush(ss);
 }
 
+void OSD::dump_historic_ops(ostream& ss)
+{
+  JSONFormatter jf(true);
+  Mutex::Locker locker(ops_in_flight_lock);
+  jf.open_object_section("historic_ops");
+  jf.dump_int("size", g_conf->osd_op_history_size);
+  jf.dump_int("duration", g_conf->osd_op_history_duration);
+  jf.open_array_section("ops");
+  for (multimap<double, OpHistoryEntry>::reverse_iterator p = op_history.rbegin();
+       p != op_history.rend();
+       ++p) {
+    jf.open_object_section("op");
+    p->second.dump(&jf);
+    jf.close_section();
+  }
+  jf.close_section();
+  jf.close_section();
+  jf.flush(ss);
+}
+
 void OSD::register_inflight_op(xlist<OpRequest*>::item *i)
 {
   ops_in_flight_lock.Lock();
@@ -1926,11 +2241,64 @@ void OSD::register_inflight_op(xlist<OpRequest*>::item *i)
   ops_in_flight_lock.Unlock();
 }
 
-void OSD::unregister_inflight_op(xlist<OpRequest*>::item *i)
+/*
+ * Turn a client op's timeline into per-stage latencies.  Ops that
+ * never reached a stage (reads have no journal, delayed ops may be
+ * requeued) just don't count toward it.
+ */
+void OSD::log_op_stages(OpRequest *op, utime_t now)
+{
+  if (!logger || op->request->get_type() != CEPH_MSG_OSD_OP)
+    return;
+
+  utime_t reached, started, submit, commit, applied, sub_sent, sub_commit, reply;
+  bool have_reached = op->get_event_stamp("reached_pg", false, &reached);
+  bool have_started = op->get_event_stamp("started", true, &started);
+  bool have_submit = op->get_event_stamp("journal_submit", false, &submit);
+
+  if (have_reached)
+    logger->finc(l_osd_op_stage_queue_lat, reached - op->received_time);
+  if (have_reached && have_started && started >= reached)
+    logger->finc(l_osd_op_stage_pg_lat, started - reached);
+  if (have_submit && op->get_event_stamp("journal_commit", false, &commit))
+    logger->finc(l_osd_op_stage_journal_lat, commit - submit);
+  if (have_submit && op->get_event_stamp("applied", false, &applied))
+    logger->finc(l_osd_op_stage_apply_lat, applied - submit);
+  if (op->get_event_stamp("sub_op_sent", false, &sub_sent) &&
+      op->get_event_stamp("sub_op_commit_rec", true, &sub_commit))
+    logger->finc(l_osd_op_stage_replica_lat, sub_commit - sub_sent);
+  if (have_started && op->get_event_stamp("reply_sent", true, &reply))
+    logger->finc(l_osd_op_stage_reply_lat, reply - started);
+}
+
+void OSD::unregister_inflight_op(OpRequest *op)
 {
+  utime_t now = ceph_clock_now(g_ceph_context);
+  log_op_stages(op, now);
+
   ops_in_flight_lock.Lock();
-  assert(i->get_list() == &ops_in_flight);
-  i->remove_myself();
+  assert(op->xitem.get_list() == &ops_in_flight);
+  op->xitem.remove_myself();
+
+  // keep the op if it is among the slowest of the recent ones
+  utime_t cutoff = now;
+  cutoff -= g_conf->osd_op_history_duration;
+  for (multimap<double, OpHistoryEntry>::iterator p = op_history.begin();
+       p != op_history.end(); ) {
+    if (p->second.received_time < cutoff)
+      op_history.erase(p++);
+    else
+      ++p;
+  }
+  double duration = now - op->received_time;
+  if (g_conf->osd_op_history_size > 0 &&
+      (op_history.size() < (unsigned)g_conf->osd_op_history_size ||
+       duration > op_history.begin()->first)) {
+    OpHistoryEntry &e = op_history.insert(make_pair(duration, OpHistoryEntry()))->second;
+    op->get_history_entry(now, &e);
+    while (op_history.size() > (unsigned)g_conf->osd_op_history_size)
+      op_history.erase(op_history.begin());
+  }
   ops_in_flight_lock.Unlock();
 }
 
@@ -1961,7 +2329,14 @@ void OSD::ms_handle_connect(Connection *con)
       send_alive();
       send_pg_temp();
       send_failures();
-      send_pg_stats(ceph_clock_now(g_ceph_context));
+
+      // a new session may be with a mon that doesn't take deltas, and
+      // won't ack what we sent the old one
+      pg_stat_queue_lock.Lock();
+      mon_accepts_pg_stat_delta = false;
+      pg_stat_unacked.clear();
+      pg_stat_queue_lock.Unlock();
+      send_pg_stats(ceph_clock_now(g_ceph_context), true);
     }
   }
 }
@@ -2229,7 +2604,23 @@ void OSD::send_still_alive(entity_inst_t i)
   monc->send_mon_message(m);
 }
 
-void OSD::send_pg_stats(const utime_t &now)
+double OSD::get_pg_stats_interval() const
+{
+  // back off as the mon gets slower to ack
+  double i = pg_stat_ack_latency * g_conf->osd_mon_report_ack_ratio;
+  if (i < g_conf->osd_mon_report_interval_min)
+    i = g_conf->osd_mon_report_interval_min;
+  if (i > g_conf->osd_mon_report_interval_max)
+    i = g_conf->osd_mon_report_interval_max;
+  return i;
+}
+
+/*
+ * Report pg stats.  Unless all is set, only urgent pgs (those whose
+ * state or mapping changed) are sent, until the report interval has
+ * passed and the mon has acked everything we've sent it.
+ */
+void OSD::send_pg_stats(const utime_t &now, bool all)
 {
   assert(osd_lock.is_locked());
 
@@ -2241,17 +2632,22 @@ void OSD::send_pg_stats(const utime_t &now)
    
   pg_stat_queue_lock.Lock();
 
-  if (osd_stat_updated || !pg_stat_queue.empty()) {
-    last_pg_stats_sent = now;
-    osd_stat_updated = false;
-
-    dout(10) << "send_pg_stats - " << pg_stat_queue.size() << " pgs updated" << dendl;
+  if (!all) {
+    double since = now - last_pg_stats_sent;
+    if (since > g_conf->osd_mon_report_interval_max ||
+	(since >= get_pg_stats_interval() &&
+	 (!mon_accepts_pg_stat_delta || pg_stat_unacked.empty())))
+      all = true;
+  }
 
+  if ((all && (osd_stat_updated || !pg_stat_queue.empty())) ||
+      (!all && pg_stat_queue_urgent)) {
     utime_t had_for(now);
     had_for -= had_map_since;
 
     MPGStats *m = new MPGStats(monc->get_fsid(), osdmap->get_epoch(), had_for);
-    m->set_tid(++pg_stat_tid);
+    uint64_t tid = pg_stat_tid + 1;
+    m->set_tid(tid);
     m->osd_stat = cur_stat;
 
     xlist<PG*>::iterator p = pg_stat_queue.begin();
@@ -2264,20 +2660,45 @@ void OSD::send_pg_stats(const utime_t &now)
 	continue;
       }
       pg->pg_stats_lock.Lock();
-      if (pg->pg_stats_valid) {
-	m->pg_stat[pg->info.pgid] = pg->pg_stats_stable;
-	dout(25) << " sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
-      } else {
+      if (!pg->pg_stats_valid) {
 	dout(25) << " NOT sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << ", not valid" << dendl;
+      } else if (!all && !pg->pg_stats_urgent()) {
+	dout(25) << " deferring " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
+      } else {
+	if (mon_accepts_pg_stat_delta && pg->pg_stats_sent_acked) {
+	  m->pg_stat_delta[pg->info.pgid].build(pg->pg_stats_sent, pg->pg_stats_stable);
+	  dout(25) << " sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported
+		   << " delta from " << pg->pg_stats_sent.reported << dendl;
+	} else {
+	  m->pg_stat[pg->info.pgid] = pg->pg_stats_stable;
+	  dout(25) << " sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
+	}
+	pg->pg_stats_sent = pg->pg_stats_stable;
+	pg->pg_stats_sent_tid = tid;
+	pg->pg_stats_sent_acked = false;
       }
       pg->pg_stats_lock.Unlock();
     }
+    pg_stat_queue_urgent = false;
 
-    if (!outstanding_pg_stats) {
-      outstanding_pg_stats = true;
-      last_pg_stats_ack = ceph_clock_now(g_ceph_context);
+    if (!all && m->pg_stat.empty() && m->pg_stat_delta.empty()) {
+      m->put();
+    } else {
+      dout(10) << "send_pg_stats - " << pg_stat_queue.size() << " pgs updated, sending "
+	       << m->pg_stat.size() << " + " << m->pg_stat_delta.size() << " deltas"
+	       << (all ? "" : " (urgent only)") << dendl;
+      ++pg_stat_tid;
+      pg_stat_unacked[tid] = now;
+      if (all) {
+	last_pg_stats_sent = now;
+	osd_stat_updated = false;
+      }
+      if (!outstanding_pg_stats) {
+	outstanding_pg_stats = true;
+	last_pg_stats_ack = ceph_clock_now(g_ceph_context);
+      }
+      monc->send_mon_message(m);
     }
-    monc->send_mon_message(m);
   }
 
   pg_stat_queue_lock.Unlock();
@@ -2301,6 +2722,21 @@ void OSD::handle_pg_stats_ack(MPGStatsAck *ack)
     pg_stat_queue_cond.Signal();
   }
 
+  mon_accepts_pg_stat_delta = ack->accepts_delta();
+
+  map<uint64_t,utime_t>::iterator t = pg_stat_unacked.find(ack->get_tid());
+  if (t != pg_stat_unacked.end()) {
+    double lat = (double)(last_pg_stats_ack - t->second);
+    if (pg_stat_ack_latency > 0)
+      pg_stat_ack_latency = pg_stat_ack_latency * .75 + lat * .25;
+    else
+      pg_stat_ack_latency = lat;
+    dout(20) << " ack latency " << lat << ", avg " << pg_stat_ack_latency
+	     << ", report interval " << get_pg_stats_interval() << dendl;
+    // acks come in order; anything older was dropped
+    pg_stat_unacked.erase(pg_stat_unacked.begin(), ++t);
+  }
+
   xlist<PG*>::iterator p = pg_stat_queue.begin();
   while (!p.end()) {
     PG *pg = *p;
@@ -2309,6 +2745,8 @@ void OSD::handle_pg_stats_ack(MPGStatsAck *ack)
     if (ack->pg_stat.count(pg->info.pgid)) {
       eversion_t acked = ack->pg_stat[pg->info.pgid];
       pg->pg_stats_lock.Lock();
+      if (acked == pg->pg_stats_sent.reported)
+	pg->pg_stats_sent_acked = true;
       if (acked == pg->pg_stats_stable.reported) {
 	dout(25) << " ack on " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
 	pg->stat_queue_item.remove_myself();
@@ -2335,7 +2773,7 @@ void OSD::flush_pg_stats()
 {
   dout(10) << "flush_pg_stats" << dendl;
   utime_t now = ceph_clock_now(cct);
-  send_pg_stats(now);
+  send_pg_stats(now, true);
 
   osd_lock.Unlock();
 
@@ -2722,6 +3160,151 @@ bool OSD::heartbeat_dispatch(Message *m)
   return true;
 }
 
+// -------------------------------------
+// sub op batching
+
+void OSD::queue_cluster_message(Message *m, const entity_inst_t& inst)
+{
+  if (g_conf->osd_subop_batch_max <= 1) {
+    send_cluster_message(m, inst);
+    return;
+  }
+  Mutex::Locker l(subop_batch_lock);
+  if (subop_batch.empty())
+    subop_batch_since = ceph_clock_now(g_ceph_context);
+  pair<entity_inst_t, list<Message*> >& q = subop_batch[inst.addr];
+  q.first = inst;
+  q.second.push_back(m);
+  subop_batch_cond.Signal();
+}
+
+void OSD::send_cluster_message(Message *m, const entity_inst_t& inst)
+{
+  Mutex::Locker l(subop_send_lock);
+  _flush_subop_batch(inst.addr);
+  cluster_messenger->send_message(m, inst);
+}
+
+void OSD::lazy_send_cluster_message(Message *m, const entity_inst_t& inst)
+{
+  Mutex::Locker l(subop_send_lock);
+  _flush_subop_batch(inst.addr);
+  cluster_messenger->lazy_send_message(m, inst);
+}
+
+void OSD::send_cluster_message(Message *m, Connection *con)
+{
+  Mutex::Locker l(subop_send_lock);
+  _flush_subop_batch(con->get_peer_addr());
+  cluster_messenger->send_message(m, con);
+}
+
+/*
+ * send whatever is queued for addr, ahead of a message that is about
+ * to go out directly.  subop_send_lock held.
+ */
+void OSD::_flush_subop_batch(const entity_addr_t& addr)
+{
+  assert(subop_send_lock.is_locked());
+  list<Message*> ls;
+  entity_inst_t inst;
+  subop_batch_lock.Lock();
+  map<entity_addr_t, pair<entity_inst_t, list<Message*> > >::iterator p = subop_batch.find(addr);
+  if (p != subop_batch.end()) {
+    inst = p->second.first;
+    ls.swap(p->second.second);
+    subop_batch.erase(p);
+  }
+  subop_batch_lock.Unlock();
+  if (!ls.empty())
+    _send_subop_batch(inst, ls);
+}
+
+/*
+ * send ls to inst, as few messages as possible.  only runs of the same
+ * priority share a message, so nothing jumps ahead of what was sent
+ * before it.  subop_send_lock held.
+ */
+void OSD::_send_subop_batch(const entity_inst_t& inst, list<Message*>& ls)
+{
+  assert(subop_send_lock.is_locked());
+  unsigned max = MAX(1, g_conf->osd_subop_batch_max);
+  bool can_batch = false;
+  Connection *con = cluster_messenger->get_connection(inst);
+  if (con) {
+    can_batch = con->has_feature(CEPH_FEATURE_OSD_SUBOP_BATCH);
+    con->put();
+  }
+
+  while (!ls.empty()) {
+    Message *m = ls.front();
+    ls.pop_front();
+    if (!can_batch || ls.empty() || max == 1 ||
+	ls.front()->get_priority() != m->get_priority()) {
+      cluster_messenger->send_message(m, inst);
+      continue;
+    }
+    MOSDSubOpBatch *b = new MOSDSubOpBatch;
+    b->set_priority(m->get_priority());
+    b->msgs.push_back(m);
+    while (!ls.empty() && b->msgs.size() < max &&
+	   ls.front()->get_priority() == m->get_priority()) {
+      b->msgs.push_back(ls.front());
+      ls.pop_front();
+    }
+    dout(20) << "_send_subop_batch " << b->msgs.size() << " to " << inst << dendl;
+    logger->inc(l_osd_subop_batch);
+    logger->inc(l_osd_subop_batched, b->msgs.size());
+    cluster_messenger->send_message(b, inst);
+  }
+}
+
+void OSD::subop_batch_entry()
+{
+  subop_send_lock.Lock();
+  subop_batch_lock.Lock();
+  while (true) {
+    if (subop_batch.empty()) {
+      if (subop_batch_stop)
+	break;
+      subop_send_lock.Unlock();
+      subop_batch_cond.Wait(subop_batch_lock);
+      // keep lock order: send lock, then batch lock
+      subop_batch_lock.Unlock();
+      subop_send_lock.Lock();
+      subop_batch_lock.Lock();
+      continue;
+    }
+
+    // give others a chance to join the oldest queued message
+    if (!subop_batch_stop && g_conf->osd_subop_batch_delay > 0) {
+      utime_t until = subop_batch_since;
+      until += g_conf->osd_subop_batch_delay;
+      if (ceph_clock_now(g_ceph_context) < until) {
+	subop_send_lock.Unlock();
+	subop_batch_cond.WaitUntil(subop_batch_lock, until);
+	subop_batch_lock.Unlock();
+	subop_send_lock.Lock();
+	subop_batch_lock.Lock();
+	continue;
+      }
+    }
+
+    // send everything queued so far; what is queued meanwhile goes
+    // out in the next round
+    map<entity_addr_t, pair<entity_inst_t, list<Message*> > > ls;
+    ls.swap(subop_batch);
+    subop_batch_lock.Unlock();
+    for (map<entity_addr_t, pair<entity_inst_t, list<Message*> > >::iterator p = ls.begin();
+	 p != ls.end();
+	 ++p)
+      _send_subop_batch(p->second.first, p->second.second);
+    subop_batch_lock.Lock();
+  }
+  subop_batch_lock.Unlock();
+  subop_send_lock.Unlock();
+}
+
 bool OSD::ms_dispatch(Message *m)
 {
   // lock!
@@ -2791,6 +3374,7 @@ bool OSD::ms_verify_authorizer(Connection *con, int peer_type,
       dout(10) << " new session " << s << " con=" << s->con << " addr=" << s->con->get_peer_addr() << dendl;
     }
 
+    s->entity_name = name;
     s->caps.set_allow_all(caps_info.allow_all);
     s->caps.set_auid(auid);
     s->caps.set_peer_type(peer_type);
@@ -2943,6 +3527,14 @@ void OSD::_dispatch(Message *m)
     handle_rep_scrub((MOSDRepScrub*)m);
     break;    
 
+  case MSG_OSD_SUBOP_BATCH:
+    handle_sub_op_batch((MOSDSubOpBatch*)m);
+    break;
+
+  case CEPH_MSG_OSD_OPREPLY:
+    handle_copy_get_reply((MOSDOpReply*)m);
+    break;
+
     // -- need OSDMap --
 
   default:
@@ -3288,10 +3880,14 @@ void OSD::handle_osd_map(MOSDMap *m)
     p = m->maps.find(e);
     if (p != m->maps.end()) {
       dout(10) << "handle_osd_map  got full map for epoch " << e << dendl;
-      OSDMap *o = new OSDMap;
       bufferlist& bl = p->second;
-      
-      o->decode(bl);
+      OSDMap *o = decode_map(e, bl);
+      // we map every pg on every new map, so the table always pays off
+      // here; osd_map_pg_mapping is only for clients and mons
+      o->enable_pg_mapping(g_conf->osd_map_pg_mapping_threads);
+      dout(10) << "handle_osd_map built pg mapping for " << o->get_pg_mapping_num_pgs()
+	       << " pgs, " << o->get_pg_mapping_bytes() << " bytes in "
+	       << o->get_pg_mapping_build_time() << dendl;
       add_map(o);
 
       hobject_t fulloid = get_osdmap_pobject_name(e);
@@ -3308,13 +3904,14 @@ void OSD::handle_osd_map(MOSDMap *m)
       t.write(coll_t::META_COLL, oid, 0, bl.length(), bl);
       add_map_inc_bl(e, bl);
 
-      OSDMap *o = new OSDMap;
-      if (e > 1) {
-	bufferlist obl;
-	OSDMapRef prev = get_map(e - 1);
-	prev->encode(obl);
-	o->decode(obl);
-      }
+      // the copy shares crush, pools, addrs and pg mappings with prev
+      OSDMap *o;
+      if (e > 1)
+	o = new OSDMap(*get_map(e - 1));
+      else
+	o = new OSDMap;
+      if (!o->has_pg_mapping())
+	o->enable_pg_mapping(g_conf->osd_map_pg_mapping_threads);
 
       OSDMap::Incremental inc;
       bufferlist::iterator p = bl.begin();
@@ -3324,14 +3921,18 @@ void OSD::handle_osd_map(MOSDMap *m)
 	assert(0 == "bad fsid");
       }
 
-      add_map(o);
-
-      bufferlist fbl;
-      o->encode(fbl);
-
-      hobject_t fulloid = get_osdmap_pobject_name(e);
-      t.write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
-      add_map_bl(e, fbl);
+      OSDMapRef ref = add_map(o);
+
+      // only checkpoint epochs get a full map on disk; the rest are
+      // rebuilt from the previous checkpoint by get_map().
+      if (e % g_conf->osd_map_full_interval == 0 ||
+	  (superblock.oldest_map == 0 && e == start)) {
+	bufferlist fbl;
+	ref->encode(fbl);
+	hobject_t fulloid = get_osdmap_pobject_name(e);
+	t.write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
+	add_map_bl(e, fbl);
+      }
       continue;
     }
 
@@ -3362,6 +3963,15 @@ void OSD::handle_osd_map(MOSDMap *m)
   assert(osd_lock.is_locked());
 
   if (superblock.oldest_map) {
+    // the new oldest epoch must have a full map to rebuild from
+    epoch_t oldest = m->oldest_map;
+    if (oldest > superblock.oldest_map && oldest <= last &&
+	!store->exists(coll_t::META_COLL, get_osdmap_pobject_name(oldest))) {
+      bufferlist bl;
+      get_map(oldest)->encode(bl);
+      dout(20) << " storing full osdmap epoch " << oldest << " as new oldest" << dendl;
+      t.write(coll_t::META_COLL, get_osdmap_pobject_name(oldest), 0, bl.length(), bl);
+    }
     for (epoch_t e = superblock.oldest_map; e < m->oldest_map; ++e) {
       dout(20) << " removing old osdmap epoch " << e << dendl;
       t.remove(coll_t::META_COLL, get_osdmap_pobject_name(e));
@@ -3381,6 +3991,8 @@ void OSD::handle_osd_map(MOSDMap *m)
   C_Contexts *fin = new C_Contexts(g_ceph_context);
 
   // advance through the new maps
+  utime_t adv_start = ceph_clock_now(g_ceph_context);
+  uint64_t adv_delivered = 0, adv_skipped = 0;
   for (epoch_t cur = start; cur <= superblock.newest_map; cur++) {
     dout(10) << " advance to epoch " << cur << " (<= newest " << superblock.newest_map << ")" << dendl;
 
@@ -3400,8 +4012,19 @@ void OSD::handle_osd_map(MOSDMap *m)
 
     superblock.current_epoch = cur;
     advance_map(t, fin);
+    advance_pgs(cur == superblock.newest_map, &adv_delivered, &adv_skipped);
     had_map_since = ceph_clock_now(g_ceph_context);
   }
+  if (start <= superblock.newest_map) {
+    utime_t lat = ceph_clock_now(g_ceph_context) - adv_start;
+    logger->inc(l_osd_pg_adv, adv_delivered);
+    logger->inc(l_osd_pg_adv_skip, adv_skipped);
+    logger->finc(l_osd_map_adv_lat, lat);
+    if (superblock.newest_map > start)
+      dout(1) << "advanced " << pg_map.size() << " pgs over epochs "
+	      << start << "-" << superblock.newest_map << " in " << lat << ": "
+	      << adv_delivered << " map events, " << adv_skipped << " skipped" << dendl;
+  }
 
   if (osdmap->is_up(whoami) &&
       osdmap->get_addr(whoami) == client_messenger->get_myaddr() &&
@@ -3410,6 +4033,10 @@ void OSD::handle_osd_map(MOSDMap *m)
     if (is_booting()) {
       dout(1) << "state: booting -> active" << dendl;
       state = STATE_ACTIVE;
+      if (!boot_noted) {
+	note_startup_phase("boot");
+	boot_noted = true;
+      }
     }
       
     // yay!
@@ -3659,26 +4286,6 @@ void OSD::advance_map(ObjectStore::Transaction& t, C_Contexts *tfin)
     }
   }
 
-  // if we skipped a discontinuity and are the first epoch, we won't have a previous map.
-  OSDMapRef lastmap;
-  if (osdmap->get_epoch() > superblock.oldest_map)
-    lastmap = get_map(osdmap->get_epoch() - 1);
-
-  // scan existing pg's
-  for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
-       it != pg_map.end();
-       it++) {
-    PG *pg = it->second;
-
-    vector<int> newup, newacting;
-    osdmap->pg_to_up_acting_osds(pg->info.pgid, newup, newacting);
-
-    pg->lock_with_map_lock_held();
-    dout(10) << "Scanning pg " << *pg << dendl;
-    pg->handle_advance_map(osdmap, lastmap, newup, newacting, 0);
-    pg->unlock();
-  }
-
   // scan pgs with waiters
   map<pg_t, list<OpRequest*> >::iterator p = waiting_for_pg.begin();
   while (p != waiting_for_pg.end()) {
@@ -3701,6 +4308,71 @@ void OSD::advance_map(ObjectStore::Transaction& t, C_Contexts *tfin)
   }
 }
 
+static bool osd_changed(const OSDMap& a, const OSDMap& b, int o)
+{
+  if (o >= a.get_max_osd() || o >= b.get_max_osd())
+    return true;
+  if (a.exists(o) != b.exists(o))
+    return true;
+  if (!b.exists(o))
+    return false;
+  return a.is_up(o) != b.is_up(o) ||
+    a.get_up_from(o) != b.get_up_from(o) ||
+    a.get_info(o).lost_at != b.get_info(o).lost_at;
+}
+
+/*
+ * Hand osdmap to the pgs that need it.  A pg only sees the epochs that
+ * can matter to it: those that change its up or acting set or its
+ * pool, or the state of an osd it is tracking (see
+ * PG::can_skip_advance_map), plus the last epoch of a batch.  After a
+ * long outage this is a handful of epochs per pg instead of all of
+ * them.  This runs right after advance_map() for each epoch, so a pg
+ * sees its pool as of the epoch it is handed.
+ */
+void OSD::advance_pgs(bool last, uint64_t *delivered, uint64_t *skipped)
+{
+  assert(osd_lock.is_locked());
+
+  // if we skipped a discontinuity and are the first epoch, we won't have a previous map.
+  OSDMapRef lastmap;
+  if (osdmap->get_epoch() > superblock.oldest_map)
+    lastmap = get_map(osdmap->get_epoch() - 1);
+
+  set<int> osds_changed;
+  if (lastmap)
+    for (int o = 0; o < MAX(lastmap->get_max_osd(), osdmap->get_max_osd()); o++)
+      if (osd_changed(*lastmap, *osdmap, o))
+	osds_changed.insert(o);
+
+  for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
+       it != pg_map.end();
+       it++) {
+    PG *pg = it->second;
+
+    vector<int> newup, newacting;
+    osdmap->pg_to_up_acting_osds(pg->info.pgid, newup, newacting);
+
+    pg->lock_with_map_lock_held();
+    if (!last && lastmap) {
+      vector<int> lastup, lastacting;
+      lastmap->pg_to_up_acting_osds(pg->info.pgid, lastup, lastacting);
+      if (newup == lastup && newacting == lastacting &&
+	  pg->can_skip_advance_map(lastmap, osdmap, osds_changed)) {
+	pg->unlock();
+	(*skipped)++;
+	continue;
+      }
+    }
+
+    dout(10) << "Scanning pg " << *pg << dendl;
+    pg->osdmap_ref = osdmap;
+    pg->handle_advance_map(osdmap, lastmap, newup, newacting, 0);
+    pg->unlock();
+    (*delivered)++;
+  }
+}
+
 void OSD::activate_map(ObjectStore::Transaction& t, list<Context*>& tfin)
 {
   assert(osd_lock.is_locked());
@@ -3741,6 +4413,9 @@ void OSD::activate_map(ObjectStore::Transaction& t, list<Context*>& tfin)
 
     PG::RecoveryCtx rctx(&query_map, &info_map, &notify_list, &tfin, &t);
     pg->handle_activate_map(&rctx);
+
+    // copy sources may have moved
+    pg->kick_copy_ops();
     
     pg->unlock();
   }  
@@ -3793,13 +4468,18 @@ MOSDMap *OSD::build_incremental_map_msg(epoch_t since, epoch_t to)
 
 void OSD::send_map(MOSDMap *m, const entity_inst_t& inst, bool lazy)
 {
-  Messenger *msgr = client_messenger;
-  if (entity_name_t::TYPE_OSD == inst.name._type)
-    msgr = cluster_messenger;
+  if (entity_name_t::TYPE_OSD == inst.name._type) {
+    // keep it in order with the sub ops queued for this peer
+    if (lazy)
+      lazy_send_cluster_message(m, inst);
+    else
+      send_cluster_message(m, inst);
+    return;
+  }
   if (lazy)
-    msgr->lazy_send_message(m, inst);  // only if we already have an open connection
+    client_messenger->lazy_send_message(m, inst);  // only if we already have an open connection
   else
-    msgr->send_message(m, inst);
+    client_messenger->send_message(m, inst);
 }
 
 void OSD::send_incremental_map(epoch_t since, const entity_inst_t& inst, bool lazy)
@@ -3828,7 +4508,7 @@ void OSD::send_incremental_map(epoch_t since, const entity_inst_t& inst, bool la
   }
 }
 
-bool OSD::get_map_bl(epoch_t e, bufferlist& bl)
+bool OSD::get_stored_map_bl(epoch_t e, bufferlist& bl)
 {
   {
     Mutex::Locker l(map_cache_lock);
@@ -3841,6 +4521,20 @@ bool OSD::get_map_bl(epoch_t e, bufferlist& bl)
   return store->read(coll_t::META_COLL, get_osdmap_pobject_name(e), 0, 0, bl) >= 0;
 }
 
+bool OSD::get_map_bl(epoch_t e, bufferlist& bl)
+{
+  if (get_stored_map_bl(e, bl))
+    return true;
+
+  // not a checkpoint epoch; rebuild it
+  if (e == 0 || e < superblock.oldest_map || e > superblock.newest_map)
+    return false;
+  bl.clear();
+  get_map(e)->encode(bl);
+  add_map_bl(e, bl);
+  return true;
+}
+
 bool OSD::get_inc_map_bl(epoch_t e, bufferlist& bl)
 {
   {
@@ -3861,12 +4555,84 @@ OSDMapRef OSD::add_map(OSDMap *o)
   if (map_cache.count(e) == 0) {
     dout(10) << "add_map " << e << " " << o << dendl;
     map_cache.insert(make_pair(e, OSDMapRef(o)));
+    _note_map_cached(e, o);
+    _update_map_cache_stats();
   } else {
     dout(10) << "add_map " << e << " already have it" << dendl;
+    delete o;
   }
   return map_cache[e];
 }
 
+void OSD::_note_map_cached(epoch_t e, const OSDMap *o)
+{
+  assert(map_cache_lock.is_locked());
+  pair<uint64_t,vector<const void*> >& u = map_cache_usage[e];
+  u.first = o->get_mem_usage(&u.second, &map_cache_part_bytes);
+  map_cache_bytes += u.first;
+  for (vector<const void*>::iterator p = u.second.begin();
+       p != u.second.end();
+       ++p)
+    if (map_cache_part_refs[*p]++ == 0)
+      map_cache_bytes += map_cache_part_bytes[*p];
+}
+
+void OSD::_note_map_uncached(epoch_t e)
+{
+  assert(map_cache_lock.is_locked());
+  map<epoch_t,pair<uint64_t,vector<const void*> > >::iterator u =
+    map_cache_usage.find(e);
+  if (u == map_cache_usage.end())
+    return;
+  map_cache_bytes -= u->second.first;
+  for (vector<const void*>::iterator p = u->second.second.begin();
+       p != u->second.second.end();
+       ++p) {
+    map<const void*,int>::iterator r = map_cache_part_refs.find(*p);
+    assert(r != map_cache_part_refs.end());
+    if (--r->second == 0) {
+      map_cache_bytes -= map_cache_part_bytes[*p];
+      map_cache_part_bytes.erase(*p);
+      map_cache_part_refs.erase(r);
+    }
+  }
+  map_cache_usage.erase(u);
+}
+
+void OSD::_update_map_cache_stats()
+{
+  assert(map_cache_lock.is_locked());
+  if (!logger)
+    return;
+  logger->set(l_osd_map_cache, map_cache.size());
+  logger->set(l_osd_map_cache_bytes, map_cache_bytes);
+}
+
+/*
+ * Decode a full map, and let it share whatever it has in common with
+ * the nearest cached epoch.
+ */
+OSDMap *OSD::decode_map(epoch_t e, bufferlist& bl)
+{
+  OSDMap *o = new OSDMap;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  o->decode(bl);
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  if (logger)
+    logger->finc(l_osd_map_decode_lat, lat);
+
+  Mutex::Locker l(map_cache_lock);
+  map<epoch_t,OSDMapRef>::iterator p = map_cache.lower_bound(e);
+  if (p == map_cache.end() && p != map_cache.begin())
+    --p;
+  if (p != map_cache.end()) {
+    dout(20) << "decode_map " << e << " in " << lat << ", dedup against "
+	     << p->first << dendl;
+    o->dedup(*p->second);
+  }
+  return o;
+}
+
 void OSD::add_map_bl(epoch_t e, bufferlist& bl)
 {
   Mutex::Locker l(map_cache_lock);
@@ -3892,16 +4658,57 @@ OSDMapRef OSD::get_map(epoch_t epoch)
     }
   }
 
-  OSDMap *map = new OSDMap;
-  if (epoch > 0) {
-    dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
-    bufferlist bl;
-    get_map_bl(epoch, bl);
-    map->decode(bl);
-  } else {
+  if (epoch == 0) {
+    OSDMap *map = new OSDMap;
     dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
+    return add_map(map);
   }
-  return add_map(map);
+
+  // walk back to a cached map or a stored full map...
+  OSDMapRef ref;
+  epoch_t e = epoch;
+  while (true) {
+    {
+      Mutex::Locker l(map_cache_lock);
+      map<epoch_t,OSDMapRef>::iterator p = map_cache.find(e);
+      if (p != map_cache.end()) {
+	ref = p->second;
+	break;
+      }
+    }
+    bufferlist bl;
+    if (e == 0) {
+      ref = add_map(new OSDMap);
+      break;
+    }
+    if (get_stored_map_bl(e, bl)) {
+      dout(20) << "get_map " << epoch << " - loading and decoding " << e << dendl;
+      ref = add_map(decode_map(e, bl));
+      break;
+    }
+    if (e <= superblock.oldest_map) {
+      derr << "get_map " << epoch << " - no full map at or before " << e
+	   << ", oldest " << superblock.oldest_map << dendl;
+      assert(0 == "missing an osdmap on disk");
+    }
+    e--;
+  }
+
+  // ...and roll forward through the incrementals
+  while (e < epoch) {
+    e++;
+    dout(20) << "get_map " << epoch << " - applying incremental " << e << dendl;
+    OSDMap::Incremental inc;
+    bool got = get_inc_map(e, inc);
+    assert(got);
+    OSDMap *o = new OSDMap(*ref);
+    int r = o->apply_incremental(inc);
+    assert(r == 0);
+    ref = add_map(o);
+    if (logger)
+      logger->inc(l_osd_map_rebuild);
+  }
+  return ref;
 }
 
 void OSD::trim_map_bl_cache(epoch_t oldest)
@@ -3925,14 +4732,21 @@ void OSD::trim_map_cache(epoch_t oldest)
     OSDMapRef o = map_cache.begin()->second;
     dout(10) << "trim_map_cache " << e << " " << o << dendl;
     map_cache.erase(map_cache.begin());
+    _note_map_uncached(e);
   }
+  _update_map_cache_stats();
 }
 
 void OSD::clear_map_cache()
 {
+  Mutex::Locker l(map_cache_lock);
   while (!map_cache.empty()) {
     map_cache.erase(map_cache.begin());
   }
+  map_cache_usage.clear();
+  map_cache_part_bytes.clear();
+  map_cache_part_refs.clear();
+  map_cache_bytes = 0;
 }
 
 bool OSD::get_inc_map(epoch_t e, OSDMap::Incremental &inc)
@@ -4125,14 +4939,8 @@ void OSD::split_pg(PG *parent, map<pg_t,PG*>& children, ObjectStore::Transaction
       t.collection_add(coll_t(pgid), coll_t(parentid), poid);
       t.collection_remove(coll_t(parentid), poid);
       if (oi.snaps.size()) {
-	snapid_t first = oi.snaps[0];
-	t.collection_add(coll_t(pgid, first), coll_t(parentid), poid);
-	t.collection_remove(coll_t(parentid, first), poid);
-	if (oi.snaps.size() > 1) {
-	  snapid_t last = oi.snaps[oi.snaps.size()-1];
-	  t.collection_add(coll_t(pgid, last), coll_t(parentid), poid);
-	  t.collection_remove(coll_t(parentid, last), poid);
-	}
+	parent->snap_mapper.remove_oid(t, poid, oi.snaps);
+	child->snap_mapper.add_oid(t, poid, oi.snaps);
       }
 
       // add to child stats
@@ -4352,7 +5160,7 @@ void OSD::do_notifies(map< int, vector<pg_info_t> >& notify_list,
 				       it->second,
 				       query_epoch);
     _share_map_outgoing(osdmap->get_cluster_inst(it->first));
-    cluster_messenger->send_message(m, osdmap->get_cluster_inst(it->first));
+    send_cluster_message(m, osdmap->get_cluster_inst(it->first));
   }
 }
 
@@ -4370,7 +5178,7 @@ void OSD::do_queries(map< int, map<pg_t,pg_query_t> >& query_map)
             << " on " << pit->second.size() << " PGs" << dendl;
     MOSDPGQuery *m = new MOSDPGQuery(osdmap->get_epoch(), pit->second);
     _share_map_outgoing(osdmap->get_cluster_inst(who));
-    cluster_messenger->send_message(m, osdmap->get_cluster_inst(who));
+    send_cluster_message(m, osdmap->get_cluster_inst(who));
   }
 }
 
@@ -4385,7 +5193,7 @@ void OSD::do_infos(map<int,MOSDPGInfo*>& info_map)
 	 ++i) {
       dout(20) << "Sending info " << *i << " to osd." << p->first << dendl;
     }
-    cluster_messenger->send_message(p->second, osdmap->get_cluster_inst(p->first));
+    send_cluster_message(p->second, osdmap->get_cluster_inst(p->first));
   }
   info_map.clear();
 }
@@ -4771,7 +5579,7 @@ void OSD::handle_pg_query(OpRequest *op)
 	MOSDPGLog *mlog = new MOSDPGLog(osdmap->get_epoch(), empty,
 					m->get_epoch());
 	_share_map_outgoing(osdmap->get_cluster_inst(from));
-	cluster_messenger->send_message(mlog,
+	send_cluster_message(mlog,
 					osdmap->get_cluster_inst(from));
       } else {
 	notify_list[from].push_back(empty);
@@ -4914,39 +5722,6 @@ void OSD::_remove_pg(PG *pg)
 
   ObjectStore::Transaction *rmt = new ObjectStore::Transaction;
 
-  // snap collections
-  for (interval_set<snapid_t>::iterator p = pg->snap_collections.begin();
-       p != pg->snap_collections.end();
-       p++) {
-    for (snapid_t cur = p.get_start();
-	 cur < p.get_start() + p.get_len();
-	 ++cur) {
-      vector<hobject_t> olist;      
-      store->collection_list(coll_t(pgid, cur), olist);
-      dout(10) << "_remove_pg " << pgid << " snap " << cur << " " << olist.size() << " objects" << dendl;
-      for (vector<hobject_t>::iterator q = olist.begin();
-	   q != olist.end();
-	   q++) {
-	ObjectStore::Transaction *t = new ObjectStore::Transaction;
-	t->remove(coll_t(pgid, cur), *q);
-	t->remove(coll_t(pgid), *q);          // we may hit this twice, but it's harmless
-	int tr = store->queue_transaction(&pg->osr, t);
-	assert(tr == 0);
-	
-	if ((++n & 0xff) == 0) {
-	  pg->unlock();
-	  pg->lock();
-	  if (!pg->deleting) {
-	    dout(10) << "_remove_pg aborted on " << *pg << dendl;
-	    pg->unlock();
-	    return;
-	  }
-	}
-      }
-      rmt->remove_collection(coll_t(pgid, cur));
-    }
-  }
-
   // (what remains of the) main collection
   vector<hobject_t> olist;
   store->collection_list(coll_t(pgid), olist);
@@ -4990,6 +5765,21 @@ void OSD::_remove_pg(PG *pg)
   {
     rmt->remove(coll_t::META_COLL, pg->log_oid);
     rmt->remove(coll_t::META_COLL, pg->biginfo_oid);
+    pg->snap_mapper.remove(*rmt);
+    // snap collections we or an older primary linked clones into
+    vector<coll_t> ls;
+    store->list_collections(ls);
+    for (vector<coll_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+      pg_t cpgid;
+      snapid_t snap;
+      if (!p->is_pg(cpgid, snap) || cpgid != pgid || snap == CEPH_NOSNAP)
+	continue;
+      vector<hobject_t> slist;
+      store->collection_list(*p, slist);
+      for (vector<hobject_t>::iterator q = slist.begin(); q != slist.end(); ++q)
+	rmt->collection_remove(*p, *q);
+      rmt->remove_collection(*p);
+    }
     rmt->remove_collection(coll_t(pgid));
     int tr = store->queue_transaction(NULL, rmt);
     assert(tr == 0);
@@ -5080,10 +5870,94 @@ bool OSD::_recover_now()
     dout(15) << "_recover_now defer until " << defer_recovery_until << dendl;
     return false;
   }
+  if (!recovery_bw_available())
+    return false;
+
+  return true;
+}
+
+/*
+ * Recovery bandwidth is metered in one second intervals.  New recovery
+ * ops are not started once the current interval's budget is spent; ops
+ * already in progress continue (bounded by osd_recovery_push_window),
+ * and tick() kicks the recovery queue when the next interval opens.
+ *
+ * If osd_recovery_client_latency_target is set, the budget backs off
+ * multiplicatively while client ops are slower than the target and
+ * grows back additively toward osd_recovery_max_bytes_per_sec.
+ */
+void OSD::_recovery_bw_roll(utime_t now)
+{
+  assert(recovery_bw_lock.is_locked());
+  if (now - recovery_bw_interval_start < utime_t(1, 0))
+    return;
+
+  uint64_t max = g_conf->osd_recovery_max_bytes_per_sec;
+  uint64_t min = MIN(g_conf->osd_recovery_min_bytes_per_sec, max);
+  if (max == 0) {
+    recovery_bw_budget = 0;
+  } else if (g_conf->osd_recovery_client_latency_target > 0 &&
+	     recovery_client_lat > g_conf->osd_recovery_client_latency_target) {
+    if (recovery_bw_budget == 0 || recovery_bw_budget > max)
+      recovery_bw_budget = max;
+    recovery_bw_budget = MAX(recovery_bw_budget / 2, min);
+    dout(10) << "_recovery_bw_roll client latency " << recovery_client_lat
+	     << " > target " << g_conf->osd_recovery_client_latency_target
+	     << ", budget now " << recovery_bw_budget << dendl;
+  } else {
+    recovery_bw_budget = MIN(recovery_bw_budget + max / 10, max);
+    if (recovery_bw_budget < min)
+      recovery_bw_budget = min;
+  }
+  logger->set(l_osd_rbudget, recovery_bw_budget);
 
+  recovery_bw_interval_start = now;
+  recovery_bw_interval_bytes = 0;
+}
+
+bool OSD::recovery_bw_available()
+{
+  Mutex::Locker l(recovery_bw_lock);
+  _recovery_bw_roll(ceph_clock_now(g_ceph_context));
+  if (recovery_bw_budget && recovery_bw_interval_bytes >= recovery_bw_budget) {
+    dout(15) << "recovery_bw_available spent " << recovery_bw_interval_bytes
+	     << " >= budget " << recovery_bw_budget << dendl;
+    return false;
+  }
   return true;
 }
 
+void OSD::note_recovery_bytes(uint64_t bytes)
+{
+  Mutex::Locker l(recovery_bw_lock);
+  _recovery_bw_roll(ceph_clock_now(g_ceph_context));
+  recovery_bw_interval_bytes += bytes;
+  logger->inc(l_osd_rbytes, bytes);
+}
+
+void OSD::note_recovery_push_sent(uint64_t bytes)
+{
+  Mutex::Locker l(recovery_bw_lock);
+  recovery_inflight_bytes += bytes;
+  logger->set(l_osd_rinflight, recovery_inflight_bytes);
+}
+
+void OSD::note_recovery_push_acked(uint64_t bytes)
+{
+  Mutex::Locker l(recovery_bw_lock);
+  assert(recovery_inflight_bytes >= bytes);
+  recovery_inflight_bytes -= bytes;
+  logger->set(l_osd_rinflight, recovery_inflight_bytes);
+}
+
+void OSD::note_client_op_latency(utime_t lat)
+{
+  if (g_conf->osd_recovery_client_latency_target <= 0)
+    return;
+  Mutex::Locker l(recovery_bw_lock);
+  recovery_client_lat = recovery_client_lat * .9 + (double)lat * .1;
+}
+
 void OSD::do_recovery(PG *pg)
 {
   // see how many we should try to start.  note that this is a bit racy.
@@ -5211,6 +6085,97 @@ void OSD::defer_recovery(PG *pg)
 }
 
 
+// =========================================================
+// object copies
+
+bool OSD::get_copy_slot(pg_t pgid, tid_t tid)
+{
+  Mutex::Locker l(copy_lock);
+  if ((int)copy_reads.size() >= g_conf->osd_copy_max_active) {
+    dout(15) << "get_copy_slot " << pgid << " tid " << tid << " waiting, "
+	     << copy_reads.size() << " reads in flight" << dendl;
+    if (find(copy_waiting_pgs.begin(), copy_waiting_pgs.end(), pgid) == copy_waiting_pgs.end())
+      copy_waiting_pgs.push_back(pgid);
+    return false;
+  }
+  copy_reads[tid] = pgid;
+  return true;
+}
+
+void OSD::put_copy_slot(tid_t tid)
+{
+  Mutex::Locker l(copy_lock);
+  copy_reads.erase(tid);
+}
+
+bool OSD::get_copy_bytes(pg_t pgid, uint64_t bytes)
+{
+  Mutex::Locker l(copy_lock);
+  if (copy_bytes && copy_bytes + bytes > g_conf->osd_copy_max_bytes) {
+    dout(15) << "get_copy_bytes " << pgid << " " << bytes << " waiting, "
+	     << copy_bytes << " bytes taken" << dendl;
+    if (find(copy_waiting_pgs.begin(), copy_waiting_pgs.end(), pgid) == copy_waiting_pgs.end())
+      copy_waiting_pgs.push_back(pgid);
+    return false;
+  }
+  copy_bytes += bytes;
+  return true;
+}
+
+void OSD::put_copy_bytes(uint64_t bytes)
+{
+  Mutex::Locker l(copy_lock);
+  assert(copy_bytes >= bytes);
+  copy_bytes -= bytes;
+}
+
+void OSD::kick_copy_waiters()
+{
+  assert(osd_lock.is_locked());
+  list<pg_t> ls;
+  {
+    Mutex::Locker l(copy_lock);
+    if ((int)copy_reads.size() >= g_conf->osd_copy_max_active)
+      return;
+    ls.swap(copy_waiting_pgs);
+  }
+  for (list<pg_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    if (!_have_pg(*p))
+      continue;
+    PG *pg = _lookup_lock_pg(*p);
+    pg->kick_copy_ops();
+    pg->unlock();
+  }
+}
+
+void OSD::handle_copy_get_reply(MOSDOpReply *m)
+{
+  pg_t pgid;
+  {
+    Mutex::Locker l(copy_lock);
+    map<tid_t, pg_t>::iterator p = copy_reads.find(m->get_tid());
+    if (p == copy_reads.end()) {
+      dout(10) << "handle_copy_get_reply " << *m << " not expected, dropping" << dendl;
+      m->put();
+      return;
+    }
+    pgid = p->second;
+    copy_reads.erase(p);
+  }
+
+  if (_have_pg(pgid)) {
+    PG *pg = _lookup_lock_pg(pgid);
+    pg->handle_copy_get_reply(m);
+    pg->unlock();
+  } else {
+    dout(10) << "handle_copy_get_reply " << *m << " for missing pg " << pgid << dendl;
+  }
+  m->put();
+
+  kick_copy_waiters();
+}
+
+
 // =========================================================
 // OPS
 
@@ -5232,6 +6197,7 @@ void OSD::reply_op_error(OpRequest *op, int err, eversion_t v)
   if (m->get_source().is_osd())
     msgr = cluster_messenger;
   msgr->send_message(reply, m->get_connection());
+  op->mark_event("reply_sent");
   op->put();
 }
 
@@ -5384,6 +6350,13 @@ bool OSD::op_has_sufficient_caps(PG *pg, MOSDOp *op)
     return false;
   }
   OSDCaps& caps = session->caps;
+  // copy-from reads an osd sends on its own behalf may touch any pool
+  if ((op->get_flags() & CEPH_OSD_FLAG_INTERNAL) &&
+      session->entity_name.get_type() == CEPH_ENTITY_TYPE_OSD) {
+    dout(20) << "op_has_sufficient_caps internal op from " << session->entity_name << dendl;
+    session->put();
+    return true;
+  }
   session->put();
 
   int perm = caps.get_pool_cap(pg->pool->name, pg->pool->auid);
@@ -5407,6 +6380,23 @@ bool OSD::op_has_sufficient_caps(PG *pg, MOSDOp *op)
   return true;
 }
 
+bool OSD::op_may_read_pool(MOSDOp *op, const string& pool_name, uint64_t auid)
+{
+  Session *session = (Session *)op->get_connection()->get_priv();
+  if (!session) {
+    dout(0) << "op_may_read_pool: no session for op " << *op << dendl;
+    return false;
+  }
+  OSDCaps& caps = session->caps;
+  session->put();
+
+  string name = pool_name;
+  int perm = caps.get_pool_cap(name, auid);
+  dout(20) << "op_may_read_pool pool " << pool_name << " owner=" << auid
+	   << " perm=" << perm << dendl;
+  return perm & OSD_POOL_CAP_R;
+}
+
 void OSD::handle_sub_op(OpRequest *op)
 {
   MOSDSubOp *m = (MOSDSubOp*)op->request;
@@ -5447,6 +6437,34 @@ void OSD::handle_sub_op(OpRequest *op)
   pg->put();
 }
 
+void OSD::handle_sub_op_batch(MOSDSubOpBatch *m)
+{
+  dout(10) << "handle_sub_op_batch " << *m << " from " << m->get_source_inst() << dendl;
+  if (!m->get_source().is_osd()) {
+    dout(0) << "handle_sub_op_batch from non-osd " << m->get_source_inst() << dendl;
+    m->put();
+    return;
+  }
+
+  // dispatch each as if it came in on its own
+  list<Message*> ls;
+  ls.swap(m->msgs);
+  for (list<Message*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    Message *sub = *p;
+    if (sub->get_type() != MSG_OSD_SUBOP &&
+	sub->get_type() != MSG_OSD_SUBOPREPLY) {
+      dout(0) << "handle_sub_op_batch dropping unexpected " << *sub << dendl;
+      sub->put();
+      continue;
+    }
+    sub->get_header().src = m->get_header().src;
+    sub->set_connection(m->get_connection()->get());
+    sub->set_recv_stamp(m->get_recv_stamp());
+    _dispatch(sub);
+  }
+  m->put();
+}
+
 void OSD::handle_sub_op_reply(OpRequest *op)
 {
   MOSDSubOpReply *m = (MOSDSubOpReply*)op->request;
@@ -30,6 +30,7 @@
 
 #include "common/DecayCounter.h"
 #include "osd/ClassHandler.h"
+#include "osd/OpRequest.h"
 
 #include "include/CompatSet.h"
 
@@ -87,6 +88,10 @@ enum {
   l_osd_push_outb,
 
   l_osd_rop,
+  l_osd_rbytes,
+  l_osd_robj,
+  l_osd_rinflight,
+  l_osd_rbudget,
 
   l_osd_loadavg,
   l_osd_buf,
@@ -100,6 +105,22 @@ enum {
   l_osd_map,
   l_osd_mape,
   l_osd_mape_dup,
+  l_osd_map_cache,
+  l_osd_map_cache_bytes,
+  l_osd_map_decode_lat,
+  l_osd_map_rebuild,
+  l_osd_pg_adv,
+  l_osd_pg_adv_skip,
+  l_osd_map_adv_lat,
+  l_osd_subop_batch,
+  l_osd_subop_batched,
+
+  l_osd_op_stage_queue_lat,    // received -> reached pg
+  l_osd_op_stage_pg_lat,       // reached pg -> started (waiting on objects, etc.)
+  l_osd_op_stage_journal_lat,  // journal submit -> local commit
+  l_osd_op_stage_apply_lat,    // journal submit -> applied
+  l_osd_op_stage_replica_lat,  // sub ops sent -> last replica commit
+  l_osd_op_stage_reply_lat,    // started -> last reply sent
 
   l_osd_last,
 };
@@ -113,6 +134,7 @@ class OSDMap;
 class MLog;
 class MClass;
 class MOSDPGMissing;
+class MOSDSubOpBatch;
 
 class Watch;
 class Notification;
@@ -122,6 +144,7 @@ class AuthAuthorizeHandlerRegistry;
 
 class OpRequest;
 class OpsFlightSocketHook;
+class StartupTimingsSocketHook;
 
 extern const coll_t meta_coll;
 
@@ -195,6 +218,14 @@ public:
     getline(ss, s);
     return hobject_t(sobject_t(object_t(s.c_str()), 0));
   }
+
+  hobject_t make_pg_snap_mapper_oid(pg_t pg) {
+    stringstream ss;
+    ss << "pgsnapmap_" << pg;
+    string s;
+    getline(ss, s);
+    return hobject_t(sobject_t(object_t(s.c_str()), 0));
+  }
   
 
 private:
@@ -281,7 +312,42 @@ private:
     }
   } heartbeat_thread;
 
+  // -- sub op batching --
+  /*
+   * Replication sub ops and their replies are queued here rather than
+   * sent directly.  A thread sends whatever has piled up for each peer
+   * as one MOSDSubOpBatch; whatever is queued while it is sending goes
+   * out in the next round.  Everything else sent to a peer goes through
+   * send_cluster_message(), which first sends what is queued for that
+   * peer, so messages to a peer stay in order.
+   */
+  Mutex subop_send_lock;   // held while sending anything to a peer
+  Mutex subop_batch_lock;  // protects the below
+  Cond subop_batch_cond;
+  bool subop_batch_stop;
+  utime_t subop_batch_since;  // when the oldest queued message was queued
+  map<entity_addr_t, pair<entity_inst_t, list<Message*> > > subop_batch;
+
+  void _send_subop_batch(const entity_inst_t& inst, list<Message*>& ls);
+  void _flush_subop_batch(const entity_addr_t& addr);
+  void subop_batch_entry();
+  void handle_sub_op_batch(MOSDSubOpBatch *m);
+
+  struct T_SubOpBatch : public Thread {
+    OSD *osd;
+    T_SubOpBatch(OSD *o) : osd(o) {}
+    void *entry() {
+      osd->subop_batch_entry();
+      return 0;
+    }
+  } subop_batch_thread;
+
 public:
+  void queue_cluster_message(Message *m, const entity_inst_t& inst);
+  void send_cluster_message(Message *m, const entity_inst_t& inst);
+  void lazy_send_cluster_message(Message *m, const entity_inst_t& inst);
+  void send_cluster_message(Message *m, Connection *con);
+
   bool heartbeat_dispatch(Message *m);
 
   struct HeartbeatDispatcher : public Dispatcher {
@@ -337,12 +403,27 @@ private:
   Mutex ops_in_flight_lock;
   void register_inflight_op(xlist<OpRequest*>::item *i);
   void check_ops_in_flight();
-  void unregister_inflight_op(xlist<OpRequest*>::item *i);
+  void unregister_inflight_op(OpRequest *op);
   void dump_ops_in_flight(ostream& ss);
+
+  /// the slowest ops of the last osd_op_history_duration seconds, by duration
+  multimap<double, OpHistoryEntry> op_history;
+  void log_op_stages(OpRequest *op, utime_t now);
+  void dump_historic_ops(ostream& ss);
   friend struct OpRequest;
   friend class OpsFlightSocketHook;
   OpsFlightSocketHook *admin_ops_hook;
 
+  // -- startup timings --
+  Mutex startup_timings_lock;
+  utime_t startup_start;
+  vector<pair<string,pair<utime_t,utime_t> > > startup_timings;  // phase -> (end, duration)
+  bool boot_noted;
+  void note_startup_phase(const char *phase);
+  void dump_startup_timings(ostream& ss);
+  friend class StartupTimingsSocketHook;
+  StartupTimingsSocketHook *admin_startup_hook;
+
   // -- op queue --
   deque<PG*> op_queue;
   int op_queue_len;
@@ -405,6 +486,7 @@ private:
   void note_up_osd(int osd);
   
   void advance_map(ObjectStore::Transaction& t, C_Contexts *tfin);
+  void advance_pgs(bool last, uint64_t *delivered, uint64_t *skipped);
   void activate_map(ObjectStore::Transaction& t, list<Context*>& tfin);
 
   // osd map cache (past osd maps)
@@ -412,9 +494,18 @@ private:
   map<epoch_t,bufferlist> map_inc_bl;
   map<epoch_t,bufferlist> map_bl;
   Mutex map_cache_lock;
+  // memory accounting for map_cache; shared parts count once
+  uint64_t map_cache_bytes;
+  map<epoch_t,pair<uint64_t,vector<const void*> > > map_cache_usage;
+  map<const void*,uint64_t> map_cache_part_bytes;
+  map<const void*,int> map_cache_part_refs;
 
   OSDMapRef get_map(epoch_t e);
   OSDMapRef add_map(OSDMap *o);
+  OSDMap *decode_map(epoch_t e, bufferlist& bl);
+  void _note_map_cached(epoch_t e, const OSDMap *o);
+  void _note_map_uncached(epoch_t e);
+  void _update_map_cache_stats();
   void add_map_bl(epoch_t e, bufferlist& bl);
   void add_map_inc_bl(epoch_t e, bufferlist& bl);
   void trim_map_cache(epoch_t oldest);
@@ -422,6 +513,7 @@ private:
   void clear_map_cache();
 
   bool get_map_bl(epoch_t e, bufferlist& bl);
+  bool get_stored_map_bl(epoch_t e, bufferlist& bl);
   bool get_inc_map_bl(epoch_t e, bufferlist& bl);
   bool get_inc_map(epoch_t e, OSDMap::Incremental &inc);
   
@@ -459,6 +551,7 @@ protected:
 		       C_Contexts **pfin);
   
   void load_pgs();
+  void build_past_intervals();
   void calc_priors_during(pg_t pgid, epoch_t start, epoch_t end, set<int>& pset);
   void project_pg_history(pg_t pgid, pg_history_t& h, epoch_t from,
 			  vector<int>& lastup, vector<int>& lastacting);
@@ -544,22 +637,35 @@ protected:
   void send_still_alive(entity_inst_t i);
 
   // -- pg stats --
+  //
+  // Once the mon has acked a pg's stats, later reports for that pg are
+  // sent as deltas against them.  Counter-only changes are reported
+  // every get_pg_stats_interval(), which grows with the mon's ack
+  // latency, and not while the mon still owes us an ack; pgs whose
+  // state or mapping changed (urgent) are reported on the next tick.
   Mutex pg_stat_queue_lock;
   Cond pg_stat_queue_cond;
   xlist<PG*> pg_stat_queue;
+  bool pg_stat_queue_urgent;
   bool osd_stat_updated;
   uint64_t pg_stat_tid, pg_stat_tid_flushed;
+  map<uint64_t,utime_t> pg_stat_unacked;  // tid -> sent
+  double pg_stat_ack_latency;             // smoothed, seconds
+  bool mon_accepts_pg_stat_delta;
 
-  void send_pg_stats(const utime_t &now);
+  double get_pg_stats_interval() const;
+  void send_pg_stats(const utime_t &now, bool all=false);
   void handle_pg_stats_ack(class MPGStatsAck *ack);
   void flush_pg_stats();
 
-  void pg_stat_queue_enqueue(PG *pg) {
+  void pg_stat_queue_enqueue(PG *pg, bool urgent=false) {
     pg_stat_queue_lock.Lock();
     if (pg->is_primary() && !pg->stat_queue_item.is_on_list()) {
       pg->get();
       pg_stat_queue.push_back(&pg->stat_queue_item);
     }
+    if (urgent)
+      pg_stat_queue_urgent = true;
     osd_stat_updated = true;
     pg_stat_queue_lock.Unlock();
   }
@@ -746,6 +852,51 @@ protected:
   void do_recovery(PG *pg);
   bool _recover_now();
 
+  // -- recovery bandwidth --
+  Mutex recovery_bw_lock;
+  utime_t recovery_bw_interval_start;
+  uint64_t recovery_bw_interval_bytes;  ///< recovery bytes moved this interval
+  uint64_t recovery_bw_budget;          ///< current bytes/sec allowance; 0 = unlimited
+  double recovery_client_lat;           ///< decaying average of client op latency
+  uint64_t recovery_inflight_bytes;     ///< pushed but not yet acked
+
+  void _recovery_bw_roll(utime_t now);
+  bool recovery_bw_available();
+  void note_recovery_bytes(uint64_t bytes);
+  void note_recovery_push_sent(uint64_t bytes);
+  void note_recovery_push_acked(uint64_t bytes);
+  void note_client_op_latency(utime_t lat);
+
+  // -- object copies --
+  Mutex copy_lock;
+  map<tid_t, pg_t> copy_reads;   ///< copy-from reads in flight -> destination pg
+  list<pg_t> copy_waiting_pgs;   ///< pgs waiting for a free read slot or bytes
+  uint64_t copy_bytes;           ///< osd_copy_max_bytes taken by copies in progress
+
+  /**
+   * Take one of the osd_copy_max_active slots for a copy-from read
+   *
+   * If none is free, the pg is kicked (kick_copy_ops()) once one is.
+   *
+   * @return false if we are at the limit
+   */
+  bool get_copy_slot(pg_t pgid, tid_t tid);
+  /// Give up a slot taken for tid (the read was cancelled)
+  void put_copy_slot(tid_t tid);
+  /**
+   * Reserve room to buffer a whole object being copied
+   *
+   * A copy holds its reservation until it is written out, so copies
+   * that got one always finish.  One copy may go over the limit when
+   * nothing else holds any.
+   *
+   * @return false (and kick the pg later) if there isn't room
+   */
+  bool get_copy_bytes(pg_t pgid, uint64_t bytes);
+  void put_copy_bytes(uint64_t bytes);
+  void kick_copy_waiters();
+  void handle_copy_get_reply(class MOSDOpReply *m);
+
   Mutex remove_list_lock;
   map<epoch_t, map<int, vector<pg_t> > > remove_list;
 
@@ -1076,6 +1227,8 @@ private:
   bool op_is_discardable(class MOSDOp *m);
   /// check if op has sufficient caps
   bool op_has_sufficient_caps(PG *pg, class MOSDOp *m);
+  /// check if op may read another pool (e.g. the source of a copy)
+  bool op_may_read_pool(class MOSDOp *m, const string& pool_name, uint64_t auid);
   /// check if op should be (re)queued for processing
   bool op_is_queueable(PG *pg, OpRequest *op);
   /// check if subop should be (re)queued for processing
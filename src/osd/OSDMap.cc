@@ -16,6 +16,7 @@
 
 #include "common/config.h"
 #include "common/Formatter.h"
+#include "common/Thread.h"
 #include "include/ceph_features.h"
 
 #include "common/code_environment.h"
@@ -429,6 +430,7 @@ bool OSDMap::is_blacklisted(const entity_addr_t& a) const
 
 void OSDMap::set_max_osd(int m)
 {
+  pg_mapping_valid = false;
   int o = max_osd;
   max_osd = m;
   osd_state.resize(m);
@@ -438,9 +440,10 @@ void OSDMap::set_max_osd(int m)
     osd_weight[o] = CEPH_OSD_OUT;
   }
   osd_info.resize(m);
-  osd_addr.resize(m);
-  osd_cluster_addr.resize(m);
-  osd_hb_addr.resize(m);
+  _cow(osd_addrs);
+  osd_addrs->client_addr.resize(m);
+  osd_addrs->cluster_addr.resize(m);
+  osd_addrs->hb_addr.resize(m);
 
   calc_num_osds();
 }
@@ -488,6 +491,8 @@ int OSDMap::apply_incremental(Incremental &inc)
   }
 
   // nope, incremental.
+  bool pg_mapping_was_valid = pg_mapping_valid;
+
   if (inc.new_flags >= 0)
     flags = inc.new_flags;
 
@@ -497,18 +502,20 @@ int OSDMap::apply_incremental(Incremental &inc)
   if (inc.new_pool_max != -1)
     pool_max = inc.new_pool_max;
 
+  if (!inc.old_pools.empty() || !inc.new_pools.empty())
+    _cow(pools);
   for (set<int64_t>::iterator p = inc.old_pools.begin();
        p != inc.old_pools.end();
        p++) {
-    pools.erase(*p);
+    pools->erase(*p);
     name_pool.erase(pool_name[*p]);
     pool_name.erase(*p);
   }
   for (map<int64_t,pg_pool_t>::iterator p = inc.new_pools.begin();
        p != inc.new_pools.end();
        p++) {
-    pools[p->first] = p->second;
-    pools[p->first].last_change = epoch;
+    (*pools)[p->first] = p->second;
+    (*pools)[p->first].last_change = epoch;
   }
   for (map<int64_t,string>::iterator p = inc.new_pool_names.begin();
        p != inc.new_pool_names.end();
@@ -538,21 +545,23 @@ int OSDMap::apply_incremental(Incremental &inc)
     }
     osd_state[i->first] ^= s;
   }
+  if (!inc.new_up_client.empty() || !inc.new_up_internal.empty())
+    _cow(osd_addrs);
   for (map<int32_t,entity_addr_t>::iterator i = inc.new_up_client.begin();
        i != inc.new_up_client.end();
        i++) {
     osd_state[i->first] |= CEPH_OSD_EXISTS | CEPH_OSD_UP;
-    osd_addr[i->first] = i->second;
+    osd_addrs->client_addr[i->first] = i->second;
     if (inc.new_hb_up.empty())
-      osd_hb_addr[i->first] = i->second;	//this is a backward-compatibility hack
+      osd_addrs->hb_addr[i->first] = i->second;	//this is a backward-compatibility hack
     else
-      osd_hb_addr[i->first] = inc.new_hb_up[i->first];
+      osd_addrs->hb_addr[i->first] = inc.new_hb_up[i->first];
     osd_info[i->first].up_from = epoch;
   }
   for (map<int32_t,entity_addr_t>::iterator i = inc.new_up_internal.begin();
        i != inc.new_up_internal.end();
        i++)
-    osd_cluster_addr[i->first] = i->second;
+    osd_addrs->cluster_addr[i->first] = i->second;
   // info
   for (map<int32_t,epoch_t>::iterator i = inc.new_up_thru.begin();
        i != inc.new_up_thru.end();
@@ -597,13 +606,128 @@ int OSDMap::apply_incremental(Incremental &inc)
   // do new crush map last (after up/down stuff)
   if (inc.crush.length()) {
     bufferlist::iterator blp = inc.crush.begin();
-    crush.decode(blp);
+    crush.reset(new CrushWrapper);
+    crush->decode(blp);
   }
 
   calc_num_osds();
+
+  if (pg_mapping_enabled) {
+    // crush and weight changes can move any pg
+    if (!pg_mapping_was_valid ||
+	inc.crush.length() ||
+	inc.new_max_osd >= 0 ||
+	!inc.new_weight.empty())
+      _build_pg_mapping();
+    else
+      _update_pg_mapping(inc);
+  }
   return 0;
 }
 
+static bool bl_equal(bufferlist& a, bufferlist& b)
+{
+  return a.length() == b.length() &&
+    memcmp(a.c_str(), b.c_str(), a.length()) == 0;
+}
+
+void OSDMap::dedup(const OSDMap& o)
+{
+  if (crush != o.crush) {
+    bufferlist a, b;
+    crush->encode(a);
+    o.crush->encode(b);
+    if (bl_equal(a, b))
+      crush = o.crush;
+  }
+  if (pools != o.pools) {
+    bufferlist a, b;
+    ::encode(*pools, a, (uint64_t)-1);
+    ::encode(*o.pools, b, (uint64_t)-1);
+    if (bl_equal(a, b))
+      pools = o.pools;
+  }
+  if (osd_addrs != o.osd_addrs &&
+      osd_addrs->client_addr == o.osd_addrs->client_addr &&
+      osd_addrs->cluster_addr == o.osd_addrs->cluster_addr &&
+      osd_addrs->hb_addr == o.osd_addrs->hb_addr)
+    osd_addrs = o.osd_addrs;
+  for (map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::iterator p =
+	 pg_mapping.begin();
+       p != pg_mapping.end();
+       ++p) {
+    map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::const_iterator q =
+      o.pg_mapping.find(p->first);
+    if (q != o.pg_mapping.end() && q->second != p->second &&
+	q->second->same_as(*p->second))
+      p->second = q->second;
+  }
+}
+
+uint64_t OSDMap::get_mem_usage(vector<const void*> *parts,
+			       map<const void*,uint64_t> *part_bytes) const
+{
+  uint64_t bytes = sizeof(*this);
+  bytes += osd_state.capacity() +
+    osd_weight.capacity() * sizeof(__u32) +
+    osd_info.capacity() * sizeof(osd_info_t);
+  for (map<pg_t,vector<int> >::const_iterator p = pg_temp.begin();
+       p != pg_temp.end();
+       ++p)
+    bytes += sizeof(*p) + p->second.capacity() * sizeof(int);
+  bytes += blacklist.size() * sizeof(pair<entity_addr_t,utime_t>);
+  bytes += pg_mapping.size() *
+    sizeof(pair<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >);
+
+  parts->push_back(osd_addrs.get());
+  if (!part_bytes->count(osd_addrs.get()))
+    (*part_bytes)[osd_addrs.get()] = sizeof(addrs_s) +
+      (osd_addrs->client_addr.capacity() +
+       osd_addrs->cluster_addr.capacity() +
+       osd_addrs->hb_addr.capacity()) * sizeof(entity_addr_t);
+
+  parts->push_back(pools.get());
+  if (!part_bytes->count(pools.get())) {
+    uint64_t b = 0;
+    for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin();
+	 p != pools->end();
+	 ++p)
+      b += sizeof(*p) +
+	p->second.snaps.size() * sizeof(pair<snapid_t,pool_snap_info_t>) +
+	p->second.removed_snaps.num_intervals() * 2 * sizeof(snapid_t);
+    (*part_bytes)[pools.get()] = b;
+  }
+
+  parts->push_back(crush.get());
+  if (!part_bytes->count(crush.get())) {
+    bufferlist bl;
+    crush->encode(bl);
+    (*part_bytes)[crush.get()] = bl.length();  // close enough
+  }
+
+  for (map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::const_iterator p =
+	 pg_mapping.begin();
+       p != pg_mapping.end();
+       ++p) {
+    parts->push_back(p->second.get());
+    if (!part_bytes->count(p->second.get()))
+      (*part_bytes)[p->second.get()] = sizeof(pg_mapping_pool_t) +
+	p->second->rows.capacity() * sizeof(int32_t);
+  }
+  return bytes;
+}
+
+uint64_t OSDMap::get_mem_usage(set<const void*> *seen) const
+{
+  vector<const void*> parts;
+  map<const void*,uint64_t> part_bytes;
+  uint64_t bytes = get_mem_usage(&parts, &part_bytes);
+  for (vector<const void*>::iterator p = parts.begin(); p != parts.end(); ++p)
+    if (seen->insert(*p).second)
+      bytes += part_bytes[*p];
+  return bytes;
+}
+
 // serialize, unserialize
 void OSDMap::encode_client_old(bufferlist& bl) const
 {
@@ -617,10 +741,10 @@ void OSDMap::encode_client_old(bufferlist& bl) const
   ::encode(modified, bl);
 
   // for ::encode(pools, bl);
-  __u32 n = pools.size();
+  __u32 n = pools->size();
   ::encode(n, bl);
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
-       p != pools.end();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin();
+       p != pools->end();
        ++p) {
     n = p->first;
     ::encode(n, bl);
@@ -645,7 +769,7 @@ void OSDMap::encode_client_old(bufferlist& bl) const
   ::encode(max_osd, bl);
   ::encode(osd_state, bl);
   ::encode(osd_weight, bl);
-  ::encode(osd_addr, bl);
+  ::encode(osd_addrs->client_addr, bl);
 
   // for ::encode(pg_temp, bl);
   n = pg_temp.size();
@@ -660,7 +784,7 @@ void OSDMap::encode_client_old(bufferlist& bl) const
 
   // crush
   bufferlist cbl;
-  crush.encode(cbl);
+  crush->encode(cbl);
   ::encode(cbl, bl);
 }
 
@@ -680,7 +804,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ::encode(created, bl);
   ::encode(modified, bl);
 
-  ::encode(pools, bl, features);
+  ::encode(*pools, bl, features);
   ::encode(pool_name, bl);
   ::encode(pool_max, bl);
 
@@ -689,22 +813,22 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ::encode(max_osd, bl);
   ::encode(osd_state, bl);
   ::encode(osd_weight, bl);
-  ::encode(osd_addr, bl);
+  ::encode(osd_addrs->client_addr, bl);
 
   ::encode(pg_temp, bl);
 
   // crush
   bufferlist cbl;
-  crush.encode(cbl);
+  crush->encode(cbl);
   ::encode(cbl, bl);
 
   // extended
   __u16 ev = CEPH_OSDMAP_VERSION_EXT;
   ::encode(ev, bl);
-  ::encode(osd_hb_addr, bl);
+  ::encode(osd_addrs->hb_addr, bl);
   ::encode(osd_info, bl);
   ::encode(blacklist, bl);
-  ::encode(osd_cluster_addr, bl);
+  ::encode(osd_addrs->cluster_addr, bl);
   ::encode(cluster_snapshot_epoch, bl);
   ::encode(cluster_snapshot, bl);
 }
@@ -731,15 +855,15 @@ void OSDMap::decode(bufferlist::iterator& p)
   if (v < 4) {
     ::decode(max_pools, p);
   }
+  pools.reset(new map<int64_t,pg_pool_t>);
   if (v < 6) {
-    pools.clear();
     ::decode(n, p);
     while (n--) {
       ::decode(t, p);
-      ::decode(pools[t], p);
+      ::decode((*pools)[t], p);
     }
   } else {
-    ::decode(pools, p);
+    ::decode(*pools, p);
   }
   if (v == 5) {
     pool_name.clear();
@@ -765,7 +889,8 @@ void OSDMap::decode(bufferlist::iterator& p)
   ::decode(max_osd, p);
   ::decode(osd_state, p);
   ::decode(osd_weight, p);
-  ::decode(osd_addr, p);
+  osd_addrs.reset(new addrs_s);
+  ::decode(osd_addrs->client_addr, p);
   if (v <= 5) {
     pg_temp.clear();
     ::decode(n, p);
@@ -782,22 +907,23 @@ void OSDMap::decode(bufferlist::iterator& p)
   bufferlist cbl;
   ::decode(cbl, p);
   bufferlist::iterator cblp = cbl.begin();
-  crush.decode(cblp);
+  crush.reset(new CrushWrapper);
+  crush->decode(cblp);
 
   // extended
   __u16 ev = 0;
   if (v >= 5)
     ::decode(ev, p);
-  ::decode(osd_hb_addr, p);
+  ::decode(osd_addrs->hb_addr, p);
   ::decode(osd_info, p);
   if (v < 5)
     ::decode(pool_name, p);
 
   ::decode(blacklist, p);
   if (ev >= 6)
-    ::decode(osd_cluster_addr, p);
+    ::decode(osd_addrs->cluster_addr, p);
   else
-    osd_cluster_addr.resize(osd_addr.size());
+    osd_addrs->cluster_addr.resize(osd_addrs->client_addr.size());
 
   if (ev >= 7) {
     ::decode(cluster_snapshot_epoch, p);
@@ -810,6 +936,249 @@ void OSDMap::decode(bufferlist::iterator& p)
     name_pool[i->second] = i->first;
 
   calc_num_osds();
+
+  pg_mapping_valid = false;
+  if (pg_mapping_enabled)
+    _build_pg_mapping();
+}
+
+
+// ----------------------------------
+// precomputed pg mappings
+
+class OSDMap::PGMappingThread : public Thread {
+  OSDMap *osdmap;
+  unsigned which, num;
+public:
+  PGMappingThread(OSDMap *m, unsigned w, unsigned n)
+    : osdmap(m), which(w), num(n) {}
+  void *entry() {
+    osdmap->_build_pg_mapping_part(*osdmap->crush, which, num);
+    return 0;
+  }
+};
+
+void OSDMap::enable_pg_mapping(int threads)
+{
+  pg_mapping_enabled = true;
+  pg_mapping_threads = MAX(threads, 1);
+  _build_pg_mapping();
+}
+
+void OSDMap::disable_pg_mapping()
+{
+  pg_mapping_enabled = false;
+  pg_mapping_valid = false;
+  pg_mapping.clear();
+}
+
+void OSDMap::copy_pg_mapping(const OSDMap& o)
+{
+  assert(epoch == o.epoch);
+  if (!o.pg_mapping_enabled)
+    return;
+  pg_mapping_enabled = true;
+  pg_mapping_threads = o.pg_mapping_threads;
+  pg_mapping = o.pg_mapping;
+  pg_mapping_valid = o.pg_mapping_valid;
+  pg_mapping_build_time = o.pg_mapping_build_time;
+}
+
+unsigned OSDMap::get_pg_mapping_num_pgs() const
+{
+  unsigned n = 0;
+  for (map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::const_iterator p =
+	 pg_mapping.begin();
+       p != pg_mapping.end();
+       ++p)
+    n += p->second->pg_num;
+  return n;
+}
+
+uint64_t OSDMap::get_pg_mapping_bytes(set<const void*> *seen) const
+{
+  uint64_t bytes = 0;
+  for (map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::const_iterator p =
+	 pg_mapping.begin();
+       p != pg_mapping.end();
+       ++p) {
+    bytes += sizeof(*p);
+    if (seen && !seen->insert(p->second.get()).second)
+      continue;
+    bytes += sizeof(pg_mapping_pool_t) +
+      p->second->rows.capacity() * sizeof(int32_t);
+  }
+  return bytes;
+}
+
+void OSDMap::_calc_pg_mapping_row(const CrushWrapper& c, const pg_pool_t& pool,
+				  pg_t pg, int32_t *row, bool calc_raw) const
+{
+  unsigned size = pool.get_size();
+  vector<int> raw, up, acting;
+  if (calc_raw) {
+    _pg_to_osds(c, pool, pg, raw);
+    assert(raw.size() <= size);
+    row[0] = raw.size();
+    copy(raw.begin(), raw.end(), row + 1);
+  } else {
+    _pg_mapping_row_get(row, size, raw);
+  }
+  row += size + 1;
+
+  _raw_to_up_osds(pg, raw, up);
+  row[0] = up.size();
+  copy(up.begin(), up.end(), row + 1);
+  row += size + 1;
+
+  if (!_raw_to_temp_osds(pool, pg, raw, acting))
+    acting = up;
+  if (acting.size() > size) {
+    row[0] = -1;  // pg_temp is wider than the pool; map on demand
+    return;
+  }
+  row[0] = acting.size();
+  copy(acting.begin(), acting.end(), row + 1);
+}
+
+void OSDMap::_build_pg_mapping_part(const CrushWrapper& c, unsigned which,
+				    unsigned num)
+{
+  for (map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::iterator p =
+	 pg_mapping.begin();
+       p != pg_mapping.end();
+       ++p) {
+    const pg_pool_t& pool = pools->find(p->first)->second;
+    pg_mapping_pool_t& t = *p->second;
+    for (ps_t ps = which; ps < t.pg_num; ps += num)
+      _calc_pg_mapping_row(c, pool, pg_t(ps, p->first, -1), t.get_row(ps), true);
+  }
+}
+
+void OSDMap::_build_pg_mapping()
+{
+  utime_t start = ceph_clock_now(NULL);
+
+  pg_mapping.clear();
+  unsigned num_pgs = 0;
+  for (map<int64_t,pg_pool_t>::iterator p = pools->begin();
+       p != pools->end();
+       ++p) {
+    pg_mapping[p->first].reset(new pg_mapping_pool_t(p->second));
+    num_pgs += p->second.get_pg_num();
+  }
+
+  // a thread is only worth it for a reasonable number of pgs
+  unsigned num = MIN((unsigned)pg_mapping_threads, num_pgs / 1024);
+  if (num < 1)
+    num = 1;
+  vector<PGMappingThread*> threads;
+  for (unsigned i = 1; i < num; i++) {
+    threads.push_back(new PGMappingThread(this, i, num));
+    threads.back()->create();
+  }
+  _build_pg_mapping_part(*crush, 0, num);
+  for (vector<PGMappingThread*>::iterator p = threads.begin();
+       p != threads.end();
+       ++p) {
+    (*p)->join();
+    delete *p;
+  }
+
+  pg_mapping_valid = true;
+  pg_mapping_build_time = ceph_clock_now(NULL) - start;
+}
+
+void OSDMap::_recalc_pg_mapping_acting(pg_t pg)
+{
+  if (pg.preferred() >= 0)
+    return;
+  map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::iterator p =
+    pg_mapping.find(pg.pool());
+  if (p == pg_mapping.end() || pg.ps() >= p->second->pg_num)
+    return;
+  _cow(p->second);
+  _calc_pg_mapping_row(*crush, pools->find(pg.pool())->second, pg,
+		       p->second->get_row(pg.ps()), false);
+}
+
+/*
+ * Tables are shared with the map we were copied from, so only the
+ * pools with rows that actually change are copied.
+ */
+void OSDMap::_update_pg_mapping(const Incremental& inc)
+{
+  for (set<int64_t>::const_iterator p = inc.old_pools.begin();
+       p != inc.old_pools.end();
+       ++p)
+    pg_mapping.erase(*p);
+
+  // new pools, or pools whose placement changed, are mapped from scratch
+  set<int64_t> remapped;
+  for (map<int64_t,pg_pool_t>::const_iterator p = inc.new_pools.begin();
+       p != inc.new_pools.end();
+       ++p) {
+    const pg_pool_t& pool = pools->find(p->first)->second;
+    std::tr1::shared_ptr<pg_mapping_pool_t>& t = pg_mapping[p->first];
+    if (t && t->matches(pool))
+      continue;  // e.g. snap or owner change
+    t.reset(new pg_mapping_pool_t(pool));
+    for (ps_t ps = 0; ps < t->pg_num; ps++)
+      _calc_pg_mapping_row(*crush, pool, pg_t(ps, p->first, -1), t->get_row(ps),
+			   true);
+    remapped.insert(p->first);
+  }
+
+  // osds going up or down change the up and acting sets of the pgs
+  // that map to them, but not the raw crush output.
+  set<int> changed;
+  for (map<int32_t,uint8_t>::const_iterator p = inc.new_state.begin();
+       p != inc.new_state.end();
+       ++p)
+    changed.insert(p->first);
+  for (map<int32_t,entity_addr_t>::const_iterator p = inc.new_up_client.begin();
+       p != inc.new_up_client.end();
+       ++p)
+    changed.insert(p->first);
+
+  if (!changed.empty()) {
+    for (map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::iterator p =
+	   pg_mapping.begin();
+	 p != pg_mapping.end();
+	 ++p) {
+      if (remapped.count(p->first))
+	continue;
+      const pg_pool_t& pool = pools->find(p->first)->second;
+      for (ps_t ps = 0; ps < p->second->pg_num; ps++) {
+	const int32_t *row = p->second->get_row(ps);
+	for (int i = 0; i < row[0]; i++) {
+	  if (changed.count(row[i + 1])) {
+	    _cow(p->second);
+	    _calc_pg_mapping_row(*crush, pool, pg_t(ps, p->first, -1),
+				 p->second->get_row(ps), false);
+	    break;
+	  }
+	}
+      }
+    }
+    for (map<pg_t,vector<int> >::iterator p = pg_temp.begin();
+	 p != pg_temp.end();
+	 ++p) {
+      for (unsigned i = 0; i < p->second.size(); i++) {
+	if (changed.count(p->second[i])) {
+	  _recalc_pg_mapping_acting(p->first);
+	  break;
+	}
+      }
+    }
+  }
+
+  for (map<pg_t,vector<int32_t> >::const_iterator p = inc.new_pg_temp.begin();
+       p != inc.new_pg_temp.end();
+       ++p)
+    _recalc_pg_mapping_acting(p->first);
+
+  pg_mapping_valid = true;
 }
 
 
@@ -834,7 +1203,7 @@ void OSDMap::dump(Formatter *f) const
   f->dump_int("max_osd", get_max_osd());
 
   f->open_array_section("pools");
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     f->open_object_section("pool");
     f->dump_int("pool", p->first);
     p->second.dump(f);
@@ -937,7 +1306,7 @@ void OSDMap::print(ostream& out) const
     out << "cluster_snapshot " << get_cluster_snapshot() << "\n";
   out << "\n";
 
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     std::string name("<unknown>");
     map<int64_t,string>::const_iterator pni = pool_name.find(p->first);
     if (pni != pool_name.end())
@@ -1004,10 +1373,10 @@ void OSDMap::print_tree(ostream& out) const
   out << "# id\tweight\ttype name\tup/down\treweight\n";
   set<int> touched;
   set<int> roots;
-  crush.find_roots(roots);
+  crush->find_roots(roots);
   for (set<int>::iterator p = roots.begin(); p != roots.end(); p++) {
     list<qi> q;
-    q.push_back(qi(*p, 0, crush.get_bucket_weight(*p) / (float)0x10000));
+    q.push_back(qi(*p, 0, crush->get_bucket_weight(*p) / (float)0x10000));
     while (!q.empty()) {
       int cur = q.front().item;
       int depth = q.front().depth;
@@ -1025,14 +1394,14 @@ void OSDMap::print_tree(ostream& out) const
 	continue;
       }
 
-      int type = crush.get_bucket_type(cur);
-      out << crush.get_type_name(type) << " " << crush.get_item_name(cur) << "\n";
+      int type = crush->get_bucket_type(cur);
+      out << crush->get_type_name(type) << " " << crush->get_item_name(cur) << "\n";
 
       // queue bucket contents...
-      int s = crush.get_bucket_size(cur);
+      int s = crush->get_bucket_size(cur);
       for (int k=s-1; k>=0; k--)
-	q.push_front(qi(crush.get_bucket_item(cur, k), depth+1,
-			(float)crush.get_bucket_item_weight(cur, k) / (float)0x10000));
+	q.push_front(qi(crush->get_bucket_item(cur, k), depth+1,
+			(float)crush->get_bucket_item_weight(cur, k) / (float)0x10000));
     }
   }
 
@@ -1075,6 +1444,7 @@ void OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
   created = modified = ceph_clock_now(cct);
 
   set_max_osd(nosd);
+  _cow(pools);
 
   // pgp_num <= pg_num
   if (pgp_bits > pg_bits)
@@ -1090,21 +1460,22 @@ void OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
 
   for (map<int,const char*>::iterator p = rulesets.begin(); p != rulesets.end(); p++) {
     int64_t pool = ++pool_max;
-    pools[pool].type = pg_pool_t::TYPE_REP;
-    pools[pool].size = cct->_conf->osd_pool_default_size;
-    pools[pool].crush_ruleset = p->first;
-    pools[pool].object_hash = CEPH_STR_HASH_RJENKINS;
-    pools[pool].pg_num = poolbase << pg_bits;
-    pools[pool].pgp_num = poolbase << pgp_bits;
-    pools[pool].lpg_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
-    pools[pool].lpgp_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
-    pools[pool].last_change = epoch;
+    (*pools)[pool].type = pg_pool_t::TYPE_REP;
+    (*pools)[pool].size = cct->_conf->osd_pool_default_size;
+    (*pools)[pool].crush_ruleset = p->first;
+    (*pools)[pool].object_hash = CEPH_STR_HASH_RJENKINS;
+    (*pools)[pool].pg_num = poolbase << pg_bits;
+    (*pools)[pool].pgp_num = poolbase << pgp_bits;
+    (*pools)[pool].lpg_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
+    (*pools)[pool].lpgp_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
+    (*pools)[pool].last_change = epoch;
     if (p->first == CEPH_DATA_RULE)
-      pools[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
+      (*pools)[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
     pool_name[pool] = p->second;
   }
 
-  build_simple_crush_map(cct, crush, rulesets, nosd);
+  crush.reset(new CrushWrapper);
+  build_simple_crush_map(cct, *crush, rulesets, nosd);
 
   for (int i=0; i<nosd; i++) {
     set_state(i, 0);
@@ -1190,6 +1561,7 @@ void OSDMap::build_simple_from_conf(CephContext *cct, epoch_t e, uuid_d &fsid,
   }
 
   set_max_osd(maxosd + 1);
+  _cow(pools);
 
   // pgp_num <= pg_num
   if (pgp_bits > pg_bits)
@@ -1203,21 +1575,22 @@ void OSDMap::build_simple_from_conf(CephContext *cct, epoch_t e, uuid_d &fsid,
 
   for (map<int,const char*>::iterator p = rulesets.begin(); p != rulesets.end(); p++) {
     int64_t pool = ++pool_max;
-    pools[pool].type = pg_pool_t::TYPE_REP;
-    pools[pool].size = cct->_conf->osd_pool_default_size;
-    pools[pool].crush_ruleset = p->first;
-    pools[pool].object_hash = CEPH_STR_HASH_RJENKINS;
-    pools[pool].pg_num = (maxosd + 1) << pg_bits;
-    pools[pool].pgp_num = (maxosd + 1) << pgp_bits;
-    pools[pool].lpg_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
-    pools[pool].lpgp_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
-    pools[pool].last_change = epoch;
+    (*pools)[pool].type = pg_pool_t::TYPE_REP;
+    (*pools)[pool].size = cct->_conf->osd_pool_default_size;
+    (*pools)[pool].crush_ruleset = p->first;
+    (*pools)[pool].object_hash = CEPH_STR_HASH_RJENKINS;
+    (*pools)[pool].pg_num = (maxosd + 1) << pg_bits;
+    (*pools)[pool].pgp_num = (maxosd + 1) << pgp_bits;
+    (*pools)[pool].lpg_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
+    (*pools)[pool].lpgp_num = lpg_bits ? (1 << (lpg_bits-1)) : 0;
+    (*pools)[pool].last_change = epoch;
     if (p->first == CEPH_DATA_RULE)
-      pools[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
+      (*pools)[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
     pool_name[pool] = p->second;
   }
 
-  build_simple_crush_map_from_conf(cct, crush, rulesets);
+  crush.reset(new CrushWrapper);
+  build_simple_crush_map_from_conf(cct, *crush, rulesets);
 
   for (int i=0; i<=maxosd; i++) {
     set_state(i, 0);
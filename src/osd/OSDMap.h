@@ -167,14 +167,24 @@ private:
   int num_osd;         // not saved
   int32_t max_osd;
   vector<uint8_t> osd_state;
-  vector<entity_addr_t> osd_addr;
-  vector<entity_addr_t> osd_cluster_addr;
-  vector<entity_addr_t> osd_hb_addr;
+
+  /*
+   * The larger, rarely changing parts of the map are held by
+   * reference so that consecutive epochs (and maps deduplicated with
+   * dedup()) can share them.  Anything that modifies one of them must
+   * _cow() it first.
+   */
+  struct addrs_s {
+    vector<entity_addr_t> client_addr;
+    vector<entity_addr_t> cluster_addr;
+    vector<entity_addr_t> hb_addr;
+  };
+  std::tr1::shared_ptr<addrs_s> osd_addrs;
   vector<__u32>   osd_weight;   // 16.16 fixed point, 0x10000 = "in", 0 = "out"
   vector<osd_info_t> osd_info;
   map<pg_t,vector<int> > pg_temp;  // temp pg mapping (e.g. while we rebuild)
 
-  map<int64_t,pg_pool_t> pools;
+  std::tr1::shared_ptr< map<int64_t,pg_pool_t> > pools;
   map<int64_t,string> pool_name;
   map<string,int64_t> name_pool;
 
@@ -183,8 +193,81 @@ private:
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  /*
+   * Precomputed pg -> osd mappings (not encoded).
+   *
+   * For each pool we keep one fixed-width row per pg holding its raw,
+   * up and acting sets:
+   *
+   *   raw_len raw[size] up_len up[size] acting_len acting[size]
+   *
+   * An acting_len of -1 means the pg_temp set does not fit and has to
+   * be computed on the fly.  The rows remember the pool parameters they
+   * were computed with so that a stale pool table is never used.
+   */
+  struct pg_mapping_pool_t {
+    unsigned pg_num, pgp_num, size;
+    int ruleset;
+    unsigned type;
+    vector<int32_t> rows;
+
+    pg_mapping_pool_t() : pg_num(0), pgp_num(0), size(0), ruleset(0), type(0) {}
+    explicit pg_mapping_pool_t(const pg_pool_t& pool)
+      : pg_num(pool.get_pg_num()), pgp_num(pool.get_pgp_num()),
+	size(pool.get_size()), ruleset(pool.get_crush_ruleset()),
+	type(pool.get_type()), rows(pg_num * row_width()) {}
+
+    unsigned row_width() const { return 3 * (size + 1); }
+    bool matches(const pg_pool_t& pool) const {
+      return pg_num == pool.get_pg_num() && pgp_num == pool.get_pgp_num() &&
+	size == pool.get_size() && ruleset == pool.get_crush_ruleset() &&
+	type == pool.get_type();
+    }
+    bool same_as(const pg_mapping_pool_t& o) const {
+      return pg_num == o.pg_num && pgp_num == o.pgp_num && size == o.size &&
+	ruleset == o.ruleset && type == o.type && rows == o.rows;
+    }
+    int32_t *get_row(ps_t ps) { return &rows[ps * row_width()]; }
+    const int32_t *get_row(ps_t ps) const { return &rows[ps * row_width()]; }
+  };
+  map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> > pg_mapping;
+  bool pg_mapping_enabled;  // keep pg_mapping current across decode/apply_incremental
+  bool pg_mapping_valid;    // pg_mapping matches this map
+  int pg_mapping_threads;
+  utime_t pg_mapping_build_time;  // duration of the last full build
+
+  class PGMappingThread;
+
+  void _build_pg_mapping();
+  void _build_pg_mapping_part(const CrushWrapper& c, unsigned which, unsigned num);
+  void _update_pg_mapping(const Incremental& inc);
+  void _recalc_pg_mapping_acting(pg_t pg);
+  void _calc_pg_mapping_row(const CrushWrapper& c, const pg_pool_t& pool,
+			    pg_t pg, int32_t *row, bool calc_raw) const;
+  const int32_t *_get_pg_mapping_row(const pg_pool_t& pool, pg_t pg) const {
+    if (!pg_mapping_valid || pg.preferred() >= 0)
+      return NULL;
+    map<int64_t,std::tr1::shared_ptr<pg_mapping_pool_t> >::const_iterator p =
+      pg_mapping.find(pg.pool());
+    if (p == pg_mapping.end() || !p->second->matches(pool))
+      return NULL;
+    return p->second->get_row(pool.raw_pg_to_pg(pg).ps());
+  }
+  static const int32_t *_pg_mapping_row_get(const int32_t *row, unsigned size,
+					    vector<int>& v) {
+    v.assign(row + 1, row + 1 + row[0]);
+    return row + size + 1;
+  }
+
+  /// make p private to this map before modifying it
+  template<typename T>
+  static void _cow(std::tr1::shared_ptr<T>& p) {
+    if (!p.unique())
+      p.reset(new T(*p));
+  }
+
  public:
-  CrushWrapper     crush;       // hierarchical map
+  std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
   friend class OSDMonitor;
   friend class PGMonitor;
@@ -195,8 +278,13 @@ private:
 	     pool_max(-1),
 	     flags(0),
 	     num_osd(0), max_osd(0),
-	     cluster_snapshot_epoch(0) { 
+	     cluster_snapshot_epoch(0),
+	     pg_mapping_enabled(false), pg_mapping_valid(false),
+	     pg_mapping_threads(1),
+	     crush(new CrushWrapper) {
     memset(&fsid, 0, sizeof(fsid));
+    osd_addrs.reset(new addrs_s);
+    pools.reset(new map<int64_t,pg_pool_t>);
   }
 
   // map info
@@ -208,8 +296,9 @@ private:
 
   void set_epoch(epoch_t e) {
     epoch = e;
-    for (map<int64_t,pg_pool_t>::iterator p = pools.begin();
-	 p != pools.end();
+    _cow(pools);
+    for (map<int64_t,pg_pool_t>::iterator p = pools->begin();
+	 p != pools->end();
 	 p++)
       p->second.last_change = e;
   }
@@ -281,6 +370,7 @@ private:
     return osd_state[o];
   }
   void set_state(int o, unsigned s) {
+    pg_mapping_valid = false;
     assert(o < max_osd);
     osd_state[o] = s;
   }
@@ -289,6 +379,7 @@ private:
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
+    pg_mapping_valid = false;
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
@@ -324,8 +415,8 @@ private:
   }
   
   int identify_osd(const entity_addr_t& addr) const {
-    for (unsigned i=0; i<osd_addr.size(); i++)
-      if ((osd_addr[i] == addr) || (osd_cluster_addr[i] == addr))
+    for (unsigned i=0; i<osd_addrs->client_addr.size(); i++)
+      if ((osd_addrs->client_addr[i] == addr) || (osd_addrs->cluster_addr[i] == addr))
 	return i;
     return -1;
   }
@@ -333,8 +424,8 @@ private:
     return identify_osd(addr) >= 0;
   }
   bool find_osd_on_ip(const entity_addr_t& ip) const {
-    for (unsigned i=0; i<osd_addr.size(); i++)
-      if (osd_addr[i].is_same_host(ip) || osd_cluster_addr[i].is_same_host(ip))
+    for (unsigned i=0; i<osd_addrs->client_addr.size(); i++)
+      if (osd_addrs->client_addr[i].is_same_host(ip) || osd_addrs->cluster_addr[i].is_same_host(ip))
 	return i;
     return -1;
   }
@@ -343,34 +434,34 @@ private:
   }
   const entity_addr_t &get_addr(int osd) const {
     assert(exists(osd));
-    return osd_addr[osd];
+    return osd_addrs->client_addr[osd];
   }
   const entity_addr_t &get_cluster_addr(int osd) const {
     assert(exists(osd));
-    if (osd_cluster_addr[osd] == entity_addr_t())
+    if (osd_addrs->cluster_addr[osd] == entity_addr_t())
       return get_addr(osd);
-    return osd_cluster_addr[osd];
+    return osd_addrs->cluster_addr[osd];
   }
   const entity_addr_t &get_hb_addr(int osd) const {
     assert(exists(osd));
-    return osd_hb_addr[osd];
+    return osd_addrs->hb_addr[osd];
   }
   entity_inst_t get_inst(int osd) const {
     assert(exists(osd));
     assert(is_up(osd));
-    return entity_inst_t(entity_name_t::OSD(osd), osd_addr[osd]);
+    return entity_inst_t(entity_name_t::OSD(osd), osd_addrs->client_addr[osd]);
   }
   entity_inst_t get_cluster_inst(int osd) const {
     assert(exists(osd));
     assert(is_up(osd));
-    if (osd_cluster_addr[osd] == entity_addr_t())
+    if (osd_addrs->cluster_addr[osd] == entity_addr_t())
       return get_inst(osd);
-    return entity_inst_t(entity_name_t::OSD(osd), osd_cluster_addr[osd]);
+    return entity_inst_t(entity_name_t::OSD(osd), osd_addrs->cluster_addr[osd]);
   }
   entity_inst_t get_hb_inst(int osd) const {
     assert(exists(osd));
     assert(is_up(osd));
-    return entity_inst_t(entity_name_t::OSD(osd), osd_hb_addr[osd]);
+    return entity_inst_t(entity_name_t::OSD(osd), osd_addrs->hb_addr[osd]);
   }
 
   const epoch_t& get_up_from(int osd) const {
@@ -399,6 +490,33 @@ private:
 
   int apply_incremental(Incremental &inc);
 
+  /**
+   * Share any parts of o that are identical to ours
+   *
+   * Maps derived from their predecessor with apply_incremental()
+   * already share everything that did not change; this is for maps
+   * that were decoded on their own.
+   *
+   * @param [in] o a map of a nearby epoch
+   */
+  void dedup(const OSDMap& o);
+
+  /// approximate memory used, skipping shared parts already in *seen
+  uint64_t get_mem_usage(set<const void*> *seen) const;
+  /**
+   * approximate memory used by this map alone
+   *
+   * Shared parts are not counted; their addresses are appended to
+   * *parts, and those not yet in *part_bytes are sized and added, so
+   * a caller can account for each shared part once.
+   *
+   * @param [out] parts shared parts this map references
+   * @param [in,out] part_bytes known sizes of shared parts
+   * @return bytes used by the unshared part of the map
+   */
+  uint64_t get_mem_usage(vector<const void*> *parts,
+			 map<const void*,uint64_t> *part_bytes) const;
+
   // serialize, unserialize
 private:
   void encode_client_old(bufferlist& bl) const;
@@ -463,25 +581,29 @@ public:
 
   // pg -> (osd list)
 private:
-  int _pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const {
+  int _pg_to_osds(const CrushWrapper& c, const pg_pool_t& pool, pg_t pg,
+		  vector<int>& osds) const {
     // map to osds[]
     ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
     unsigned size = pool.get_size();
     {
       int preferred = pg.preferred();
-      if (preferred >= max_osd || preferred >= crush.get_max_devices())
+      if (preferred >= max_osd || preferred >= c.get_max_devices())
 	preferred = -1;
 
-      assert(get_max_osd() >= crush.get_max_devices());
+      assert(get_max_osd() >= c.get_max_devices());
 
       // what crush rule?
-      int ruleno = crush.find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+      int ruleno = c.find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
       if (ruleno >= 0)
-	crush.do_rule(ruleno, pps, osds, size, preferred, osd_weight);
+	c.do_rule(ruleno, pps, osds, size, preferred, osd_weight);
     }
   
     return osds.size();
   }
+  int _pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const {
+    return _pg_to_osds(*crush, pool, pg, osds);
+  }
 
   // pg -> (up osd list)
   void _raw_to_up_osds(pg_t pg, vector<int>& raw, vector<int>& up) const {
@@ -513,6 +635,11 @@ public:
     const pg_pool_t *pool = get_pg_pool(pg.pool());
     if (!pool)
       return 0;
+    const int32_t *row = _get_pg_mapping_row(*pool, pg);
+    if (row) {
+      _pg_mapping_row_get(row, pool->get_size(), raw);
+      return raw.size();
+    }
     return _pg_to_osds(*pool, pg, raw);
   }
 
@@ -521,7 +648,17 @@ public:
     if (!pool)
       return 0;
     vector<int> raw;
-    _pg_to_osds(*pool, pg, raw);
+    const int32_t *row = _get_pg_mapping_row(*pool, pg);
+    if (row) {
+      row = _pg_mapping_row_get(row, pool->get_size(), raw);
+      row += pool->get_size() + 1;  // skip up
+      if (row[0] >= 0) {
+	_pg_mapping_row_get(row, pool->get_size(), acting);
+	return acting.size();
+      }
+    } else {
+      _pg_to_osds(*pool, pg, raw);
+    }
     if (!_raw_to_temp_osds(*pool, pg, raw, acting))
       _raw_to_up_osds(pg, raw, acting);
     return acting.size();
@@ -532,6 +669,12 @@ public:
     if (!pool)
       return;
     vector<int> raw;
+    const int32_t *row = _get_pg_mapping_row(*pool, pg);
+    if (row) {
+      row += pool->get_size() + 1;  // skip raw
+      _pg_mapping_row_get(row, pool->get_size(), up);
+      return;
+    }
     _pg_to_osds(*pool, pg, raw);
     _raw_to_up_osds(pg, raw, up);
   }
@@ -541,19 +684,75 @@ public:
     if (!pool)
       return;
     vector<int> raw;
+    const int32_t *row = _get_pg_mapping_row(*pool, pg);
+    if (row) {
+      row = _pg_mapping_row_get(row, pool->get_size(), raw);
+      row = _pg_mapping_row_get(row, pool->get_size(), up);
+      if (row[0] >= 0)
+	_pg_mapping_row_get(row, pool->get_size(), acting);
+      else if (!_raw_to_temp_osds(*pool, pg, raw, acting))
+	acting = up;
+      return;
+    }
     _pg_to_osds(*pool, pg, raw);
     _raw_to_up_osds(pg, raw, up);
     if (!_raw_to_temp_osds(*pool, pg, raw, acting))
       acting = up;
   }
 
+  /**
+   * Calculate a pg mapping with crush, ignoring any precomputed table
+   *
+   * @param [in] pg pg to map
+   * @param [out] raw crush output
+   * @param [out] up up subset of raw
+   * @param [out] acting acting set (pg_temp or up)
+   */
+  void calc_pg_mapping(pg_t pg, vector<int>& raw, vector<int>& up,
+		       vector<int>& acting) const {
+    const pg_pool_t *pool = get_pg_pool(pg.pool());
+    if (!pool)
+      return;
+    _pg_to_osds(*pool, pg, raw);
+    _raw_to_up_osds(pg, raw, up);
+    if (!_raw_to_temp_osds(*pool, pg, raw, acting))
+      acting = up;
+  }
+
+  /**
+   * Keep a precomputed table of pg mappings
+   *
+   * Builds the table now and keeps it current across decode() and
+   * apply_incremental(); the latter only recalculates the pgs whose
+   * inputs changed.  Other mutators (set_state, set_weight, ...)
+   * invalidate it until the next decode or incremental.  Changes to
+   * crush must go through apply_incremental().
+   *
+   * @param [in] threads number of threads to use for full builds
+   */
+  void enable_pg_mapping(int threads=1);
+  void disable_pg_mapping();
+  bool has_pg_mapping() const {
+    return pg_mapping_enabled && pg_mapping_valid;
+  }
+  /// adopt the table from o, an identical map (e.g., one we decoded from)
+  void copy_pg_mapping(const OSDMap& o);
+  /// number of pgs with precomputed mappings
+  unsigned get_pg_mapping_num_pgs() const;
+  /// memory used by the table, skipping pool tables already in *seen
+  uint64_t get_pg_mapping_bytes(set<const void*> *seen=NULL) const;
+  /// duration of the last full build
+  const utime_t& get_pg_mapping_build_time() const {
+    return pg_mapping_build_time;
+  }
+
   int64_t lookup_pg_pool_name(const char *name) {
     if (name_pool.count(name))
       return name_pool[name];
     return -ENOENT;
   }
 
-  const map<int64_t,pg_pool_t>& get_pools() { return pools; }
+  const map<int64_t,pg_pool_t>& get_pools() const { return *pools; }
   const char *get_pool_name(int64_t p) const {
     map<int64_t, string>::const_iterator i = pool_name.find(p);
     if (i != pool_name.end())
@@ -561,28 +760,28 @@ public:
     return 0;
   }
   bool have_pg_pool(int64_t p) const {
-    return pools.count(p);
+    return pools->count(p);
   }
   const pg_pool_t* get_pg_pool(int64_t p) const {
-    map<int64_t, pg_pool_t>::const_iterator i = pools.find(p);
-    if (i != pools.end())
+    map<int64_t, pg_pool_t>::const_iterator i = pools->find(p);
+    if (i != pools->end())
       return &i->second;
     return NULL;
   }
   unsigned get_pg_size(pg_t pg) const {
-    map<int64_t,pg_pool_t>::const_iterator p = pools.find(pg.pool());
-    assert(p != pools.end());
+    map<int64_t,pg_pool_t>::const_iterator p = pools->find(pg.pool());
+    assert(p != pools->end());
     return p->second.get_size();
   }
   int get_pg_type(pg_t pg) const {
-    assert(pools.count(pg.pool()));
-    return pools.find(pg.pool())->second.get_type();
+    assert(pools->count(pg.pool()));
+    return pools->find(pg.pool())->second.get_type();
   }
 
 
   pg_t raw_pg_to_pg(pg_t pg) const {
-    assert(pools.count(pg.pool()));
-    return pools.find(pg.pool())->second.raw_pg_to_pg(pg);
+    assert(pools->count(pg.pool()));
+    return pools->find(pg.pool())->second.raw_pg_to_pg(pg);
   }
 
   // pg -> primary osd
@@ -0,0 +1,118 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sstream>
+
+#include "OSD.h"
+#include "OpRequest.h"
+
+#include "common/Formatter.h"
+#include "common/config.h"
+
+static void dump_events(const list<pair<utime_t, string> > &events, utime_t start,
+			Formatter *f)
+{
+  f->open_array_section("events");
+  for (list<pair<utime_t, string> >::const_iterator p = events.begin();
+       p != events.end();
+       ++p) {
+    f->open_object_section("event");
+    f->dump_stream("time") << p->first;
+    f->dump_float("since_received", p->first - start);
+    f->dump_string("event", p->second);
+    f->close_section();
+  }
+  f->close_section();
+}
+
+void OpHistoryEntry::dump(Formatter *f) const
+{
+  f->dump_string("description", description);
+  f->dump_stream("received_at") << received_time;
+  f->dump_float("duration", duration);
+  dump_events(events, received_time, f);
+}
+
+
+OpRequest::OpRequest(Message *req, OSD *o)
+  : request(req), xitem(this),
+    warn_interval_multiplier(1),
+    osd(o), hit_flag_points(0), latest_flag_point(0),
+    lock("OpRequest::lock")
+{
+  received_time = request->get_recv_stamp();
+  events.push_back(make_pair(received_time, string("received")));
+}
+
+OpRequest::~OpRequest()
+{
+  if (osd)
+    osd->unregister_inflight_op(this);
+  if (request) {
+    request->put();
+  }
+}
+
+void OpRequest::mark_event(const string &event)
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  Mutex::Locker l(lock);
+  events.push_back(make_pair(now, event));
+}
+
+bool OpRequest::get_event_stamp(const string &prefix, bool last, utime_t *stamp) const
+{
+  Mutex::Locker l(lock);
+  bool found = false;
+  for (list<pair<utime_t, string> >::const_iterator p = events.begin();
+       p != events.end();
+       ++p) {
+    if (p->second.compare(0, prefix.length(), prefix) == 0) {
+      *stamp = p->first;
+      found = true;
+      if (!last)
+	break;
+    }
+  }
+  return found;
+}
+
+void OpRequest::dump(utime_t now, Formatter *f) const
+{
+  stringstream name;
+  request->print(name);
+  f->dump_string("description", name.str());
+  f->dump_stream("received_at") << received_time;
+  f->dump_float("age", now - received_time);
+  f->dump_string("flag_point", state_string());
+  if (request->get_orig_source().is_client()) {
+    f->open_object_section("client_info");
+    stringstream client_name;
+    client_name << request->get_orig_source();
+    f->dump_string("client", client_name.str());
+    f->dump_int("tid", request->get_tid());
+    f->close_section();
+  }
+  Mutex::Locker l(lock);
+  dump_events(events, received_time, f);
+}
+
+void OpRequest::get_history_entry(utime_t now, OpHistoryEntry *e) const
+{
+  stringstream name;
+  request->print(name);
+  e->description = name.str();
+  e->received_time = received_time;
+  e->duration = now - received_time;
+  Mutex::Locker l(lock);
+  e->events = events;
+}
@@ -14,12 +14,41 @@
 #ifndef OPREQUEST_H_
 #define OPREQUEST_H_
 
+#include <list>
+#include <string>
+
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+#include "include/utime.h"
+#include "include/xlist.h"
+#include "msg/Message.h"
+
+class OSD;
+
+/**
+ * A finished op, as kept in the OSD's history of slow ops.
+ */
+struct OpHistoryEntry {
+  string description;
+  utime_t received_time;
+  double duration;
+  list<pair<utime_t, string> > events;
+
+  OpHistoryEntry() : duration(0) {}
+  void dump(Formatter *f) const;
+};
+
 /**
  * The OpRequest takes in a Message* and takes over a single reference
  * to it, which it puts() when destroyed.
  * OpRequest is itself ref-counted. The expectation is that you get a Message
  * you want to track, create an OpRequest with it, and then pass around that OpRequest
  * the way you used to pass around the Message.
+ *
+ * Along the way the op collects a timeline of named events (see
+ * mark_event()); it is dumped with the ops in flight, and when the op
+ * finishes the OSD turns it into per-stage latencies and, if the op
+ * was slow, keeps it in its history.
  */
 struct OpRequest : public RefCountedObject {
   Message *request;
@@ -36,19 +65,15 @@ private:
   static const uint8_t flag_started =     1 << 3;
   static const uint8_t flag_sub_op_sent = 1 << 4;
 
+  mutable Mutex lock;  ///< protects events
+  list<pair<utime_t, string> > events;
+
 public:
-  OpRequest() : request(NULL), xitem(this) {}
-  OpRequest(Message *req, OSD *o) : request(req), xitem(this),
-      warn_interval_multiplier(1),
-      osd(o) {
-    received_time = request->get_recv_stamp();
-  }
-  ~OpRequest() {
-    osd->unregister_inflight_op(&xitem);
-    if (request) {
-      request->put();
-    }
-  }
+  OpRequest() : request(NULL), xitem(this), warn_interval_multiplier(1),
+		osd(NULL), hit_flag_points(0), latest_flag_point(0),
+		lock("OpRequest::lock") {}
+  OpRequest(Message *req, OSD *o);
+  ~OpRequest();
 
   bool been_queued_for_pg() { return hit_flag_points & flag_queued_for_pg; }
   bool been_reached_pg() { return hit_flag_points & flag_reached_pg; }
@@ -61,7 +86,7 @@ public:
   bool currently_started() { return latest_flag_point & flag_started; }
   bool currently_sub_op_sent() { return latest_flag_point & flag_sub_op_sent; }
 
-  const char *state_string() {
+  const char *state_string() const {
     switch(latest_flag_point) {
     case flag_queued_for_pg: return "queued for pg";
     case flag_reached_pg: return "reached pg";
@@ -73,26 +98,45 @@ public:
     return "no flag points reached";
   }
 
+  /// add a point to the op's timeline
+  void mark_event(const string &event);
+
   void mark_queued_for_pg() {
     hit_flag_points |= flag_queued_for_pg;
     latest_flag_point = flag_queued_for_pg;
+    mark_event("queued_for_pg");
   }
   void mark_reached_pg() {
     hit_flag_points |= flag_reached_pg;
     latest_flag_point = flag_reached_pg;
+    mark_event("reached_pg");
   }
-  void mark_delayed() {
+  void mark_delayed(const string &why = "delayed") {
     hit_flag_points |= flag_delayed;
     latest_flag_point = flag_delayed;
+    mark_event(why);
   }
   void mark_started() {
     hit_flag_points |= flag_started;
     latest_flag_point = flag_started;
+    mark_event("started");
   }
   void mark_sub_op_sent() {
     hit_flag_points |= flag_sub_op_sent;
     latest_flag_point = flag_sub_op_sent;
+    mark_event("sub_op_sent");
   }
+
+  /**
+   * Find when an event (or any event with that prefix) happened
+   *
+   * @param last the last such event rather than the first
+   * @return false if it never did
+   */
+  bool get_event_stamp(const string &prefix, bool last, utime_t *stamp) const;
+
+  void dump(utime_t now, Formatter *f) const;
+  void get_history_entry(utime_t now, OpHistoryEntry *e) const;
 };
 
 #endif /* OPREQUEST_H_ */
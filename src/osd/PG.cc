@@ -674,33 +674,102 @@ bool PG::needs_recovery() const
   return ret;
 }
 
-void PG::generate_past_intervals()
+/*
+ * Find the epochs past_intervals does not cover yet.
+ *
+ * Intervals are noted as they end (start_peering_interval) and persisted
+ * with the info, so normally only a prefix can be missing: the epochs
+ * before this osd started tracking the pg.
+ */
+bool PG::get_missing_past_interval_epochs(epoch_t *start, epoch_t *end)
 {
-  // Do we already have the intervals we want?
-  map<epoch_t,Interval>::const_iterator pif = past_intervals.begin();
-  if (pif != past_intervals.end()) {
-    if (pif->first <= info.history.last_epoch_clean) {
-      dout(10) << __func__ << ": already have past intervals back to "
-	       << info.history.last_epoch_clean << dendl;
-      return;
-    }
-    past_intervals.clear();
-  }
-
-  epoch_t first_epoch = 0;
   epoch_t stop = MAX(info.history.epoch_created, info.history.last_epoch_clean);
   if (stop < osd->superblock.oldest_map)
     stop = osd->superblock.oldest_map;   // this is a lower bound on last_epoch_clean cluster-wide.     
+
   epoch_t last_epoch = info.history.same_interval_since - 1;
+  if (!past_intervals.empty()) {
+    if (past_intervals.rbegin()->second.last != last_epoch) {
+      dout(10) << __func__ << ": past intervals end at "
+	       << past_intervals.rbegin()->second.last
+	       << " but same_interval_since is " << info.history.same_interval_since
+	       << ", regenerating" << dendl;
+      past_intervals.clear();
+    } else {
+      last_epoch = past_intervals.begin()->first - 1;
+    }
+  }
+
+  if (last_epoch + 1 <= stop)
+    return false;
+  *start = stop;
+  *end = last_epoch;
+  return true;
+}
 
-  if (last_epoch < stop) {
-    dout(10) << __func__ << " last_epoch " << last_epoch << " < oldest " << stop
-	     << ", nothing to do" << dendl;
+/*
+ * Note the interval [first,last], with lastmap being the map at epoch
+ * last.
+ */
+void PG::add_past_interval(epoch_t first, epoch_t last,
+			   vector<int>& up, vector<int>& acting,
+			   OSDMapRef lastmap)
+{
+  Interval &i = past_intervals[first];
+  i.first = first;
+  i.last = last;
+  i.up.swap(up);
+  i.acting.swap(acting);
+  if (i.acting.size()) {
+    if (lastmap->get_up_thru(i.acting[0]) >= first &&
+	lastmap->get_up_from(i.acting[0]) <= first) {
+      i.maybe_went_rw = true;
+      dout(10) << __func__ << " " << i
+	       << " : primary up " << lastmap->get_up_from(i.acting[0])
+	       << "-" << lastmap->get_up_thru(i.acting[0])
+	       << dendl;
+    } else if (info.history.last_epoch_clean >= first &&
+	       info.history.last_epoch_clean <= last) {
+      // If the last_epoch_clean is included in this interval, then
+      // the pg must have been rw (for recovery to have completed).
+      // This is important because we won't know the _real_
+      // first_epoch because we stop at last_epoch_clean, and we
+      // don't want the oldest interval to randomly have
+      // maybe_went_rw false depending on the relative up_thru vs
+      // last_epoch_clean timing.
+      i.maybe_went_rw = true;
+      dout(10) << __func__ << " " << i
+	       << " : includes last_epoch_clean " << info.history.last_epoch_clean
+	       << " and presumed to have been rw"
+	       << dendl;
+    } else {
+      i.maybe_went_rw = false;
+      dout(10) << __func__ << " " << i
+	       << " : primary up " << lastmap->get_up_from(i.acting[0])
+	       << "-" << lastmap->get_up_thru(i.acting[0])
+	       << " does not include interval"
+	       << dendl;
+    }
+  } else {
+    i.maybe_went_rw = false;
+    dout(10) << __func__ << " " << i << " : empty" << dendl;
+  }
+  dirty_info = true;
+}
+
+void PG::generate_past_intervals()
+{
+  // Do we already have the intervals we want?
+  epoch_t stop, last_epoch;
+  if (!get_missing_past_interval_epochs(&stop, &last_epoch)) {
+    dout(10) << __func__ << ": already have past intervals back to "
+	     << info.history.last_epoch_clean << dendl;
     return;
   }
 
   dout(10) << __func__ << " over epochs " << stop << "-" << last_epoch << dendl;
 
+  epoch_t first_epoch = 0;
   OSDMapRef nextmap = osd->get_map(last_epoch);
   for (;
        last_epoch >= stop;
@@ -718,45 +787,7 @@ void PG::generate_past_intervals()
 	break;
     }
 
-    Interval &i = past_intervals[first_epoch];
-    i.first = first_epoch;
-    i.last = last_epoch;
-    i.up.swap(tup);
-    i.acting.swap(tacting);
-    if (i.acting.size()) {
-      if (lastmap->get_up_thru(i.acting[0]) >= first_epoch &&
-	  lastmap->get_up_from(i.acting[0]) <= first_epoch) {
-	i.maybe_went_rw = true;
-	dout(10) << "generate_past_intervals " << i
-		 << " : primary up " << lastmap->get_up_from(i.acting[0])
-		 << "-" << lastmap->get_up_thru(i.acting[0])
-		 << dendl;
-      } else if (info.history.last_epoch_clean >= first_epoch &&
-		 info.history.last_epoch_clean <= last_epoch) {
-	// If the last_epoch_clean is included in this interval, then
-	// the pg must have been rw (for recovery to have completed).
-	// This is important because we won't know the _real_
-	// first_epoch because we stop at last_epoch_clean, and we
-	// don't want the oldest interval to randomly have
-	// maybe_went_rw false depending on the relative up_thru vs
-	// last_epoch_clean timing.
-	i.maybe_went_rw = true;
-	dout(10) << "generate_past_intervals " << i
-		 << " : includes last_epoch_clean " << info.history.last_epoch_clean
-		 << " and presumed to have been rw"
-		 << dendl;
-      } else {
-	i.maybe_went_rw = false;
-	dout(10) << "generate_past_intervals " << i
-		 << " : primary up " << lastmap->get_up_from(i.acting[0])
-		 << "-" << lastmap->get_up_thru(i.acting[0])
-		 << " does not include interval"
-		 << dendl;
-      }
-    } else {
-      i.maybe_went_rw = false;
-      dout(10) << "generate_past_intervals " << i << " : empty" << dendl;
-    }
+    add_past_interval(first_epoch, last_epoch, tup, tacting, lastmap);
   }
 }
 
@@ -790,6 +821,33 @@ bool PG::adjust_need_up_thru(const OSDMapRef osdmap)
   return false;
 }
 
+/*
+ * Can we skip handle_advance_map() for osdmap, given that our up and
+ * acting sets are the same as in lastmap?  Only changes to the pool or
+ * to the osds we are tracking matter, except while peering, where the
+ * prior set can involve anyone.
+ */
+bool PG::can_skip_advance_map(const OSDMapRef lastmap, const OSDMapRef osdmap,
+			      const set<int>& osds_changed) const
+{
+  const pg_pool_t *pi = osdmap->get_pg_pool(info.pgid.pool());
+  if (!pi || pi->get_last_change() == osdmap->get_epoch())
+    return false;
+  if (osds_changed.empty())
+    return true;
+  if (is_peering())
+    return false;
+
+  for (set<int>::const_iterator p = osds_changed.begin();
+       p != osds_changed.end();
+       ++p) {
+    if (is_acting(*p) || is_up(*p) || peer_info.count(*p) ||
+	std::find(want_acting.begin(), want_acting.end(), *p) != want_acting.end())
+      return false;
+  }
+  return true;
+}
+
 void PG::remove_down_peer_info(const OSDMapRef osdmap)
 {
   // Remove any downed osds from peer_info
@@ -1215,6 +1273,8 @@ void PG::activate(ObjectStore::Transaction& t, list<Context*>& tfin,
 
   need_up_thru = false;
 
+  check_legacy_snap_peers(t);
+
   // write pg info, log
   write_info(t);
   write_log(t);
@@ -1342,7 +1402,7 @@ void PG::activate(ObjectStore::Transaction& t, list<Context*>& tfin,
       if (m) {
 	dout(10) << "activate peer osd." << peer << " sending " << m->log << dendl;
 	//m->log.print(cout);
-	osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(peer));
+	osd->send_cluster_message(m, get_osdmap()->get_cluster_inst(peer));
       }
 
       // peer now has 
@@ -1477,7 +1537,7 @@ void PG::_activate_committed(epoch_t e, entity_inst_t& primary)
     pg_info_t i = info;
     i.history.last_epoch_started = e;
     m->pg_info.push_back(i);
-    osd->cluster_messenger->send_message(m, primary);
+    osd->send_cluster_message(m, primary);
   }
   unlock();
   put();
@@ -1702,6 +1762,7 @@ void PG::update_heartbeat_peers()
 
 void PG::update_stats()
 {
+  bool urgent = false;
   pg_stats_lock.Lock();
   if (is_primary()) {
     // update our stat summary
@@ -1756,7 +1817,9 @@ void PG::update_stats()
       pg_stats_stable.stats.sum.num_objects_unfound = get_num_unfound();
     }
 
-    dout(15) << "update_stats " << pg_stats_stable.reported << dendl;
+    urgent = pg_stats_urgent();
+    dout(15) << "update_stats " << pg_stats_stable.reported
+	     << (urgent ? " (urgent)" : "") << dendl;
   } else {
     pg_stats_valid = false;
     dout(15) << "update_stats -- not primary" << dendl;
@@ -1764,7 +1827,7 @@ void PG::update_stats()
   pg_stats_lock.Unlock();
 
   if (is_primary())
-    osd->pg_stat_queue_enqueue(this);
+    osd->pg_stat_queue_enqueue(this, urgent);
 }
 
 void PG::clear_stats()
@@ -1772,6 +1835,7 @@ void PG::clear_stats()
   dout(15) << "clear_stats" << dendl;
   pg_stats_lock.Lock();
   pg_stats_valid = false;
+  pg_stats_sent_acked = false;
   pg_stats_lock.Unlock();
 
   osd->pg_stat_queue_dequeue(this);
@@ -1807,6 +1871,7 @@ void PG::init(int role, vector<int>& newup, vector<int>& newacting, pg_history_t
 
   osd->reg_last_pg_scrub(info.pgid, info.history.last_scrub_stamp);
 
+  snap_mapper.create(*t);
   write_info(*t);
   write_log(*t);
 }
@@ -1917,7 +1982,7 @@ void PG::trim_peers()
   dout(10) << "trim_peers " << pg_trim_to << dendl;
   if (pg_trim_to != eversion_t()) {
     for (unsigned i=1; i<acting.size(); i++)
-      osd->cluster_messenger->send_message(new MOSDPGTrim(get_osdmap()->get_epoch(), info.pgid,
+      osd->send_cluster_message(new MOSDPGTrim(get_osdmap()->get_epoch(), info.pgid,
 						  pg_trim_to),
 				   get_osdmap()->get_cluster_inst(acting[i]));
   }
@@ -2335,40 +2400,124 @@ void PG::log_weirdness()
 		      << "\n";
 }
 
-coll_t PG::make_snap_collection(ObjectStore::Transaction& t, snapid_t s)
-{
-  coll_t c(info.pgid, s);
-  if (!snap_collections.contains(s)) {
-    snap_collections.insert(s);
-    dout(10) << "create_snap_collection " << c << ", set now " << snap_collections << dendl;
-    bufferlist bl;
-    ::encode(snap_collections, bl);
-    t.collection_setattr(coll, "snap_collections", bl);
-    t.create_collection(c);
+/*
+ * Older osds hard linked each clone into collections for its first
+ * and last snaps.  Map those clones into the snap mapper instead, and
+ * drop the collections.  Also creates the mapper for pgs that predate
+ * it.  With scan, also convert snap collections an older primary
+ * created that we never recorded.
+ */
+void PG::convert_snap_collections(ObjectStore::Transaction& t, bool scan)
+{
+  ObjectStore *store = osd->store;
+  if (!snap_mapper.exists(store))
+    snap_mapper.create(t);
+  if (scan) {
+    vector<coll_t> ls;
+    store->list_collections(ls);
+    for (vector<coll_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+      pg_t pgid;
+      snapid_t snap;
+      if (p->is_pg(pgid, snap) && pgid == info.pgid && snap != CEPH_NOSNAP &&
+	  !snap_collections.contains(snap))
+	snap_collections.insert(snap);
+    }
   }
-  return c;
+  if (snap_collections.empty())
+    return;
+
+  dout(10) << "converting snap collections " << snap_collections << dendl;
+  set<hobject_t> seen;
+  for (interval_set<snapid_t>::iterator p = snap_collections.begin();
+       p != snap_collections.end();
+       ++p) {
+    for (snapid_t cur = p.get_start();
+	 cur < p.get_start() + p.get_len();
+	 ++cur) {
+      coll_t c(info.pgid, cur);
+      vector<hobject_t> olist;
+      store->collection_list(c, olist);
+      for (vector<hobject_t>::iterator q = olist.begin(); q != olist.end(); ++q) {
+	t.collection_remove(c, *q);
+	if (!seen.insert(*q).second)
+	  continue;
+	bufferlist bv;
+	if (store->getattr(coll, *q, OI_ATTR, bv) < 0)
+	  continue;
+	object_info_t oi(bv);
+	snap_mapper.add_oid(t, *q, oi.snaps);
+      }
+      t.remove_collection(c);
+    }
+  }
+  dout(10) << "converted snap collections, " << seen.size() << " clones" << dendl;
+  snap_collections.clear();
+  write_info(t);
 }
 
-void PG::update_snap_collections(vector<pg_log_entry_t> &log_entries,
-				 ObjectStore::Transaction &t)
+/*
+ * Osds without CEPH_FEATURE_OSD_SNAPMAPPER trim clones by way of the
+ * snap collections, so while one of them is acting we link clones
+ * into those as well as mapping them.  Once they are all gone, fold
+ * whatever was linked (by us or by an older primary) into the mapper.
+ */
+void PG::check_legacy_snap_peers(ObjectStore::Transaction& t)
 {
-  for (vector<pg_log_entry_t>::iterator i = log_entries.begin();
-       i != log_entries.end();
-       ++i) {
-    // If past backfill line, snap_collections will be updated during push
-    if (i->soid > info.last_backfill)
+  bool legacy = false;
+  for (unsigned i = 0; i < acting.size(); i++) {
+    if (acting[i] == osd->whoami)
       continue;
-    if (i->is_clone()) {
-      vector<snapid_t> snaps;
-      bufferlist::iterator p = i->snaps.begin();
-      ::decode(snaps, p);
-      make_snap_collection(t, snaps[0]);
-      if (snaps.size() > 1)
-	make_snap_collection(t, *(snaps.rbegin()));
+    Connection *con = osd->cluster_messenger->get_connection(
+      get_osdmap()->get_cluster_inst(acting[i]));
+    if (!con) {
+      legacy = true;  // can't tell; linking too is always safe
+      continue;
+    }
+    if (!con->has_feature(CEPH_FEATURE_OSD_SNAPMAPPER))
+      legacy = true;
+    con->put();
+  }
+  if (legacy != legacy_snap_peers)
+    dout(10) << "check_legacy_snap_peers " << (legacy ? "keeping" : "dropping")
+	     << " snap collections" << dendl;
+  if (legacy_snap_peers && !legacy) {
+    osr.flush();
+    convert_snap_collections(t, true);
+  }
+  legacy_snap_peers = legacy;
+}
+
+void PG::snap_link(ObjectStore::Transaction& t, const hobject_t& coid,
+		   const vector<snapid_t>& snaps)
+{
+  if (!legacy_snap_peers || snaps.empty())
+    return;
+  set<snapid_t> ends;
+  ends.insert(snaps.front());
+  ends.insert(snaps.back());
+  for (set<snapid_t>::iterator p = ends.begin(); p != ends.end(); ++p) {
+    if (!snap_collections.contains(*p)) {
+      t.create_collection(coll_t(info.pgid, *p));
+      snap_collections.insert(*p);
+      dirty_info = true;
     }
+    t.collection_add(coll_t(info.pgid, *p), coll, coid);
   }
 }
 
+void PG::snap_unlink(ObjectStore::Transaction& t, const hobject_t& coid,
+		     const vector<snapid_t>& snaps)
+{
+  if (snaps.empty())
+    return;
+  set<snapid_t> ends;
+  ends.insert(snaps.front());
+  ends.insert(snaps.back());
+  for (set<snapid_t>::iterator p = ends.begin(); p != ends.end(); ++p)
+    if (snap_collections.contains(*p))
+      t.collection_remove(coll_t(info.pgid, *p), coid);
+}
+
 /**
  * filter trimming|trimmed snaps out of snapcontext
  */
@@ -2399,11 +2548,30 @@ void PG::filter_snapc(SnapContext& snapc)
 }
 
 
+/*
+ * Find a purged snap that still has clones mapped to it
+ */
+bool PG::get_purged_mapped_snap(snapid_t *snap)
+{
+  for (interval_set<snapid_t>::const_iterator p = info.purged_snaps.begin();
+       p != info.purged_snaps.end();
+       ++p) {
+    snapid_t s;
+    int r = snap_mapper.get_next_snap(osd->store, p.get_start(), &s);
+    if (r < 0)
+      return false;
+    if (s < p.get_start() + p.get_len()) {
+      *snap = s;
+      return true;
+    }
+  }
+  return false;
+}
+
 void PG::adjust_local_snaps()
 {
-  interval_set<snapid_t> to_remove;
-  to_remove.intersection_of(snap_collections, info.purged_snaps);
-  if (!to_remove.empty()) {
+  snapid_t snap;
+  if (get_purged_mapped_snap(&snap)) {
     queue_snap_trim();
   }
 }
@@ -2558,7 +2726,7 @@ void PG::_request_scrub_map(int replica, eversion_t version)
   MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version,
 					      last_update_applied,
                                               get_osdmap()->get_epoch());
-  osd->cluster_messenger->send_message(repscrubop,
+  osd->send_cluster_message(repscrubop,
                                        get_osdmap()->get_cluster_inst(replica));
 }
 
@@ -2580,7 +2748,7 @@ void PG::sub_op_scrub_reserve(OpRequest *op)
 
   MOSDSubOpReply *reply = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
   ::encode(scrub_reserved, reply->get_data());
-  osd->cluster_messenger->send_message(reply, m->get_connection());
+  osd->send_cluster_message(reply, m->get_connection());
 
   op->put();
 }
@@ -2645,7 +2813,7 @@ void PG::sub_op_scrub_stop(OpRequest *op)
   scrub_reserved = false;
 
   MOSDSubOpReply *reply = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
-  osd->cluster_messenger->send_message(reply, m->get_connection());
+  osd->send_cluster_message(reply, m->get_connection());
 
   op->put();
 }
@@ -2674,7 +2842,7 @@ void PG::scrub_reserve_replicas()
     MOSDSubOp *subop = new MOSDSubOp(reqid, info.pgid, poid, false, 0,
                                      get_osdmap()->get_epoch(), osd->get_tid(), v);
     subop->ops = scrub;
-    osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(acting[i]));
+    osd->send_cluster_message(subop, get_osdmap()->get_cluster_inst(acting[i]));
   }
 }
 
@@ -2690,7 +2858,7 @@ void PG::scrub_unreserve_replicas()
     MOSDSubOp *subop = new MOSDSubOp(reqid, info.pgid, poid, false, 0,
                                      get_osdmap()->get_epoch(), osd->get_tid(), v);
     subop->ops = scrub;
-    osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(acting[i]));
+    osd->send_cluster_message(subop, get_osdmap()->get_cluster_inst(acting[i]));
   }
 }
 
@@ -2854,7 +3022,7 @@ void PG::replica_scrub(MOSDRepScrub *msg)
   ::encode(map, subop->get_data());
   subop->ops = scrub;
 
-  osd->cluster_messenger->send_message(subop, msg->get_connection());
+  osd->send_cluster_message(subop, msg->get_connection());
 
   msg->put();
 }
@@ -3249,7 +3417,7 @@ void PG::share_pg_info()
     int peer = acting[i];
     MOSDPGInfo *m = new MOSDPGInfo(get_osdmap()->get_epoch());
     m->pg_info.push_back(info);
-    osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(peer));
+    osd->send_cluster_message(m, get_osdmap()->get_cluster_inst(peer));
   }
 }
 
@@ -3281,7 +3449,7 @@ void PG::share_pg_log()
     }
     pinfo.last_update = m->log.head;
 
-    osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(peer));
+    osd->send_cluster_message(m, get_osdmap()->get_cluster_inst(peer));
   }
 }
 
@@ -3327,7 +3495,7 @@ void PG::fulfill_log(int from, const pg_query_t &query, epoch_t query_epoch)
   dout(10) << " sending " << mlog->log << " " << mlog->missing << dendl;
 
   osd->_share_map_outgoing(get_osdmap()->get_cluster_inst(from));
-  osd->cluster_messenger->send_message(mlog, 
+  osd->send_cluster_message(mlog, 
 				       get_osdmap()->get_cluster_inst(from));
 }
 
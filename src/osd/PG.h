@@ -32,6 +32,7 @@
 #include "include/atomic.h"
 
 #include "OSDMap.h"
+#include "SnapMapper.h"
 #include "os/ObjectStore.h"
 #include "msg/Messenger.h"
 #include "messages/MOSDRepScrub.h"
@@ -447,11 +448,13 @@ public:
   IndexedLog  log;
   hobject_t    log_oid;
   hobject_t    biginfo_oid;
+  SnapMapper   snap_mapper;
   OndiskLog   ondisklog;
   pg_missing_t     missing;
   map<hobject_t, set<int> > missing_loc;
   
-  interval_set<snapid_t> snap_collections;
+  interval_set<snapid_t> snap_collections;  // legacy; see convert_snap_collections()
+  bool legacy_snap_peers;  // an acting osd predates the snap mapper; see check_legacy_snap_peers()
   map<epoch_t,Interval> past_intervals;
 
   interval_set<snapid_t> snap_trimq;
@@ -652,6 +655,16 @@ protected:
   Mutex pg_stats_lock;
   bool pg_stats_valid;
   pg_stat_t pg_stats_stable;
+  pg_stat_t pg_stats_sent;      // last reported to the mon
+  uint64_t pg_stats_sent_tid;   // MPGStats tid that carried it
+  bool pg_stats_sent_acked;     // mon has it; the next report can be a delta
+
+  /// the mon should hear about this now rather than at the next report
+  bool pg_stats_urgent() const {
+    return pg_stats_stable.state != pg_stats_sent.state ||
+      pg_stats_stable.up != pg_stats_sent.up ||
+      pg_stats_stable.acting != pg_stats_sent.acting;
+  }
 
   // for ordering writes
   ObjectStore::Sequencer osr;
@@ -676,6 +689,10 @@ public:
   
   bool needs_recovery() const;
 
+  bool get_missing_past_interval_epochs(epoch_t *start, epoch_t *end);
+  void add_past_interval(epoch_t first, epoch_t last,
+			 vector<int>& up, vector<int>& acting,
+			 OSDMapRef lastmap);
   void generate_past_intervals();
   void trim_past_intervals();
   void build_prior(std::auto_ptr<PriorSet> &prior_set);
@@ -683,6 +700,8 @@ public:
   void remove_down_peer_info(const OSDMapRef osdmap);
 
   bool adjust_need_up_thru(const OSDMapRef osdmap);
+  bool can_skip_advance_map(const OSDMapRef lastmap, const OSDMapRef osdmap,
+			    const set<int>& osds_changed) const;
 
   bool all_unfound_are_queried_or_lost(const OSDMapRef osdmap) const;
   virtual void mark_all_unfound_lost(int how) = 0;
@@ -1259,11 +1278,13 @@ public:
 
 
  public:  
-  PG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& loid, const hobject_t& ioid) : 
+  PG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& loid, const hobject_t& ioid,
+     const hobject_t& moid) : 
     osd(o), pool(_pool),
     _lock("PG::_lock"),
     ref(0), deleting(false), dirty_info(false), dirty_log(false),
-    info(p), coll(p), log_oid(loid), biginfo_oid(ioid),
+    info(p), coll(p), log_oid(loid), biginfo_oid(ioid), snap_mapper(coll_t::META_COLL, moid),
+    legacy_snap_peers(false),
     recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), remove_item(this), stat_queue_item(this),
     recovery_ops_active(0),
     waiting_on_backfill(0),
@@ -1276,6 +1297,7 @@ public:
     backfill_target(-1),
     pg_stats_lock("PG::pg_stats_lock"),
     pg_stats_valid(false),
+    pg_stats_sent_tid(0), pg_stats_sent_acked(false),
     finish_sync_event(NULL),
     finalizing_scrub(false),
     scrub_reserved(false), scrub_reserve_failed(false),
@@ -1348,10 +1370,14 @@ public:
 
   std::string get_corrupt_pg_log_name() const;
   void read_state(ObjectStore *store);
-  coll_t make_snap_collection(ObjectStore::Transaction& t, snapid_t sn);
-  void update_snap_collections(vector<pg_log_entry_t> &log_entries,
-			       ObjectStore::Transaction& t);
+  void convert_snap_collections(ObjectStore::Transaction& t, bool scan=false);
+  void check_legacy_snap_peers(ObjectStore::Transaction& t);
+  void snap_link(ObjectStore::Transaction& t, const hobject_t& coid,
+		 const vector<snapid_t>& snaps);
+  void snap_unlink(ObjectStore::Transaction& t, const hobject_t& coid,
+		   const vector<snapid_t>& snaps);
   void filter_snapc(SnapContext& snapc);
+  bool get_purged_mapped_snap(snapid_t *snap);
   void adjust_local_snaps();
 
   void log_weirdness();
@@ -1426,6 +1452,10 @@ public:
   virtual int do_command(vector<string>& cmd, ostream& ss,
 			 bufferlist& idata, bufferlist& odata) = 0;
 
+  /// (re)send copy-from reads that are waiting for a slot or whose source moved
+  virtual void kick_copy_ops() = 0;
+  virtual void handle_copy_get_reply(class MOSDOpReply *m) = 0;
+
   virtual bool same_for_read_since(epoch_t e) = 0;
   virtual bool same_for_modify_since(epoch_t e) = 0;
   virtual bool same_for_rep_modify_since(epoch_t e) = 0;
@@ -122,7 +122,7 @@ void ReplicatedPG::wait_for_missing_object(const hobject_t& soid, OpRequest *op)
     pull(soid, v);
   }
   waiting_for_missing_object[soid].push_back(op);
-  op->mark_delayed();
+  op->mark_delayed("waiting for missing object");
 }
 
 void ReplicatedPG::wait_for_all_missing(OpRequest *op)
@@ -184,7 +184,7 @@ void ReplicatedPG::wait_for_degraded_object(const hobject_t& soid, OpRequest *op
     recover_object_replicas(soid, v);
   }
   waiting_for_degraded_object[soid].push_back(op);
-  op->mark_delayed();
+  op->mark_delayed("waiting for degraded object");
 }
 
 bool PGLSParentFilter::filter(bufferlist& xattr_data, bufferlist& outdata)
@@ -541,6 +541,7 @@ void ReplicatedPG::do_pg_op(OpRequest *op)
   reply->set_data(outdata);
   reply->set_result(result);
   osd->client_messenger->send_message(reply, m->get_connection());
+  op->mark_event("reply_sent");
   op->put();
   delete filter;
 }
@@ -574,8 +575,9 @@ void ReplicatedPG::calc_trim_to()
   }
 }
 
-ReplicatedPG::ReplicatedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid) : 
-  PG(o, _pool, p, oid, ioid), snap_trimmer_machine(this)
+ReplicatedPG::ReplicatedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid,
+			   const hobject_t& moid) :
+  PG(o, _pool, p, oid, ioid, moid), snap_trimmer_machine(this)
 { 
   snap_trimmer_machine.initiate();
 }
@@ -639,6 +641,24 @@ void ReplicatedPG::do_op(OpRequest *op)
     wait_for_degraded_object(snapdir, op);
     return;
   }
+
+  // being copied into?
+  if (m->may_write()) {
+    map<hobject_t, CopyOp*>::iterator cp = copy_ops.find(head);
+    if (cp != copy_ops.end() && cp->second->op != op) {
+      CopyOp *cop = cp->second;
+      if (!cop->done) {
+	dout(10) << "do_op " << head << " is being copied into, waiting" << dendl;
+	cop->waiting.push_back(op);
+	op->mark_delayed("waiting for copy");
+	return;
+      }
+      // whatever started it went away without it
+      dout(10) << "do_op discarding finished copy into " << head << dendl;
+      copy_ops.erase(cp);
+      put_copy_op(cop);
+    }
+  }
  
   entity_inst_t client = m->get_source_inst();
 
@@ -933,6 +953,7 @@ void ReplicatedPG::do_op(OpRequest *op)
     ctx->reply = NULL;
     reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
     osd->client_messenger->send_message(reply, m->get_connection());
+    op->mark_event("reply_sent");
     op->put();
     delete ctx;
     put_object_context(obc);
@@ -986,6 +1007,7 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
   osd->logger->inc(l_osd_op_outb, outb);
   osd->logger->inc(l_osd_op_inb, inb);
   osd->logger->finc(l_osd_op_lat, latency);
+  osd->note_client_op_latency(latency);
 
   if (m->may_read() && m->may_write()) {
     osd->logger->inc(l_osd_op_rw);
@@ -1109,7 +1131,7 @@ void ReplicatedPG::do_scan(OpRequest *op)
 					 get_osdmap()->get_epoch(), m->query_epoch,
 					 info.pgid, bi.begin, bi.end);
       ::encode(bi.objects, reply->get_data());
-      osd->cluster_messenger->send_message(reply, m->get_connection());
+      osd->send_cluster_message(reply, m->get_connection());
     }
     break;
 
@@ -1154,7 +1176,7 @@ void ReplicatedPG::do_backfill(OpRequest *op)
       MOSDPGBackfill *reply = new MOSDPGBackfill(MOSDPGBackfill::OP_BACKFILL_FINISH_ACK,
 						 get_osdmap()->get_epoch(), m->query_epoch,
 						 info.pgid);
-      osd->cluster_messenger->send_message(reply, m->get_connection());
+      osd->send_cluster_message(reply, m->get_connection());
     }
     // fall-thru
 
@@ -1185,10 +1207,11 @@ void ReplicatedPG::do_backfill(OpRequest *op)
   op->put();
 }
 
-/* Returns head of snap_trimq as snap_to_trim and the relevant objects as 
- * obs_to_trim */
-bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
-				   coll_t &col_to_trim,
+/* Returns head of snap_trimq as snap_to_trim and the next batch (at
+ * most osd_snap_trim_max) of its objects as obs_to_trim.  Returns 0 if
+ * there is nothing to trim, 1 if there is a snap, or an error from
+ * reading the snap mapper. */
+int ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
 				   vector<hobject_t> &obs_to_trim)
 {
   assert_locked();
@@ -1205,21 +1228,23 @@ bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
   dout(10) << "get_obs_to_trim , purged_snaps " << info.purged_snaps << dendl;
 
   if (snap_trimq.size() == 0)
-    return false;
+    return 0;
 
   snap_to_trim = snap_trimq.range_start();
-  col_to_trim = coll_t(info.pgid, snap_to_trim);
-
-  if (!snap_collections.contains(snap_to_trim)) {
-    return true;
-  }
 
-  // flush pg ops to fs so we can rely on collection_list()
+  // flush pg ops to fs so the snap mapper is current
   osr.flush();
 
-  osd->store->collection_list(col_to_trim, obs_to_trim);
-
-  return true;
+  int r = snap_mapper.get_next_objects_to_trim(osd->store, snap_to_trim,
+					       MAX(1, g_conf->osd_snap_trim_max),
+					       &obs_to_trim);
+  if (r == -ENOENT)
+    return 1;  // no mapper object: nothing has ever been mapped
+  if (r < 0) {
+    derr << "get_obs_to_trim snap " << snap_to_trim << " got " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 1;
 }
 
 ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
@@ -1272,10 +1297,9 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
   if (newsnaps.empty()) {
     // remove clone
     dout(10) << coid << " snaps " << snaps << " -> " << newsnaps << " ... deleting" << dendl;
+    snap_unlink(*t, coid, snaps);
     t->remove(coll, coid);
-    t->collection_remove(coll_t(info.pgid, snaps[0]), coid);
-    if (snaps.size() > 1)
-      t->collection_remove(coll_t(info.pgid, snaps[snaps.size()-1]), coid);
+    snap_mapper.remove_oid(*t, coid, snaps);
 
     // ...from snapset
     snapid_t last = coid.snap;
@@ -1317,16 +1341,9 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
     ::encode(coi, bl);
     t->setattr(coll, coid, OI_ATTR, bl);
 
-    if (oldsnaps[0] != snaps[0]) {
-      t->collection_remove(coll_t(info.pgid, oldsnaps[0]), coid);
-      if (oldsnaps.size() > 1 && oldsnaps[snaps.size() - 1] != snaps[0] && snaps.size() > 1)
-	t->collection_add(coll_t(info.pgid, snaps[0]), coll, coid);
-    }
-    if (oldsnaps.size() > 1 && oldsnaps[oldsnaps.size()-1] != snaps[snaps.size()-1]) {
-      t->collection_remove(coll_t(info.pgid, oldsnaps[oldsnaps.size()-1]), coid);
-      if (snaps.size() > 1)
-	t->collection_add(coll_t(info.pgid, snaps[snaps.size()-1]), coll, coid);
-    }	      
+    snap_mapper.update_snaps(*t, coid, snaps, oldsnaps);
+    snap_unlink(*t, coid, oldsnaps);
+    snap_link(*t, coid, snaps);
 
     ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::MODIFY, coid, coi.version, coi.prior_version,
 				  osd_reqid_t(), ctx->mtime));
@@ -1399,8 +1416,14 @@ bool ReplicatedPG::snap_trimmer()
     dout(10) << "snap_trimmer requeue" << dendl;
     queue_snap_trim();
   }
+  bool pause = snap_trimmer_machine.batch_done;
+  snap_trimmer_machine.batch_done = false;
   unlock();
   put();
+
+  // throttle between batches, without the pg lock
+  if (pause && g_conf->osd_snap_trim_sleep > 0)
+    usleep((useconds_t)(g_conf->osd_snap_trim_sleep * 1000000.0));
   return true;
 }
 
@@ -1552,6 +1575,14 @@ void ReplicatedPG::remove_watchers_and_notifies()
 // ========================================================================
 // low level osd ops
 
+// note off~len as changed, for delta recovery
+static void mark_dirty(interval_set<uint64_t>& dirty, uint64_t off, uint64_t len)
+{
+  interval_set<uint64_t> ch;
+  ch.insert(off, len);
+  dirty.union_of(ch);
+}
+
 int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 {
   int result = 0;
@@ -1873,6 +1904,30 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	break;
       }
 
+    case CEPH_OSD_OP_COPY_GET:
+      {
+	object_copy_cursor_t cursor;
+	try {
+	  ::decode(cursor, bp);
+	}
+	catch (const buffer::error& e) {
+	  result = -EINVAL;
+	  break;
+	}
+	if (!obs.exists) {
+	  result = -ENOENT;
+	  break;
+	}
+	object_copy_data_t reply;
+	result = fill_in_copy_get(soid, oi, cursor, op.copy_get.max, &reply);
+	if (result < 0)
+	  break;
+	::encode(reply, osd_op.outdata);
+	ctx->delta_stats.num_rd++;
+	ctx->delta_stats.num_rd_kb += SHIFT_ROUND_UP(reply.data.length(), 10);
+      }
+      break;
+
     case CEPH_OSD_OP_ASSERT_SRC_VERSION:
       {
 	uint64_t ver = op.watch.ver;
@@ -1948,6 +2003,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  dout(10) << " truncate_seq " << op.extent.truncate_seq << " > current " << seq
 		   << ", truncating to " << op.extent.truncate_size << dendl;
 	  t.truncate(coll, soid, op.extent.truncate_size);
+	  if (oi.size > op.extent.truncate_size)
+	    mark_dirty(ctx->dirty_extents, op.extent.truncate_size,
+		       oi.size - op.extent.truncate_size);
 	  oi.truncate_seq = op.extent.truncate_seq;
 	  oi.truncate_size = op.extent.truncate_size;
 	  if (op.extent.truncate_size != oi.size) {
@@ -1959,6 +2017,8 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	bufferlist nbl;
 	bp.copy(op.extent.length, nbl);
 	t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	if (op.extent.length)
+	  mark_dirty(ctx->dirty_extents, op.extent.offset, op.extent.length);
 	write_update_size_and_usage(ctx->delta_stats, oi, ssc->snapset, ctx->modified_ranges,
 				    op.extent.offset, op.extent.length, true);
 	if (!obs.exists) {
@@ -1979,6 +2039,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  obs.exists = true;
 	}
 	t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	ctx->dirty_whole = true;
 	interval_set<uint64_t> ch;
 	if (oi.size > 0)
 	  ch.insert(0, oi.size);
@@ -1993,8 +2054,44 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       }
       break;
 
+    case CEPH_OSD_OP_COPY_FROM:
+      {
+	object_t src;
+	object_locator_t src_oloc;
+	try {
+	  ::decode(src, bp);
+	  ::decode(src_oloc, bp);
+	}
+	catch (const buffer::error& e) {
+	  result = -EINVAL;
+	  break;
+	}
+	map<hobject_t, CopyOp*>::iterator cp = copy_ops.find(soid);
+	if (cp == copy_ops.end()) {
+	  // go get it; we'll be back
+	  result = start_copy(ctx, src, src_oloc, snapid_t(op.copy_from.snapid),
+			      op.copy_from.src_version);
+	  break;
+	}
+	CopyOp *cop = cp->second;
+	assert(cop->op == ctx->op);
+	if (!cop->done) {
+	  cop->waiting.push_back(ctx->op);
+	  result = -EAGAIN;
+	  break;
+	}
+	copy_ops.erase(cp);
+	result = cop->rval;
+	if (result >= 0)
+	  result = write_copy_result(ctx, cop);
+	ctx->dirty_whole = true;
+	put_copy_op(cop);
+      }
+      break;
+
     case CEPH_OSD_OP_ROLLBACK :
       result = _rollback_to(ctx, op);
+      ctx->dirty_whole = true;
       break;
 
     case CEPH_OSD_OP_ZERO:
@@ -2002,6 +2099,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	assert(op.extent.length);
 	if (obs.exists) {
 	  t.zero(coll, soid, op.extent.offset, op.extent.length);
+	  mark_dirty(ctx->dirty_extents, op.extent.offset, op.extent.length);
 	  interval_set<uint64_t> ch;
 	  ch.insert(op.extent.offset, op.extent.length);
 	  ctx->modified_ranges.union_of(ch);
@@ -2069,6 +2167,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  interval_set<uint64_t> trim;
 	  trim.insert(op.extent.offset, oi.size-op.extent.offset);
 	  ctx->modified_ranges.union_of(trim);
+	  ctx->dirty_extents.union_of(trim);
 	}
 	if (op.extent.offset != oi.size) {
 	  ctx->delta_stats.num_bytes -= oi.size;
@@ -2101,7 +2200,8 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	t.clone_range(coll, src_obc->obs.oi.soid,
 		      obs.oi.soid, op.clonerange.src_offset,
 		      op.clonerange.length, op.clonerange.offset);
-		      
+	if (op.clonerange.length)
+	  mark_dirty(ctx->dirty_extents, op.clonerange.offset, op.clonerange.length);
 
 	write_update_size_and_usage(ctx->delta_stats, oi, ssc->snapset, ctx->modified_ranges,
 				    op.clonerange.offset, op.clonerange.length, false);
@@ -2412,7 +2512,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 
     ctx->bytes_read += osd_op.outdata.length();
 
-    if (result < 0 && (op.flags & CEPH_OSD_OP_FLAG_FAILOK))
+    if (result < 0 && result != -EAGAIN && (op.flags & CEPH_OSD_OP_FLAG_FAILOK))
       result = 0;
 
     if (result < 0)
@@ -2421,6 +2521,364 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
   return result;
 }
 
+// ========================================================================
+// object copies
+
+/*
+ * Fill in the next chunk of soid for a COPY_GET, starting at cursor:
+ * user xattrs and the omap header first, then data, then omap keys,
+ * up to about max bytes (capped at osd_copy_max_chunk).
+ */
+int ReplicatedPG::fill_in_copy_get(const hobject_t& soid, const object_info_t& oi,
+				   object_copy_cursor_t cursor, uint64_t max,
+				   object_copy_data_t *reply)
+{
+  if (!max || max > g_conf->osd_copy_max_chunk)
+    max = g_conf->osd_copy_max_chunk;
+  uint64_t left = max;
+
+  reply->size = oi.size;
+  reply->mtime = oi.mtime;
+  reply->version = oi.version;
+  reply->user_version = oi.user_version;
+
+  if (!cursor.attr_complete) {
+    map<string,bufferptr> attrs;
+    int r = osd->store->getattrs(coll, soid, attrs, true);
+    if (r < 0)
+      return r;
+    for (map<string,bufferptr>::iterator p = attrs.begin(); p != attrs.end(); ++p) {
+      reply->attrs[p->first].append(p->second);
+      left -= MIN(left, p->first.length() + p->second.length());
+    }
+    r = osd->store->omap_get_header(coll, soid, &reply->omap_header);
+    if (r < 0)
+      return r;
+    left -= MIN(left, reply->omap_header.length());
+    cursor.attr_complete = true;
+  }
+
+  if (!cursor.data_complete && left > 0) {
+    if (cursor.data_offset < oi.size) {
+      uint64_t len = MIN(left, oi.size - cursor.data_offset);
+      int r = osd->store->read(coll, soid, cursor.data_offset, len, reply->data);
+      if (r < 0)
+	return r;
+      if ((uint64_t)r < len)
+	cursor.data_offset = oi.size;  // nothing stored past here
+      else
+	cursor.data_offset += r;
+      left -= MIN(left, (uint64_t)r);
+    }
+    if (cursor.data_offset >= oi.size)
+      cursor.data_complete = true;
+  }
+
+  if (cursor.data_complete && !cursor.omap_complete && left > 0) {
+    ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(coll, soid);
+    if (!iter) {
+      cursor.omap_complete = true;
+    } else {
+      if (cursor.omap_offset.empty())
+	iter->seek_to_first();
+      else
+	iter->upper_bound(cursor.omap_offset);
+      for (; iter->valid(); iter->next()) {
+	uint64_t len = iter->key().size() + iter->value().length();
+	if (len > left && left < max)
+	  break;  // the next chunk, unless it would be empty
+	reply->omap.insert(make_pair(iter->key(), iter->value()));
+	cursor.omap_offset = iter->key();
+	left -= MIN(left, len);
+      }
+      int r = iter->status();
+      if (r < 0)
+	return r;
+      if (!iter->valid())
+	cursor.omap_complete = true;
+    }
+  }
+
+  dout(20) << "fill_in_copy_get " << soid << " " << cursor << ": " << reply->attrs.size()
+	   << " attrs, " << reply->data.length() << " bytes, " << reply->omap.size()
+	   << " omap keys" << dendl;
+  reply->cursor = cursor;
+  return 0;
+}
+
+int ReplicatedPG::start_copy(OpContext *ctx, const object_t& src,
+			     const object_locator_t& src_oloc,
+			     snapid_t src_snap, version_t src_version)
+{
+  const hobject_t& dest = ctx->obs->oi.soid;
+  MOSDOp *m = (MOSDOp *)ctx->op->request;
+  OSDMapRef curmap = get_osdmap();
+
+  const pg_pool_t *spool = curmap->get_pg_pool(src_oloc.get_pool());
+  if (!spool) {
+    dout(10) << "start_copy " << dest << " from " << src
+	     << ": no pool " << src_oloc.get_pool() << dendl;
+    return -ENOENT;
+  }
+  if (!osd->op_may_read_pool(m, curmap->get_pool_name(src_oloc.get_pool()),
+			     spool->get_auid())) {
+    dout(10) << "start_copy " << dest << " from " << src
+	     << ": may not read pool " << src_oloc.get_pool() << dendl;
+    return -EPERM;
+  }
+
+  dout(10) << "start_copy " << dest << " from " << src << " " << src_oloc
+	   << " snap " << src_snap << " v " << src_version << dendl;
+  CopyOp *cop = new CopyOp(ctx->op, src, src_oloc, src_snap, src_version);
+  copy_ops[dest] = cop;
+  cop->waiting.push_back(ctx->op);
+  ctx->op->mark_delayed("waiting for copy");
+  send_copy_get(dest, cop);
+  return -EAGAIN;
+}
+
+void ReplicatedPG::send_copy_get(const hobject_t& dest, CopyOp *cop)
+{
+  assert(!cop->tid);
+  OSDMapRef curmap = get_osdmap();
+  if (!curmap->have_pg_pool(cop->src_oloc.get_pool())) {
+    finish_copy(cop, -ENOENT);
+    return;
+  }
+
+  pg_t raw_pgid = curmap->object_locator_to_pg(cop->src, cop->src_oloc);
+  vector<int> acting;
+  curmap->pg_to_acting_osds(curmap->raw_pg_to_pg(raw_pgid), acting);
+  if (acting.empty()) {
+    dout(10) << "send_copy_get " << dest << " source pg " << raw_pgid
+	     << " has no primary, waiting for a new map" << dendl;
+    return;
+  }
+
+  tid_t tid = osd->get_tid();
+  if (!osd->get_copy_slot(info.pgid, tid)) {
+    dout(10) << "send_copy_get " << dest << " waiting for a slot" << dendl;
+    return;
+  }
+  cop->tid = tid;
+  cop->src_osd = acting[0];
+
+  MOSDOp *op = new MOSDOp(0, tid, cop->src, cop->src_oloc, raw_pgid,
+			  curmap->get_epoch(),
+			  CEPH_OSD_FLAG_READ | CEPH_OSD_FLAG_ACK |
+			  CEPH_OSD_FLAG_INTERNAL);
+  op->set_snapid(cop->src_snap);
+  OSDOp osd_op;
+  osd_op.op.op = CEPH_OSD_OP_COPY_GET;
+  osd_op.op.copy_get.max = g_conf->osd_copy_max_chunk;
+  ::encode(cop->results.cursor, osd_op.indata);
+  op->ops.push_back(osd_op);
+
+  dout(10) << "send_copy_get " << dest << " " << cop->results.cursor
+	   << " from osd." << cop->src_osd << " tid " << tid << dendl;
+  osd->send_cluster_message(op, curmap->get_cluster_inst(cop->src_osd));
+}
+
+void ReplicatedPG::handle_copy_get_reply(MOSDOpReply *m)
+{
+  map<hobject_t, CopyOp*>::iterator p;
+  for (p = copy_ops.begin(); p != copy_ops.end(); ++p)
+    if (p->second->tid == m->get_tid())
+      break;
+  if (p == copy_ops.end()) {
+    dout(10) << "handle_copy_get_reply " << *m << " no longer wanted" << dendl;
+    return;
+  }
+  const hobject_t& dest = p->first;
+  CopyOp *cop = p->second;
+  cop->tid = 0;
+  cop->src_osd = -1;
+
+  int r = m->get_result();
+  object_copy_data_t reply;
+  if (r >= 0) {
+    vector<OSDOp> ops;
+    m->claim_ops(ops);
+    try {
+      if (ops.empty())
+	throw buffer::end_of_buffer();
+      bufferlist::iterator bp = ops[0].outdata.begin();
+      ::decode(reply, bp);
+    }
+    catch (const buffer::error& e) {
+      dout(0) << "handle_copy_get_reply " << dest << " unable to decode " << *m << dendl;
+      r = -EIO;
+    }
+  }
+
+  if (r >= 0 && cop->results.cursor.is_initial()) {
+    // first chunk
+    if (cop->src_version) {
+      if (cop->src_version < reply.user_version.version)
+	r = -ERANGE;
+      else if (cop->src_version > reply.user_version.version)
+	r = -EOVERFLOW;
+    }
+    if (g_conf->osd_max_write_size &&
+	reply.size > (uint64_t)g_conf->osd_max_write_size << 20)
+      r = -OSD_WRITETOOBIG;  // we write it out in one transaction
+    // we buffer the whole object until then, so make room for it first
+    if (r >= 0 && !osd->get_copy_bytes(info.pgid, reply.size)) {
+      dout(10) << "handle_copy_get_reply " << dest << " waiting for room for "
+	       << reply.size << " bytes" << dendl;
+      return;  // kick_copy_ops() starts over
+    }
+    if (r >= 0)
+      cop->reserved = reply.size;
+  } else if (r >= 0 && reply.version != cop->results.version) {
+    dout(10) << "handle_copy_get_reply " << dest << " source changed from "
+	     << cop->results.version << " to " << reply.version << dendl;
+    if (cop->src_version) {
+      r = -ERANGE;
+    } else {
+      cop->results = object_copy_data_t();
+      osd->put_copy_bytes(cop->reserved);
+      cop->reserved = 0;
+      send_copy_get(dest, cop);
+      return;
+    }
+  }
+  if (r < 0) {
+    finish_copy(cop, r);
+    return;
+  }
+
+  object_copy_data_t& results = cop->results;
+  results.cursor = reply.cursor;
+  results.size = reply.size;
+  results.mtime = reply.mtime;
+  results.version = reply.version;
+  results.user_version = reply.user_version;
+  if (!reply.attrs.empty())
+    results.attrs.swap(reply.attrs);
+  if (reply.omap_header.length())
+    results.omap_header.claim(reply.omap_header);
+  results.data.claim_append(reply.data);
+  results.omap.insert(reply.omap.begin(), reply.omap.end());
+
+  if (results.cursor.is_complete())
+    finish_copy(cop, 0);
+  else
+    send_copy_get(dest, cop);
+}
+
+void ReplicatedPG::put_copy_op(CopyOp *cop)
+{
+  if (cop->reserved)
+    osd->put_copy_bytes(cop->reserved);
+  delete cop;
+}
+
+void ReplicatedPG::finish_copy(CopyOp *cop, int r)
+{
+  dout(10) << "finish_copy from " << cop->src << " r = " << r << dendl;
+  cop->rval = r;
+  cop->done = true;
+  osd->requeue_ops(this, cop->waiting);
+}
+
+/*
+ * Replace the object with what we copied.  Our own xattrs are rewritten
+ * by prepare_transaction, so it is safe to drop them all here.
+ */
+int ReplicatedPG::write_copy_result(OpContext *ctx, CopyOp *cop)
+{
+  ObjectState& obs = ctx->new_obs;
+  object_info_t& oi = obs.oi;
+  const hobject_t& soid = oi.soid;
+  ObjectStore::Transaction& t = ctx->op_t;
+  object_copy_data_t& results = cop->results;
+
+  dout(10) << "write_copy_result " << soid << " from " << cop->src
+	   << " v " << results.version << " size " << results.size << dendl;
+
+  interval_set<uint64_t> ch;
+  if (obs.exists) {
+    t.truncate(coll, soid, 0);
+    t.rmattrs(coll, soid);
+    t.omap_clear(coll, soid);
+    if (oi.size)
+      ch.insert(0, oi.size);
+  } else {
+    t.touch(coll, soid);
+    ctx->delta_stats.num_objects++;
+    obs.exists = true;
+  }
+
+  if (results.data.length())
+    t.write(coll, soid, 0, results.data.length(), results.data);
+  if (results.data.length() != results.size)
+    t.truncate(coll, soid, results.size);
+  for (map<string, bufferlist>::iterator p = results.attrs.begin();
+       p != results.attrs.end();
+       ++p)
+    t.setattr(coll, soid, "_" + p->first, p->second);
+  if (results.omap_header.length())
+    t.omap_setheader(coll, soid, results.omap_header);
+  if (!results.omap.empty())
+    t.omap_setkeys(coll, soid, results.omap);
+
+  interval_set<uint64_t> nch;
+  if (results.size)
+    nch.insert(0, results.size);
+  ch.union_of(nch);
+  ctx->modified_ranges.union_of(ch);
+
+  ctx->delta_stats.num_bytes -= oi.size;
+  oi.size = results.size;
+  ctx->delta_stats.num_bytes += oi.size;
+  ctx->delta_stats.num_wr++;
+  ctx->delta_stats.num_wr_kb += SHIFT_ROUND_UP(results.size, 10);
+  return 0;
+}
+
+void ReplicatedPG::kick_copy_ops()
+{
+  if (copy_ops.empty())
+    return;
+  OSDMapRef curmap = get_osdmap();
+  for (map<hobject_t, CopyOp*>::iterator p = copy_ops.begin(); p != copy_ops.end(); ++p) {
+    CopyOp *cop = p->second;
+    if (cop->done)
+      continue;
+    if (cop->tid) {
+      // did the source move?
+      if (curmap->have_pg_pool(cop->src_oloc.get_pool())) {
+	pg_t pgid = curmap->raw_pg_to_pg(curmap->object_locator_to_pg(cop->src, cop->src_oloc));
+	vector<int> acting;
+	curmap->pg_to_acting_osds(pgid, acting);
+	if (!acting.empty() && acting[0] == cop->src_osd)
+	  continue;
+      }
+      dout(10) << "kick_copy_ops " << p->first << " source moved from osd."
+	       << cop->src_osd << ", resending" << dendl;
+      osd->put_copy_slot(cop->tid);
+      cop->tid = 0;
+      cop->src_osd = -1;
+    }
+    send_copy_get(p->first, cop);
+  }
+}
+
+void ReplicatedPG::cancel_copy_ops()
+{
+  dout(10) << "cancel_copy_ops" << dendl;
+  for (map<hobject_t, CopyOp*>::iterator p = copy_ops.begin();
+       p != copy_ops.end();
+       copy_ops.erase(p++)) {
+    CopyOp *cop = p->second;
+    if (cop->tid)
+      osd->put_copy_slot(cop->tid);
+    osd->requeue_ops(this, cop->waiting);
+    put_copy_op(cop);
+  }
+}
+
 inline int ReplicatedPG::_delete_head(OpContext *ctx)
 {
   SnapSet& snapset = ctx->new_snapset;
@@ -2617,13 +3075,9 @@ void ReplicatedPG::make_writeable(OpContext *ctx)
     snap_oi->snaps = snaps;
     _make_clone(t, soid, coid, snap_oi);
     
-    // add to snap bound collections
-    coll_t fc = make_snap_collection(ctx->local_t, snaps[0]);
-    t.collection_add(fc, coll, coid);
-    if (snaps.size() > 1) {
-      coll_t lc = make_snap_collection(ctx->local_t, snaps[snaps.size()-1]);
-      t.collection_add(lc, coll, coid);
-    }
+    // index it under each of its snaps
+    snap_mapper.add_oid(t, coid, snaps);
+    snap_link(t, coid, snaps);
     
     ctx->delta_stats.num_objects++;
     ctx->delta_stats.num_object_clones++;
@@ -2885,6 +3339,10 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     logopcode = pg_log_entry_t::DELETE;
   ctx->log.push_back(pg_log_entry_t(logopcode, soid, ctx->at_version, old_version,
 				ctx->reqid, ctx->mtime));
+  if (logopcode == pg_log_entry_t::MODIFY && !ctx->dirty_whole) {
+    ctx->log.back().dirty_extents.swap(ctx->dirty_extents);
+    ctx->log.back().dirty_extents_valid = true;
+  }
 
   if (ctx->new_obs.exists) {
     ctx->new_obs.oi.version = ctx->at_version;
@@ -3016,6 +3474,8 @@ void ReplicatedPG::apply_repop(RepGather *repop)
   Context *onapplied = new C_OSD_OpApplied(this, repop);
   Context *onapplied_sync = new C_OSD_OndiskWriteUnlock(repop->obc,
 							repop->ctx->clone_obc);
+  if (repop->ctx->op)
+    repop->ctx->op->mark_event("journal_submit");
   int r = osd->store->queue_transactions(&osr, repop->tls, onapplied, oncommit, onapplied_sync);
   if (r) {
     derr << "apply_repop  queue_transactions returned " << r << " on " << *repop << dendl;
@@ -3027,6 +3487,8 @@ void ReplicatedPG::op_applied(RepGather *repop)
 {
   lock();
   dout(10) << "op_applied " << *repop << dendl;
+  if (repop->ctx->op)
+    repop->ctx->op->mark_event("applied");
 
   // discard my reference to the buffer
   if (repop->ctx->op)
@@ -3088,6 +3550,8 @@ void ReplicatedPG::op_commit(RepGather *repop)
   } else {
     dout(10) << "op_commit " << *repop << dendl;
     int whoami = osd->get_nodeid();
+    if (repop->ctx->op)
+      repop->ctx->op->mark_event("journal_commit");
 
     repop->waitfor_disk.erase(whoami);
 
@@ -3160,6 +3624,7 @@ void ReplicatedPG::eval_repop(RepGather *repop)
 	assert(entity_name_t::TYPE_OSD != m->get_connection()->peer_type);
 	osd->client_messenger->send_message(reply, m->get_connection());
 	repop->sent_disk = true;
+	repop->ctx->op->mark_event("reply_sent commit");
       }
     }
 
@@ -3177,6 +3642,7 @@ void ReplicatedPG::eval_repop(RepGather *repop)
         assert(entity_name_t::TYPE_OSD != m->get_connection()->peer_type);
 	osd->client_messenger->send_message(reply, m->get_connection());
 	repop->sent_ack = true;
+	repop->ctx->op->mark_event("reply_sent ack");
       }
 
       // note the write is now readable (for rlatency calc).  note
@@ -3276,7 +3742,7 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
     }
     
     wr->pg_trim_to = pg_trim_to;
-    osd->cluster_messenger->send_message(wr, get_osdmap()->get_cluster_inst(peer));
+    osd->queue_cluster_message(wr, get_osdmap()->get_cluster_inst(peer));
 
     // keep peer_info up to date
     if (pinfo.last_complete == pinfo.last_update)
@@ -3341,6 +3807,13 @@ void ReplicatedPG::repop_ack(RepGather *repop, int result, int ack_type,
 	    << " from osd." << fromosd
 	    << dendl;
   
+  if (repop->ctx->op) {
+    ostringstream ss;
+    ss << ((ack_type & CEPH_OSD_FLAG_ONDISK) ? "sub_op_commit_rec" : "sub_op_applied_rec")
+       << " from osd." << fromosd;
+    repop->ctx->op->mark_event(ss.str());
+  }
+
   if (ack_type & CEPH_OSD_FLAG_ONDISK) {
     // disk
     if (repop->waitfor_disk.count(fromosd)) {
@@ -3817,7 +4290,6 @@ void ReplicatedPG::sub_op_modify(OpRequest *op)
       ::decode(log, p);
       
       info.stats = m->pg_stats;
-      update_snap_collections(log, rm->localt);
       append_log(log, m->pg_trim_to, rm->localt);
 
       rm->tls.push_back(&rm->localt);
@@ -3865,6 +4337,7 @@ void ReplicatedPG::sub_op_modify(OpRequest *op)
   
   Context *oncommit = new C_OSD_RepModifyCommit(rm);
   Context *onapply = new C_OSD_RepModifyApply(rm);
+  op->mark_event("journal_submit");
   int r = osd->store->queue_transactions(&osr, rm->tls, onapply, oncommit);
   if (r) {
     dout(0) << "error applying transaction: r = " << r << dendl;
@@ -3877,6 +4350,7 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
 {
   lock();
   dout(10) << "sub_op_modify_applied on " << rm << " op " << *rm->op->request << dendl;
+  rm->op->mark_event("applied");
   MOSDSubOp *m = (MOSDSubOp*)rm->op->request;
   assert(m->get_header().type == MSG_OSD_SUBOP);
 
@@ -3884,7 +4358,7 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
     // send ack to acker only if we haven't sent a commit already
     MOSDSubOpReply *ack = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
     ack->set_priority(CEPH_MSG_PRIO_HIGH); // this better match commit priority!
-    osd->cluster_messenger->send_message(ack, get_osdmap()->get_cluster_inst(rm->ackerosd));
+    osd->queue_cluster_message(ack, get_osdmap()->get_cluster_inst(rm->ackerosd));
   }
 
   rm->applied = true;
@@ -3919,6 +4393,7 @@ void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
   dout(10) << "sub_op_modify_commit on op " << *rm->op->request
            << ", sending commit to osd." << rm->ackerosd
            << dendl;
+  rm->op->mark_event("journal_commit");
 
   log_subop_stats(rm->op, l_osd_sop_w_inb, l_osd_sop_w_lat);
 
@@ -3927,7 +4402,7 @@ void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
     MOSDSubOpReply *commit = new MOSDSubOpReply((MOSDSubOp*)rm->op->request, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ONDISK);
     commit->set_last_complete_ondisk(rm->last_complete);
     commit->set_priority(CEPH_MSG_PRIO_HIGH); // this better match ack priority!
-    osd->cluster_messenger->send_message(commit, get_osdmap()->get_cluster_inst(rm->ackerosd));
+    osd->queue_cluster_message(commit, get_osdmap()->get_cluster_inst(rm->ackerosd));
   }
   
   rm->committed = true;
@@ -4214,7 +4689,49 @@ void ReplicatedPG::send_remove_op(const hobject_t& oid, eversion_t v, int peer)
   subop->ops = vector<OSDOp>(1);
   subop->ops[0].op.op = CEPH_OSD_OP_DELETE;
 
-  osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  osd->send_cluster_message(subop, get_osdmap()->get_cluster_inst(peer));
+}
+
+/**
+ * union the dirty extents logged for soid since version have
+ *
+ * Fails if have predates our log, or if any later update to the
+ * object did not record which extents it modified; the caller must
+ * then push the whole object.
+ */
+bool ReplicatedPG::calc_dirty_subset(const hobject_t& soid, eversion_t have,
+				     interval_set<uint64_t>& dirty)
+{
+  if (have < log.tail) {
+    dout(15) << "calc_dirty_subset " << soid << " v" << have
+	     << " predates log tail " << log.tail << dendl;
+    return false;
+  }
+  for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() && p->version > have;
+       ++p) {
+    if (p->soid != soid)
+      continue;
+    if (!p->is_modify() || !p->dirty_extents_valid) {
+      dout(15) << "calc_dirty_subset " << soid << " no extents for " << *p << dendl;
+      return false;
+    }
+    dirty.union_of(p->dirty_extents);
+  }
+  return true;
+}
+
+bool ReplicatedPG::peer_supports_delta_recovery(int peer)
+{
+  if (!g_conf->osd_recovery_delta)
+    return false;
+  Connection *con = osd->cluster_messenger->get_connection(
+    get_osdmap()->get_cluster_inst(peer));
+  if (!con)
+    return false;
+  bool r = con->has_feature(CEPH_FEATURE_OSD_DELTA_RECOVERY);
+  con->put();
+  return r;
 }
 
 /*
@@ -4269,6 +4786,39 @@ void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, in
     put_snapset_context(ssc);
   } else if (soid.snap == CEPH_NOSNAP) {
     // pushing head or unversioned object.
+    // does the replica have an older copy we can patch?
+    eversion_t have;
+    if (peer_missing[peer].is_missing(soid))
+      have = peer_missing[peer].missing[soid].have;
+    if (have != eversion_t() &&
+	peer_supports_delta_recovery(peer) &&
+	calc_dirty_subset(soid, have, data_subset)) {
+      interval_set<uint64_t> extent;
+      if (size)
+	extent.insert(0, size);
+      data_subset.intersection_of(extent);
+
+      // the replica patches its live copy, so the delta has to fit in
+      // a single push to be applied in one transaction.  omap is
+      // resent whole, so objects with omap always get a full push.
+      ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(coll, soid);
+      bool has_omap = true;
+      if (iter) {
+	iter->seek_to_first();
+	has_omap = iter->valid();
+      }
+      if (data_subset.size() <= g_conf->osd_recovery_max_chunk && !has_omap) {
+	dout(10) << "push_to_replica osd." << peer << " has " << soid
+		 << " v" << have << ", pushing dirty extents " << data_subset
+		 << dendl;
+	push_start(obc, soid, peer, oi.version, data_subset, clone_subsets, have);
+	return;
+      }
+      dout(15) << "push_to_replica " << soid << " delta " << data_subset
+	       << " won't fit in one push" << dendl;
+    }
+    data_subset.clear();
+
     // base this on partially on replica's clones?
     SnapSetContext *ssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
     dout(15) << "push_to_replica snapset is " << ssc->snapset << dendl;
@@ -4296,7 +4846,8 @@ void ReplicatedPG::push_start(
   const hobject_t& soid, int peer,
   eversion_t version,
   interval_set<uint64_t> &data_subset,
-  map<hobject_t, interval_set<uint64_t> >& clone_subsets)
+  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+  eversion_t delta_from)
 {
   // take note.
   PushInfo &pi = pushing[soid][peer];
@@ -4306,14 +4857,36 @@ void ReplicatedPG::push_start(
   pi.recovery_info.soid = soid;
   pi.recovery_info.oi = obc->obs.oi;
   pi.recovery_info.version = version;
+  pi.recovery_info.delta_from = delta_from;
   pi.recovery_progress.first = true;
   pi.recovery_progress.data_recovered_to = 0;
   pi.recovery_progress.data_complete = 0;
   pi.recovery_progress.omap_complete = 0;
 
-  ObjectRecoveryProgress new_progress;
-  send_push(peer, pi.recovery_info, pi.recovery_progress, &new_progress);
-  pi.recovery_progress = new_progress;
+  send_push_window(peer, pi);
+}
+
+/*
+ * Keep up to osd_recovery_push_window chunks of this object in flight
+ * to the peer.  The peer applies and acks them in the order sent, so
+ * each ack retires the oldest chunk and lets us send the next one.
+ */
+int ReplicatedPG::send_push_window(int peer, PushInfo &pi)
+{
+  int window = MAX(g_conf->osd_recovery_push_window, 1);
+  while ((int)pi.in_flight.size() < window &&
+	 !pi.recovery_progress.data_complete) {
+    ObjectRecoveryProgress new_progress;
+    uint64_t bytes = 0;
+    int r = send_push(peer, pi.recovery_info, pi.recovery_progress,
+		      &new_progress, &bytes);
+    if (r < 0)
+      return r;
+    pi.recovery_progress = new_progress;
+    pi.in_flight.push_back(bytes);
+    osd->note_recovery_push_sent(bytes);
+  }
+  return 0;
 }
 
 int ReplicatedPG::send_pull(int peer,
@@ -4340,7 +4913,7 @@ int ReplicatedPG::send_pull(int peer,
   subop->recovery_info = recovery_info;
   subop->recovery_progress = progress;
 
-  osd->cluster_messenger->send_message(subop,
+  osd->send_cluster_message(subop,
 				       get_osdmap()->get_cluster_inst(peer));
 
   osd->logger->inc(l_osd_pull);
@@ -4356,9 +4929,20 @@ void ReplicatedPG::submit_push_data(
   map<string, bufferlist> &omap_entries,
   ObjectStore::Transaction *t)
 {
+  // a delta push patches our existing copy in place; a full push
+  // builds a new copy in the temp collection.  the primary only sends
+  // a delta that fits in one push, so first and complete land in the
+  // same transaction and a partial patch is never visible.
+  coll_t target = recovery_info.is_delta() ? coll : coll_t::TEMP_COLL;
   if (first) {
-    t->remove(coll_t::TEMP_COLL, recovery_info.soid);
-    t->touch(coll_t::TEMP_COLL, recovery_info.soid);
+    if (recovery_info.is_delta()) {
+      t->truncate(coll, recovery_info.soid, recovery_info.size);
+      t->rmattrs(coll, recovery_info.soid);
+      t->omap_clear(coll, recovery_info.soid);
+    } else {
+      t->remove(coll_t::TEMP_COLL, recovery_info.soid);
+      t->touch(coll_t::TEMP_COLL, recovery_info.soid);
+    }
   }
   uint64_t off = 0;
   for (interval_set<uint64_t>::const_iterator p = intervals_included.begin();
@@ -4366,23 +4950,25 @@ void ReplicatedPG::submit_push_data(
        ++p) {
     bufferlist bit;
     bit.substr_of(data_included, off, p.get_len());
-    t->write(coll_t::TEMP_COLL, recovery_info.soid,
+    t->write(target, recovery_info.soid,
 	     p.get_start(), p.get_len(), bit);
     off += p.get_len();
   }
 
-  t->omap_setkeys(coll_t::TEMP_COLL, recovery_info.soid,
+  t->omap_setkeys(target, recovery_info.soid,
 		  omap_entries);
-  t->setattrs(coll_t::TEMP_COLL, recovery_info.soid,
+  t->setattrs(target, recovery_info.soid,
 	      attrs);
 }
 
 void ReplicatedPG::submit_push_complete(ObjectRecoveryInfo &recovery_info,
 					ObjectStore::Transaction *t)
 {
-  remove_object_with_snap_hardlinks(*t, recovery_info.soid);
-  t->collection_add(coll, coll_t::TEMP_COLL, recovery_info.soid);
-  t->collection_remove(coll_t::TEMP_COLL, recovery_info.soid);
+  if (!recovery_info.is_delta()) {
+    remove_snap_mapped_object(*t, recovery_info.soid);
+    t->collection_add(coll, coll_t::TEMP_COLL, recovery_info.soid);
+    t->collection_remove(coll_t::TEMP_COLL, recovery_info.soid);
+  }
   for (map<hobject_t, interval_set<uint64_t> >::const_iterator p =
 	 recovery_info.clone_subset.begin();
        p != recovery_info.clone_subset.end();
@@ -4398,17 +4984,8 @@ void ReplicatedPG::submit_push_complete(ObjectRecoveryInfo &recovery_info,
   }
 
   if (recovery_info.soid.snap < CEPH_NOSNAP) {
-    if (recovery_info.oi.snaps.size()) {
-      coll_t lc = make_snap_collection(*t,
-				       recovery_info.oi.snaps[0]);
-      t->collection_add(lc, coll, recovery_info.soid);
-      if (recovery_info.oi.snaps.size() > 1) {
-	coll_t hc = make_snap_collection(
-	  *t,
-	  recovery_info.oi.snaps[recovery_info.oi.snaps.size()-1]);
-	t->collection_add(hc, coll, recovery_info.soid);
-      }
-    }
+    snap_mapper.add_oid(*t, recovery_info.soid, recovery_info.oi.snaps);
+    snap_link(*t, recovery_info.soid, recovery_info.oi.snaps);
   }
 
   if (missing.is_missing(recovery_info.soid) &&
@@ -4532,6 +5109,8 @@ void ReplicatedPG::handle_pull_response(OpRequest *op)
     return;
   }
 
+  osd->note_recovery_bytes(data.length());
+
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
   Context *onreadable = 0;
   Context *onreadable_sync = 0;
@@ -4556,6 +5135,7 @@ void ReplicatedPG::handle_pull_response(OpRequest *op)
 
     onreadable = new C_OSD_AppliedRecoveredObject(this, t, obc);
     onreadable_sync = new C_OSD_OndiskWriteUnlock(obc);
+    osd->logger->inc(l_osd_robj);
   } else {
     onreadable = new ObjectStore::C_DeleteTransaction(t);
   }
@@ -4600,6 +5180,7 @@ void ReplicatedPG::handle_push(OpRequest *op)
   bool first = m->current_progress.first;
   bool complete = m->recovery_progress.data_complete &&
     m->recovery_progress.omap_complete;
+  assert(!m->recovery_info.is_delta() || (first && complete));
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
   Context *onreadable = new ObjectStore::C_DeleteTransaction(t);
   Context *onreadable_sync = 0;
@@ -4627,13 +5208,14 @@ void ReplicatedPG::handle_push(OpRequest *op)
   MOSDSubOpReply *reply = new MOSDSubOpReply(
     m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
   assert(entity_name_t::TYPE_OSD == m->get_connection()->peer_type);
-  osd->cluster_messenger->send_message(reply, m->get_connection());
+  osd->send_cluster_message(reply, m->get_connection());
 }
 
 int ReplicatedPG::send_push(int peer,
 			    ObjectRecoveryInfo recovery_info,
 			    ObjectRecoveryProgress progress,
-			    ObjectRecoveryProgress *out_progress)
+			    ObjectRecoveryProgress *out_progress,
+			    uint64_t *out_bytes)
 {
   ObjectRecoveryProgress new_progress = progress;
 
@@ -4719,8 +5301,10 @@ int ReplicatedPG::send_push(int peer,
   if (new_progress.is_complete(recovery_info))
     new_progress.data_complete = true;
 
+  uint64_t bytes = subop->ops[0].indata.length();
   osd->logger->inc(l_osd_push);
-  osd->logger->inc(l_osd_push_outb, subop->ops[0].indata.length());
+  osd->logger->inc(l_osd_push_outb, bytes);
+  osd->note_recovery_bytes(bytes);
   
   // send
   subop->recovery_info = recovery_info;
@@ -4730,6 +5314,8 @@ int ReplicatedPG::send_push(int peer,
     send_message(subop, get_osdmap()->get_cluster_inst(peer));
   if (out_progress)
     *out_progress = new_progress;
+  if (out_bytes)
+    *out_bytes = bytes;
   return 0;
 }
 
@@ -4744,7 +5330,7 @@ void ReplicatedPG::send_push_op_blank(const hobject_t& soid, int peer)
   subop->ops[0].op.op = CEPH_OSD_OP_PUSH;
   subop->first = false;
   subop->complete = false;
-  osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  osd->send_cluster_message(subop, get_osdmap()->get_cluster_inst(peer));
 }
 
 void ReplicatedPG::sub_op_push_reply(OpRequest *op)
@@ -4768,14 +5354,19 @@ void ReplicatedPG::sub_op_push_reply(OpRequest *op)
   } else {
     PushInfo *pi = &pushing[soid][peer];
 
+    if (!pi->in_flight.empty()) {
+      osd->note_recovery_push_acked(pi->in_flight.front());
+      pi->in_flight.pop_front();
+    }
+
     if (!pi->recovery_progress.data_complete) {
       dout(10) << " pushing more from, "
 	       << pi->recovery_progress.data_recovered_to
 	       << " of " << pi->recovery_info.copy_subset << dendl;
-      ObjectRecoveryProgress new_progress;
-      send_push(
-	peer, pi->recovery_info, pi->recovery_progress, &new_progress);
-      pi->recovery_progress = new_progress;
+      send_push_window(peer, *pi);
+    } else if (!pi->in_flight.empty()) {
+      dout(10) << " pushed all of " << soid << " to osd." << peer
+	       << ", waiting for " << pi->in_flight.size() << " acks" << dendl;
     } else {
       // done!
       if (peer == backfill_target && backfills_in_flight.count(soid))
@@ -4791,6 +5382,7 @@ void ReplicatedPG::sub_op_push_reply(OpRequest *op)
       if (pushing[soid].empty()) {
 	pushing.erase(soid);
 	dout(10) << "pushed " << soid << " to all replicas" << dendl;
+	osd->logger->inc(l_osd_robj);
 	finish_recovery_op(soid);
 	if (waiting_for_degraded_object.count(soid)) {
 	  osd->requeue_ops(this, waiting_for_degraded_object[soid]);
@@ -5041,7 +5633,7 @@ void ReplicatedPG::sub_op_remove(OpRequest *op)
   op->mark_started();
 
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
-  remove_object_with_snap_hardlinks(*t, m->poid);
+  remove_snap_mapped_object(*t, m->poid);
   int r = osd->store->queue_transaction(&osr, t);
   assert(r == 0);
   
@@ -5311,6 +5903,9 @@ void ReplicatedPG::on_change()
 
   context_registry_on_change();
 
+  // drop copies in progress; their ops get requeued
+  cancel_copy_ops();
+
   // take object waiters
   requeue_object_waiters(waiting_for_missing_object);
   for (map<hobject_t,list<OpRequest*> >::iterator p = waiting_for_degraded_object.begin();
@@ -5356,6 +5951,16 @@ void ReplicatedPG::_clear_recovery_state()
   backfills_in_flight.clear();
   pending_backfill_updates.clear();
   pulling.clear();
+  for (map<hobject_t, map<int, PushInfo> >::iterator i = pushing.begin();
+       i != pushing.end();
+       ++i)
+    for (map<int, PushInfo>::iterator j = i->second.begin();
+	 j != i->second.end();
+	 ++j)
+      for (list<uint64_t>::iterator k = j->second.in_flight.begin();
+	   k != j->second.in_flight.end();
+	   ++k)
+	osd->note_recovery_push_acked(*k);
   pushing.clear();
   pull_from_peer.clear();
 }
@@ -5796,7 +6401,7 @@ int ReplicatedPG::recover_backfill(int max)
       epoch_t e = get_osdmap()->get_epoch();
       MOSDPGScan *m = new MOSDPGScan(MOSDPGScan::OP_SCAN_GET_DIGEST, e, e, info.pgid,
 				     pbi.end, hobject_t());
-      osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(backfill_target));
+      osd->send_cluster_message(m, get_osdmap()->get_cluster_inst(backfill_target));
       waiting_on_backfill = true;
       start_recovery_op(pbi.end);
       ops++;
@@ -5914,7 +6519,7 @@ int ReplicatedPG::recover_backfill(int max)
     }
     m->last_backfill = bound;
     m->stats = pinfo.stats.stats;
-    osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(backfill_target));
+    osd->send_cluster_message(m, get_osdmap()->get_cluster_inst(backfill_target));
   }
 
   dout(10) << " peer num_objects now " << pinfo.stats.stats.sum.num_objects
@@ -5970,20 +6575,18 @@ void ReplicatedPG::scan_range(hobject_t begin, int min, int max, BackfillInterva
 }
 
 
-void ReplicatedPG::remove_object_with_snap_hardlinks(ObjectStore::Transaction& t, const hobject_t& soid)
+void ReplicatedPG::remove_snap_mapped_object(ObjectStore::Transaction& t, const hobject_t& soid)
 {
-  t.remove(coll, soid);
   if (soid.snap < CEPH_MAXSNAP) {
     bufferlist ba;
     int r = osd->store->getattr(coll, soid, OI_ATTR, ba);
     if (r >= 0) {
-      // grr, need first snap bound, too.
       object_info_t oi(ba);
-      if (oi.snaps.size() > 1)
-	t.remove(coll_t(info.pgid, oi.snaps[oi.snaps.size() - 1]), soid);
-      t.remove(coll_t(info.pgid, oi.snaps[0]), soid);
+      snap_unlink(t, soid, oi.snaps);
+      snap_mapper.remove_oid(t, soid, oi.snaps);
     }
   }
+  t.remove(coll, soid);
 }
 
 /** clean_up_local
@@ -6008,7 +6611,7 @@ void ReplicatedPG::clean_up_local(ObjectStore::Transaction& t)
     if (p->is_delete()) {
       dout(10) << " deleting " << p->soid
 	       << " when " << p->version << dendl;
-      remove_object_with_snap_hardlinks(t, p->soid);
+      remove_snap_mapped_object(t, p->soid);
     } else {
       // keep old(+missing) objects, just for kicks.
     }
@@ -6185,7 +6788,7 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
       for (unsigned i=1; i<acting.size(); i++) {
 	MOSDPGInfo *m = new MOSDPGInfo(get_osdmap()->get_epoch());
 	m->pg_info.push_back(info);
-	osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(acting[i]));
+	osd->send_cluster_message(m, get_osdmap()->get_cluster_inst(acting[i]));
       }
     }
   }
@@ -6248,26 +6851,46 @@ boost::statechart::result ReplicatedPG::NotTrimming::react(const SnapTrim&)
   // Primary trimming
   vector<hobject_t> &obs_to_trim = context<SnapTrimmer>().obs_to_trim;
   snapid_t &snap_to_trim = context<SnapTrimmer>().snap_to_trim;
-  coll_t &col_to_trim = context<SnapTrimmer>().col_to_trim;
-  if (!pg->get_obs_to_trim(snap_to_trim,
-			   col_to_trim,
-			   obs_to_trim)) {
+  int r = pg->get_obs_to_trim(snap_to_trim, obs_to_trim);
+  if (r < 0) {
+    // we don't know what is left, so the snap can't be marked purged;
+    // leave it queued and try again after a pause
+    dout(10) << "NotTrimming: can't read snap mapper, retrying" << dendl;
+    context<SnapTrimmer>().batch_done = true;
+    pg->queue_snap_trim();
+    return discard_event();
+  }
+  if (r == 0) {
     // Nothing to trim
     dout(10) << "NotTrimming: nothing to trim" << dendl;
     return discard_event();
   }
 
   if (obs_to_trim.empty()) {
-    // Nothing to actually trim, just update info and try again
+    // Nothing (left) mapped to this snap, it is purged; update info
+    // and try the next one
     pg->info.purged_snaps.insert(snap_to_trim);
     pg->snap_trimq.erase(snap_to_trim);
     dout(10) << "NotTrimming: obs_to_trim empty!" << dendl;
     dout(10) << "purged_snaps now " << pg->info.purged_snaps << ", snap_trimq now " 
 	     << pg->snap_trimq << dendl;
     ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    t->remove_collection(col_to_trim);
-    int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
+    if (pg->snap_collections.contains(snap_to_trim)) {
+      // trimming moved every clone off this snap, so whatever is
+      // still linked here is stale
+      coll_t c(pg->info.pgid, snap_to_trim);
+      vector<hobject_t> olist;
+      pg->osd->store->collection_list(c, olist);
+      for (vector<hobject_t>::iterator p = olist.begin(); p != olist.end(); ++p)
+	t->collection_remove(c, *p);
+      t->remove_collection(c);
+      pg->snap_collections.erase(snap_to_trim);
+    }
+    pg->write_info(*t);
+    r = pg->osd->store->queue_transaction(&pg->osr, t,
+					  new ObjectStore::C_DeleteTransaction(t));
     assert(r == 0);
+    context<SnapTrimmer>().need_share_pg_info = true;
     post_event(SnapTrim());
     return discard_event();
   } else {
@@ -6294,33 +6917,26 @@ boost::statechart::result ReplicatedPG::RepColTrim::react(const SnapTrim&)
   dout(10) << "RepColTrim react" << dendl;
   ReplicatedPG *pg = context< SnapTrimmer >().pg;
 
-  if (to_trim.empty()) {
-    to_trim.intersection_of(pg->info.purged_snaps, pg->snap_collections);
-    if (to_trim.empty()) {
-      return transit<NotTrimming>();
-    }
-  }
-
-  snapid_t snap_to_trim(to_trim.range_start());
-  coll_t col_to_trim(pg->info.pgid, snap_to_trim);
-  to_trim.erase(snap_to_trim);
-  
-  // flush all operations to fs so we can rely on collection_list
-  // below.
+  // The primary's trims reach us as part of its transactions; this
+  // only drops whatever was left mapped to snaps that are now purged.
+  // flush all operations to fs so the snap mapper is current
   pg->osr.flush();
 
-  vector<hobject_t> obs_to_trim;
-  pg->osd->store->collection_list(col_to_trim, obs_to_trim);
+  snapid_t snap_to_trim;
+  if (!pg->get_purged_mapped_snap(&snap_to_trim)) {
+    return transit<NotTrimming>();
+  }
+
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
-  for (vector<hobject_t>::iterator i = obs_to_trim.begin();
-       i != obs_to_trim.end();
-       ++i) {
-    t->collection_remove(col_to_trim, *i);
+  int r = pg->snap_mapper.remove_snap_keys(pg->osd->store, *t, snap_to_trim,
+					   MAX(1, g_conf->osd_snap_trim_max));
+  if (r <= 0) {
+    delete t;
+    return transit<NotTrimming>();
   }
-  t->remove_collection(col_to_trim);
-  int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
+  r = pg->osd->store->queue_transaction(&pg->osr, t, new ObjectStore::C_DeleteTransaction(t));
   assert(r == 0);
-  pg->snap_collections.erase(snap_to_trim);
+  context<SnapTrimmer>().batch_done = true;
   return discard_event();
 }
 
@@ -6367,15 +6983,14 @@ boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
     pg->eval_repop(repop);
     
     repops.insert(repop);
-    ++position;
   } else {
-    // object has already been trimmed, this is an extra
-    coll_t col_to_trim(pg->info.pgid, snap_to_trim);
+    // object has already been trimmed, this is a stale mapping
     ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    t->collection_remove(col_to_trim, *position);
-    int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
+    pg->snap_mapper.remove_oid(*t, *position, vector<snapid_t>(1, snap_to_trim));
+    int r = pg->osd->store->queue_transaction(&pg->osr, t, new ObjectStore::C_DeleteTransaction(t));
     assert(r == 0);
   }
+  ++position;
   return discard_event();
 }
 /* WaitingOnReplicasObjects */
@@ -6415,28 +7030,13 @@ boost::statechart::result ReplicatedPG::WaitingOnReplicas::react(const SnapTrim&
     }
   }
 
-  // All applied, now to update and share info
-  snapid_t &sn = context<SnapTrimmer>().snap_to_trim;
-  coll_t &c = context<SnapTrimmer>().col_to_trim;
-
-  pg->info.purged_snaps.insert(sn);
-  pg->snap_trimq.erase(sn);
-  dout(10) << "purged_snaps now " << pg->info.purged_snaps << ", snap_trimq now " 
-	   << pg->snap_trimq << dendl;
-  
-  // remove snap collection
-  ObjectStore::Transaction *t = new ObjectStore::Transaction;
-  dout(10) << "removing snap " << sn << " collection " << c << dendl;
-  pg->snap_collections.erase(sn);
-  pg->write_info(*t);
-  t->remove_collection(c);
-  int tr = pg->osd->store->queue_transaction(&pg->osr, t);
-  assert(tr == 0);
-
-  context<SnapTrimmer>().need_share_pg_info = true;
-
-  // Back to the start
-  post_event(SnapTrim());
+  // All applied.  Come back for the next batch of this snap in a later
+  // pass, so client ops on this pg are not held up behind the whole
+  // trim; the snap is marked purged once nothing is left mapped to it.
+  dout(10) << "batch of " << context<SnapTrimmer>().obs_to_trim.size()
+	   << " for snap " << context<SnapTrimmer>().snap_to_trim << " done" << dendl;
+  context<SnapTrimmer>().batch_done = true;
+  pg->queue_snap_trim();
   return transit< NotTrimming >();
 }
 
@@ -363,6 +363,8 @@ public:
     vector<pg_log_entry_t> log;
 
     interval_set<uint64_t> modified_ranges;
+    interval_set<uint64_t> dirty_extents; // data the op changed, for delta recovery
+    bool dirty_whole;                     // or we lost track: push it all
     ObjectContext *obc;          // For ref counting purposes
     map<hobject_t,ObjectContext*> src_obc;
     ObjectContext *clone_obc;    // if we created a clone
@@ -385,7 +387,7 @@ public:
       new_obs(_obs->oi, _obs->exists),
       modify(false), user_modify(false),
       watch_connect(false), watch_disconnect(false),
-      bytes_written(0), bytes_read(0),
+      bytes_written(0), bytes_read(0), dirty_whole(false),
       obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
       if (_ssc) {
 	new_snapset = _ssc->snapset;
@@ -547,6 +549,7 @@ protected:
   struct PushInfo {
     ObjectRecoveryProgress recovery_progress;
     ObjectRecoveryInfo recovery_info;
+    list<uint64_t> in_flight;  ///< bytes in each unacked chunk, in send order
   };
   map<hobject_t, map<int, PushInfo> > pushing;
 
@@ -572,7 +575,9 @@ protected:
   int send_push(int peer,
 		ObjectRecoveryInfo recovery_info,
 		ObjectRecoveryProgress progress,
-		ObjectRecoveryProgress *out_progress = 0);
+		ObjectRecoveryProgress *out_progress = 0,
+		uint64_t *out_bytes = 0);
+  int send_push_window(int peer, PushInfo &pi);
   int send_pull(int peer,
 		ObjectRecoveryInfo recovery_info,
 		ObjectRecoveryProgress progress);
@@ -586,6 +591,47 @@ protected:
   void submit_push_complete(ObjectRecoveryInfo &recovery_info,
 			    ObjectStore::Transaction *t);
 
+  /*
+   * Object copies
+   *
+   * COPY_FROM makes us read the source object from its primary, a chunk
+   * at a time, with COPY_GET.  The op that asked for it waits until we
+   * have it all, and then runs again and writes it out in one go.
+   * Other writes to the object wait behind it.
+   */
+  struct CopyOp {
+    OpRequest *op;          ///< op that started the copy
+    object_t src;
+    object_locator_t src_oloc;
+    snapid_t src_snap;
+    version_t src_version;  ///< required source user_version, or 0 for any
+    int src_osd;            ///< where the read in flight went, or -1
+    tid_t tid;              ///< read in flight, or 0
+    uint64_t reserved;      ///< bytes taken with OSD::get_copy_bytes()
+    object_copy_data_t results;
+    int rval;
+    bool done;
+    list<OpRequest*> waiting;
+
+    CopyOp(OpRequest *op, const object_t& src, const object_locator_t& src_oloc,
+	   snapid_t src_snap, version_t src_version)
+      : op(op), src(src), src_oloc(src_oloc), src_snap(src_snap),
+	src_version(src_version), src_osd(-1), tid(0), reserved(0), rval(0),
+	done(false) {}
+  };
+  map<hobject_t, CopyOp*> copy_ops;  ///< by destination object
+
+  int fill_in_copy_get(const hobject_t& soid, const object_info_t& oi,
+		       object_copy_cursor_t cursor, uint64_t max,
+		       object_copy_data_t *reply);
+  int start_copy(OpContext *ctx, const object_t& src, const object_locator_t& src_oloc,
+		 snapid_t src_snap, version_t src_version);
+  void send_copy_get(const hobject_t& dest, CopyOp *cop);
+  void finish_copy(CopyOp *cop, int r);
+  void put_copy_op(CopyOp *cop);  ///< free cop and the bytes it holds
+  int write_copy_result(OpContext *ctx, CopyOp *cop);
+  void cancel_copy_ops();
+
   /*
    * Backfill
    *
@@ -626,7 +672,11 @@ protected:
 		  const hobject_t& soid, int peer,
 		  eversion_t version,
 		  interval_set<uint64_t> &data_subset,
-		  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+		  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+		  eversion_t delta_from = eversion_t());
+  bool calc_dirty_subset(const hobject_t& soid, eversion_t have,
+			 interval_set<uint64_t>& dirty);
+  bool peer_supports_delta_recovery(int peer);
   void send_push_op_blank(const hobject_t& soid, int peer);
 
   void finish_degraded_object(const hobject_t& oid);
@@ -651,7 +701,7 @@ protected:
   int prepare_transaction(OpContext *ctx);
   
   // pg on-disk content
-  void remove_object_with_snap_hardlinks(ObjectStore::Transaction& t, const hobject_t& soid);
+  void remove_snap_mapped_object(ObjectStore::Transaction& t, const hobject_t& soid);
   void clean_up_local(ObjectStore::Transaction& t);
 
   void _clear_recovery_state();
@@ -787,11 +837,15 @@ protected:
   int get_pgls_filter(bufferlist::iterator& iter, PGLSFilter **pfilter);
 
 public:
-  ReplicatedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid);
+  ReplicatedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid,
+	       const hobject_t& moid);
   ~ReplicatedPG() {}
 
   int do_command(vector<string>& cmd, ostream& ss, bufferlist& idata, bufferlist& odata);
 
+  void kick_copy_ops();
+  void handle_copy_get_reply(MOSDOpReply *m);
+
   void do_op(OpRequest *op);
   bool pg_op_must_wait(MOSDOp *op);
   void do_pg_op(OpRequest *op);
@@ -799,8 +853,7 @@ public:
   void do_sub_op_reply(OpRequest *op);
   void do_scan(OpRequest *op);
   void do_backfill(OpRequest *op);
-  bool get_obs_to_trim(snapid_t &snap_to_trim,
-		       coll_t &col_to_trim,
+  int get_obs_to_trim(snapid_t &snap_to_trim,
 		       vector<hobject_t> &obs_to_trim);
   RepGather *trim_object(const hobject_t &coid, const snapid_t &sn);
   bool snap_trimmer();
@@ -819,10 +872,11 @@ private:
     set<RepGather *> repops;
     vector<hobject_t> obs_to_trim;
     snapid_t snap_to_trim;
-    coll_t col_to_trim;
     bool need_share_pg_info;
     bool requeue;
-    SnapTrimmer(ReplicatedPG *pg) : pg(pg), need_share_pg_info(false), requeue(false) {}
+    bool batch_done;   // finished a batch; pause before the next
+    SnapTrimmer(ReplicatedPG *pg) : pg(pg), need_share_pg_info(false), requeue(false),
+				    batch_done(false) {}
     void log_enter(const char *state_name);
     void log_exit(const char *state_name, utime_t duration);
   } snap_trimmer_machine;
@@ -833,7 +887,6 @@ private:
       boost::statechart::custom_reaction< SnapTrim >,
       boost::statechart::transition< Reset, NotTrimming >
       > reactions;
-    interval_set<snapid_t> to_trim;
     RepColTrim(my_context ctx);
     void exit();
     boost::statechart::result react(const SnapTrim&);
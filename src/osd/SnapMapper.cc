@@ -0,0 +1,193 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <map>
+
+#include "SnapMapper.h"
+#include "common/debug.h"
+#include "common/config.h"
+
+#define DOUT_SUBSYS osd
+#undef dout_prefix
+#define dout_prefix *_dout << "snap_mapper(" << oid << ") "
+
+const char *SnapMapper::PREFIX = "SNA_";
+
+string SnapMapper::get_prefix(snapid_t snap)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%s%016llX_", PREFIX, (unsigned long long)snap.val);
+  return string(buf);
+}
+
+string SnapMapper::to_raw_key(snapid_t snap, const hobject_t &hoid)
+{
+  // the name length keeps (name, key) pairs from running together
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%08X_%016llX_%u_", hoid.hash,
+	   (unsigned long long)hoid.snap.val, (unsigned)hoid.oid.name.length());
+  return get_prefix(snap) + buf + hoid.oid.name + hoid.get_key();
+}
+
+bool SnapMapper::parse_raw_key(const string &key, snapid_t *snap)
+{
+  size_t plen = strlen(PREFIX);
+  if (key.length() < plen + 17 ||
+      key.compare(0, plen, PREFIX) != 0 ||
+      key[plen + 16] != '_')
+    return false;
+  unsigned long long v = 0;
+  for (size_t i = plen; i < plen + 16; i++) {
+    char c = key[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9')
+      v |= c - '0';
+    else if (c >= 'A' && c <= 'F')
+      v |= c - 'A' + 10;
+    else
+      return false;
+  }
+  *snap = v;
+  return true;
+}
+
+bool SnapMapper::exists(ObjectStore *store) const
+{
+  return store->exists(coll, oid);
+}
+
+void SnapMapper::create(ObjectStore::Transaction &t) const
+{
+  t.touch(coll, oid);
+}
+
+void SnapMapper::remove(ObjectStore::Transaction &t) const
+{
+  t.remove(coll, oid);
+}
+
+void SnapMapper::add_oid(ObjectStore::Transaction &t, const hobject_t &hoid,
+			 const vector<snapid_t> &snaps) const
+{
+  if (snaps.empty())
+    return;
+  dout(20) << "add_oid " << hoid << " " << snaps << dendl;
+  bufferlist bl;
+  ::encode(hoid, bl);
+  map<string, bufferlist> keys;
+  for (vector<snapid_t>::const_iterator p = snaps.begin(); p != snaps.end(); ++p)
+    keys[to_raw_key(*p, hoid)] = bl;
+  t.omap_setkeys(coll, oid, keys);
+}
+
+void SnapMapper::remove_oid(ObjectStore::Transaction &t, const hobject_t &hoid,
+			    const vector<snapid_t> &snaps) const
+{
+  if (snaps.empty())
+    return;
+  dout(20) << "remove_oid " << hoid << " " << snaps << dendl;
+  set<string> keys;
+  for (vector<snapid_t>::const_iterator p = snaps.begin(); p != snaps.end(); ++p)
+    keys.insert(to_raw_key(*p, hoid));
+  t.omap_rmkeys(coll, oid, keys);
+}
+
+void SnapMapper::update_snaps(ObjectStore::Transaction &t, const hobject_t &hoid,
+			      const vector<snapid_t> &new_snaps,
+			      const vector<snapid_t> &old_snaps) const
+{
+  set<snapid_t> n(new_snaps.begin(), new_snaps.end());
+  set<snapid_t> o(old_snaps.begin(), old_snaps.end());
+  vector<snapid_t> added, removed;
+  for (set<snapid_t>::iterator p = n.begin(); p != n.end(); ++p)
+    if (!o.count(*p))
+      added.push_back(*p);
+  for (set<snapid_t>::iterator p = o.begin(); p != o.end(); ++p)
+    if (!n.count(*p))
+      removed.push_back(*p);
+  remove_oid(t, hoid, removed);
+  add_oid(t, hoid, added);
+}
+
+int SnapMapper::get_next_objects_to_trim(ObjectStore *store, snapid_t snap,
+					 unsigned max, vector<hobject_t> *out) const
+{
+  out->clear();
+  ObjectMap::ObjectMapIterator iter = store->get_omap_iterator(coll, oid);
+  if (!iter)
+    return -ENOENT;
+  string prefix = get_prefix(snap);
+  int r = iter->lower_bound(prefix);
+  if (r < 0)
+    return r;
+  for (; iter->valid() && out->size() < max; iter->next()) {
+    string key = iter->key();
+    if (key.compare(0, prefix.length(), prefix) != 0)
+      break;
+    bufferlist bl = iter->value();
+    bufferlist::iterator p = bl.begin();
+    hobject_t hoid;
+    ::decode(hoid, p);
+    out->push_back(hoid);
+  }
+  dout(20) << "get_next_objects_to_trim snap " << snap << " got " << out->size()
+	   << " (max " << max << ")" << dendl;
+  return iter->status();
+}
+
+int SnapMapper::get_next_snap(ObjectStore *store, snapid_t first, snapid_t *snap) const
+{
+  ObjectMap::ObjectMapIterator iter = store->get_omap_iterator(coll, oid);
+  if (!iter)
+    return -ENOENT;
+  int r = iter->lower_bound(get_prefix(first));
+  if (r < 0)
+    return r;
+  if (!iter->valid())
+    return -ENOENT;
+  if (!parse_raw_key(iter->key(), snap))
+    return -ENOENT;
+  return 0;
+}
+
+int SnapMapper::remove_snap_keys(ObjectStore *store, ObjectStore::Transaction &t,
+				 snapid_t snap, unsigned max) const
+{
+  set<string> keys;
+  {
+    ObjectMap::ObjectMapIterator iter = store->get_omap_iterator(coll, oid);
+    if (!iter)
+      return -ENOENT;
+    string prefix = get_prefix(snap);
+    int r = iter->lower_bound(prefix);
+    if (r < 0)
+      return r;
+    for (; iter->valid() && keys.size() < max; iter->next()) {
+      string key = iter->key();
+      if (key.compare(0, prefix.length(), prefix) != 0)
+	break;
+      keys.insert(key);
+    }
+    r = iter->status();
+    if (r < 0)
+      return r;
+  }
+  if (!keys.empty()) {
+    dout(10) << "remove_snap_keys snap " << snap << " removing " << keys.size() << dendl;
+    t.omap_rmkeys(coll, oid, keys);
+  }
+  return keys.size();
+}
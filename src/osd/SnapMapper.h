@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_SNAPMAPPER_H
+#define CEPH_OSD_SNAPMAPPER_H
+
+#include <string>
+#include <vector>
+
+#include "include/types.h"
+#include "os/hobject.h"
+#include "os/ObjectStore.h"
+
+/**
+ * Index from snapid to the clones in a pg that belong to that snap.
+ *
+ * Each pg has one mapper object in the meta collection.  For every
+ * clone in the pg there is one omap key on that object per snap the
+ * clone belongs to, named
+ *
+ *   SNA_<snap, 16 hex digits>_<hash>_<clone snap>_<len>_<name><key>
+ *
+ * with the hobject_t as the value.  Since all keys for one snap share a
+ * prefix and sort together, finding what to trim for a snap is a
+ * bounded range scan rather than a directory listing, and keeping the
+ * index current is a couple of omap ops in the same transaction that
+ * creates or removes the clone.
+ *
+ * This replaces the per-snap collections of hard links.
+ */
+class SnapMapper {
+  coll_t coll;    ///< collection holding the mapper object (the meta collection)
+  hobject_t oid;  ///< mapper object
+
+public:
+  static const char *PREFIX;
+
+  SnapMapper(coll_t coll, const hobject_t &oid) : coll(coll), oid(oid) {}
+
+  const hobject_t &get_oid() const { return oid; }
+
+  /// Prefix shared by every key for snap
+  static string get_prefix(snapid_t snap);
+
+  /// Key mapping (snap, hoid)
+  static string to_raw_key(snapid_t snap, const hobject_t &hoid);
+
+  /// Recover the snap from a key; false if it is not a mapper key
+  static bool parse_raw_key(const string &key, snapid_t *snap);
+
+  /// True if the mapper object exists on disk
+  bool exists(ObjectStore *store) const;
+
+  /// Create the (empty) mapper object
+  void create(ObjectStore::Transaction &t) const;
+
+  /// Remove the mapper object, and with it every key
+  void remove(ObjectStore::Transaction &t) const;
+
+  /// Map hoid into each of snaps
+  void add_oid(ObjectStore::Transaction &t, const hobject_t &hoid,
+	       const vector<snapid_t> &snaps) const;
+
+  /// Unmap hoid from each of snaps
+  void remove_oid(ObjectStore::Transaction &t, const hobject_t &hoid,
+		  const vector<snapid_t> &snaps) const;
+
+  /// Move hoid from old_snaps to new_snaps, touching only the difference
+  void update_snaps(ObjectStore::Transaction &t, const hobject_t &hoid,
+		    const vector<snapid_t> &new_snaps,
+		    const vector<snapid_t> &old_snaps) const;
+
+  /**
+   * Get up to max of the clones mapped to snap
+   *
+   * Callers trim what they get back and call again; once trimmed
+   * clones are unmapped, the next call returns the next batch.
+   *
+   * @param [out] out clones in key order
+   * @return 0, or error code
+   */
+  int get_next_objects_to_trim(ObjectStore *store, snapid_t snap, unsigned max,
+			       vector<hobject_t> *out) const;
+
+  /**
+   * Find the lowest snap >= first with anything mapped to it
+   *
+   * @return 0, -ENOENT if there is none, or error code
+   */
+  int get_next_snap(ObjectStore *store, snapid_t first, snapid_t *snap) const;
+
+  /**
+   * Unmap up to max keys of snap, whatever they point to
+   *
+   * @return number of keys removed, or error code
+   */
+  int remove_snap_keys(ObjectStore *store, ObjectStore::Transaction &t,
+		       snapid_t snap, unsigned max) const;
+};
+
+#endif
@@ -1082,6 +1082,223 @@ void pg_stat_t::generate_test_instances(list<pg_stat_t*>& o)
   o.push_back(new pg_stat_t(a));
 }
 
+// -- pg_stat_delta_t --
+
+void pg_stat_delta_t::build(const pg_stat_t& from, const pg_stat_t& to)
+{
+  base = from.reported;
+  fields = 0;
+  stat = pg_stat_t();
+  stat.version = to.version;
+  stat.reported = to.reported;
+
+  if (to.state != from.state ||
+      to.last_change != from.last_change) {
+    fields |= STATE;
+    stat.state = to.state;
+    stat.last_change = to.last_change;
+  }
+  if (to.last_fresh != from.last_fresh ||
+      to.last_active != from.last_active ||
+      to.last_clean != from.last_clean ||
+      to.last_unstale != from.last_unstale) {
+    fields |= STAMPS;
+    stat.last_fresh = to.last_fresh;
+    stat.last_active = to.last_active;
+    stat.last_clean = to.last_clean;
+    stat.last_unstale = to.last_unstale;
+  }
+  if (to.log_start != from.log_start ||
+      to.ondisk_log_start != from.ondisk_log_start ||
+      to.log_size != from.log_size ||
+      to.ondisk_log_size != from.ondisk_log_size) {
+    fields |= LOG;
+    stat.log_start = to.log_start;
+    stat.ondisk_log_start = to.ondisk_log_start;
+    stat.log_size = to.log_size;
+    stat.ondisk_log_size = to.ondisk_log_size;
+  }
+  if (to.created != from.created ||
+      to.last_epoch_clean != from.last_epoch_clean ||
+      to.parent != from.parent ||
+      to.parent_split_bits != from.parent_split_bits ||
+      to.last_scrub != from.last_scrub ||
+      to.last_scrub_stamp != from.last_scrub_stamp) {
+    fields |= HISTORY;
+    stat.created = to.created;
+    stat.last_epoch_clean = to.last_epoch_clean;
+    stat.parent = to.parent;
+    stat.parent_split_bits = to.parent_split_bits;
+    stat.last_scrub = to.last_scrub;
+    stat.last_scrub_stamp = to.last_scrub_stamp;
+  }
+  if (to.stats.sum != from.stats.sum) {
+    fields |= SUM;
+    stat.stats.sum = to.stats.sum;
+  }
+  if (to.stats.cat_sum != from.stats.cat_sum) {
+    fields |= CAT_SUM;
+    stat.stats.cat_sum = to.stats.cat_sum;
+  }
+  if (to.up != from.up ||
+      to.acting != from.acting ||
+      to.mapping_epoch != from.mapping_epoch) {
+    fields |= MAPPING;
+    stat.up = to.up;
+    stat.acting = to.acting;
+    stat.mapping_epoch = to.mapping_epoch;
+  }
+}
+
+void pg_stat_delta_t::apply(pg_stat_t& cur) const
+{
+  cur.version = stat.version;
+  cur.reported = stat.reported;
+  if (fields & STATE) {
+    cur.state = stat.state;
+    cur.last_change = stat.last_change;
+  }
+  if (fields & STAMPS) {
+    cur.last_fresh = stat.last_fresh;
+    cur.last_active = stat.last_active;
+    cur.last_clean = stat.last_clean;
+    cur.last_unstale = stat.last_unstale;
+  }
+  if (fields & LOG) {
+    cur.log_start = stat.log_start;
+    cur.ondisk_log_start = stat.ondisk_log_start;
+    cur.log_size = stat.log_size;
+    cur.ondisk_log_size = stat.ondisk_log_size;
+  }
+  if (fields & HISTORY) {
+    cur.created = stat.created;
+    cur.last_epoch_clean = stat.last_epoch_clean;
+    cur.parent = stat.parent;
+    cur.parent_split_bits = stat.parent_split_bits;
+    cur.last_scrub = stat.last_scrub;
+    cur.last_scrub_stamp = stat.last_scrub_stamp;
+  }
+  if (fields & SUM)
+    cur.stats.sum = stat.stats.sum;
+  if (fields & CAT_SUM)
+    cur.stats.cat_sum = stat.stats.cat_sum;
+  if (fields & MAPPING) {
+    cur.up = stat.up;
+    cur.acting = stat.acting;
+    cur.mapping_epoch = stat.mapping_epoch;
+  }
+}
+
+void pg_stat_delta_t::dump(Formatter *f) const
+{
+  f->dump_stream("base") << base;
+  f->dump_unsigned("fields", fields);
+  f->open_object_section("stat");
+  stat.dump(f);
+  f->close_section();
+}
+
+void pg_stat_delta_t::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(base, bl);
+  ::encode(fields, bl);
+  ::encode(stat.version, bl);
+  ::encode(stat.reported, bl);
+  if (fields & STATE) {
+    ::encode(stat.state, bl);
+    ::encode(stat.last_change, bl);
+  }
+  if (fields & STAMPS) {
+    ::encode(stat.last_fresh, bl);
+    ::encode(stat.last_active, bl);
+    ::encode(stat.last_clean, bl);
+    ::encode(stat.last_unstale, bl);
+  }
+  if (fields & LOG) {
+    ::encode(stat.log_start, bl);
+    ::encode(stat.ondisk_log_start, bl);
+    ::encode(stat.log_size, bl);
+    ::encode(stat.ondisk_log_size, bl);
+  }
+  if (fields & HISTORY) {
+    ::encode(stat.created, bl);
+    ::encode(stat.last_epoch_clean, bl);
+    ::encode(stat.parent, bl);
+    ::encode(stat.parent_split_bits, bl);
+    ::encode(stat.last_scrub, bl);
+    ::encode(stat.last_scrub_stamp, bl);
+  }
+  if (fields & SUM)
+    ::encode(stat.stats.sum, bl);
+  if (fields & CAT_SUM)
+    ::encode(stat.stats.cat_sum, bl);
+  if (fields & MAPPING) {
+    ::encode(stat.up, bl);
+    ::encode(stat.acting, bl);
+    ::encode(stat.mapping_epoch, bl);
+  }
+  ENCODE_FINISH(bl);
+}
+
+void pg_stat_delta_t::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(base, bl);
+  ::decode(fields, bl);
+  ::decode(stat.version, bl);
+  ::decode(stat.reported, bl);
+  if (fields & STATE) {
+    ::decode(stat.state, bl);
+    ::decode(stat.last_change, bl);
+  }
+  if (fields & STAMPS) {
+    ::decode(stat.last_fresh, bl);
+    ::decode(stat.last_active, bl);
+    ::decode(stat.last_clean, bl);
+    ::decode(stat.last_unstale, bl);
+  }
+  if (fields & LOG) {
+    ::decode(stat.log_start, bl);
+    ::decode(stat.ondisk_log_start, bl);
+    ::decode(stat.log_size, bl);
+    ::decode(stat.ondisk_log_size, bl);
+  }
+  if (fields & HISTORY) {
+    ::decode(stat.created, bl);
+    ::decode(stat.last_epoch_clean, bl);
+    ::decode(stat.parent, bl);
+    ::decode(stat.parent_split_bits, bl);
+    ::decode(stat.last_scrub, bl);
+    ::decode(stat.last_scrub_stamp, bl);
+  }
+  if (fields & SUM)
+    ::decode(stat.stats.sum, bl);
+  if (fields & CAT_SUM)
+    ::decode(stat.stats.cat_sum, bl);
+  if (fields & MAPPING) {
+    ::decode(stat.up, bl);
+    ::decode(stat.acting, bl);
+    ::decode(stat.mapping_epoch, bl);
+  }
+  DECODE_FINISH(bl);
+}
+
+void pg_stat_delta_t::generate_test_instances(list<pg_stat_delta_t*>& o)
+{
+  o.push_back(new pg_stat_delta_t);
+  list<pg_stat_t*> l;
+  pg_stat_t::generate_test_instances(l);
+  o.push_back(new pg_stat_delta_t(*l.front(), *l.back()));
+  pg_stat_t b = *l.back();
+  b.reported = eversion_t(1, 3);
+  b.state = 124;
+  b.stats.sum.num_rd++;
+  o.push_back(new pg_stat_delta_t(*l.back(), b));
+  for (list<pg_stat_t*>::iterator p = l.begin(); p != l.end(); ++p)
+    delete *p;
+}
+
 
 // -- pool_stat_t --
 
@@ -1324,7 +1541,7 @@ void pg_query_t::generate_test_instances(list<pg_query_t*>& o)
 
 void pg_log_entry_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(4, 4, bl);
+  ENCODE_START(5, 4, bl);
   ::encode(op, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
@@ -1333,12 +1550,15 @@ void pg_log_entry_t::encode(bufferlist &bl) const
   ::encode(mtime, bl);
   if (op == CLONE)
     ::encode(snaps, bl);
+  ::encode(dirty_extents_valid, bl);
+  if (dirty_extents_valid)
+    ::encode(dirty_extents, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_log_entry_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(4, 4, 4, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(5, 4, 4, bl);
   ::decode(op, bl);
   if (struct_v < 2) {
     sobject_t old_soid;
@@ -1357,6 +1577,14 @@ void pg_log_entry_t::decode(bufferlist::iterator &bl)
   ::decode(mtime, bl);
   if (op == CLONE)
     ::decode(snaps, bl);
+  dirty_extents.clear();
+  if (struct_v >= 5) {
+    ::decode(dirty_extents_valid, bl);
+    if (dirty_extents_valid)
+      ::decode(dirty_extents, bl);
+  } else {
+    dirty_extents_valid = false;
+  }
   DECODE_FINISH(bl);
 }
 
@@ -1368,6 +1596,8 @@ void pg_log_entry_t::dump(Formatter *f) const
   f->dump_stream("prior_version") << version;
   f->dump_stream("reqid") << reqid;
   f->dump_stream("mtime") << mtime;
+  if (dirty_extents_valid)
+    f->dump_stream("dirty_extents") << dirty_extents;
 }
 
 void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
@@ -1376,6 +1606,10 @@ void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
   hobject_t oid(object_t("objname"), "key", 123, 456);
   o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,2), eversion_t(3,4),
 				 osd_reqid_t(entity_name_t::CLIENT(777), 8, 999), utime_t(8,9)));
+  o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,3), eversion_t(1,2),
+				 osd_reqid_t(entity_name_t::CLIENT(777), 9, 999), utime_t(8,10)));
+  o.back()->dirty_extents.insert(4096, 8192);
+  o.back()->dirty_extents_valid = true;
 }
 
 ostream& operator<<(ostream& out, const pg_log_entry_t& e)
@@ -2136,7 +2370,7 @@ void ObjectRecoveryProgress::dump(Formatter *f) const
 
 void ObjectRecoveryInfo::encode(bufferlist &bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
   ::encode(size, bl);
@@ -2144,12 +2378,13 @@ void ObjectRecoveryInfo::encode(bufferlist &bl) const
   ::encode(ss, bl);
   ::encode(copy_subset, bl);
   ::encode(clone_subset, bl);
+  ::encode(delta_from, bl);
   ENCODE_FINISH(bl);
 }
 
 void ObjectRecoveryInfo::decode(bufferlist::iterator &bl)
 {
-  DECODE_START(1, bl);
+  DECODE_START(2, bl);
   ::decode(soid, bl);
   ::decode(version, bl);
   ::decode(size, bl);
@@ -2157,6 +2392,8 @@ void ObjectRecoveryInfo::decode(bufferlist::iterator &bl)
   ::decode(ss, bl);
   ::decode(copy_subset, bl);
   ::decode(clone_subset, bl);
+  if (struct_v >= 2)
+    ::decode(delta_from, bl);
   DECODE_FINISH(bl);
 }
 
@@ -2187,6 +2424,7 @@ void ObjectRecoveryInfo::dump(Formatter *f) const
   }
   f->dump_stream("copy_subset") << copy_subset;
   f->dump_stream("clone_subset") << clone_subset;
+  f->dump_stream("delta_from") << delta_from;
 }
 
 ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
@@ -2196,11 +2434,137 @@ ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
 
 ostream &ObjectRecoveryInfo::print(ostream &out) const
 {
-  return out << "ObjectRecoveryInfo("
-	     << soid << "@" << version
-	     << ", copy_subset: " << copy_subset
-	     << ", clone_subset: " << clone_subset
-	     << ")";
+  out << "ObjectRecoveryInfo("
+      << soid << "@" << version
+      << ", copy_subset: " << copy_subset
+      << ", clone_subset: " << clone_subset;
+  if (is_delta())
+    out << ", delta_from: " << delta_from;
+  return out << ")";
+}
+
+// -- object_copy_cursor_t --
+
+void object_copy_cursor_t::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(attr_complete, bl);
+  ::encode(data_offset, bl);
+  ::encode(data_complete, bl);
+  ::encode(omap_offset, bl);
+  ::encode(omap_complete, bl);
+  ENCODE_FINISH(bl);
+}
+
+void object_copy_cursor_t::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(attr_complete, bl);
+  ::decode(data_offset, bl);
+  ::decode(data_complete, bl);
+  ::decode(omap_offset, bl);
+  ::decode(omap_complete, bl);
+  DECODE_FINISH(bl);
+}
+
+void object_copy_cursor_t::dump(Formatter *f) const
+{
+  f->dump_int("attr_complete", (int)attr_complete);
+  f->dump_unsigned("data_offset", data_offset);
+  f->dump_int("data_complete", (int)data_complete);
+  f->dump_string("omap_offset", omap_offset);
+  f->dump_int("omap_complete", (int)omap_complete);
+}
+
+void object_copy_cursor_t::generate_test_instances(list<object_copy_cursor_t*>& o)
+{
+  o.push_back(new object_copy_cursor_t);
+  o.push_back(new object_copy_cursor_t);
+  o.back()->attr_complete = true;
+  o.back()->data_offset = 123;
+  o.push_back(new object_copy_cursor_t);
+  o.back()->attr_complete = true;
+  o.back()->data_complete = true;
+  o.back()->omap_offset = "foo";
+  o.push_back(new object_copy_cursor_t);
+  o.back()->attr_complete = true;
+  o.back()->data_complete = true;
+  o.back()->omap_complete = true;
+}
+
+ostream& operator<<(ostream& out, const object_copy_cursor_t &cursor)
+{
+  out << "copy_cursor(";
+  if (cursor.is_complete())
+    return out << "complete)";
+  if (!cursor.attr_complete)
+    return out << "attrs)";
+  if (!cursor.data_complete)
+    return out << "data " << cursor.data_offset << ")";
+  return out << "omap '" << cursor.omap_offset << "')";
+}
+
+// -- object_copy_data_t --
+
+void object_copy_data_t::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(cursor, bl);
+  ::encode(size, bl);
+  ::encode(mtime, bl);
+  ::encode(version, bl);
+  ::encode(user_version, bl);
+  ::encode(attrs, bl);
+  ::encode(omap_header, bl);
+  ::encode(data, bl);
+  ::encode(omap, bl);
+  ENCODE_FINISH(bl);
+}
+
+void object_copy_data_t::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(cursor, bl);
+  ::decode(size, bl);
+  ::decode(mtime, bl);
+  ::decode(version, bl);
+  ::decode(user_version, bl);
+  ::decode(attrs, bl);
+  ::decode(omap_header, bl);
+  ::decode(data, bl);
+  ::decode(omap, bl);
+  DECODE_FINISH(bl);
+}
+
+void object_copy_data_t::dump(Formatter *f) const
+{
+  f->open_object_section("cursor");
+  cursor.dump(f);
+  f->close_section();
+  f->dump_unsigned("size", size);
+  f->dump_stream("mtime") << mtime;
+  f->dump_stream("version") << version;
+  f->dump_stream("user_version") << user_version;
+  f->dump_unsigned("attrs_size", attrs.size());
+  f->dump_unsigned("omap_header_length", omap_header.length());
+  f->dump_unsigned("data_length", data.length());
+  f->dump_unsigned("omap_size", omap.size());
+}
+
+void object_copy_data_t::generate_test_instances(list<object_copy_data_t*>& o)
+{
+  o.push_back(new object_copy_data_t);
+  o.push_back(new object_copy_data_t);
+  o.back()->cursor.attr_complete = true;
+  o.back()->cursor.data_offset = 3;
+  o.back()->size = 1234;
+  o.back()->mtime = utime_t(12, 34);
+  o.back()->version = eversion_t(3, 14);
+  o.back()->user_version = eversion_t(3, 12);
+  o.back()->attrs["foo"].append("bar");
+  o.back()->omap_header.append("header");
+  o.back()->data.append("abc");
+  o.back()->omap["key"].append("value");
 }
 
 // -- ScrubMap --
@@ -2353,6 +2717,13 @@ ostream& operator<<(ostream& out, const OSDOp& op)
     case CEPH_OSD_OP_ROLLBACK:
       out << " " << snapid_t(op.op.snap.snapid);
       break;
+    case CEPH_OSD_OP_COPY_GET:
+      out << " max " << op.op.copy_get.max;
+      break;
+    case CEPH_OSD_OP_COPY_FROM:
+      out << " snapid " << snapid_t(op.op.copy_from.snapid)
+	  << " src_version " << op.op.copy_from.src_version;
+      break;
     default:
       out << " " << op.op.extent.offset << "~" << op.op.extent.length;
       if (op.op.extent.truncate_seq)
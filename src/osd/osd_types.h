@@ -36,6 +36,7 @@
 #define CEPH_OSD_FEATURE_INCOMPAT_OLOC CompatSet::Feature(3, "object locator")
 #define CEPH_OSD_FEATURE_INCOMPAT_LEC  CompatSet::Feature(4, "last_epoch_clean")
 #define CEPH_OSD_FEATURE_INCOMPAT_CATEGORIES  CompatSet::Feature(5, "categories")
+#define CEPH_OSD_FEATURE_INCOMPAT_MAP_CHECKPOINTS CompatSet::Feature(6, "checkpointed full maps")
 
 
 typedef hobject_t collection_list_handle_t;
@@ -757,6 +758,24 @@ struct object_stat_sum_t {
 };
 WRITE_CLASS_ENCODER(object_stat_sum_t)
 
+inline bool operator==(const object_stat_sum_t& l, const object_stat_sum_t& r) {
+  return
+    l.num_bytes == r.num_bytes &&
+    l.num_objects == r.num_objects &&
+    l.num_object_clones == r.num_object_clones &&
+    l.num_object_copies == r.num_object_copies &&
+    l.num_objects_missing_on_primary == r.num_objects_missing_on_primary &&
+    l.num_objects_degraded == r.num_objects_degraded &&
+    l.num_objects_unfound == r.num_objects_unfound &&
+    l.num_rd == r.num_rd &&
+    l.num_rd_kb == r.num_rd_kb &&
+    l.num_wr == r.num_wr &&
+    l.num_wr_kb == r.num_wr_kb;
+}
+inline bool operator!=(const object_stat_sum_t& l, const object_stat_sum_t& r) {
+  return !(l == r);
+}
+
 /**
  * a collection of object stat sums
  *
@@ -813,6 +832,13 @@ struct object_stat_collection_t {
 };
 WRITE_CLASS_ENCODER(object_stat_collection_t)
 
+inline bool operator==(const object_stat_collection_t& l, const object_stat_collection_t& r) {
+  return l.sum == r.sum && l.cat_sum == r.cat_sum;
+}
+inline bool operator!=(const object_stat_collection_t& l, const object_stat_collection_t& r) {
+  return !(l == r);
+}
+
 /** pg_stat
  * aggregate stats for a single PG.
  */
@@ -871,6 +897,46 @@ struct pg_stat_t {
 };
 WRITE_CLASS_ENCODER(pg_stat_t)
 
+/**
+ * pg_stat_delta_t - a pg_stat_t relative to an earlier one
+ *
+ * Fields are grouped; only the groups that differ from the base are
+ * encoded.  version and reported are always included.  The receiver
+ * must hold stats with reported == base for apply() to be meaningful.
+ */
+struct pg_stat_delta_t {
+  enum {
+    STATE   = 1<<0,  // state, last_change
+    STAMPS  = 1<<1,  // last_fresh, last_active, last_clean, last_unstale
+    LOG     = 1<<2,  // log_start, ondisk_log_start, log_size, ondisk_log_size
+    HISTORY = 1<<3,  // created, last_epoch_clean, parent*, last_scrub*
+    SUM     = 1<<4,  // stats.sum
+    CAT_SUM = 1<<5,  // stats.cat_sum
+    MAPPING = 1<<6,  // up, acting, mapping_epoch
+  };
+
+  eversion_t base;  // reported of the stats this is relative to
+  __u32 fields;     // groups present in stat
+  pg_stat_t stat;   // only the groups in fields are meaningful
+
+  pg_stat_delta_t() : fields(0) {}
+  pg_stat_delta_t(const pg_stat_t& from, const pg_stat_t& to) {
+    build(from, to);
+  }
+
+  /// set up a delta taking from to to
+  void build(const pg_stat_t& from, const pg_stat_t& to);
+
+  /// update cur, which must be the base, to the new stats
+  void apply(pg_stat_t& cur) const;
+
+  void dump(Formatter *f) const;
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  static void generate_test_instances(list<pg_stat_delta_t*>& o);
+};
+WRITE_CLASS_ENCODER(pg_stat_delta_t)
+
 /*
  * summation over an entire pool
  */
@@ -1134,16 +1200,22 @@ struct pg_log_entry_t {
   bufferlist snaps;   // only for clone entries
   bool invalid_hash; // only when decoding sobject_t based entries
 
+  // byte ranges of object data this op changed; lets recovery push
+  // only what changed.  only meaningful if dirty_extents_valid.
+  interval_set<uint64_t> dirty_extents;
+  bool dirty_extents_valid;
+
   uint64_t offset;   // [soft state] my offset on disk
       
   pg_log_entry_t()
-    : op(0), invalid_hash(false), offset(0) {}
+    : op(0), invalid_hash(false), dirty_extents_valid(false), offset(0) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 const osd_reqid_t& rid, const utime_t& mt)
     : op(_op), soid(_soid), version(v),
       prior_version(pv),
-      reqid(rid), mtime(mt), invalid_hash(false), offset(0) {}
+      reqid(rid), mtime(mt), invalid_hash(false),
+      dirty_extents_valid(false), offset(0) {}
       
   bool is_clone() const { return op == CLONE; }
   bool is_modify() const { return op == MODIFY; }
@@ -1626,9 +1698,12 @@ struct ObjectRecoveryInfo {
   SnapSet ss;
   interval_set<uint64_t> copy_subset;
   map<hobject_t, interval_set<uint64_t> > clone_subset;
+  eversion_t delta_from;  // if set, copy_subset applies on top of the peer's copy at this version
 
   ObjectRecoveryInfo() : size(0) { }
 
+  bool is_delta() const { return delta_from != eversion_t(); }
+
   static void generate_test_instances(list<ObjectRecoveryInfo*>& o);
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
@@ -1667,6 +1742,62 @@ WRITE_CLASS_ENCODER(ObjectRecoveryProgress)
 ostream& operator<<(ostream& out, const ObjectRecoveryProgress &prog);
 
 
+/*
+ * object copies (CEPH_OSD_OP_COPY_GET)
+ *
+ * an object is read out in chunks: first the user xattrs and omap
+ * header, then the data, then the omap keys.  the cursor says where the
+ * next chunk starts.
+ */
+struct object_copy_cursor_t {
+  bool attr_complete;
+  uint64_t data_offset;
+  bool data_complete;
+  string omap_offset;   ///< last omap key we got
+  bool omap_complete;
+
+  object_copy_cursor_t()
+    : attr_complete(false),
+      data_offset(0),
+      data_complete(false),
+      omap_complete(false) { }
+
+  bool is_initial() const {
+    return !attr_complete && data_offset == 0 && omap_offset.empty();
+  }
+  bool is_complete() const {
+    return attr_complete && data_complete && omap_complete;
+  }
+
+  static void generate_test_instances(list<object_copy_cursor_t*>& o);
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(object_copy_cursor_t)
+ostream& operator<<(ostream& out, const object_copy_cursor_t &cursor);
+
+struct object_copy_data_t {
+  object_copy_cursor_t cursor;  ///< where the next chunk starts
+  uint64_t size;
+  utime_t mtime;
+  eversion_t version;           ///< so we notice if it changes under us
+  eversion_t user_version;
+  map<string, bufferlist> attrs;  ///< user xattrs
+  bufferlist omap_header;
+  bufferlist data;
+  map<string, bufferlist> omap;
+
+  object_copy_data_t() : size(0) {}
+
+  static void generate_test_instances(list<object_copy_data_t*>& o);
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(object_copy_data_t)
+
+
 /*
  * summarize pg contents for purposes of a scrub
  */
@@ -4,7 +4,28 @@
 #include "msg/Messenger.h"
 #include "ObjectCacher.h"
 #include "Objecter.h"
+#include "common/perf_counters.h"
 
+enum {
+  l_objectcacher_first = 25000,
+
+  l_objectcacher_clean_recent,    // bytes on the first-use (or only) list
+  l_objectcacher_clean_frequent,  // bytes on the re-referenced list (2q)
+  l_objectcacher_ghost,           // bytes of recently evicted extents (2q)
+  l_objectcacher_dirty,
+  l_objectcacher_tx,
+  l_objectcacher_rx,
+
+  l_objectcacher_hit_recent,
+  l_objectcacher_hit_frequent,
+  l_objectcacher_hit_dirty,       // reads served from dirty or tx data
+  l_objectcacher_miss,
+  l_objectcacher_ghost_hit,       // misses that were recently evicted
+  l_objectcacher_evict_recent,
+  l_objectcacher_evict_frequent,
+
+  l_objectcacher_last,
+};
 
 
 /*** ObjectCacher::BufferHead ***/
@@ -14,16 +35,27 @@
 
 #define DOUT_SUBSYS objectcacher
 #undef dout_prefix
-#define dout_prefix *_dout << oc->objecter->messenger->get_myname() << ".objectcacher.object(" << oid << ") "
+#define dout_prefix *_dout << oc->name << ".objectcacher.object(" << oid << ") "
 
 ObjectCacher::
-ObjectCacher(CephContext *cct_, Objecter *o, Mutex& l, flush_set_callback_t flush_callback,
-	     void *flush_callback_arg) : 
-    cct(cct_), objecter(o), filer(o), lock(l),
+ObjectCacher(CephContext *cct_, string name, WritebackHandler& wb, Mutex& l,
+	     flush_set_callback_t flush_callback,
+	     void *flush_callback_arg, Objecter *o) : 
+    cct(cct_), name(name), writeback_handler(wb), objecter(o), filer(NULL), lock(l),
     flush_set_callback(flush_callback), flush_set_callback_arg(flush_callback_arg),
+    max_size(cct_->_conf->client_oc_size),
+    max_dirty(cct_->_conf->client_oc_max_dirty),
+    target_dirty(cct_->_conf->client_oc_target_dirty),
+    max_dirty_age(cct_->_conf->client_oc_max_dirty_age),
+    policy_2q(cct_->_conf->client_oc_policy == "2q"),
+    perfcounter(NULL),
     flusher_stop(false), flusher_thread(this),
     stat_waiter(0),
-    stat_clean(0), stat_dirty(0), stat_rx(0), stat_tx(0), stat_missing(0) {
+    stat_clean(0), stat_dirty(0), stat_rx(0), stat_tx(0), stat_missing(0),
+    stat_clean_hot(0), stat_ghost(0),
+    writeback_rate(0), writeback_bytes(0) {
+  if (objecter)
+    filer = new Filer(objecter);
   }
 
 ObjectCacher::BufferHead *ObjectCacher::Object::split(BufferHead *left, loff_t off)
@@ -35,6 +67,7 @@ ObjectCacher::BufferHead *ObjectCacher::Object::split(BufferHead *left, loff_t o
   right->last_write_tid = left->last_write_tid;
   right->set_state(left->get_state());
   right->snapc = left->snapc;
+  right->hot = left->hot;
   
   loff_t newleftlen = off - left->start();
   right->set_start(off);
@@ -119,7 +152,8 @@ void ObjectCacher::Object::try_merge_bh(BufferHead *bh)
   if (p != data.begin()) {
     p--;
     if (p->second->end() == bh->start() &&
-	p->second->get_state() == bh->get_state()) {
+	p->second->get_state() == bh->get_state() &&
+	p->second->hot == bh->hot) {
       merge_left(p->second, bh);
       bh = p->second;
     } else 
@@ -130,7 +164,8 @@ void ObjectCacher::Object::try_merge_bh(BufferHead *bh)
   p++;
   if (p != data.end() &&
       p->second->start() == bh->end() &&
-      p->second->get_state() == bh->get_state()) 
+      p->second->get_state() == bh->get_state() &&
+      p->second->hot == bh->hot)
     merge_left(bh, p->second);
 }
 
@@ -139,14 +174,7 @@ void ObjectCacher::Object::try_merge_bh(BufferHead *bh)
  */
 bool ObjectCacher::Object::is_cached(loff_t cur, loff_t left)
 {
-  map<loff_t, BufferHead*>::iterator p = data.lower_bound(cur);
-  
-  if (p != data.begin() && 
-      (p == data.end() || p->first > cur)) {
-    p--;     // might overlap!
-    if (p->first + p->second->length() <= cur) 
-      p++;   // doesn't overlap.
-  }
+  map<loff_t, BufferHead*>::iterator p = data_lower_bound(cur);
   
   while (left > 0) {
     if (p == data.end())
@@ -187,19 +215,11 @@ int ObjectCacher::Object::map_read(OSDRead *rd,
     ldout(oc->cct, 10) << "map_read " << ex_it->oid 
              << " " << ex_it->offset << "~" << ex_it->length << dendl;
     
-    map<loff_t, BufferHead*>::iterator p = data.lower_bound(ex_it->offset);
-    // p->first >= start
+    map<loff_t, BufferHead*>::iterator p = data_lower_bound(ex_it->offset);
     
     loff_t cur = ex_it->offset;
     loff_t left = ex_it->length;
     
-    if (p != data.begin() && 
-        (p == data.end() || p->first > cur)) {
-      p--;     // might overlap!
-      if (p->first + p->second->length() <= cur) 
-        p++;   // doesn't overlap.
-    }
-    
     while (left > 0) {
       // at end?
       if (p == data.end()) {
@@ -278,27 +298,11 @@ ObjectCacher::BufferHead *ObjectCacher::Object::map_write(OSDWrite *wr)
     ldout(oc->cct, 10) << "map_write oex " << ex_it->oid
              << " " << ex_it->offset << "~" << ex_it->length << dendl;
     
-    map<loff_t, BufferHead*>::iterator p = data.lower_bound(ex_it->offset);
-    // p->first >= start
+    map<loff_t, BufferHead*>::iterator p = data_lower_bound(ex_it->offset);
     
     loff_t cur = ex_it->offset;
     loff_t left = ex_it->length;
     
-    if (p != data.begin() && 
-        (p == data.end() || p->first > cur)) {
-      p--;     // might overlap or butt up!
-
-      /*// dirty and butts up?
-      if (p->first + p->second->length() == cur &&
-          p->second->is_dirty()) {
-        ldout(oc->cct, 10) << "map_write will append to tail of " << *p->second << dendl;
-        final = p->second;
-      }
-      */
-      if (p->first + p->second->length() <= cur) 
-        p++;   // doesn't overlap.
-    }    
-    
     while (left > 0) {
       loff_t max = left;
 
@@ -421,10 +425,131 @@ void ObjectCacher::Object::truncate(loff_t s)
 /*** ObjectCacher ***/
 
 #undef dout_prefix
-#define dout_prefix *_dout << objecter->messenger->get_myname() << ".objectcacher "
+#define dout_prefix *_dout << name << ".objectcacher "
 
 /* private */
 
+void ObjectCacher::start()
+{
+  if (!perfcounter) {
+    PerfCountersBuilder pcb(cct, "objectcacher-" + name,
+			    l_objectcacher_first, l_objectcacher_last);
+    pcb.add_u64(l_objectcacher_clean_recent, "clean_recent");
+    pcb.add_u64(l_objectcacher_clean_frequent, "clean_frequent");
+    pcb.add_u64(l_objectcacher_ghost, "ghost");
+    pcb.add_u64(l_objectcacher_dirty, "dirty");
+    pcb.add_u64(l_objectcacher_tx, "tx");
+    pcb.add_u64(l_objectcacher_rx, "rx");
+    pcb.add_u64_counter(l_objectcacher_hit_recent, "hit_recent");
+    pcb.add_u64_counter(l_objectcacher_hit_frequent, "hit_frequent");
+    pcb.add_u64_counter(l_objectcacher_hit_dirty, "hit_dirty");
+    pcb.add_u64_counter(l_objectcacher_miss, "miss");
+    pcb.add_u64_counter(l_objectcacher_ghost_hit, "ghost_hit");
+    pcb.add_u64_counter(l_objectcacher_evict_recent, "evict_recent");
+    pcb.add_u64_counter(l_objectcacher_evict_frequent, "evict_frequent");
+    perfcounter = pcb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(perfcounter);
+  }
+  flusher_thread.create();
+}
+
+void ObjectCacher::stop()
+{
+  assert(flusher_thread.is_started());
+  lock.Lock();  // hmm.. watch out for deadlock!
+  flusher_stop = true;
+  flusher_cond.Signal();
+  lock.Unlock();
+  flusher_thread.join();
+
+  if (perfcounter) {
+    cct->get_perfcounters_collection()->remove(perfcounter);
+    delete perfcounter;
+    perfcounter = NULL;
+  }
+}
+
+void ObjectCacher::update_perf()
+{
+  if (!perfcounter)
+    return;
+  perfcounter->set(l_objectcacher_clean_recent, stat_clean - stat_clean_hot);
+  perfcounter->set(l_objectcacher_clean_frequent, stat_clean_hot);
+  perfcounter->set(l_objectcacher_ghost, stat_ghost);
+  perfcounter->set(l_objectcacher_dirty, stat_dirty);
+  perfcounter->set(l_objectcacher_tx, stat_tx);
+  perfcounter->set(l_objectcacher_rx, stat_rx);
+}
+
+void ObjectCacher::ghost_add(BufferHead *bh)
+{
+  ldout(cct, 20) << "ghost_add " << *bh->ob << " " << *bh << dendl;
+  GhostKey key(bh->ob->oloc.pool, bh->ob->get_soid(), bh->start());
+  map<GhostKey, GhostEntry>::iterator p = ghost.find(key);
+  if (p != ghost.end())
+    ghost_remove(p);
+
+  ghost_lru.push_back(key);
+  GhostEntry& e = ghost[key];
+  e.length = bh->length();
+  e.lru_pos = --ghost_lru.end();
+  stat_ghost += e.length;
+
+  loff_t max = (loff_t)(max_size * cct->_conf->client_oc_2q_ghost_ratio);
+  while (stat_ghost > max && !ghost_lru.empty())
+    ghost_remove(ghost.find(ghost_lru.front()));
+}
+
+void ObjectCacher::ghost_remove(map<GhostKey, GhostEntry>::iterator p)
+{
+  assert(p != ghost.end());
+  stat_ghost -= p->second.length;
+  ghost_lru.erase(p->second.lru_pos);
+  ghost.erase(p);
+}
+
+/*
+ * was any part of bh evicted from the first-use list recently?  matching
+ * ghost entries are dropped, since bh is about to be cached again.
+ */
+bool ObjectCacher::ghost_hit(BufferHead *bh)
+{
+  if (ghost.empty())
+    return false;
+
+  int64_t pool = bh->ob->oloc.pool;
+  sobject_t oid = bh->ob->get_soid();
+  map<GhostKey, GhostEntry>::iterator p = ghost.lower_bound(GhostKey(pool, oid, bh->start()));
+  if (p != ghost.begin()) {
+    --p;
+    if (p->first.pool != pool || p->first.oid != oid ||
+	p->first.start + p->second.length <= bh->start())
+      ++p;
+  }
+
+  bool hit = false;
+  while (p != ghost.end() &&
+	 p->first.pool == pool && p->first.oid == oid &&
+	 p->first.start < bh->end()) {
+    hit = true;
+    ghost_remove(p++);
+  }
+  return hit;
+}
+
+void ObjectCacher::bh_make_hot(BufferHead *bh)
+{
+  assert(bh->is_clean());
+  if (bh->hot)
+    return;
+  ldout(cct, 20) << "bh_make_hot " << *bh << dendl;
+  bh_stat_sub(bh);
+  lru_rest.lru_remove(bh);
+  bh->hot = true;
+  lru_hot.lru_insert_top(bh);
+  bh_stat_add(bh);
+}
+
 void ObjectCacher::close_object(Object *ob) 
 {
   ldout(cct, 10) << "close_object " << *ob << dendl;
@@ -451,23 +576,28 @@ void ObjectCacher::bh_read(BufferHead *bh)
   ObjectSet *oset = bh->ob->oset;
 
   // go
-  objecter->read_trunc(bh->ob->get_oid(), bh->ob->get_oloc(), 
-		 bh->start(), bh->length(), bh->ob->get_snap(),
-		 &onfinish->bl, 0,
-		 oset->truncate_size, oset->truncate_seq,
-		 onfinish);
+  writeback_handler.read(bh->ob->get_oid(), bh->ob->get_oloc(),
+			 bh->start(), bh->length(), bh->ob->get_snap(),
+			 &onfinish->bl,
+			 oset->truncate_size, oset->truncate_seq,
+			 onfinish);
 }
 
-void ObjectCacher::bh_read_finish(int64_t poolid, sobject_t oid, loff_t start, uint64_t length, bufferlist &bl)
+void ObjectCacher::bh_read_finish(int64_t poolid, sobject_t oid, loff_t start, uint64_t length,
+				  bufferlist &bl, int r)
 {
   //lock.Lock();
   ldout(cct, 7) << "bh_read_finish " 
           << oid
           << " " << start << "~" << length
 	  << " (bl is " << bl.length() << ")"
+	  << " r = " << r
           << dendl;
 
-  if (bl.length() < length) {
+  // only a missing object reads as a hole
+  bool failed = (r < 0 && r != -ENOENT);
+
+  if (!failed && bl.length() < length) {
     bufferptr bp(length - bl.length());
     bp.zero();
     ldout(cct, 7) << "bh_read_finish " << oid << " padding " << start << "~" << length 
@@ -506,11 +636,34 @@ void ObjectCacher::bh_read_finish(int64_t poolid, sobject_t oid, loff_t start, u
       assert(opos >= bh->start());
       assert(bh->start() == opos);   // we don't merge rx bh's... yet!
       assert(bh->length() <= start+(loff_t)length-opos);
+
+      if (failed) {
+	// hand the error to the readers and forget the bh, so the next
+	// read of this range goes back to the osd
+	ldout(cct, 10) << "bh_read_finish error " << r << " on " << *bh << dendl;
+	list<Context*> ls;
+	for (map<loff_t, list<Context*> >::iterator p = bh->waitfor_read.begin();
+	     p != bh->waitfor_read.end();
+	     p++)
+	  ls.splice(ls.end(), p->second);
+	bh->waitfor_read.clear();
+	opos = bh->end();
+	p++;
+	bh_remove(ob, bh);
+	delete bh;
+	finish_contexts(cct, ls, r);
+	continue;
+      }
       
       bh->bl.substr_of(bl,
-                       opos-bh->start(),
+                       opos-start,
                        bh->length());
       mark_clean(bh);
+      if (policy_2q && ghost_hit(bh)) {
+	if (perfcounter)
+	  perfcounter->inc(l_objectcacher_ghost_hit);
+	bh_make_hot(bh);
+      }
       ldout(cct, 10) << "bh_read_finish read " << *bh << dendl;
       
       opos = bh->end();
@@ -545,11 +698,11 @@ void ObjectCacher::bh_write(BufferHead *bh)
   ObjectSet *oset = bh->ob->oset;
 
   // go
-  tid_t tid = objecter->write_trunc(bh->ob->get_oid(), bh->ob->get_oloc(),
-			      bh->start(), bh->length(),
-			      bh->snapc, bh->bl, bh->last_write, 0,
-			      oset->truncate_size, oset->truncate_seq,
-				    NULL, oncommit);
+  tid_t tid = writeback_handler.write(bh->ob->get_oid(), bh->ob->get_oloc(),
+				      bh->start(), bh->length(),
+				      bh->snapc, bh->bl, bh->last_write,
+				      oset->truncate_size, oset->truncate_seq,
+				      oncommit);
 
   // set bh last_write_tid
   oncommit->tid = tid;
@@ -559,6 +712,38 @@ void ObjectCacher::bh_write(BufferHead *bh)
   mark_tx(bh);
 }
 
+/*
+ * write out bh along with the rest of its object's dirty bhs, in
+ * offset order, so an object's writeback goes out as one burst of
+ * ordered writes rather than trickling out in lru order.
+ */
+loff_t ObjectCacher::bh_write_object(BufferHead *bh)
+{
+  Object *ob = bh->ob;
+  set<BufferHead*, BufferHeadObjectLess>::iterator p = dirty_bh.find(bh);
+  assert(p != dirty_bh.end());
+  while (p != dirty_bh.begin()) {
+    --p;
+    if ((*p)->ob != ob) {
+      ++p;
+      break;
+    }
+  }
+
+  list<BufferHead*> ls;
+  for (; p != dirty_bh.end() && (*p)->ob == ob; ++p)
+    ls.push_back(*p);
+
+  ldout(cct, 10) << "bh_write_object " << *ob << " " << ls.size() << " dirty bhs" << dendl;
+
+  loff_t did = 0;
+  for (list<BufferHead*>::iterator i = ls.begin(); i != ls.end(); ++i) {
+    did += (*i)->length();
+    bh_write(*i);
+  }
+  return did;
+}
+
 void ObjectCacher::lock_ack(int64_t poolid, list<sobject_t>& oids, tid_t tid)
 {
   for (list<sobject_t>::iterator i = oids.begin();
@@ -667,6 +852,7 @@ void ObjectCacher::bh_write_commit(int64_t poolid, sobject_t oid, loff_t start,
       mark_clean(bh);
       ldout(cct, 10) << "bh_write_commit clean " << *bh << dendl;
     }
+    note_writeback(length);
     
     // update last_commit.
     assert(ob->last_commit_tid < tid);
@@ -694,12 +880,32 @@ void ObjectCacher::bh_write_commit(int64_t poolid, sobject_t oid, loff_t start,
   //lock.Unlock();
 }
 
-void ObjectCacher::flush(loff_t amount)
+void ObjectCacher::note_writeback(loff_t bytes)
 {
-  utime_t cutoff = ceph_clock_now(cct);
-  //cutoff.sec_ref() -= cct->_conf->client_oc_max_dirty_age;
+  utime_t now = ceph_clock_now(cct);
+  if (writeback_stamp == utime_t())
+    writeback_stamp = now;
+  writeback_bytes += bytes;
+
+  double elapsed = now - writeback_stamp;
+  if (elapsed < .1)
+    return;
+  double rate = (double)writeback_bytes / elapsed;
+  if (writeback_rate > 0)
+    writeback_rate = (writeback_rate * 3.0 + rate) / 4.0;
+  else
+    writeback_rate = rate;
+  writeback_bytes = 0;
+  writeback_stamp = now;
+}
 
-  ldout(cct, 10) << "flush " << amount << dendl;
+/*
+ * write back at least amount bytes (everything, if 0), oldest first,
+ * stopping at the first bh dirtied after cutoff (if set).
+ */
+void ObjectCacher::flush(loff_t amount, utime_t cutoff)
+{
+  ldout(cct, 10) << "flush " << amount << " cutoff " << cutoff << dendl;
   
   /*
    * NOTE: we aren't actually pulling things off the LRU here, just looking at the
@@ -710,10 +916,9 @@ void ObjectCacher::flush(loff_t amount)
   while (amount == 0 || did < amount) {
     BufferHead *bh = (BufferHead*) lru_dirty.lru_get_next_expire();
     if (!bh) break;
-    if (bh->last_write > cutoff) break;
+    if (cutoff != utime_t() && bh->last_write > cutoff) break;
 
-    did += bh->length();
-    bh_write(bh);
+    did += bh_write_object(bh);
   }    
 }
 
@@ -721,18 +926,39 @@ void ObjectCacher::flush(loff_t amount)
 void ObjectCacher::trim(loff_t max)
 {
   if (max < 0) 
-    max = cct->_conf->client_oc_size;
+    max = max_size;
   
   ldout(cct, 10) << "trim  start: max " << max 
            << "  clean " << get_stat_clean()
+	   << " (" << get_stat_clean_hot() << " hot)"
            << dendl;
 
+  // under 2q, take from the first-use list while it is over its share
+  loff_t max_recent = (loff_t)(max * cct->_conf->client_oc_2q_recent_ratio);
+
   while (get_stat_clean() > max) {
-    BufferHead *bh = (BufferHead*) lru_rest.lru_expire();
+    BufferHead *bh = NULL;
+    if (!policy_2q ||
+	get_stat_clean() - get_stat_clean_hot() > max_recent)
+      bh = (BufferHead*) lru_rest.lru_expire();
+    if (!bh)
+      bh = (BufferHead*) lru_hot.lru_expire();
+    if (!bh && policy_2q)
+      bh = (BufferHead*) lru_rest.lru_expire();
     if (!bh) break;
     
     ldout(cct, 10) << "trim trimming " << *bh << dendl;
     assert(bh->is_clean());
+
+    if (bh->hot) {
+      if (perfcounter)
+	perfcounter->inc(l_objectcacher_evict_frequent);
+    } else {
+      if (perfcounter)
+	perfcounter->inc(l_objectcacher_evict_recent);
+      if (policy_2q)
+	ghost_add(bh);
+    }
     
     Object *ob = bh->ob;
     bh_remove(ob, bh);
@@ -801,6 +1027,8 @@ int ObjectCacher::readx(OSDRead *rd, ObjectSet *oset, Context *onfinish)
            bh_it != missing.end();
            bh_it++) {
         bh_read(bh_it->second);
+	if (perfcounter)
+	  perfcounter->inc(l_objectcacher_miss);
         if (success && onfinish) {
           ldout(cct, 10) << "readx missed, waiting on " << *bh_it->second 
                    << " off " << bh_it->first << dendl;
@@ -882,8 +1110,17 @@ int ObjectCacher::readx(OSDRead *rd, ObjectSet *oset, Context *onfinish)
   // bump hits in lru
   for (list<BufferHead*>::iterator bhit = hit_ls.begin();
        bhit != hit_ls.end();
-       bhit++) 
+       bhit++) {
+    if (perfcounter) {
+      if (!(*bhit)->is_clean())
+	perfcounter->inc(l_objectcacher_hit_dirty);
+      else if ((*bhit)->hot)
+	perfcounter->inc(l_objectcacher_hit_frequent);
+      else
+	perfcounter->inc(l_objectcacher_hit_recent);
+    }
     touch_bh(*bhit);
+  }
   
   if (!success) return 0;  // wait!
 
@@ -966,6 +1203,18 @@ int ObjectCacher::writex(OSDWrite *wr, ObjectSet *oset)
     touch_bh(bh);
     bh->last_write = now;
 
+    // we may have written over an rx bh; its readers can use our data
+    // now, and won't hear from bh_read_finish since we're no longer rx.
+    if (!bh->waitfor_read.empty()) {
+      list<Context*> ls;
+      for (map<loff_t, list<Context*> >::iterator p = bh->waitfor_read.begin();
+	   p != bh->waitfor_read.end();
+	   p++)
+	ls.splice(ls.end(), p->second);
+      bh->waitfor_read.clear();
+      finish_contexts(cct, ls);
+    }
+
     o->try_merge_bh(bh);
   }
 
@@ -983,11 +1232,16 @@ bool ObjectCacher::wait_for_write(uint64_t len, Mutex& lock)
   int blocked = 0;
   const md_config_t *conf = cct->_conf;
 
+  // write-through: nothing may stay dirty, so there is nothing to
+  // throttle here; the caller waits for the write to commit instead.
+  if (max_dirty == 0)
+    return false;
+
   // wait for writeback?
-  while (get_stat_dirty() + get_stat_tx() >= conf->client_oc_max_dirty) {
+  while (get_stat_dirty() + get_stat_tx() >= max_dirty) {
     ldout(cct, 10) << "wait_for_write waiting on " << len << ", dirty|tx " 
 	     << (get_stat_dirty() + get_stat_tx()) 
-	     << " >= " << conf->client_oc_max_dirty 
+	     << " >= " << max_dirty 
 	     << dendl;
     flusher_cond.Signal();
     stat_waiter++;
@@ -998,54 +1252,92 @@ bool ObjectCacher::wait_for_write(uint64_t len, Mutex& lock)
   }
 
   // start writeback anyway?
-  if (get_stat_dirty() > conf->client_oc_target_dirty) {
+  if (get_stat_dirty() > target_dirty) {
     ldout(cct, 10) << "wait_for_write " << get_stat_dirty() << " > target "
-	     << conf->client_oc_target_dirty << ", nudging flusher" << dendl;
+	     << target_dirty << ", nudging flusher" << dendl;
     flusher_cond.Signal();
   }
+
+  /*
+   * between target and max, pace the writer to the writeback rate,
+   * scaled by how far past target we are.  writers then slow down
+   * gradually instead of all stalling at once when max is reached.
+   */
+  loff_t target = target_dirty;
+  loff_t max = max_dirty;
+  loff_t dirty = get_stat_dirty() + get_stat_tx();
+  if (dirty > target && max > target &&
+      writeback_rate > 0 && conf->client_oc_max_dirty_delay > 0) {
+    double frac = (double)(dirty - target) / (double)(max - target);
+    double delay = MIN(frac * (double)len / writeback_rate,
+		       conf->client_oc_max_dirty_delay);
+    utime_t until = ceph_clock_now(cct);
+    until += delay;
+    ldout(cct, 10) << "wait_for_write pacing " << len << " for " << delay
+	     << "s, dirty|tx " << dirty << ", writeback " << writeback_rate
+	     << " bytes/sec" << dendl;
+    while (get_stat_dirty() + get_stat_tx() > target &&
+	   ceph_clock_now(cct) < until) {
+      stat_waiter++;
+      stat_cond.WaitUntil(lock, until);
+      stat_waiter--;
+    }
+    blocked++;
+  }
   return blocked;
 }
 
 void ObjectCacher::flusher_entry()
 {
-  const md_config_t *conf = cct->_conf;
   ldout(cct, 10) << "flusher start" << dendl;
   lock.Lock();
   while (!flusher_stop) {
     while (!flusher_stop) {
       loff_t all = get_stat_tx() + get_stat_rx() + get_stat_clean() + get_stat_dirty();
       ldout(cct, 11) << "flusher "
-               << all << " / " << conf->client_oc_size << ":  "
+               << all << " / " << max_size << ":  "
                << get_stat_tx() << " tx, "
                << get_stat_rx() << " rx, "
                << get_stat_clean() << " clean, "
                << get_stat_dirty() << " dirty ("
-	       << conf->client_oc_target_dirty << " target, "
-	       << conf->client_oc_max_dirty << " max)"
+	       << target_dirty << " target, "
+	       << max_dirty << " max), "
+	       << get_stat_clean_hot() << " hot, "
+	       << get_stat_ghost() << " ghost"
                << dendl;
-      if (get_stat_dirty() > conf->client_oc_target_dirty) {
+      update_perf();
+      if (get_stat_dirty() > target_dirty) {
         // flush some dirty pages
         ldout(cct, 10) << "flusher " 
                  << get_stat_dirty() << " dirty > target "
-		 << conf->client_oc_target_dirty
+		 << target_dirty
                  << ", flushing some dirty bhs" << dendl;
-        flush(get_stat_dirty() - conf->client_oc_target_dirty);
+        flush(get_stat_dirty() - target_dirty);
       }
       else {
-        // check tail of lru for old dirty items
+        // write back anything that has been dirty too long
         utime_t cutoff = ceph_clock_now(cct);
-        cutoff.sec_ref()--;
-        BufferHead *bh = 0;
-        while ((bh = (BufferHead*)lru_dirty.lru_get_next_expire()) != 0 &&
-               bh->last_write < cutoff) {
-          ldout(cct, 10) << "flusher flushing aged dirty bh " << *bh << dendl;
-          bh_write(bh);
-        }
+        cutoff -= max_dirty_age;
+        flush(0, cutoff);
         break;
       }
     }
     if (flusher_stop) break;
-    flusher_cond.WaitInterval(cct, lock, utime_t(1,0));
+
+    // sleep until the oldest dirty bh comes due, rather than a fixed tick,
+    // so aged writeback trickles out instead of arriving in bursts.
+    utime_t interval(1, 0);
+    BufferHead *bh = (BufferHead*)lru_dirty.lru_get_next_expire();
+    if (bh) {
+      utime_t due = bh->last_write;
+      due += max_dirty_age;
+      utime_t now = ceph_clock_now(cct);
+      if (due <= now)
+	interval = utime_t(0, 10000000);  // 10ms
+      else if (due - now < interval)
+	interval = due - now;
+    }
+    flusher_cond.WaitInterval(cct, lock, interval);
   }
   lock.Unlock();
   ldout(cct, 10) << "flusher finish" << dendl;
@@ -1059,6 +1351,7 @@ int ObjectCacher::atomic_sync_readx(OSDRead *rd, ObjectSet *oset, Mutex& lock)
   ldout(cct, 10) << "atomic_sync_readx " << rd
            << " in " << oset
            << dendl;
+  assert(objecter);
 
   if (rd->extents.size() == 1) {
     // single object.
@@ -1125,6 +1418,7 @@ int ObjectCacher::atomic_sync_writex(OSDWrite *wr, ObjectSet *oset, Mutex& lock)
   ldout(cct, 10) << "atomic_sync_writex " << wr
            << " in " << oset
            << dendl;
+  assert(objecter);
 
   if (wr->extents.size() == 1 &&
       wr->extents.front().length <= cct->_conf->client_oc_max_sync_write) {
@@ -1460,6 +1754,7 @@ bool ObjectCacher::flush_set(ObjectSet *oset, Context *onfinish)
   
   if (safe) {
     ldout(cct, 10) << "flush_set " << oset << " has no dirty|tx bhs" << dendl;
+    gather.set_finisher(NULL);  // nothing to wait for; caller keeps onfinish
     return true;
   }
   return false;
@@ -1503,6 +1798,7 @@ bool ObjectCacher::commit_set(ObjectSet *oset, Context *onfinish)
 
   if (safe) {
     ldout(cct, 10) << "commit_set " << oset << " all committed" << dendl;
+    gather.set_finisher(NULL);  // nothing to wait for; caller keeps onfinish
     return true;
   }
   return false;
@@ -1724,7 +2020,7 @@ void ObjectCacher::verify_stats() const
 {
   ldout(cct, 10) << "verify_stats" << dendl;
 
-  loff_t clean = 0, dirty = 0, rx = 0, tx = 0, missing = 0;
+  loff_t clean = 0, clean_hot = 0, dirty = 0, rx = 0, tx = 0, missing = 0;
   for (vector<hash_map<sobject_t, Object*> >::const_iterator i = objects.begin();
       i != objects.end();
       ++i) {
@@ -1742,6 +2038,8 @@ void ObjectCacher::verify_stats() const
           break;
         case BufferHead::STATE_CLEAN:
           clean += bh->length();
+	  if (bh->hot)
+	    clean_hot += bh->length();
           break;
         case BufferHead::STATE_DIRTY:
           dirty += bh->length();
@@ -1760,12 +2058,14 @@ void ObjectCacher::verify_stats() const
   }
 
   ldout(cct, 10) << " clean " << clean
+	   << " (" << clean_hot << " hot)"
 	   << " rx " << rx 
 	   << " tx " << tx
 	   << " dirty " << dirty
 	   << " missing " << missing
 	   << dendl;
   assert(clean == stat_clean);
+  assert(clean_hot == stat_clean_hot);
   assert(rx == stat_rx);
   assert(tx == stat_tx);
   assert(dirty == stat_dirty);
@@ -13,9 +13,11 @@
 
 #include "Objecter.h"
 #include "Filer.h"
+#include "WritebackHandler.h"
 
 class CephContext;
 class Objecter;
+class PerfCounters;
 
 class ObjectCacher {
  public:
@@ -79,6 +81,7 @@ class ObjectCacher {
     tid_t last_write_tid;  // version of bh (if non-zero)
     utime_t last_write;
     SnapContext snapc;
+    bool hot;              // clean, and on the frequently-used list (2q)
     
     map< loff_t, list<Context*> > waitfor_read;
     
@@ -88,7 +91,8 @@ class ObjectCacher {
       state(STATE_MISSING),
       ref(0),
       ob(o),
-      last_write_tid(0) {}
+      last_write_tid(0),
+      hot(false) {}
   
     // extent
     loff_t start() const { return ex.start; }
@@ -231,6 +235,22 @@ class ObjectCacher {
     }
     bool is_empty() { return data.empty(); }
 
+    /*
+     * first bh overlapping or following offset.  bhs never overlap,
+     * so a lookup by start plus one step back is enough to find the
+     * whole overlapping run without walking the map.
+     */
+    map<loff_t, BufferHead*>::iterator data_lower_bound(loff_t offset) {
+      map<loff_t, BufferHead*>::iterator p = data.lower_bound(offset);
+      if (p != data.begin() &&
+	  (p == data.end() || p->first > offset)) {
+	p--;     // might overlap!
+	if (p->first + p->second->length() <= offset)
+	  p++;   // doesn't overlap.
+      }
+      return p;
+    }
+
     // mid-level
     BufferHead *split(BufferHead *bh, loff_t off);
     void merge_left(BufferHead *left, BufferHead *right);
@@ -248,6 +268,20 @@ class ObjectCacher {
   };
   
 
+  // order bhs by object, then offset, so writeback goes out in order
+  struct BufferHeadObjectLess {
+    bool operator()(BufferHead *l, BufferHead *r) const {
+      if (l->ob != r->ob) {
+	if (l->ob->oloc.pool != r->ob->oloc.pool)
+	  return l->ob->oloc.pool < r->ob->oloc.pool;
+	if (l->ob->get_soid() != r->ob->get_soid())
+	  return l->ob->get_soid() < r->ob->get_soid();
+	return l->ob < r->ob;
+      }
+      return l->start() < r->start();
+    }
+  };
+
   struct ObjectSet {
     void *parent;
 
@@ -268,8 +302,10 @@ class ObjectCacher {
   // ******* ObjectCacher *********
   // ObjectCacher fields
  public:
-  Objecter *objecter;
-  Filer filer;
+  string name;
+  WritebackHandler& writeback_handler;
+  Objecter *objecter;  // only needed by the file and sync/lock interfaces
+  Filer *filer;
 
  private:
   Mutex& lock;
@@ -279,9 +315,53 @@ class ObjectCacher {
 
   vector<hash_map<sobject_t, Object*> > objects; // indexed by pool_id
 
-  set<BufferHead*>    dirty_bh;
+  // limits; these default to the client_oc_* options.  a max_dirty of
+  // zero means write-through.
+  loff_t max_size, max_dirty, target_dirty;
+  double max_dirty_age;
+
+  set<BufferHead*, BufferHeadObjectLess> dirty_bh;
   LRU   lru_dirty, lru_rest;
 
+  /*
+   * With the 2q policy, clean bhs start out on lru_rest, which is then
+   * kept in fifo order and capped at a share of the cache, so a one-off
+   * scan only ever cycles through that share.  Extents evicted from it
+   * are remembered in the ghost list; reading one back in before it
+   * falls off the ghost list means it is in active use, and it goes on
+   * lru_hot, a plain lru for everything re-referenced.
+   */
+  bool policy_2q;
+  LRU   lru_hot;
+
+  struct GhostKey {
+    int64_t pool;
+    sobject_t oid;
+    loff_t start;
+    GhostKey(int64_t p, sobject_t o, loff_t s) : pool(p), oid(o), start(s) {}
+    bool operator<(const GhostKey& r) const {
+      if (pool != r.pool)
+	return pool < r.pool;
+      if (oid != r.oid)
+	return oid < r.oid;
+      return start < r.start;
+    }
+  };
+  struct GhostEntry {
+    loff_t length;
+    list<GhostKey>::iterator lru_pos;
+  };
+  map<GhostKey, GhostEntry> ghost;
+  list<GhostKey> ghost_lru;   // oldest first
+
+  void ghost_add(BufferHead *bh);
+  void ghost_remove(map<GhostKey, GhostEntry>::iterator p);
+  bool ghost_hit(BufferHead *bh);
+  void bh_make_hot(BufferHead *bh);
+
+  PerfCounters *perfcounter;
+  void update_perf();
+
   Cond flusher_cond;
   bool flusher_stop;
   void flusher_entry();
@@ -330,6 +410,14 @@ class ObjectCacher {
   loff_t stat_rx;
   loff_t stat_tx;
   loff_t stat_missing;
+  loff_t stat_clean_hot;
+  loff_t stat_ghost;
+
+  // recent writeback commit rate (bytes/sec), used to pace writers
+  double writeback_rate;
+  loff_t writeback_bytes;
+  utime_t writeback_stamp;
+  void note_writeback(loff_t bytes);
 
   void verify_stats() const;
 
@@ -340,6 +428,8 @@ class ObjectCacher {
       break;
     case BufferHead::STATE_CLEAN:
       stat_clean += bh->length();
+      if (bh->hot)
+	stat_clean_hot += bh->length();
       break;
     case BufferHead::STATE_DIRTY: 
       stat_dirty += bh->length(); 
@@ -364,6 +454,8 @@ class ObjectCacher {
       break;
     case BufferHead::STATE_CLEAN: 
       stat_clean -= bh->length();
+      if (bh->hot)
+	stat_clean_hot -= bh->length();
       break;
     case BufferHead::STATE_DIRTY: 
       stat_dirty -= bh->length(); 
@@ -385,18 +477,30 @@ class ObjectCacher {
   loff_t get_stat_dirty() { return stat_dirty; }
   loff_t get_stat_clean() { return stat_clean; }
 
+  loff_t get_stat_clean_hot() { return stat_clean_hot; }
+  loff_t get_stat_ghost() { return stat_ghost; }
+
+  // lru holding a non-dirty bh
+  LRU& bh_lru(BufferHead *bh) {
+    return bh->hot ? lru_hot : lru_rest;
+  }
+
   void touch_bh(BufferHead *bh) {
     if (bh->is_dirty())
       lru_dirty.lru_touch(bh);
-    else
-      lru_rest.lru_touch(bh);
+    else if (bh->hot || !policy_2q)
+      bh_lru(bh).lru_touch(bh);
+    // else: first-use list under 2q stays in fifo order
   }
 
   // bh states
   void bh_set_state(BufferHead *bh, int s) {
+    bh_stat_sub(bh);
+
     // move between lru lists?
     if (s == BufferHead::STATE_DIRTY && bh->get_state() != BufferHead::STATE_DIRTY) {
-      lru_rest.lru_remove(bh);
+      bh_lru(bh).lru_remove(bh);
+      bh->hot = false;
       lru_dirty.lru_insert_top(bh);
       dirty_bh.insert(bh);
     }
@@ -406,10 +510,19 @@ class ObjectCacher {
       dirty_bh.erase(bh);
     }
 
+    // done with i/o?  it was pinned while in flight, and may have been
+    // parked on the pintail; requeue it so it can expire again.
+    bool requeue = (s == BufferHead::STATE_CLEAN &&
+		    (bh->is_rx() || bh->is_tx()));
+
     // set state
-    bh_stat_sub(bh);
     bh->set_state(s);
     bh_stat_add(bh);
+
+    if (requeue) {
+      bh_lru(bh).lru_remove(bh);
+      bh_lru(bh).lru_insert_top(bh);
+    }
   }      
 
   void copy_bh_state(BufferHead *bh1, BufferHead *bh2) { 
@@ -432,7 +545,7 @@ class ObjectCacher {
       lru_dirty.lru_insert_top(bh);
       dirty_bh.insert(bh);
     } else {
-      lru_rest.lru_insert_top(bh);
+      bh_lru(bh).lru_insert_top(bh);
     }
     bh_stat_add(bh);
   }
@@ -442,7 +555,7 @@ class ObjectCacher {
       lru_dirty.lru_remove(bh);
       dirty_bh.erase(bh);
     } else {
-      lru_rest.lru_remove(bh);
+      bh_lru(bh).lru_remove(bh);
     }
     bh_stat_sub(bh);
   }
@@ -450,9 +563,10 @@ class ObjectCacher {
   // io
   void bh_read(BufferHead *bh);
   void bh_write(BufferHead *bh);
+  loff_t bh_write_object(BufferHead *bh);
 
   void trim(loff_t max=-1);
-  void flush(loff_t amount=0);
+  void flush(loff_t amount=0, utime_t cutoff=utime_t());
 
   bool flush(Object *o);
   loff_t release(Object *o);
@@ -464,7 +578,8 @@ class ObjectCacher {
   void wrunlock(Object *o);
 
  public:
-  void bh_read_finish(int64_t poolid, sobject_t oid, loff_t offset, uint64_t length, bufferlist &bl);
+  void bh_read_finish(int64_t poolid, sobject_t oid, loff_t offset, uint64_t length,
+		      bufferlist &bl, int r);
   void bh_write_commit(int64_t poolid, sobject_t oid, loff_t offset, uint64_t length, tid_t t);
   void lock_ack(int64_t poolid, list<sobject_t>& oids, tid_t tid);
 
@@ -479,7 +594,7 @@ class ObjectCacher {
     C_ReadFinish(ObjectCacher *c, int _poolid, sobject_t o, loff_t s, uint64_t l) :
       oc(c), poolid(_poolid), oid(o), start(s), length(l) {}
     void finish(int r) {
-      oc->bh_read_finish(poolid, oid, start, length, bl);
+      oc->bh_read_finish(poolid, oid, start, length, bl, r);
     }
   };
 
@@ -515,31 +630,29 @@ class ObjectCacher {
 
 
  public:
-  ObjectCacher(CephContext *cct_, Objecter *o, Mutex& l,
+  ObjectCacher(CephContext *cct_, string name, WritebackHandler& wb, Mutex& l,
 	       flush_set_callback_t flush_callback,
-	       void *flush_callback_arg);
+	       void *flush_callback_arg, Objecter *o = NULL);
   ~ObjectCacher() {
+    delete filer;
     // we should be empty.
     for (vector<hash_map<sobject_t, Object *> >::iterator i = objects.begin();
         i != objects.end();
         ++i)
       assert(!i->size());
     assert(lru_rest.lru_get_size() == 0);
+    assert(lru_hot.lru_get_size() == 0);
     assert(lru_dirty.lru_get_size() == 0);
     assert(dirty_bh.empty());
   }
 
-  void start() {
-    flusher_thread.create();
-  }
-  void stop() {
-    assert(flusher_thread.is_started());
-    lock.Lock();  // hmm.. watch out for deadlock!
-    flusher_stop = true;
-    flusher_cond.Signal();
-    lock.Unlock();
-    flusher_thread.join();
-  }
+  void start();
+  void stop();
+
+  void set_max_size(loff_t v) { max_size = v; }
+  void set_max_dirty(loff_t v) { max_dirty = v; }
+  void set_target_dirty(loff_t v) { target_dirty = v; }
+  void set_max_dirty_age(double a) { max_dirty_age = a; }
 
 
   class C_RetryRead : public Context {
@@ -549,8 +662,15 @@ class ObjectCacher {
     Context *onfinish;
   public:
     C_RetryRead(ObjectCacher *_oc, OSDRead *r, ObjectSet *os, Context *c) : oc(_oc), rd(r), oset(os), onfinish(c) {}
-    void finish(int) {
-      int r = oc->readx(rd, oset, onfinish);
+    void finish(int r) {
+      if (r < 0) {
+	// the read we were waiting on failed; don't go round again
+	delete rd;
+	if (onfinish)
+	  onfinish->complete(r);
+	return;
+      }
+      r = oc->readx(rd, oset, onfinish);
       if (r > 0 && onfinish) {
         onfinish->finish(r);
         delete onfinish;
@@ -598,7 +718,7 @@ class ObjectCacher {
   int file_is_cached(ObjectSet *oset, ceph_file_layout *layout, snapid_t snapid,
 		     loff_t offset, uint64_t len) {
     vector<ObjectExtent> extents;
-    filer.file_to_extents(oset->ino, layout, offset, len, extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, extents);
     return is_cached(oset, extents, snapid);
   }
 
@@ -608,7 +728,7 @@ class ObjectCacher {
 		int flags,
                 Context *onfinish) {
     OSDRead *rd = prepare_read(snapid, bl, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, rd->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, rd->extents);
     return readx(rd, oset, onfinish);
   }
 
@@ -616,7 +736,7 @@ class ObjectCacher {
                  loff_t offset, uint64_t len, 
                  bufferlist& bl, utime_t mtime, int flags) {
     OSDWrite *wr = prepare_write(snapc, bl, mtime, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, wr->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, wr->extents);
     return writex(wr, oset);
   }
 
@@ -630,7 +750,7 @@ class ObjectCacher {
                             bufferlist *bl, int flags,
                             Mutex &lock) {
     OSDRead *rd = prepare_read(snapid, bl, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, rd->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, rd->extents);
     return atomic_sync_readx(rd, oset, lock);
   }
 
@@ -640,7 +760,7 @@ class ObjectCacher {
                              bufferlist& bl, utime_t mtime, int flags,
                              Mutex &lock) {
     OSDWrite *wr = prepare_write(snapc, bl, mtime, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, wr->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, wr->extents);
     return atomic_sync_writex(wr, oset, lock);
   }
 
@@ -658,6 +778,7 @@ inline ostream& operator<<(ostream& out, ObjectCacher::BufferHead &bh)
   if (bh.is_dirty()) out << " dirty";
   if (bh.is_clean()) out << " clean";
   if (bh.is_missing()) out << " missing";
+  if (bh.hot) out << " hot";
   if (bh.bl.length() > 0) out << " firstbyte=" << (int)bh.bl[0];
   out << "]";
   return out;
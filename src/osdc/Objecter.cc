@@ -114,6 +114,12 @@ enum {
   l_osdc_osd_session_open,
   l_osdc_osd_session_close,
   l_osdc_osd_laggy,
+
+  l_osdc_batch,
+  l_osdc_batch_ops,
+  l_osdc_batch_saved,
+  l_osdc_batch_merged_reads,
+  l_osdc_batch_split,
   l_osdc_last,
 };
 
@@ -195,6 +201,12 @@ void Objecter::init()
     pcb.add_u64_counter(l_osdc_osd_session_close, "osd_session_close");
     pcb.add_u64(l_osdc_osd_laggy, "osd_laggy");
 
+    pcb.add_u64_counter(l_osdc_batch, "batch");                // compound ops sent for batches
+    pcb.add_u64_counter(l_osdc_batch_ops, "batch_ops");        // ops sent in them
+    pcb.add_u64_counter(l_osdc_batch_saved, "batch_saved");    // round trips saved
+    pcb.add_u64_counter(l_osdc_batch_merged_reads, "batch_merged_reads");
+    pcb.add_u64_counter(l_osdc_batch_split, "batch_split");    // batches redone op by op
+
     logger = pcb.create_perf_counters();
     cct->get_perfcounters_collection()->add(logger);
   }
@@ -209,6 +221,13 @@ void Objecter::init()
 	       << cpp_strerror(-ret) << dendl;
   }
 
+  if (cct->_conf->osd_map_pg_mapping && !osdmap->has_pg_mapping())
+    osdmap->enable_pg_mapping(cct->_conf->osd_map_pg_mapping_threads);
+
+  batch_lock.Lock();
+  batch_stop = false;
+  batch_lock.Unlock();
+
   schedule_tick();
   maybe_request_map();
 
@@ -219,13 +238,23 @@ void Objecter::shutdown()
 {
   assert(client_lock.is_locked());
   assert(initialized);
-  initialized = false;
 
+  // send off any batched reads
+  batch_lock.Lock();
+  batch_stop = true;
+  batch_cond.Signal();
+  batch_lock.Unlock();
+  if (batch_thread.is_started())
+    batch_thread.join();
+
+  rwlock.get_write();
+  initialized = false;
   map<int,OSDSession*>::iterator p;
   while (!osd_sessions.empty()) {
     p = osd_sessions.begin();
     close_session(p->second);
   }
+  rwlock.put_write();
 
   if (tick_event) {
     timer.cancel_event(tick_event);
@@ -259,12 +288,20 @@ void Objecter::send_linger(LingerOp *info)
     o->snapid = info->snap;
 
     if (info->session) {
+      num_homeless_ops.inc();  // like any new op; recalc_op_target() expects it
       int r = recalc_op_target(o);
+      if (!o->session)
+	num_homeless_ops.dec();  // _op_submit() will attach it to info->session
       if (r == RECALC_OP_TARGET_POOL_DNE) {
 	linger_check_for_latest_map(info);
       }
     }
-    op_submit(o, info->session);
+
+    // we hold rwlock for write here, so we must not block on the
+    // throttle; lingering ops are few and small anyway.
+    op_throttler.take(calc_op_budget(o));
+    o->tid = last_tid.inc();
+    _op_submit(o, info->session, true);
     info->registering = true;
 
     logger->inc(l_osdc_linger_send);
@@ -276,30 +313,39 @@ void Objecter::send_linger(LingerOp *info)
 void Objecter::_linger_ack(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_ack " << info->linger_id << dendl;
-  if (info->on_reg_ack) {
-    info->on_reg_ack->finish(r);
-    delete info->on_reg_ack;
-    info->on_reg_ack = NULL;
+  rwlock.get_write();
+  Context *onack = info->on_reg_ack;
+  info->on_reg_ack = NULL;
+  rwlock.put_write();
+
+  if (onack) {
+    onack->finish(r);
+    delete onack;
   }
 }
 
 void Objecter::_linger_commit(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_commit " << info->linger_id << dendl;
-  if (info->on_reg_commit) {
-    info->on_reg_commit->finish(r);
-    delete info->on_reg_commit;
-    info->on_reg_commit = NULL;
-  }
+  rwlock.get_write();
+  Context *oncommit = info->on_reg_commit;
+  info->on_reg_commit = NULL;
 
   // only tell the user the first time we do this
   info->registered = true;
   info->registering = false;
   info->pobjver = NULL;
+  rwlock.put_write();
+
+  if (oncommit) {
+    oncommit->finish(r);
+    delete oncommit;
+  }
 }
 
 void Objecter::unregister_linger(uint64_t linger_id)
 {
+  rwlock.get_write();
   map<uint64_t, LingerOp*>::iterator iter = linger_ops.find(linger_id);
   if (iter != linger_ops.end()) {
     LingerOp *info = iter->second;
@@ -308,6 +354,7 @@ void Objecter::unregister_linger(uint64_t linger_id)
     info->put();
     logger->set(l_osdc_linger_active, linger_ops.size());
   }
+  rwlock.put_write();
 }
 
 tid_t Objecter::linger(const object_t& oid, const object_locator_t& oloc, 
@@ -330,14 +377,17 @@ tid_t Objecter::linger(const object_t& oid, const object_locator_t& oloc,
   info->on_reg_ack = onack;
   info->on_reg_commit = onfinish;
 
+  rwlock.get_write();
   info->linger_id = ++max_linger_id;
   linger_ops[info->linger_id] = info;
 
   logger->set(l_osdc_linger_active, linger_ops.size());
 
   send_linger(info);
+  uint64_t linger_id = info->linger_id;
+  rwlock.put_write();
 
-  return info->linger_id;
+  return linger_id;
 }
 
 void Objecter::dispatch(Message *m)
@@ -381,6 +431,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
     return;
   }
 
+  rwlock.get_write();
+
   bool was_pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
   bool was_pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || osdmap->test_flag(CEPH_OSDMAP_FULL);
   
@@ -455,7 +507,9 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	}
 
 	// check for changed request mappings
-	for (hash_map<tid_t,Op*>::iterator p = ops.begin();
+	map<tid_t,Op*> ops;
+	_get_all_ops(ops);
+	for (map<tid_t,Op*>::iterator p = ops.begin();
 	     p != ops.end();
 	     ++p) {
 	  Op *op = p->second;
@@ -514,8 +568,10 @@ void Objecter::handle_osd_map(MOSDMap *m)
   
   // unpause requests?
   if ((was_pauserd && !pauserd) ||
-      (was_pausewr && !pausewr))
-    for (hash_map<tid_t,Op*>::iterator p = ops.begin();
+      (was_pausewr && !pausewr)) {
+    map<tid_t,Op*> ops;
+    _get_all_ops(ops);
+    for (map<tid_t,Op*>::iterator p = ops.begin();
 	 p != ops.end();
 	 p++) {
       Op *op = p->second;
@@ -524,6 +580,7 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  !((op->flags & CEPH_OSD_FLAG_WRITE) && pausewr))    // not still paused as a write
 	need_resend[op->tid] = op;
     }
+  }
 
   // resend requests
   for (map<tid_t, Op*>::iterator p = need_resend.begin(); p != need_resend.end(); p++) {
@@ -542,6 +599,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
   }
 
   dump_active();
+
+  rwlock.put_write();
   
   // finish any Contexts that were waiting on a map update
   map<epoch_t,list< pair< Context*, int > > >::iterator p =
@@ -568,27 +627,40 @@ void Objecter::C_Op_Map_Latest::finish(int r)
     return;
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<tid_t, Op*>::iterator iter =
     objecter->check_latest_map_ops.find(tid);
   if (iter == objecter->check_latest_map_ops.end()) {
+    objecter->rwlock.put_write();
     return;
   }
 
   Op *op = iter->second;
   objecter->check_latest_map_ops.erase(iter);
 
-  if (r == 0) { // we had the latest map
-    if (op->onack) {
-      op->onack->complete(-ENOENT);
-    }
-    if (op->oncommit) {
-      op->oncommit->complete(-ENOENT);
-    }
-    op->session_item.remove_myself();
-    objecter->ops.erase(op->tid);
-    delete op;
+  if (r != 0) {
+    objecter->rwlock.put_write();
+    return;
   }
+
+  // we had the latest map
+  Context *onack = op->onack;
+  Context *oncommit = op->oncommit;
+  if (onack)
+    objecter->num_unacked.dec();
+  if (oncommit)
+    objecter->num_uncommitted.dec();
+  objecter->_session_op_remove(op);
+  objecter->_op_map_remove(op);
+  objecter->put_op_budget(op);
+  objecter->rwlock.put_write();
+  delete op;
+
+  if (onack)
+    onack->complete(-ENOENT);
+  if (oncommit)
+    oncommit->complete(-ENOENT);
 }
 
 void Objecter::C_Linger_Map_Latest::finish(int r)
@@ -597,23 +669,32 @@ void Objecter::C_Linger_Map_Latest::finish(int r)
     return;
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<uint64_t, LingerOp*>::iterator iter =
     objecter->check_latest_map_lingers.find(linger_id);
   if (iter == objecter->check_latest_map_lingers.end()) {
+    objecter->rwlock.put_write();
     return;
   }
 
   LingerOp *op = iter->second;
   objecter->check_latest_map_lingers.erase(iter);
 
+  Context *onack = NULL, *oncommit = NULL;
   if (r == 0) { // we had the latest map
-    if (op->on_reg_ack) {
-      op->on_reg_ack->complete(-ENOENT);
-    }
-    if (op->on_reg_commit) {
-      op->on_reg_commit->complete(-ENOENT);
-    }
+    onack = op->on_reg_ack;
+    op->on_reg_ack = NULL;
+    oncommit = op->on_reg_commit;
+    op->on_reg_commit = NULL;
+  }
+  objecter->rwlock.put_write();
+
+  if (r == 0) {
+    if (onack)
+      onack->complete(-ENOENT);
+    if (oncommit)
+      oncommit->complete(-ENOENT);
     objecter->unregister_linger(op->linger_id);
   }
   op->put();
@@ -654,11 +735,13 @@ void Objecter::linger_cancel_map_check(LingerOp *op)
   }
 }
 
-Objecter::OSDSession *Objecter::get_session(int osd)
+Objecter::OSDSession *Objecter::get_session(int osd, bool create)
 {
   map<int,OSDSession*>::iterator p = osd_sessions.find(osd);
   if (p != osd_sessions.end())
     return p->second;
+  if (!create)
+    return NULL;
   OSDSession *s = new OSDSession(osd);
   osd_sessions[osd] = s;
   s->con = messenger->get_connection(osdmap->get_inst(osd));
@@ -770,20 +853,26 @@ void Objecter::tick()
   cutoff -= cct->_conf->objecter_timeout;  // timeout
 
   unsigned laggy_ops = 0;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-       p != ops.end();
-       p++) {
-    Op *op = p->second;
-    if (op->session && op->stamp < cutoff) {
-      ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd << " is laggy" << dendl;
-      toping.insert(op->session);
-      ++laggy_ops;
+  rwlock.get_read();
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p) {
+    OSDSession *s = p->second;
+    s->lock.Lock();
+    for (xlist<Op*>::iterator q = s->ops.begin(); !q.end(); ++q) {
+      Op *op = *q;
+      if (op->stamp < cutoff) {
+	ldout(cct, 2) << " tid " << op->tid << " on osd." << s->osd << " is laggy" << dendl;
+	toping.insert(s);
+	++laggy_ops;
+      }
     }
+    s->lock.Unlock();
   }
   logger->set(l_osdc_op_laggy, laggy_ops);
   logger->set(l_osdc_osd_laggy, toping.size());
 
-  if (num_homeless_ops || !toping.empty())
+  if (num_homeless_ops.read() || !toping.empty())
     maybe_request_map();
 
   if (!toping.empty()) {
@@ -794,6 +883,7 @@ void Objecter::tick()
 	 i++)
       messenger->send_message(new MPing, (*i)->con);
   }
+  rwlock.put_read();
     
   // reschedule
   schedule_tick();
@@ -831,49 +921,386 @@ void Objecter::resend_mon_ops()
 
 // read | write ---------------------------
 
-tid_t Objecter::op_submit(Op *op, OSDSession *s)
+tid_t Objecter::op_submit(Op *op)
 {
-  assert(client_lock.is_locked());
+  if (!unlocked_io)
+    assert(client_lock.is_locked());
   assert(initialized);
 
   assert(op->ops.size() == op->out_bl.size());
   assert(op->ops.size() == op->out_rval.size());
   assert(op->ops.size() == op->out_handler.size());
 
+  if (!op->no_batch && batch_read(op))
+    return op->tid;
+
+  // reads still held in a batch for this object were submitted
+  // before this op, so they have to reach the osd first.
+  batch_flush(op->oid, op->oloc);
+
   // throttle.  before we look at any state, because
   // take_op_budget() may drop our lock while it blocks.
   take_op_budget(op);
 
+  return _op_submit_budgeted(op);
+}
+
+/*
+ * send an op whose budget has already been taken.  an op that sat in
+ * a read batch keeps the tid op_submit() returned for it.
+ */
+tid_t Objecter::_op_submit_budgeted(Op *op)
+{
   // pick tid
-  tid_t mytid = ++last_tid;
-  op->tid = mytid;
+  if (!op->tid)
+    op->tid = last_tid.inc();
+  tid_t tid = op->tid;
   assert(client_inc >= 0);
 
+  // the common case only needs the read lock; if the op maps to an
+  // osd we have no session with yet, or to a pool we don't know
+  // about, redo it under the write lock.
+  rwlock.get_read();
+  bool done = _op_submit(op, NULL, false);
+  rwlock.put_read();
+  if (!done) {
+    rwlock.get_write();
+    _op_submit(op, NULL, true);
+    rwlock.put_write();
+  }
+
+  // op may already be completed and freed by now
+  return tid;
+}
+
+// read batching
+
+bool Objecter::_can_batch(Op *op)
+{
+  if (!(op->flags & CEPH_OSD_FLAG_READ) ||
+      (op->flags & (CEPH_OSD_FLAG_WRITE | CEPH_OSD_FLAG_PGOP)))
+    return false;
+  for (vector<OSDOp>::iterator p = op->ops.begin(); p != op->ops.end(); ++p) {
+    if (!ceph_osd_op_mode_read(p->op.op))
+      return false;
+    if (!ceph_osd_op_type_data(p->op.op) && !ceph_osd_op_type_attr(p->op.op))
+      return false;
+  }
+  return !op->ops.empty();
+}
+
+/*
+ * queue a read to go out with others on the same object.  returns
+ * false if the op should be sent right away instead.
+ */
+bool Objecter::batch_read(Op *op)
+{
+  // the flush thread submits ops, so it only works when that can be
+  // done without client_lock
+  double window = cct->_conf->objecter_batch_window;
+  int max_ops = cct->_conf->objecter_batch_max_ops;
+  if (!unlocked_io || window <= 0 || max_ops < 2 || !_can_batch(op))
+    return false;
+
+  list<Op*> full;
+  batch_lock.Lock();
+  if (batch_stop) {
+    batch_lock.Unlock();
+    return false;
+  }
+  if (!batch_thread.is_started())
+    batch_thread.create();
+
+  // callers may track the op by tid while it waits
+  op->tid = last_tid.inc();
+
+  BatchKey key(op);
+  ReadBatch& b = read_batches[key];
+  if (b.ops.empty()) {
+    b.deadline = ceph_clock_now(cct);
+    b.deadline += window;
+    batch_cond.Signal();
+  }
+  b.ops.push_back(op);
+  ldout(cct, 20) << "batch_read " << op->oid << " " << op->ops
+		 << ", " << b.ops.size() << " batched" << dendl;
+  if ((int)b.ops.size() >= max_ops) {
+    full.swap(b.ops);
+    read_batches.erase(key);
+    batch_sending[op->oid]++;
+  }
+  _batch_update_pending();
+  batch_lock.Unlock();
+
+  if (!full.empty()) {
+    _batch_submit(full);
+    _batch_sent(op->oid);
+  }
+  return true;
+}
+
+/*
+ * send any reads batched on this object ahead of an op that can't
+ * join them, and wait for batches already on their way out.
+ */
+void Objecter::batch_flush(const object_t& oid, const object_locator_t& oloc)
+{
+  // nothing is batched when batching is off, so this is the common
+  // case; don't make every op take batch_lock for it
+  if (!unlocked_io || batch_pending.read() == 0)
+    return;
+
+  list< list<Op*> > flush;
+  batch_lock.Lock();
+  while (batch_sending.count(oid))
+    batch_sent_cond.Wait(batch_lock);
+  for (map<BatchKey, ReadBatch>::iterator p = read_batches.begin();
+       p != read_batches.end(); ) {
+    if (p->first.oid == oid && p->first.oloc == oloc) {
+      flush.push_back(list<Op*>());
+      flush.back().swap(p->second.ops);
+      read_batches.erase(p++);
+      batch_sending[oid]++;
+    } else {
+      ++p;
+    }
+  }
+  _batch_update_pending();
+  batch_lock.Unlock();
+
+  for (list< list<Op*> >::iterator p = flush.begin(); p != flush.end(); ++p) {
+    ldout(cct, 15) << "batch_flush " << oid << " " << p->size() << " ops" << dendl;
+    _batch_submit(*p);
+    _batch_sent(oid);
+  }
+}
+
+void Objecter::_batch_sent(const object_t& oid)
+{
+  Mutex::Locker l(batch_lock);
+  map<object_t, int>::iterator p = batch_sending.find(oid);
+  assert(p != batch_sending.end());
+  if (--p->second == 0) {
+    batch_sending.erase(p);
+    _batch_update_pending();
+    batch_sent_cond.SignalAll();
+  }
+}
+
+void Objecter::batch_entry()
+{
+  batch_lock.Lock();
+  while (true) {
+    utime_t now = ceph_clock_now(cct);
+    utime_t next;
+    list< list<Op*> > due;
+    for (map<BatchKey, ReadBatch>::iterator p = read_batches.begin();
+	 p != read_batches.end(); ) {
+      if (batch_stop || p->second.deadline <= now) {
+	due.push_back(list<Op*>());
+	due.back().swap(p->second.ops);
+	batch_sending[p->first.oid]++;
+	read_batches.erase(p++);
+      } else {
+	if (next == utime_t() || p->second.deadline < next)
+	  next = p->second.deadline;
+	++p;
+      }
+    }
+    if (!due.empty()) {
+      _batch_update_pending();
+      batch_lock.Unlock();
+      for (list< list<Op*> >::iterator p = due.begin(); p != due.end(); ++p) {
+	object_t oid = p->front()->oid;
+	_batch_submit(*p);
+	_batch_sent(oid);
+      }
+      batch_lock.Lock();
+      continue;
+    }
+    if (batch_stop)
+      break;
+    if (next == utime_t())
+      batch_cond.Wait(batch_lock);
+    else
+      batch_cond.WaitUntil(batch_lock, next);
+  }
+  batch_lock.Unlock();
+}
+
+void Objecter::_batch_submit(list<Op*>& ls)
+{
+  if (ls.size() == 1) {
+    Op *op = ls.front();
+    op->no_batch = true;
+    take_op_budget(op);
+    _op_submit_budgeted(op);
+    return;
+  }
+
+  C_BatchReply *fin = new C_BatchReply(this);
+  vector<OSDOp> ops;
+  Op *first = ls.front();
+  int priority = 0;
+  int merged = 0;
+  for (list<Op*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    Op *op = *p;
+    fin->ops.push_back(op);
+    fin->pieces.push_back(vector<C_BatchReply::Piece>());
+    vector<C_BatchReply::Piece>& pieces = fin->pieces.back();
+    if (op->priority > priority)
+      priority = op->priority;
+    for (vector<OSDOp>::iterator q = op->ops.begin(); q != op->ops.end(); ++q) {
+      if (q->op.op != CEPH_OSD_OP_READ || !q->op.extent.length) {
+	pieces.push_back(C_BatchReply::Piece(ops.size()));
+	ops.push_back(*q);
+	continue;
+      }
+      // extend the previous read if this one starts where it ends
+      if (!ops.empty()) {
+	OSDOp& last = ops.back();
+	if (last.op.op == CEPH_OSD_OP_READ &&
+	    last.op.extent.length &&
+	    last.op.extent.offset + last.op.extent.length == q->op.extent.offset &&
+	    last.op.extent.truncate_size == q->op.extent.truncate_size &&
+	    last.op.extent.truncate_seq == q->op.extent.truncate_seq) {
+	  uint64_t off = last.op.extent.length;
+	  uint64_t len = q->op.extent.length;
+	  pieces.push_back(C_BatchReply::Piece(ops.size() - 1, off, len));
+	  last.op.extent.length = off + len;
+	  merged++;
+	  continue;
+	}
+      }
+      pieces.push_back(C_BatchReply::Piece(ops.size(), 0, q->op.extent.length));
+      ops.push_back(*q);
+    }
+  }
+  fin->out.resize(ops.size());
+  fin->rval.resize(ops.size());
+
+  Op *o = new Op(first->oid, first->oloc, ops, first->flags, fin, NULL, &fin->version);
+  o->snapid = first->snapid;
+  o->priority = priority;
+  o->reply_epoch = &fin->epoch;
+  o->no_batch = true;
+  for (unsigned i = 0; i < o->ops.size(); i++) {
+    o->out_bl[i] = &fin->out[i];
+    o->out_rval[i] = &fin->rval[i];
+  }
+
+  ldout(cct, 10) << "_batch_submit " << ls.size() << " ops on " << o->oid
+		 << " as " << o->ops << dendl;
+  if (logger) {
+    logger->inc(l_osdc_batch);
+    logger->inc(l_osdc_batch_ops, ls.size());
+    logger->inc(l_osdc_batch_saved, ls.size() - 1);
+    logger->inc(l_osdc_batch_merged_reads, merged);
+  }
+  take_op_budget(o);
+  _op_submit_budgeted(o);
+}
+
+void Objecter::_batch_reply(C_BatchReply *fin, int r)
+{
+  ldout(cct, 10) << "_batch_reply " << fin->ops.size() << " ops, r = " << r << dendl;
+
+  if (r < 0) {
+    // the first failing sub-op fails the whole compound op, so redo
+    // them one by one to give each op its own result
+    if (logger)
+      logger->inc(l_osdc_batch_split);
+    // we're on the dispatch thread and must not block on the
+    // throttle; the compound op's budget was just returned.
+    for (vector<Op*>::iterator p = fin->ops.begin(); p != fin->ops.end(); ++p) {
+      (*p)->no_batch = true;
+      op_throttler.take(calc_op_budget(*p));
+      _op_submit_budgeted(*p);
+    }
+    return;
+  }
+
+  for (unsigned i = 0; i < fin->ops.size(); i++) {
+    Op *op = fin->ops[i];
+    bufferlist data;
+    for (unsigned j = 0; j < op->ops.size(); j++) {
+      C_BatchReply::Piece& pc = fin->pieces[i][j];
+      bufferlist& src = fin->out[pc.idx];
+      bufferlist bl;
+      if (pc.whole)
+	bl = src;
+      else if (pc.off < src.length())   // merged reads may come back short
+	bl.substr_of(src, pc.off, MIN(pc.len, src.length() - pc.off));
+      if (op->out_bl[j])
+	*op->out_bl[j] = bl;
+      if (op->out_rval[j])
+	*op->out_rval[j] = fin->rval[pc.idx];
+      if (op->out_handler[j])
+	op->out_handler[j]->complete(fin->rval[pc.idx]);
+      data.claim_append(bl);
+    }
+    if (op->objver)
+      *op->objver = fin->version;
+    if (op->reply_epoch)
+      *op->reply_epoch = fin->epoch;
+    if (op->outbl)
+      op->outbl->claim(data);
+
+    Context *onack = op->onack;
+    Context *oncommit = op->oncommit;
+    delete op;
+    if (onack) {
+      onack->finish(r);
+      delete onack;
+    }
+    if (oncommit) {
+      oncommit->finish(r);
+      delete oncommit;
+    }
+  }
+}
+
+/*
+ * called with rwlock held, for write iff wlocked.  returns false
+ * without side effects if the op can't be mapped without the write
+ * lock.
+ */
+bool Objecter::_op_submit(Op *op, OSDSession *s, bool wlocked)
+{
   // pick target
   bool check_for_latest_map = false;
   if (s) {
+    assert(wlocked);
     op->session = s;
+    s->lock.Lock();
     s->ops.push_back(&op->session_item);
+    s->lock.Unlock();
   } else {
-    int r = recalc_op_target(op);
+    num_homeless_ops.inc();  // initially!
+    int r = recalc_op_target(op, wlocked);
+    if (r == RECALC_OP_TARGET_NEED_SESSION ||
+	(r == RECALC_OP_TARGET_POOL_DNE && !wlocked)) {
+      assert(!wlocked);
+      num_homeless_ops.dec();
+      return false;
+    }
     check_for_latest_map = (r == RECALC_OP_TARGET_POOL_DNE);
-    num_homeless_ops++;  // initially!
   }
 
   // add to gather set(s)
   if (op->onack) {
-    ++num_unacked;
+    num_unacked.inc();
   } else {
     ldout(cct, 20) << " note: not requesting ack" << dendl;
   }
   if (op->oncommit) {
-    ++num_uncommitted;
+    num_uncommitted.inc();
   } else {
     ldout(cct, 20) << " note: not requesting commit" << dendl;
   }
-  ops[op->tid] = op;
+  _op_map_insert(op);
 
-  logger->set(l_osdc_op_active, ops.size());
+  logger->set(l_osdc_op_active, num_active_ops.read());
 
   logger->inc(l_osdc_op);
   if ((op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE)) == (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE))
@@ -927,34 +1354,95 @@ tid_t Objecter::op_submit(Op *op, OSDSession *s)
 
   assert(op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE));
 
+  if (check_for_latest_map) {
+    op_check_for_latest_map(op);
+  }
+
   if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
       osdmap->test_flag(CEPH_OSDMAP_PAUSEWR)) {
-    ldout(cct, 10) << " paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused modify " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_READ) &&
 	     osdmap->test_flag(CEPH_OSDMAP_PAUSERD)) {
-    ldout(cct, 10) << " paused read " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused read " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
 	     osdmap->test_flag(CEPH_OSDMAP_FULL)) {
-    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if (op->session) {
+    // the reply may race with us as soon as the message is out; don't
+    // touch op after dropping the session lock.
+    OSDSession *session = op->session;
+    session->lock.Lock();
     send_op(op);
+    session->lock.Unlock();
   } else {
     maybe_request_map();
   }
 
-  if (check_for_latest_map) {
-    op_check_for_latest_map(op);
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
+  
+  return true;
+}
+
+void Objecter::_op_map_insert(Op *op)
+{
+  OpShard& shard = get_op_shard(op->tid);
+  shard.lock.Lock();
+  shard.ops[op->tid] = op;
+  shard.lock.Unlock();
+  num_active_ops.inc();
+}
+
+Objecter::Op *Objecter::_op_map_lookup(tid_t tid)
+{
+  OpShard& shard = get_op_shard(tid);
+  Mutex::Locker l(shard.lock);
+  hash_map<tid_t,Op*>::iterator p = shard.ops.find(tid);
+  if (p == shard.ops.end())
+    return NULL;
+  return p->second;
+}
+
+void Objecter::_op_map_remove(Op *op)
+{
+  OpShard& shard = get_op_shard(op->tid);
+  shard.lock.Lock();
+  shard.ops.erase(op->tid);
+  shard.lock.Unlock();
+  num_active_ops.dec();
+  logger->set(l_osdc_op_active, num_active_ops.read());
+}
+
+/*
+ * snapshot of all in-flight ops, in tid order.  the caller must hold
+ * rwlock for write, or the ops may go away under it.
+ */
+void Objecter::_get_all_ops(map<tid_t,Op*>& m)
+{
+  for (int i = 0; i < NUM_OP_SHARDS; i++) {
+    OpShard& shard = op_shards[i];
+    shard.lock.Lock();
+    for (hash_map<tid_t,Op*>::iterator p = shard.ops.begin();
+	 p != shard.ops.end();
+	 ++p)
+      m[p->first] = p->second;
+    shard.lock.Unlock();
   }
+}
 
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
-  
-  return op->tid;
+void Objecter::_session_op_remove(Op *op)
+{
+  if (op->session) {
+    Mutex::Locker l(op->session->lock);
+    op->session_item.remove_myself();
+  } else {
+    num_homeless_ops.dec();
+  }
 }
 
 bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
@@ -970,7 +1458,7 @@ bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
   return false;      // same primary (tho replicas may have changed)
 }
 
-int Objecter::recalc_op_target(Op *op)
+int Objecter::recalc_op_target(Op *op, bool can_create_session)
 {
   vector<int> acting;
   pg_t pgid = op->pgid;
@@ -982,20 +1470,15 @@ int Objecter::recalc_op_target(Op *op)
   osdmap->pg_to_acting_osds(pgid, acting);
 
   if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica)) {
-    op->pgid = pgid;
-    op->acting = acting;
-    ldout(cct, 10) << "recalc_op_target tid " << op->tid
-	     << " pgid " << pgid << " acting " << acting << dendl;
-
     OSDSession *s = NULL;
-    op->used_replica = false;
+    bool used_replica = false;
     if (acting.size()) {
       int osd;
       bool read = (op->flags & CEPH_OSD_FLAG_READ) && (op->flags & CEPH_OSD_FLAG_WRITE) == 0;
       if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
 	int p = rand() % acting.size();
 	if (p)
-	  op->used_replica = true;
+	  used_replica = true;
 	osd = acting[p];
 	ldout(cct, 10) << " chose random osd." << osd << " of " << acting << dendl;
       } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
@@ -1007,7 +1490,7 @@ int Objecter::recalc_op_target(Op *op)
          * order.) */
 	for (i = acting.size()-1; i > 0; --i) {
 	  if (osdmap->get_addr(acting[i]).is_same_host(messenger->get_myaddr())) {
-	    op->used_replica = true;
+	    used_replica = true;
 	    ldout(cct, 10) << " chose local osd." << acting[i] << " of " << acting << dendl;
 	    break;
 	  }
@@ -1015,18 +1498,30 @@ int Objecter::recalc_op_target(Op *op)
 	osd = acting[i];
       } else
 	osd = acting[0];
-      s = get_session(osd);
+      s = get_session(osd, can_create_session);
+      if (!s)
+	return RECALC_OP_TARGET_NEED_SESSION;
     }
 
+    op->pgid = pgid;
+    op->acting = acting;
+    op->used_replica = used_replica;
+    ldout(cct, 10) << "recalc_op_target tid " << op->tid
+	     << " pgid " << pgid << " acting " << acting << dendl;
+
     if (op->session != s) {
       if (!op->session)
-	num_homeless_ops--;
-      op->session_item.remove_myself();
+	num_homeless_ops.dec();
+      else
+	_session_op_remove(op);
       op->session = s;
-      if (s)
+      if (s) {
+	s->lock.Lock();
 	s->ops.push_back(&op->session_item);
-      else
-	num_homeless_ops++;
+	s->lock.Unlock();
+      } else {
+	num_homeless_ops.inc();
+      }
     }
     return RECALC_OP_TARGET_NEED_RESEND;
   }
@@ -1138,26 +1633,43 @@ void Objecter::throttle_op(Op *op, int op_budget)
   if (!op_budget)
     op_budget = calc_op_budget(op);
   if (!op_throttler.get_or_fail(op_budget)) { //couldn't take right now
-    client_lock.Unlock();
-    op_throttler.get(op_budget);
-    client_lock.Lock();
+    if (unlocked_io) {
+      op_throttler.get(op_budget);
+    } else {
+      client_lock.Unlock();
+      op_throttler.get(op_budget);
+      client_lock.Lock();
+    }
   }
 }
 
 /* This function DOES put the passed message before returning */
 void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 {
-  assert(client_lock.is_locked());
-  assert(initialized);
+  if (!unlocked_io)
+    assert(client_lock.is_locked());
   ldout(cct, 10) << "in handle_osd_op_reply" << dendl;
 
   // get pio
   tid_t tid = m->get_tid();
 
-  if (ops.count(tid) == 0) {
+  // replies are handled by a single dispatch thread, so nobody else
+  // will touch this op's reply state; the read lock keeps the op from
+  // being remapped or resent under us.
+  rwlock.get_read();
+  if (!initialized) {
+    // not started yet, or raced with shutdown()
+    ldout(cct, 10) << "handle_osd_op_reply " << tid << " while not running, dropping" << dendl;
+    rwlock.put_read();
+    m->put();
+    return;
+  }
+  Op *op = _op_map_lookup(tid);
+  if (!op) {
     ldout(cct, 7) << "handle_osd_op_reply " << tid
 	    << (m->is_ondisk() ? " ondisk":(m->is_onnvram() ? " onnvram":" ack"))
 	    << " ... stray" << dendl;
+    rwlock.put_read();
     m->put();
     return;
   }
@@ -1167,14 +1679,14 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		<< " v " << m->get_version() << " in " << m->get_pg()
 		<< " attempt " << m->get_retry_attempt()
 		<< dendl;
-  Op *op = ops[tid];
 
   if (m->get_retry_attempt() >= 0) {
     if (m->get_retry_attempt() != (op->attempts - 1)) {
       ldout(cct, 7) << " ignoring reply from attempt " << m->get_retry_attempt()
 		    << " from " << m->get_source_inst()
-		    << "; last attempt " << (op->attempts - 1) << " sent to "
-		    << op->session->con->get_peer_addr() << dendl;
+		    << "; last attempt " << (op->attempts - 1) << " sent to osd."
+		    << (op->session ? op->session->osd : -1) << dendl;
+      rwlock.put_read();
       m->put();
       return;
     }
@@ -1192,9 +1704,17 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
   if (rc == -EAGAIN) {
     ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
     if (op->onack)
-      num_unacked--;
+      num_unacked.dec();
     if (op->oncommit)
-      num_uncommitted--;
+      num_uncommitted.dec();
+    // forget the old tid and mapping; op_submit starts from scratch
+    _session_op_remove(op);
+    _op_map_remove(op);
+    op->tid = 0;
+    op->session = NULL;
+    op->acting.clear();
+    rwlock.put_read();
+    put_op_budget(op);
     op_submit(op);
     m->put();
     return;
@@ -1241,14 +1761,14 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     op->version = m->get_version();
     onack = op->onack;
     op->onack = 0;  // only do callback once
-    num_unacked--;
+    num_unacked.dec();
     logger->inc(l_osdc_op_ack);
   }
   if (op->oncommit && (m->is_ondisk() || rc)) {
     ldout(cct, 15) << "handle_osd_op_reply safe" << dendl;
     oncommit = op->oncommit;
     op->oncommit = 0;
-    num_uncommitted--;
+    num_uncommitted.dec();
     logger->inc(l_osdc_op_commit);
   }
 
@@ -1262,17 +1782,17 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   // done with this tid?
   if (!op->onack && !op->oncommit) {
-    op->session_item.remove_myself();
+    _session_op_remove(op);
     ldout(cct, 15) << "handle_osd_op_reply completed tid " << tid << dendl;
     put_op_budget(op);
-    ops.erase(tid);
-    logger->set(l_osdc_op_active, ops.size());
+    _op_map_remove(op);
     if (op->con)
       op->con->put();
     delete op;
   }
+  rwlock.put_read();
   
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
 
   // do callbacks
   if (onack) {
@@ -1296,111 +1816,265 @@ void Objecter::list_objects(ListContext *list_context, Context *onfinish) {
 	   << "\nmax_entries " << list_context->max_entries
 	   << "\nlist_context " << list_context
 	   << "\nonfinish " << onfinish
-	   << "\nlist_context->current_pg" << list_context->current_pg
-	   << "\nlist_context->cookie" << list_context->cookie << dendl;
+	   << "\nlist_context->current_pg" << list_context->current_pg << dendl;
 
+  list_context->lock.Lock();
   if (list_context->at_end) {
+    list_context->lock.Unlock();
     onfinish->finish(0);
     delete onfinish;
     return;
   }
 
+  rwlock.get_read();
   const pg_pool_t *pool = osdmap->get_pg_pool(list_context->pool_id);
-  int pg_num = pool->get_pg_num();
+  int pg_num = pool ? pool->get_pg_num() : 0;
+  rwlock.put_read();
 
-  if (list_context->starting_pg_num == 0) {     // there can't be zero pgs!
-    list_context->starting_pg_num = pg_num;
-    ldout(cct, 20) << pg_num << " placement groups" << dendl;
+  if (!pool) {
+    list_context->lock.Unlock();
+    onfinish->finish(-ENOENT);
+    delete onfinish;
+    return;
   }
+
   if (list_context->starting_pg_num != pg_num) {
-    // start reading from the beginning; the pgs have changed
-    ldout(cct, 10) << "The placement groups have changed, restarting with " << pg_num << dendl;
-    list_context->current_pg = 0;
-    list_context->cookie = collection_list_handle_t();
-    list_context->current_pg_epoch = 0;
+    if (list_context->starting_pg_num) {
+      // start reading from the beginning; the pgs have changed
+      ldout(cct, 10) << "The placement groups have changed, restarting with " << pg_num << dendl;
+    } else {
+      ldout(cct, 20) << pg_num << " placement groups" << dendl;
+    }
     list_context->starting_pg_num = pg_num;
+    _list_reset(list_context);
   }
-  if (list_context->current_pg == pg_num){ //this context got all the way through
-    onfinish->finish(0);
-    delete onfinish;
-    return;
-  }
 
-  ObjectOperation op;
-  op.pg_ls(list_context->max_entries, list_context->filter, list_context->cookie,
-	   list_context->current_pg_epoch);
+  assert(!list_context->onfinish);
+  list_context->onfinish = onfinish;
+  list_context->pgls_max = list_context->max_entries;
+
+  list<Op*> ops;
+  int r = 0;
+  Context *fin = _list_advance(list_context, ops, &r);
+  list_context->lock.Unlock();
 
-  bufferlist *bl = new bufferlist();
-  C_List *onack = new C_List(list_context, onfinish, bl, this);
+  for (list<Op*>::iterator p = ops.begin(); p != ops.end(); ++p)
+    op_submit(*p);
+  if (fin) {
+    fin->finish(r);
+    delete fin;
+  }
+}
 
-  object_t oid;
-  object_locator_t oloc(list_context->pool_id);
+/*
+ * Move to another pg position (pg index) of the listing.  Anything still in
+ * flight for the old position is ignored when it comes back.
+ */
+void Objecter::list_objects_seek(ListContext *list_context, uint32_t pos)
+{
+  ldout(cct, 10) << "list_objects_seek " << list_context << " to " << pos << dendl;
 
-  // 
-  Op *o = new Op(oid, oloc, op.ops, CEPH_OSD_FLAG_READ, onack, NULL, NULL);
-  o->priority = op.priority;
-  o->snapid = list_context->pool_snap_seq;
-  o->outbl = bl;
-  o->reply_epoch = &onack->epoch;
+  list_context->lock.Lock();
+  assert(!list_context->onfinish);
 
-  o->pgid = pg_t(list_context->current_pg, list_context->pool_id, -1);
+  rwlock.get_read();
+  const pg_pool_t *pool = osdmap->get_pg_pool(list_context->pool_id);
+  if (pool)
+    list_context->starting_pg_num = pool->get_pg_num();
+  rwlock.put_read();
+
+  _list_reset(list_context);
+  if ((int64_t)pos > list_context->current_pg)
+    list_context->current_pg = MIN((int64_t)pos, list_context->end_pg);
+  list_context->list.clear();
+  list_context->lock.Unlock();
+}
 
-  op_submit(o);
+/*
+ * Drop the caller's reference to a listing.  pgls ops still in flight
+ * hold their own references; their replies are ignored and start no
+ * new ops, and the last one frees the context.
+ */
+void Objecter::list_objects_close(ListContext *list_context)
+{
+  list_context->lock.Lock();
+  ldout(cct, 10) << "list_objects_close " << list_context
+		 << " with " << list_context->pgls_in_flight << " pgls in flight" << dendl;
+  assert(!list_context->onfinish);
+  list_context->gen++;
+  list_context->pgls_max = 0;
+  list_context->pgs.clear();
+  list_context->list.clear();
+  list_context->lock.Unlock();
+  list_context->put();
 }
 
-void Objecter::_list_reply(ListContext *list_context, bufferlist *bl, Context *final_finish, epoch_t reply_epoch)
+void Objecter::_list_reset(ListContext *list_context)
 {
-  ldout(cct, 10) << "_list_reply" << dendl;
+  assert(list_context->lock.is_locked());
+  uint64_t pg_num = list_context->starting_pg_num;
+  list_context->start_pg = pg_num * list_context->shard / list_context->num_shards;
+  list_context->end_pg = pg_num * (list_context->shard + 1) / list_context->num_shards;
+  list_context->current_pg = list_context->start_pg;
+  list_context->pgs.clear();
+  list_context->gen++;
+  list_context->at_end = false;
+  list_context->error = 0;
+  ldout(cct, 20) << "_list_reset " << list_context << " pgs [" << list_context->start_pg
+		 << "," << list_context->end_pg << ") gen " << list_context->gen << dendl;
+}
 
-  bufferlist::iterator iter = bl->begin();
-  pg_ls_response_t response;
-  bufferlist extra_info;
-  ::decode(response, iter);
-  if (!iter.end()) {
-    ::decode(extra_info, iter);
-  }
-  list_context->cookie = response.handle;
-  if (!list_context->current_pg_epoch) {
-    // first pgls result, set epoch marker
-    ldout(cct, 20) << "first pgls piece, reply_epoch is " << reply_epoch << dendl;
-    list_context->current_pg_epoch = reply_epoch;
+/*
+ * If someone is waiting on the listing, hand them the entries that are
+ * ready for the lowest pgs (from a single pg, so that the pg
+ * position they see stays exact), then keep max_concurrent pgs reading
+ * ahead.  Returns the waiter's Context if it should be completed, with
+ * its result in *r.  The caller submits ops after dropping the lock.
+ */
+Context *Objecter::_list_advance(ListContext *list_context, list<Op*>& ops, int *r)
+{
+  assert(list_context->lock.is_locked());
+
+  if (list_context->error) {
+    // report errors before reading any further; the caller may retry
+    if (!list_context->onfinish)
+      return NULL;
+    *r = list_context->error;
+    list_context->error = 0;
+    Context *fin = list_context->onfinish;
+    list_context->onfinish = NULL;
+    return fin;
+  }
+
+  Context *fin = NULL;
+  if (list_context->onfinish) {
+    while (list_context->max_entries > 0 &&
+	   list_context->current_pg < list_context->end_pg) {
+      ListContext::PGBuffer& b = list_context->pgs[list_context->current_pg];
+      if (!b.entries.empty()) {
+	if (!list_context->list.empty() &&
+	    list_context->list_pg != list_context->current_pg)
+	  break;
+	std::list<pair<object_t, string> >::iterator e = b.entries.begin();
+	int n = 0;
+	while (e != b.entries.end() && n < list_context->max_entries) {
+	  ++e;
+	  ++n;
+	}
+	list_context->list.splice(list_context->list.end(), b.entries, b.entries.begin(), e);
+	list_context->list_pg = list_context->current_pg;
+	list_context->max_entries -= n;
+	continue;
+      }
+      if (!b.done)
+	break;
+      // if we make this this far, there are no objects left in the current pg
+      list_context->pgs.erase(list_context->current_pg);
+      ++list_context->current_pg;
+      ldout(cct, 20) << "emptied current pg, moving on to next one:" << list_context->current_pg << dendl;
+    }
+    if (list_context->current_pg >= list_context->end_pg) {
+      ldout(cct, 20) << "out of pgs" << dendl;
+      list_context->at_end = true;
+    }
+    if (list_context->at_end || !list_context->list.empty()) {
+      ldout(cct, 20) << "returning " << list_context->list.size() << " entries to "
+		     << list_context->onfinish << dendl;
+      *r = 0;
+      fin = list_context->onfinish;
+      list_context->onfinish = NULL;
+    }
   }
 
-  int response_size = response.entries.size();
-  ldout(cct, 20) << "response.entries.size " << response_size
-	   << ", response.entries " << response.entries << dendl;
-  list_context->extra_info.append(extra_info);
-  if (response_size) {
-    ldout(cct, 20) << "got a response with objects, proceeding" << dendl;
-    list_context->list.merge(response.entries);
-    list_context->max_entries -= response_size;
-    ldout(cct, 20) << "cleaning up and exiting" << dendl;
-    if (!list_context->max_entries) {
-      final_finish->finish(0);
-      delete bl;
-      delete final_finish;
-      return;
+  int window = list_context->max_concurrent;
+  if (window <= 0)
+    window = cct->_conf->objecter_list_concurrent_pgs;
+  if (window <= 0)
+    window = 1;
+  if (list_context->pgls_max <= 0)
+    return fin;
+
+  for (int pg = list_context->current_pg;
+       pg < list_context->end_pg && pg < list_context->current_pg + window &&
+	 list_context->pgls_in_flight < window;
+       ++pg) {
+    ListContext::PGBuffer& b = list_context->pgs[pg];
+    if (b.in_flight || b.done || !b.entries.empty())
+      continue;
+
+    ObjectOperation op;
+    op.pg_ls(list_context->pgls_max, list_context->filter, b.cookie, b.epoch);
+
+    C_List *onack = new C_List(list_context, pg, list_context->gen, this);
+    object_t oid;
+    object_locator_t oloc(list_context->pool_id);
+
+    Op *o = new Op(oid, oloc, op.ops, CEPH_OSD_FLAG_READ, onack, NULL, NULL);
+    o->priority = op.priority;
+    o->snapid = list_context->pool_snap_seq;
+    o->outbl = &onack->bl;
+    o->reply_epoch = &onack->epoch;
+    o->pgid = pg_t(pg, list_context->pool_id, -1);
+
+    ldout(cct, 20) << "pgls " << o->pgid << " cookie " << b.cookie << dendl;
+    b.in_flight = true;
+    list_context->pgls_in_flight++;
+    ops.push_back(o);
+  }
+  return fin;
+}
+
+void Objecter::_list_reply(ListContext *list_context, int pg, uint64_t gen,
+			   int r, bufferlist& bl, epoch_t reply_epoch)
+{
+  ldout(cct, 10) << "_list_reply pg " << pg << " r = " << r << dendl;
+
+  list_context->lock.Lock();
+  list_context->pgls_in_flight--;
+  if (gen != list_context->gen) {
+    ldout(cct, 20) << "stale reply for gen " << gen << ", ignoring" << dendl;
+  } else if (r < 0) {
+    list_context->pgs[pg].in_flight = false;
+    list_context->error = r;
+  } else {
+    ListContext::PGBuffer& b = list_context->pgs[pg];
+    b.in_flight = false;
+
+    bufferlist::iterator iter = bl.begin();
+    pg_ls_response_t response;
+    bufferlist extra_info;
+    ::decode(response, iter);
+    if (!iter.end()) {
+      ::decode(extra_info, iter);
+    }
+    b.cookie = response.handle;
+    if (!b.epoch) {
+      // first pgls result, set epoch marker
+      ldout(cct, 20) << "first pgls piece, reply_epoch is " << reply_epoch << dendl;
+      b.epoch = reply_epoch;
     }
+
+    int response_size = response.entries.size();
+    ldout(cct, 20) << "response.entries.size " << response_size
+	     << ", response.entries " << response.entries << dendl;
+    list_context->extra_info.append(extra_info);
+    // replies can come back short (the osd skips clones, snapdirs and
+    // whatever a filter rejects), so only an empty one means the pg is
+    // done
+    b.done = response_size == 0;
+    b.entries.splice(b.entries.end(), response.entries);
   }
 
-  // if we make this this far, there are no objects left in the current pg, but we want more!
-  ++list_context->current_pg;
-  list_context->current_pg_epoch = 0;
-  ldout(cct, 20) << "emptied current pg, moving on to next one:" << list_context->current_pg << dendl;
-  if (list_context->current_pg < list_context->starting_pg_num){ // we have more pgs to go through
-    list_context->cookie = collection_list_handle_t();
-    delete bl;
-    list_objects(list_context, final_finish);
-    return;
+  list<Op*> ops;
+  Context *fin = _list_advance(list_context, ops, &r);
+  list_context->lock.Unlock();
+
+  for (list<Op*>::iterator p = ops.begin(); p != ops.end(); ++p)
+    op_submit(*p);
+  if (fin) {
+    fin->finish(r);
+    delete fin;
   }
-  
-  // if we make it this far, there are no more pgs
-  ldout(cct, 20) << "out of pgs, returning to" << final_finish << dendl;
-  list_context->at_end = true;
-  delete bl;
-  final_finish->finish(0);
-  delete final_finish;
-  return;
 }
 
 
@@ -1411,7 +2085,7 @@ int Objecter::create_pool_snap(int64_t pool, string& snapName, Context *onfinish
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snapName;
   op->onfinish = onfinish;
@@ -1444,7 +2118,7 @@ int Objecter::allocate_selfmanaged_snap(int64_t pool, snapid_t *psnapid,
   ldout(cct, 10) << "allocate_selfmanaged_snap; pool: " << pool << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   C_SelfmanagedSnap *fin = new C_SelfmanagedSnap(psnapid, onfinish);
   op->onfinish = fin;
@@ -1462,7 +2136,7 @@ int Objecter::delete_pool_snap(int64_t pool, string& snapName, Context *onfinish
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snapName;
   op->onfinish = onfinish;
@@ -1480,7 +2154,7 @@ int Objecter::delete_selfmanaged_snap(int64_t pool, snapid_t snap,
 	   << snap << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->onfinish = onfinish;
   op->pool_op = POOL_OP_DELETE_UNMANAGED_SNAP;
@@ -1499,7 +2173,7 @@ int Objecter::create_pool(string& name, Context *onfinish, uint64_t auid,
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = 0;
   op->name = name;
   op->onfinish = onfinish;
@@ -1519,7 +2193,7 @@ int Objecter::delete_pool(int64_t pool, Context *onfinish)
 
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "delete";
   op->onfinish = onfinish;
@@ -1542,7 +2216,7 @@ int Objecter::change_pool_auid(int64_t pool, Context *onfinish, uint64_t auid)
   ldout(cct, 10) << "change_pool_auid " << pool << " to " << auid << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "change_pool_auid";
   op->onfinish = onfinish;
@@ -1620,7 +2294,7 @@ void Objecter::get_pool_stats(list<string>& pools, map<string,pool_stat_t> *resu
   ldout(cct, 10) << "get_pool_stats " << pools << dendl;
 
   PoolStatOp *op = new PoolStatOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pools = pools;
   op->pool_stats = result;
   op->onfinish = onfinish;
@@ -1673,7 +2347,7 @@ void Objecter::get_fs_stats(ceph_statfs& result, Context *onfinish)
   ldout(cct, 10) << "get_fs_stats" << dendl;
 
   StatfsOp *op = new StatfsOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->stats = &result;
   op->onfinish = onfinish;
   statfs_ops[op->tid] = op;
@@ -1843,7 +2517,7 @@ void Objecter::ms_handle_connect(Connection *con)
 void Objecter::ms_handle_reset(Connection *con)
 {
   if (con->get_peer_type() == CEPH_ENTITY_TYPE_OSD) {
-    //
+    rwlock.get_write();
     int osd = osdmap->identify_osd(con->get_peer_addr());
     if (osd >= 0) {
       ldout(cct, 1) << "ms_handle_reset on osd." << osd << dendl;
@@ -1857,6 +2531,7 @@ void Objecter::ms_handle_reset(Connection *con)
     } else {
       ldout(cct, 10) << "ms_handle_reset on unknown osd addr " << con->get_peer_addr() << dendl;
     }
+    rwlock.put_write();
   }
 }
 
@@ -1871,8 +2546,10 @@ void Objecter::ms_handle_remote_reset(Connection *con)
 
 void Objecter::dump_active()
 {
-  ldout(cct, 20) << "dump_active .. " << num_homeless_ops << " homeless" << dendl;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin(); p != ops.end(); p++) {
+  ldout(cct, 20) << "dump_active .. " << num_homeless_ops.read() << " homeless" << dendl;
+  map<tid_t,Op*> ops;
+  _get_all_ops(ops);
+  for (map<tid_t,Op*>::iterator p = ops.begin(); p != ops.end(); p++) {
     Op *op = p->second;
     ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << (op->session ? op->session->osd : -1)
 	    << "\t" << op->oid << "\t" << op->ops << dendl;
@@ -1894,34 +2571,43 @@ void Objecter::dump_requests(Formatter& fmt) const
 
 void Objecter::dump_ops(Formatter& fmt) const
 {
+  rwlock.get_read();
   fmt.open_array_section("ops");
-  for (hash_map<tid_t,Op*>::const_iterator p = ops.begin();
-       p != ops.end();
-       ++p) {
-    Op *op = p->second;
-    fmt.open_object_section("op");
-    fmt.dump_unsigned("tid", op->tid);
-    fmt.dump_stream("pg") << op->pgid;
-    fmt.dump_int("osd", op->session ? op->session->osd : -1);
-    fmt.dump_stream("last_sent") << op->stamp;
-    fmt.dump_int("attempts", op->attempts);
-    fmt.dump_stream("object_id") << op->oid;
-    fmt.dump_stream("object_locator") << op->oloc;
-    fmt.dump_stream("snapid") << op->snapid;
-    fmt.dump_stream("snap_context") << op->snapc;
-    fmt.dump_stream("mtime") << op->mtime;
-
-    fmt.open_array_section("osd_ops");
-    for (vector<OSDOp>::const_iterator it = op->ops.begin();
-	 it != op->ops.end();
-	 ++it) {
-      fmt.dump_stream("osd_op") << *it;
-    }
-    fmt.close_section(); // osd_ops array
-
-    fmt.close_section(); // op object
+  for (int i = 0; i < NUM_OP_SHARDS; i++) {
+    OpShard& shard = op_shards[i];
+    Mutex::Locker l(shard.lock);
+    for (hash_map<tid_t,Op*>::const_iterator p = shard.ops.begin();
+	 p != shard.ops.end();
+	 ++p)
+      dump_op(fmt, p->second);
   }
   fmt.close_section(); // ops array
+  rwlock.put_read();
+}
+
+void Objecter::dump_op(Formatter& fmt, const Op *op) const
+{
+  fmt.open_object_section("op");
+  fmt.dump_unsigned("tid", op->tid);
+  fmt.dump_stream("pg") << op->pgid;
+  fmt.dump_int("osd", op->session ? op->session->osd : -1);
+  fmt.dump_stream("last_sent") << op->stamp;
+  fmt.dump_int("attempts", op->attempts);
+  fmt.dump_stream("object_id") << op->oid;
+  fmt.dump_stream("object_locator") << op->oloc;
+  fmt.dump_stream("snapid") << op->snapid;
+  fmt.dump_stream("snap_context") << op->snapc;
+  fmt.dump_stream("mtime") << op->mtime;
+
+  fmt.open_array_section("osd_ops");
+  for (vector<OSDOp>::const_iterator it = op->ops.begin();
+       it != op->ops.end();
+       ++it) {
+    fmt.dump_stream("osd_op") << *it;
+  }
+  fmt.close_section(); // osd_ops array
+
+  fmt.close_section(); // op object
 }
 
 void Objecter::dump_linger_ops(Formatter& fmt) const
@@ -18,12 +18,17 @@
 #include "include/types.h"
 #include "include/buffer.h"
 #include "include/xlist.h"
+#include "include/atomic.h"
 
 #include "osd/OSDMap.h"
 #include "messages/MOSDOp.h"
 
 #include "common/admin_socket.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/RWLock.h"
 #include "common/Timer.h"
+#include "common/Thread.h"
 
 #include <list>
 #include <map>
@@ -259,6 +264,25 @@ struct ObjectOperation {
     add_clone_range(CEPH_OSD_OP_CLONERANGE, dst_offset, len, src_oid, src_offset, CEPH_NOSNAP);
   }
 
+  void rollback(snapid_t snapid) {
+    OSDOp& osd_op = add_op(CEPH_OSD_OP_ROLLBACK);
+    osd_op.op.snap.snapid = snapid;
+  }
+
+  /*
+   * replace this object's data, xattrs and omap with a copy of src,
+   * pulled by the primary osd.  src_version of 0 copies whatever
+   * version is current.
+   */
+  void copy_from(const object_t& src, snapid_t snapid,
+		 const object_locator_t& src_oloc, version_t src_version) {
+    OSDOp& osd_op = add_op(CEPH_OSD_OP_COPY_FROM);
+    osd_op.op.copy_from.snapid = snapid;
+    osd_op.op.copy_from.src_version = src_version;
+    ::encode(src, osd_op.indata);
+    ::encode(src_oloc, osd_op.indata);
+  }
+
   // object attrs
   void getxattr(const char *name, bufferlist *pbl, int *prval) {
     bufferlist bl;
@@ -403,14 +427,15 @@ class Objecter {
   bool initialized;
  
  private:
-  tid_t last_tid;
+  atomic_t last_tid;
   int client_inc;
   uint64_t max_linger_id;
-  int num_unacked;
-  int num_uncommitted;
+  atomic_t num_unacked;
+  atomic_t num_uncommitted;
   int global_op_flags; // flags which are applied to each IO op
   bool keep_balanced_budget;
   bool honor_osdmap_full;
+  bool unlocked_io;
 
   void maybe_request_map(epoch_t epoch=0);
 
@@ -420,6 +445,17 @@ class Objecter {
   Mutex &client_lock;
   SafeTimer &timer;
 
+  /**
+   * rwlock protects osdmap, osd_sessions and the op -> session
+   * mapping.  op_submit() and handle_osd_op_reply() only take it for
+   * read (plus the target session's lock and an op shard lock), so
+   * that io from many threads does not serialize on client_lock;
+   * anything that remaps or resends ops takes it for write.
+   *
+   * lock order: client_lock -> rwlock -> OSDSession::lock -> OpShard::lock
+   */
+  mutable RWLock rwlock;
+
   PerfCounters *logger;
   
   class C_Tick : public Context {
@@ -487,6 +523,8 @@ public:
 
     utime_t stamp;
 
+    bool no_batch;  // send as is, don't merge into a read batch
+
     Op(const object_t& o, const object_locator_t& ol, vector<OSDOp>& op,
        int f, Context *ac, Context *co, eversion_t *ov) :
       session(NULL), session_item(this), incarnation(0),
@@ -496,7 +534,8 @@ public:
       outbl(NULL),
       flags(f), priority(0), onack(ac), oncommit(co),
       tid(0), attempts(0),
-      paused(false), objver(ov), reply_epoch(NULL) {
+      paused(false), objver(ov), reply_epoch(NULL),
+      no_batch(false) {
       ops.swap(op);
       
       /* initialize out_* to match op vector */
@@ -518,6 +557,91 @@ public:
     }
   };
 
+  /*
+   * Read batching.  Read-only ops on the same object (and snap, and
+   * flags) that are submitted within objecter_batch_window of each
+   * other are sent as one compound op, with adjacent read extents
+   * merged, and the reply is split back out to the original ops.
+   */
+  struct BatchKey {
+    object_t oid;
+    object_locator_t oloc;
+    snapid_t snapid;
+    int flags;
+    BatchKey(const Op *op)
+      : oid(op->oid), oloc(op->oloc), snapid(op->snapid), flags(op->flags) {}
+    bool operator<(const BatchKey& o) const {
+      if (oid != o.oid)
+	return oid < o.oid;
+      if (oloc.pool != o.oloc.pool)
+	return oloc.pool < o.oloc.pool;
+      if (oloc.preferred != o.oloc.preferred)
+	return oloc.preferred < o.oloc.preferred;
+      if (oloc.key != o.oloc.key)
+	return oloc.key < o.oloc.key;
+      if (snapid != o.snapid)
+	return snapid < o.snapid;
+      return flags < o.flags;
+    }
+  };
+
+  struct ReadBatch {
+    list<Op*> ops;
+    utime_t deadline;
+  };
+
+  struct C_BatchReply : public Context {
+    /// where an original sub-op's result lives in the compound op
+    struct Piece {
+      unsigned idx;
+      uint64_t off, len;
+      bool whole;
+      Piece(unsigned i) : idx(i), off(0), len(0), whole(true) {}
+      Piece(unsigned i, uint64_t o, uint64_t l) : idx(i), off(o), len(l), whole(false) {}
+    };
+    Objecter *objecter;
+    vector<Op*> ops;
+    vector< vector<Piece> > pieces;   // per sub-op of each of ops
+    vector<bufferlist> out;           // per sub-op of the compound op
+    vector<int> rval;
+    eversion_t version;
+    epoch_t epoch;
+    C_BatchReply(Objecter *o) : objecter(o), epoch(0) {}
+    void finish(int r) {
+      objecter->_batch_reply(this, r);
+    }
+  };
+
+  class BatchThread : public Thread {
+    Objecter *objecter;
+  public:
+    BatchThread(Objecter *o) : objecter(o) {}
+    void *entry() {
+      objecter->batch_entry();
+      return 0;
+    }
+  } batch_thread;
+
+  Mutex batch_lock;
+  Cond batch_cond;
+  Cond batch_sent_cond;
+  bool batch_stop;
+  map<BatchKey, ReadBatch> read_batches;
+  map<object_t, int> batch_sending;  // taken off read_batches, not yet sent
+  atomic_t batch_pending;  // read_batches.size() + batch_sending.size()
+
+  void _batch_update_pending() {
+    assert(batch_lock.is_locked());
+    batch_pending.set(read_batches.size() + batch_sending.size());
+  }
+  bool _can_batch(Op *op);
+  bool batch_read(Op *op);
+  void batch_flush(const object_t& oid, const object_locator_t& oloc);
+  void _batch_sent(const object_t& oid);
+  void _batch_submit(list<Op*>& ls);
+  void _batch_reply(C_BatchReply *fin, int r);
+  void batch_entry();
+
   struct C_Op_Map_Latest : public Context {
     Objecter *objecter;
     tid_t tid;
@@ -566,42 +690,87 @@ public:
 
 
   // Pools and statistics 
+  /**
+   * state of a pool listing
+   *
+   * Entries are handed back in pg order, but up to max_concurrent pgs
+   * starting at current_pg are read ahead in parallel.  The listing
+   * covers the pgs [start_pg, end_pg), which are recomputed from
+   * shard/num_shards whenever the pool's pg_num changes, so that several
+   * clients can each walk their own slice of a pool.  current_pg is the
+   * resume cursor: entries from pgs before it have all been returned.
+   */
   struct ListContext {
+    struct PGBuffer {
+      std::list<pair<object_t, string> > entries;
+      collection_list_handle_t cookie;
+      epoch_t epoch;
+      bool in_flight;
+      bool done;      // no more objects in the pg beyond entries
+      PGBuffer() : epoch(0), in_flight(false), done(false) {}
+    };
+
+    Mutex lock;
+
     int current_pg;
-    collection_list_handle_t cookie;
-    epoch_t current_pg_epoch;
     int starting_pg_num;
     bool at_end;
 
+    uint32_t shard, num_shards;
+    int start_pg, end_pg;
+    int max_concurrent;   // 0: objecter_list_concurrent_pgs
+
     int64_t pool_id;
     int pool_snap_seq;
     int max_entries;
     std::list<pair<object_t, string> > list;
+    int list_pg;              // pg the entries in list came from
 
     bufferlist filter;
 
     bufferlist extra_info;
 
-    ListContext() : current_pg(0), current_pg_epoch(0), starting_pg_num(0),
-		    at_end(false), pool_id(0),
-		    pool_snap_seq(0), max_entries(0) {}
+    // private to the Objecter
+    map<int, PGBuffer> pgs;   // current_pg and the pgs read ahead of it
+    int pgls_in_flight;
+    int pgls_max;             // entries asked for per pgls
+    uint64_t gen;             // bumped whenever pgs is reset
+    int error;
+    Context *onfinish;
+    atomic_t nref;            // the owner plus each pgls in flight
+
+    ListContext() : lock("Objecter::ListContext::lock"),
+		    current_pg(0), starting_pg_num(0),
+		    at_end(false), shard(0), num_shards(1),
+		    start_pg(0), end_pg(0), max_concurrent(0),
+		    pool_id(0), pool_snap_seq(0), max_entries(0), list_pg(0),
+		    pgls_in_flight(0), pgls_max(0), gen(0), error(0),
+		    onfinish(NULL), nref(1) {}
+    void get() {
+      nref.inc();
+    }
+    void put() {
+      if (nref.dec() == 0)
+	delete this;
+    }
   };
 
   struct C_List : public Context {
     ListContext *list_context;
-    Context *final_finish;
-    bufferlist *bl;
+    int pg;
+    uint64_t gen;
+    bufferlist bl;
     Objecter *objecter;
     epoch_t epoch;
-    C_List(ListContext *lc, Context * finish, bufferlist *b, Objecter *ob) :
-      list_context(lc), final_finish(finish), bl(b), objecter(ob), epoch(0) {}
+    C_List(ListContext *lc, int p, uint64_t g, Objecter *ob) :
+      list_context(lc), pg(p), gen(g), objecter(ob), epoch(0) {
+      list_context->get();
+    }
+    ~C_List() {
+      list_context->put();
+    }
     void finish(int r) {
-      if (r >= 0) {
-        objecter->_list_reply(list_context, bl, final_finish, epoch);
-      } else {
-        final_finish->finish(r);
-        delete final_finish;
-      }
+      objecter->_list_reply(list_context, pg, gen, r, bl, epoch);
     }
   };
   
@@ -713,21 +882,41 @@ public:
 
   // -- osd sessions --
   struct OSDSession {
+    Mutex lock;   // protects ops; sends to this osd are serialized under it
     xlist<Op*> ops;
     xlist<LingerOp*> linger_ops;
     int osd;
     int incarnation;
     Connection *con;
 
-    OSDSession(int o) : osd(o), incarnation(0), con(NULL) {}
+    OSDSession(int o) : lock("Objecter::OSDSession::lock"),
+			osd(o), incarnation(0), con(NULL) {}
   };
   map<int,OSDSession*> osd_sessions;
 
 
  private:
-  // pending ops
-  hash_map<tid_t,Op*>       ops;
-  int                       num_homeless_ops;
+  // pending ops, sharded by tid so that submit and reply on different
+  // ops rarely contend
+  enum { NUM_OP_SHARDS = 32 };
+  struct OpShard {
+    Mutex lock;
+    hash_map<tid_t,Op*> ops;
+    OpShard() : lock("Objecter::OpShard::lock") {}
+  };
+  mutable OpShard           op_shards[NUM_OP_SHARDS];
+  atomic_t                  num_active_ops;
+  atomic_t                  num_homeless_ops;
+
+  OpShard& get_op_shard(tid_t tid) {
+    return op_shards[tid % NUM_OP_SHARDS];
+  }
+  void _op_map_insert(Op *op);
+  Op *_op_map_lookup(tid_t tid);
+  void _op_map_remove(Op *op);
+  void _get_all_ops(map<tid_t,Op*>& m);
+  void _session_op_remove(Op *op);
+
   map<uint64_t, LingerOp*>  linger_ops;
   map<tid_t,PoolStatOp*>    poolstat_ops;
   map<tid_t,StatfsOp*>      statfs_ops;
@@ -746,8 +935,9 @@ public:
     RECALC_OP_TARGET_NO_ACTION = 0,
     RECALC_OP_TARGET_NEED_RESEND,
     RECALC_OP_TARGET_POOL_DNE,
+    RECALC_OP_TARGET_NEED_SESSION,
   };
-  int recalc_op_target(Op *op);
+  int recalc_op_target(Op *op, bool can_create_session=true);
   bool recalc_linger_op_target(LingerOp *op);
 
   void send_linger(LingerOp *info);
@@ -761,12 +951,14 @@ public:
 
   void kick_requests(OSDSession *session);
 
-  OSDSession *get_session(int osd);
+  OSDSession *get_session(int osd, bool create=true);
   void reopen_session(OSDSession *session);
   void close_session(OSDSession *session);
   
-  void _list_reply(ListContext *list_context, bufferlist *bl, Context *final_finish,
-		   epoch_t reply_epoch);
+  void _list_reply(ListContext *list_context, int pg, uint64_t gen,
+		   int r, bufferlist& bl, epoch_t reply_epoch);
+  void _list_reset(ListContext *list_context);
+  Context *_list_advance(ListContext *list_context, list<Op*>& ops, int *r);
 
   void resend_mon_ops();
 
@@ -774,7 +966,8 @@ public:
    * handle a budget for in-flight ops
    * budget is taken whenever an op goes into the ops map
    * and returned whenever an op is removed from the map
-   * If throttle_op needs to throttle it will unlock client_lock.
+   * If throttle_op needs to throttle it will unlock client_lock
+   * (unless unlocked_io is set, in which case the caller holds no lock).
    */
   int calc_op_budget(Op *op);
   void throttle_op(Op *op, int op_size=0);
@@ -800,11 +993,17 @@ public:
     num_unacked(0), num_uncommitted(0),
     global_op_flags(0),
     keep_balanced_budget(false), honor_osdmap_full(true),
+    unlocked_io(false),
     last_seen_osdmap_version(0),
     last_seen_pgmap_version(0),
     client_lock(l), timer(t),
+    rwlock("Objecter::rwlock"),
     logger(NULL), tick_event(NULL),
     m_request_state_hook(NULL),
+    batch_thread(this),
+    batch_lock("Objecter::batch_lock"),
+    batch_stop(false),
+    num_active_ops(0),
     num_homeless_ops(0),
     op_throttler(cct->_conf->objecter_inflight_op_bytes)
   { }
@@ -830,6 +1029,16 @@ public:
   void set_honor_osdmap_full() { honor_osdmap_full = true; }
   void unset_honor_osdmap_full() { honor_osdmap_full = false; }
 
+  /**
+   * Allow reads, writes and other osd ops to be submitted, and their
+   * replies handled, without holding client_lock.  Completion
+   * callbacks for those ops are then called without client_lock as
+   * well, so only set this if the caller's callbacks do their own
+   * locking.  Everything else (maps, pool ops, statfs, ...) still
+   * requires client_lock.
+   */
+  void set_unlocked_io() { unlocked_io = true; }
+
   // messages
  public:
   void dispatch(Message *m);
@@ -839,12 +1048,15 @@ public:
 
 private:
   // low-level
-  tid_t op_submit(Op *op, OSDSession *s = NULL);
+  tid_t op_submit(Op *op);
+  bool _op_submit(Op *op, OSDSession *s, bool wlocked);
+  tid_t _op_submit_budgeted(Op *op);
 
   // public interface
  public:
   bool is_active() {
-    return !(ops.empty() && linger_ops.empty() && poolstat_ops.empty() && statfs_ops.empty());
+    return !(num_active_ops.read() == 0 && linger_ops.empty() &&
+	     poolstat_ops.empty() && statfs_ops.empty());
   }
 
   /**
@@ -853,6 +1065,7 @@ private:
   void dump_active();
   void dump_requests(Formatter& fmt) const;
   void dump_ops(Formatter& fmt) const;
+  void dump_op(Formatter& fmt, const Op *op) const;
   void dump_linger_ops(Formatter& fmt) const;
   void dump_pool_ops(Formatter& fmt) const;
   void dump_pool_stat_ops(Formatter& fmt) const;
@@ -1249,6 +1462,8 @@ private:
   }
 
   void list_objects(ListContext *p, Context *onfinish);
+  void list_objects_seek(ListContext *p, uint32_t pos);
+  void list_objects_close(ListContext *p);
 
   // -------------------------
   // pool ops
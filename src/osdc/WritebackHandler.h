@@ -0,0 +1,32 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_OSDC_WRITEBACKHANDLER_H
+#define CEPH_OSDC_WRITEBACKHANDLER_H
+
+#include "include/Context.h"
+#include "include/types.h"
+#include "osd/osd_types.h"
+
+/*
+ * The ObjectCacher's path to the backing store.  Completions are
+ * called with the cache lock held, and write commits for a single
+ * object must complete in the order their tids were handed out.
+ */
+class WritebackHandler {
+ public:
+  WritebackHandler() {}
+  virtual ~WritebackHandler() {}
+
+  virtual void read(const object_t& oid, const object_locator_t& oloc,
+		    loff_t off, uint64_t len, snapid_t snapid,
+		    bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+		    Context *onfinish) = 0;
+
+  virtual tid_t write(const object_t& oid, const object_locator_t& oloc,
+		      loff_t off, uint64_t len, const SnapContext& snapc,
+		      const bufferlist &bl, utime_t mtime,
+		      uint64_t trunc_size, __u32 trunc_seq,
+		      Context *oncommit) = 0;
+};
+
+#endif
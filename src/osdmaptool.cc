@@ -25,6 +25,7 @@ using namespace std;
 #include "common/config.h"
 
 #include "common/errno.h"
+#include "common/Clock.h"
 #include "osd/OSDMap.h"
 #include "mon/MonMap.h"
 #include "common/ceph_argparse.h"
@@ -36,6 +37,8 @@ void usage()
   cout << "   --export-crush <file>   write osdmap's crush map to <file>" << std::endl;
   cout << "   --import-crush <file>   replace osdmap's crush map with <file>" << std::endl;
   cout << "   --test-map-pg <pgid>    map a pgid to osds" << std::endl;
+  cout << "   --test-map-pgs          build the pg mapping table and check it against crush" << std::endl;
+  cout << "   --mapping-threads <n>   threads to build the pg mapping table with" << std::endl;
   exit(1);
 }
 
@@ -66,6 +69,8 @@ int main(int argc, const char **argv)
   std::string export_crush, import_crush, test_map_pg, test_map_object;
   list<entity_addr_t> add, rm;
   bool test_crush = false;
+  bool test_map_pgs = false;
+  int mapping_threads = 1;
 
   std::string val;
   std::ostringstream err;
@@ -115,6 +120,13 @@ int main(int argc, const char **argv)
       test_map_object = val;
     } else if (ceph_argparse_flag(args, i, "--test_crush", (char*)NULL)) {
       test_crush = true;
+    } else if (ceph_argparse_flag(args, i, "--test_map_pgs", (char*)NULL)) {
+      test_map_pgs = true;
+    } else if (ceph_argparse_withint(args, i, &mapping_threads, &err, "--mapping_threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
     } else {
       ++i;
     }
@@ -208,7 +220,7 @@ int main(int argc, const char **argv)
 
   if (!export_crush.empty()) {
     bufferlist cbl;
-    osdmap.crush.encode(cbl);
+    osdmap.crush->encode(cbl);
     r = cbl.write_file(export_crush.c_str());
     if (r < 0) {
       cerr << me << ": error writing crush map to " << import_crush << std::endl;
@@ -245,6 +257,48 @@ int main(int argc, const char **argv)
     osdmap.pg_to_up_acting_osds(pgid, up, acting);
     cout << pgid << " raw " << raw << " up " << up << " acting " << acting << std::endl;
   }
+  if (test_map_pgs) {
+    // time a crush pass over every pg, then the table build and lookups
+    vector<pg_t> pgs;
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p)
+      for (ps_t ps = 0; ps < p->second.get_pg_num(); ps++)
+	pgs.push_back(pg_t(ps, p->first, -1));
+
+    vector<vector<int> > expected(pgs.size());
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (unsigned i = 0; i < pgs.size(); i++) {
+      vector<int> raw, up;
+      osdmap.calc_pg_mapping(pgs[i], raw, up, expected[i]);
+    }
+    utime_t crush_time = ceph_clock_now(g_ceph_context) - start;
+
+    osdmap.enable_pg_mapping(mapping_threads);
+
+    start = ceph_clock_now(g_ceph_context);
+    unsigned mismatch = 0;
+    for (unsigned i = 0; i < pgs.size(); i++) {
+      vector<int> acting;
+      osdmap.pg_to_acting_osds(pgs[i], acting);
+      if (acting != expected[i]) {
+	cerr << pgs[i] << " table " << acting << " != crush " << expected[i] << std::endl;
+	mismatch++;
+      }
+    }
+    utime_t lookup_time = ceph_clock_now(g_ceph_context) - start;
+
+    cout << "pg mapping table: " << osdmap.get_pg_mapping_num_pgs() << " pgs, "
+	 << osdmap.get_pg_mapping_bytes() << " bytes, built in "
+	 << osdmap.get_pg_mapping_build_time() << " with " << mapping_threads
+	 << " threads" << std::endl;
+    cout << "mapped " << pgs.size() << " pgs: crush " << crush_time
+	 << ", table " << lookup_time << std::endl;
+    if (mismatch) {
+      cerr << me << ": " << mismatch << " pgs differ from crush" << std::endl;
+      exit(1);
+    }
+  }
   if (test_crush) {
     int pass = 0;
     while (1) {
@@ -278,7 +332,7 @@ int main(int argc, const char **argv)
 
   if (!print && !print_json && !tree && !modified && 
       export_crush.empty() && import_crush.empty() && 
-      test_map_pg.empty() && test_map_object.empty()) {
+      test_map_pg.empty() && test_map_object.empty() && !test_map_pgs) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }
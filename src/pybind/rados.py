@@ -524,6 +524,123 @@ class Ioctx(object):
             raise make_ex(ret, "error reading %s" % object_name)
         return completion
 
+    def aio_stat(self, object_name, oncomplete):
+        """
+        oncomplete will be called with the object's size and mtime as
+        well as the completion:
+
+        oncomplete(completion, size, mtime)
+        """
+        psize = c_uint64()
+        pmtime = c_uint64()
+        def oncomplete_(completion):
+            return oncomplete(completion, psize.value,
+                              time.localtime(pmtime.value))
+        completion = self.__get_completion(oncomplete_, None)
+        ret = self.librados.rados_aio_stat(
+            self.io,
+            c_char_p(object_name),
+            completion.rados_comp,
+            pointer(psize),
+            pointer(pmtime))
+        if ret < 0:
+            raise make_ex(ret, "error stating %s" % object_name)
+        return completion
+
+    def aio_remove(self, object_name, oncomplete=None, onsafe=None):
+        completion = self.__get_completion(oncomplete, onsafe)
+        ret = self.librados.rados_aio_remove(
+            self.io,
+            c_char_p(object_name),
+            completion.rados_comp)
+        if ret < 0:
+            raise make_ex(ret, "error removing %s" % object_name)
+        return completion
+
+    def aio_trunc(self, object_name, size, oncomplete=None, onsafe=None):
+        completion = self.__get_completion(oncomplete, onsafe)
+        ret = self.librados.rados_aio_trunc(
+            self.io,
+            c_char_p(object_name),
+            completion.rados_comp,
+            c_uint64(size))
+        if ret < 0:
+            raise make_ex(ret, "error truncating %s" % object_name)
+        return completion
+
+    def aio_get_xattr(self, object_name, xattr_name, oncomplete):
+        """
+        oncomplete will be called with the xattr value as well as the
+        completion:
+
+        oncomplete(completion, value)
+        """
+        ret_length = 4096
+        buf = create_string_buffer(ret_length)
+        def oncomplete_(completion):
+            ret = completion.get_return_value()
+            return oncomplete(completion,
+                              ctypes.string_at(buf, max(ret, 0)))
+        completion = self.__get_completion(oncomplete_, None)
+        ret = self.librados.rados_aio_getxattr(
+            self.io,
+            c_char_p(object_name),
+            completion.rados_comp,
+            c_char_p(xattr_name),
+            buf,
+            c_size_t(ret_length))
+        if ret < 0:
+            raise make_ex(ret, "error getting xattr %r" % xattr_name)
+        return completion
+
+    def aio_get_xattrs(self, object_name, oncomplete):
+        """
+        oncomplete will be called with an XattrIterator as well as the
+        completion:
+
+        oncomplete(completion, xattrs)
+        """
+        it = c_void_p(0)
+        xattrs = []
+        def oncomplete_(completion):
+            return oncomplete(completion, xattrs[0])
+        completion = self.__get_completion(oncomplete_, None)
+        ret = self.librados.rados_aio_getxattrs(
+            self.io,
+            c_char_p(object_name),
+            completion.rados_comp,
+            byref(it))
+        if ret < 0:
+            raise make_ex(ret, "error getting xattrs of %s" % object_name)
+        xattrs.append(XattrIterator(self, it, object_name))
+        return completion
+
+    def aio_set_xattr(self, object_name, xattr_name, xattr_value,
+                      oncomplete=None, onsafe=None):
+        completion = self.__get_completion(oncomplete, onsafe)
+        ret = self.librados.rados_aio_setxattr(
+            self.io,
+            c_char_p(object_name),
+            completion.rados_comp,
+            c_char_p(xattr_name),
+            c_char_p(xattr_value),
+            c_size_t(len(xattr_value)))
+        if ret < 0:
+            raise make_ex(ret, "error setting xattr %r" % xattr_name)
+        return completion
+
+    def aio_rm_xattr(self, object_name, xattr_name,
+                     oncomplete=None, onsafe=None):
+        completion = self.__get_completion(oncomplete, onsafe)
+        ret = self.librados.rados_aio_rmxattr(
+            self.io,
+            c_char_p(object_name),
+            completion.rados_comp,
+            c_char_p(xattr_name))
+        if ret < 0:
+            raise make_ex(ret, "error removing xattr %r" % xattr_name)
+        return completion
+
     def require_ioctx_open(self):
         if self.state != "open":
             raise IoctxStateError("The pool is %s" % self.state)
@@ -20,6 +20,7 @@
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include "common/safe_io.h"
+#include "common/Throttle.h"
 #include "common/secret.h"
 #include "include/rados/librados.hpp"
 #include "include/rbd/librbd.hpp"
@@ -66,6 +67,8 @@ void usage()
        << "  <ls | list> [pool-name]                   list rbd images\n"
        << "  info <--snap=name> [image-name]           show information about image size,\n"
        << "                                            striping, etc.\n"
+       << "  du <--snap=name> [image-name]             show space used by the image's\n"
+       << "                                            objects\n"
        << "  create <--order=bits> [--size MB] [name]  create an empty image\n"
        << "  resize [--size MB] [image-name]           resize (expand or contract) image\n"
        << "  rm [image-name]                           delete an image\n"
@@ -97,6 +100,10 @@ void usage()
        << "  --size <size in MB>          size parameter for create and resize commands\n"
        << "  --order <bits>               the object size in bits, such that the objects\n"
        << "                               are (1 << order) bytes. Default is 22 (4 MB).\n"
+       << "  --stripe-unit <bytes>        for create and import, stripe the image over\n"
+       << "  --stripe-count <num>         stripe-count objects, stripe-unit bytes to each\n"
+       << "                               in turn.  Default is one object at a time, so\n"
+       << "                               the image stays usable by older clients.\n"
        << "\n"
        << "For the map command:\n"
        << "  --user <username>            rados user to authenticate as\n"
@@ -110,7 +117,8 @@ void usage_exit()
   exit(1);
 }
 
-static void print_info(const char *imgname, librbd::image_info_t& info)
+static void print_info(const char *imgname, librbd::image_info_t& info,
+		       uint64_t stripe_unit, uint64_t stripe_count)
 {
   cout << "rbd image '" << imgname << "':\n"
        << "\tsize " << prettybyte_t(info.size) << " in "
@@ -124,6 +132,9 @@ static void print_info(const char *imgname, librbd::image_info_t& info)
        << "\tparent: " << info.parent_name
        << " (pool " << info.parent_pool << ")"
        << std::endl;
+  if (stripe_unit != info.obj_size || stripe_count != 1)
+    cout << "\tstripe unit: " << prettybyte_t(stripe_unit) << std::endl
+	 << "\tstripe count: " << stripe_count << std::endl;
 }
 
 struct MyProgressContext : public librbd::ProgressContext {
@@ -165,9 +176,11 @@ static int do_list(librbd::RBD &rbd, librados::IoCtx& io_ctx)
 }
 
 static int do_create(librbd::RBD &rbd, librados::IoCtx& io_ctx,
-		     const char *imgname, uint64_t size, int *order)
+		     const char *imgname, uint64_t size, int *order,
+		     uint64_t stripe_unit, uint64_t stripe_count)
 {
-  int r = rbd.create(io_ctx, imgname, size, order);
+  int r = rbd.create_striped(io_ctx, imgname, size, order,
+			     stripe_unit, stripe_count);
   if (r < 0)
     return r;
   return 0;
@@ -186,10 +199,33 @@ static int do_show_info(const char *imgname, librbd::Image& image)
 {
   librbd::image_info_t info;
   int r = image.stat(info, sizeof(info));
+  if (r < 0)
+    return r;
+  uint64_t stripe_unit, stripe_count;
+  r = image.get_stripe_unit(&stripe_unit);
+  if (r < 0)
+    return r;
+  r = image.get_stripe_count(&stripe_count);
+  if (r < 0)
+    return r;
+
+  print_info(imgname, info, stripe_unit, stripe_count);
+  return 0;
+}
+
+static int do_du(const char *imgname, librbd::Image& image)
+{
+  librbd::image_info_t info;
+  int r = image.stat(info, sizeof(info));
+  if (r < 0)
+    return r;
+  uint64_t used;
+  r = image.used_size(&used);
   if (r < 0)
     return r;
 
-  print_info(imgname, info);
+  cout << imgname << ": " << prettybyte_t(used) << " used of "
+       << prettybyte_t(info.size) << std::endl;
   return 0;
 }
 
@@ -279,31 +315,35 @@ static int do_purge_snaps(librbd::Image& image)
   return 0;
 }
 
+static bool buf_is_zero(const char *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    if (buf[i])
+      return false;
+  return true;
+}
+
 struct ExportContext {
   int fd;
+  uint64_t totalsize;
   MyProgressContext pc;
 
-  ExportContext(int f) : fd(f), pc("Exporting image") {}
+  ExportContext(int f, uint64_t t) : fd(f), totalsize(t), pc("Exporting image") {}
 };
 
 static int export_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
 {
-  ssize_t ret;
   ExportContext *ec = (ExportContext *)arg;
   int fd = ec->fd;
 
-  if (!buf) /* a hole */
-    return 0;
+  ec->pc.update_progress(ofs, ec->totalsize);
 
-  ret = lseek64(fd, ofs, SEEK_SET);
-  if (ret < 0)
-    return -errno;
-  ret = write(fd, buf, len);
-  if (ret < 0)
-    return -errno;
+  /* a hole, or zeroes; the file is extended to full size at the end,
+   * so leaving these unwritten keeps the export sparse */
+  if (!buf || buf_is_zero(buf, len))
+    return 0;
 
-  cerr << "writing " << len << " bytes at ofs " << ofs << std::endl;
-  return 0;
+  return safe_pwrite(fd, buf, len, ofs);
 }
 
 static int do_export(librbd::Image& image, const char *path)
@@ -320,7 +360,8 @@ static int do_export(librbd::Image& image, const char *path)
   if (fd < 0)
     return -errno;
 
-  ExportContext ec(fd);
+  // librbd keeps rbd_concurrent_management_ops objects' reads in flight
+  ExportContext ec(fd, info.size);
   r = image.read_iterate(0, info.size, export_read_cb, (void *)&ec);
   if (r < 0)
     goto out;
@@ -400,8 +441,18 @@ done_img:
   update_snap_name(*new_img, snap);
 }
 
+static void import_write_cb(librbd::completion_t cb, void *arg)
+{
+  librbd::RBD::AioCompletion *completion = (librbd::RBD::AioCompletion *)cb;
+  SimpleThrottle *throttle = (SimpleThrottle *)arg;
+  int r = completion->get_return_value();
+  completion->release();
+  throttle->end_op(r);
+}
+
 static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
-		     const char *imgname, int *order, const char *path)
+		     const char *imgname, int *order, const char *path,
+		     uint64_t stripe_unit, uint64_t stripe_count)
 {
   int fd = open(path, O_RDONLY);
   int r;
@@ -430,7 +481,7 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
   md_oid = imgname;
   md_oid += RBD_SUFFIX;
 
-  r = do_create(rbd, io_ctx, imgname, size, order);
+  r = do_create(rbd, io_ctx, imgname, size, order, stripe_unit, stripe_count);
   if (r < 0) {
     cerr << "image creation failed" << std::endl;
     return r;
@@ -441,6 +492,11 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     cerr << "failed to open image" << std::endl;
     return r;
   }
+
+  // writes are issued one object at a time, several objects in flight
+  SimpleThrottle throttle(g_conf->rbd_concurrent_management_ops, false);
+  uint64_t object_size = 1ull << *order;
+
   fsync(fd); /* flush it first, otherwise extents information might not have been flushed yet */
   fiemap = read_fiemap(fd);
   if (fiemap && !fiemap->fm_mapped_extents) {
@@ -509,21 +565,31 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
           goto done;
         }
         bufferlist bl;
-        bl.append(p);
-        librbd::RBD::AioCompletion *completion = new librbd::RBD::AioCompletion(NULL, NULL);
-        if (!completion) {
-          r = -ENOMEM;
-          goto done;
-        }
-        r = image.aio_write(file_pos, len, bl, completion);
-        if (r < 0)
-          goto done;
-	completion->wait_for_complete();
-	r = completion->get_return_value();
-	completion->release();
-        if (r < 0) {
-          cerr << "error writing to image block" << std::endl;
-          goto done;
+        bl.append(p, 0, len);
+
+        /* split at object boundaries, and leave all-zero pieces as holes */
+        uint64_t bl_off = 0;
+        while (bl_off < len) {
+          uint64_t obj_off = (file_pos + bl_off) & (object_size - 1);
+          uint64_t piece = MIN(len - bl_off, object_size - obj_off);
+          if (!buf_is_zero(p.c_str() + bl_off, piece)) {
+            bufferlist piece_bl;
+            piece_bl.substr_of(bl, bl_off, piece);
+            librbd::RBD::AioCompletion *completion =
+              new librbd::RBD::AioCompletion(&throttle, import_write_cb);
+            throttle.start_op();
+            r = image.aio_write(file_pos + bl_off, piece, piece_bl, completion);
+            if (r < 0) {
+              completion->release();
+              throttle.end_op(r);
+            }
+          }
+          r = throttle.get_ret();
+          if (r < 0) {
+            cerr << "error writing to image block: " << cpp_strerror(r) << std::endl;
+            goto done;
+          }
+          bl_off += piece;
         }
 
         file_pos += len;
@@ -536,6 +602,13 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
   r = 0;
 
  done:
+  {
+    int ret = throttle.wait_for_ret();
+    if (r == 0 && ret < 0) {
+      cerr << "error writing to image block: " << cpp_strerror(ret) << std::endl;
+      r = ret;
+    }
+  }
   if (r < 0)
     pc.fail();
   else
@@ -824,6 +897,7 @@ enum {
   OPT_NO_CMD = 0,
   OPT_LIST,
   OPT_INFO,
+  OPT_DU,
   OPT_CREATE,
   OPT_RESIZE,
   OPT_RM,
@@ -850,6 +924,8 @@ static int get_cmd(const char *cmd, bool snapcmd)
       return OPT_LIST;
     if (strcmp(cmd, "info") == 0)
       return OPT_INFO;
+    if (strcmp(cmd, "du") == 0)
+      return OPT_DU;
     if (strcmp(cmd, "create") == 0)
       return OPT_CREATE;
     if (strcmp(cmd, "resize") == 0)
@@ -923,11 +999,12 @@ int main(int argc, const char **argv)
   const char *poolname = NULL;
   uint64_t size = 0;  // in bytes
   int order = 0;
+  uint64_t stripe_unit = 0, stripe_count = 0;
   const char *imgname = NULL, *snapname = NULL, *destname = NULL, *dest_poolname = NULL, *path = NULL, *secretfile = NULL, *user = NULL, *devpath = NULL;
 
   std::string val;
   std::ostringstream err;
-  long long sizell = 0;
+  long long sizell = 0, stripell = 0;
   std::vector<const char*>::iterator i;
   for (i = args.begin(); i != args.end(); ) {
     if (ceph_argparse_double_dash(args, i)) {
@@ -954,6 +1031,18 @@ int main(int argc, const char **argv)
 	cerr << err.str() << std::endl;
 	exit(EXIT_FAILURE);
       }
+    } else if (ceph_argparse_withlonglong(args, i, &stripell, &err, "--stripe-unit", (char*)NULL)) {
+      if (!err.str().empty() || stripell <= 0) {
+	cerr << "invalid stripe unit " << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      stripe_unit = stripell;
+    } else if (ceph_argparse_withlonglong(args, i, &stripell, &err, "--stripe-count", (char*)NULL)) {
+      if (!err.str().empty() || stripell <= 0) {
+	cerr << "invalid stripe count " << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      stripe_count = stripell;
     } else if (ceph_argparse_witharg(args, i, &val, "--path", (char*)NULL)) {
       path = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--dest", (char*)NULL)) {
@@ -995,6 +1084,7 @@ int main(int argc, const char **argv)
 	set_conf_param(v, &poolname, NULL);
 	break;
       case OPT_INFO:
+      case OPT_DU:
       case OPT_CREATE:
       case OPT_RESIZE:
       case OPT_RM:
@@ -1056,7 +1146,7 @@ int main(int argc, const char **argv)
 		      (char **)&imgname, (char **)&snapname);
   if (snapname && opt_cmd != OPT_SNAP_CREATE && opt_cmd != OPT_SNAP_ROLLBACK &&
       opt_cmd != OPT_SNAP_REMOVE && opt_cmd != OPT_INFO &&
-      opt_cmd != OPT_EXPORT && opt_cmd != OPT_COPY &&
+      opt_cmd != OPT_DU && opt_cmd != OPT_EXPORT && opt_cmd != OPT_COPY &&
       opt_cmd != OPT_MAP) {
     cerr << "error: snapname specified for a command that doesn't use it" << std::endl;
     usage_exit();
@@ -1105,7 +1195,8 @@ int main(int argc, const char **argv)
   }
 
   if (imgname && talk_to_cluster &&
-      (opt_cmd == OPT_RESIZE || opt_cmd == OPT_INFO || opt_cmd == OPT_SNAP_LIST ||
+      (opt_cmd == OPT_RESIZE || opt_cmd == OPT_INFO || opt_cmd == OPT_DU ||
+       opt_cmd == OPT_SNAP_LIST ||
        opt_cmd == OPT_SNAP_CREATE || opt_cmd == OPT_SNAP_ROLLBACK ||
        opt_cmd == OPT_SNAP_REMOVE || opt_cmd == OPT_SNAP_PURGE ||
        opt_cmd == OPT_EXPORT || opt_cmd == OPT_WATCH || opt_cmd == OPT_COPY)) {
@@ -1117,7 +1208,8 @@ int main(int argc, const char **argv)
   }
 
   if (snapname && talk_to_cluster &&
-      (opt_cmd == OPT_INFO || opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY)) {
+      (opt_cmd == OPT_INFO || opt_cmd == OPT_DU || opt_cmd == OPT_EXPORT ||
+       opt_cmd == OPT_COPY)) {
     r = image.snap_set(snapname);
     if (r < 0) {
       cerr << "error setting snapshot context: " << cpp_strerror(-r) << std::endl;
@@ -1159,7 +1251,7 @@ int main(int argc, const char **argv)
       usage();
       exit(1);
     }
-    r = do_create(rbd, io_ctx, imgname, size, &order);
+    r = do_create(rbd, io_ctx, imgname, size, &order, stripe_unit, stripe_count);
     if (r < 0) {
       cerr << "create error: " << cpp_strerror(-r) << std::endl;
       exit(1);
@@ -1182,6 +1274,14 @@ int main(int argc, const char **argv)
     }
     break;
 
+  case OPT_DU:
+    r = do_du(imgname, image);
+    if (r < 0) {
+      cerr << "error: " << cpp_strerror(-r) << std::endl;
+      exit(1);
+    }
+    break;
+
   case OPT_RM:
     r = do_delete(rbd, io_ctx, imgname);
     if (r < 0) {
@@ -1281,7 +1381,8 @@ int main(int argc, const char **argv)
       cerr << "pathname should be specified" << std::endl;
       exit(1);
     }
-    r = do_import(rbd, dest_io_ctx, destname, &order, path);
+    r = do_import(rbd, dest_io_ctx, destname, &order, path,
+		  stripe_unit, stripe_count);
     if (r < 0) {
       cerr << "import failed: " << cpp_strerror(-r) << std::endl;
       exit(1);
@@ -60,7 +60,7 @@ public:
 
   void finish_get_obj(void **handle);
   int read(void *ctx, rgw_obj& obj, off_t ofs, size_t size, bufferlist& bl);
-  int obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime, map<string, bufferlist> *attrs, bufferlist *prefetch_data);
+  int obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime, uint64_t *epoch, map<string, bufferlist> *attrs, bufferlist *prefetch_data);
 
   virtual int get_bucket_info(void *ctx, string& bucket_name, RGWBucketInfo& info);
   virtual int put_bucket_info(string& bucket_name, RGWBucketInfo& info, bool exclusive);
@@ -820,12 +820,18 @@ int RGWRados::copy_obj(void *ctx,
                struct rgw_err *err)
 {
   int ret, r;
-  char *data;
   uint64_t total_len, obj_size;
   time_t lastmod;
   map<string, bufferlist>::iterator iter;
   rgw_obj tmp_obj = dest_obj;
   string tmp_oid;
+  rgw_bucket bucket;
+  string src_oid, src_key, tmp_raw_oid, tmp_key;
+  librados::IoCtx src_ctx, tmp_ctx;
+  ObjectWriteOperation copy_op;
+  RGWRadosCtx *rctx = (RGWRadosCtx *)ctx;
+  RGWRadosCtx src_rctx;
+  uint64_t src_ver;
 
   append_rand_alpha(dest_obj.object, tmp_oid, 32);
   tmp_obj.set_obj(tmp_oid);
@@ -840,26 +846,37 @@ int RGWRados::copy_obj(void *ctx,
   map<string, bufferlist> attrset;
   off_t ofs = 0;
   off_t end = -1;
-  ret = prepare_get_obj(ctx, src_obj, &ofs, &end, &attrset,
+  if (!rctx)
+    rctx = &src_rctx;
+  ret = prepare_get_obj(rctx, src_obj, &ofs, &end, &attrset,
                 mod_ptr, unmod_ptr, &lastmod, if_match, if_nomatch, &total_len, &obj_size, &handle, err);
 
   if (ret < 0)
     return ret;
 
-  do {
-    ret = get_obj(ctx, &handle, src_obj, &data, ofs, end);
-    if (ret < 0)
-      return ret;
+  // copy the version we just checked the conditions and attrs against
+  src_ver = rctx->get_state(src_obj)->epoch;
 
-    // In the first call to put_obj_data, we pass ofs == -1 so that it will do
-    // a write_full, wiping out whatever was in the object before this
-    r = put_obj_data(ctx, tmp_obj, data, ((ofs == 0) ? -1 : ofs), ret, false);
-    free(data);
-    if (r < 0)
-      goto done_err;
+  // have the osd pull the source data into the temp object directly,
+  // rather than reading it back here and writing it out again
+  get_obj_bucket_and_oid_key(src_obj, bucket, src_oid, src_key);
+  r = open_bucket_ctx(bucket, src_ctx);
+  if (r < 0)
+    goto done_err;
+  src_ctx.locator_set_key(src_key);
 
-    ofs += ret;
-  } while (ofs <= end);
+  get_obj_bucket_and_oid_key(tmp_obj, bucket, tmp_raw_oid, tmp_key);
+  r = open_bucket_ctx(bucket, tmp_ctx);
+  if (r < 0)
+    goto done_err;
+  tmp_ctx.locator_set_key(tmp_key);
+
+  copy_op.copy_from(src_oid, src_ctx, src_ver);
+  r = tmp_ctx.operate(tmp_raw_oid, &copy_op);
+  if (r < 0) {
+    dout(0) << "ERROR: copy_from " << src_obj << " => " << tmp_obj << " returned " << r << dendl;
+    goto done_err;
+  }
 
   for (iter = attrs.begin(); iter != attrs.end(); ++iter) {
     attrset[iter->first] = iter->second;
@@ -868,7 +885,7 @@ int RGWRados::copy_obj(void *ctx,
 
   ret = clone_obj(ctx, dest_obj, 0, tmp_obj, 0, end + 1, NULL, attrs, category);
   if (mtime)
-    obj_stat(ctx, tmp_obj, NULL, mtime, NULL, NULL);
+    obj_stat(ctx, tmp_obj, NULL, mtime, NULL, NULL, NULL);
 
   r = rgwstore->delete_obj(ctx, tmp_obj, false);
   if (r < 0)
@@ -1059,7 +1076,7 @@ int RGWRados::get_obj_state(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io
   if (s->has_attrs)
     return 0;
 
-  int r = obj_stat(rctx, obj, &s->size, &s->mtime, &s->attrset, (s->prefetch_data ? &s->data : NULL));
+  int r = obj_stat(rctx, obj, &s->size, &s->mtime, &s->epoch, &s->attrset, (s->prefetch_data ? &s->data : NULL));
   if (r == -ENOENT) {
     s->exists = false;
     s->has_attrs = true;
@@ -1782,7 +1799,7 @@ int RGWRados::read(void *ctx, rgw_obj& obj, off_t ofs, size_t size, bufferlist&
   return r;
 }
 
-int RGWRados::obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime, map<string, bufferlist> *attrs, bufferlist *first_chunk)
+int RGWRados::obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime, uint64_t *epoch, map<string, bufferlist> *attrs, bufferlist *first_chunk)
 {
   rgw_bucket bucket;
   std::string oid, key;
@@ -1813,6 +1830,8 @@ int RGWRados::obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime,
     *psize = size;
   if (pmtime)
     *pmtime = mtime;
+  if (epoch)
+    *epoch = io_ctx.get_last_version();
   if (attrs)
     *attrs = attrset;
 
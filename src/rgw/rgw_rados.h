@@ -17,6 +17,7 @@ struct RGWObjState {
   bool exists;
   uint64_t size;
   time_t mtime;
+  uint64_t epoch;
   bufferlist obj_tag;
   string shadow_obj;
   bool has_data;
@@ -24,7 +25,7 @@ struct RGWObjState {
   bool prefetch_data;
 
   map<string, bufferlist> attrset;
-  RGWObjState() : is_atomic(false), has_attrs(0), exists(false), prefetch_data(false) {}
+  RGWObjState() : is_atomic(false), has_attrs(0), exists(false), epoch(0), prefetch_data(false) {}
 
   bool get_attr(string name, bufferlist& dest) {
     map<string, bufferlist>::iterator iter = attrset.find(name);
@@ -40,6 +41,7 @@ struct RGWObjState {
     exists = false;
     size = 0;
     mtime = 0;
+    epoch = 0;
     obj_tag.clear();
     shadow_obj.clear();
     attrset.clear();
@@ -285,7 +287,7 @@ public:
 
   virtual int read(void *ctx, rgw_obj& obj, off_t ofs, size_t size, bufferlist& bl);
 
-  virtual int obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime, map<string, bufferlist> *attrs, bufferlist *first_chunk);
+  virtual int obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime, uint64_t *epoch, map<string, bufferlist> *attrs, bufferlist *first_chunk);
 
   virtual bool supports_tmap() { return true; }
   virtual int tmap_get(rgw_obj& obj, bufferlist& header, std::map<string, bufferlist>& m);
@@ -481,6 +481,47 @@ TEST_F(ObjectMapTest, CloneOneObject) {
   db->clear(hoid2, path);
 }
 
+TEST_F(ObjectMapTest, InlineData) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  CollectionIndex::IndexedPath path = CollectionIndex::get_testing_path(
+    "/bar", coll_t("foo_coll"));
+
+  bufferlist data, got;
+  data.append("inline");
+  ASSERT_EQ(0, db->get_inline_data(hoid, path, &got));
+  ASSERT_EQ(0u, got.length());
+  ASSERT_EQ(0, db->set_inline_data(hoid, path, data));
+  set_key(hoid, path, "foo", "bar");
+  ASSERT_EQ(0, db->get_inline_data(hoid, path, &got));
+  ASSERT_EQ(string("inline"), string(got.c_str(), got.length()));
+
+  // a clone sees the data; dropping it on one side leaves the other
+  db->clone_keys(hoid, path, hoid2, path);
+  got.clear();
+  ASSERT_EQ(0, db->get_inline_data(hoid2, path, &got));
+  ASSERT_EQ(string("inline"), string(got.c_str(), got.length()));
+  ASSERT_EQ(0, db->set_inline_data(hoid, path, bufferlist()));
+  got.clear();
+  ASSERT_EQ(0, db->get_inline_data(hoid, path, &got));
+  ASSERT_EQ(0u, got.length());
+  got.clear();
+  ASSERT_EQ(0, db->get_inline_data(hoid2, path, &got));
+  ASSERT_EQ(string("inline"), string(got.c_str(), got.length()));
+
+  // and it survives the clone losing its parent
+  remove_key(hoid2, path, "foo");
+  got.clear();
+  ASSERT_EQ(0, db->get_inline_data(hoid2, path, &got));
+  ASSERT_EQ(string("inline"), string(got.c_str(), got.length()));
+
+  db->clear(hoid, path);
+  db->clear(hoid2, path);
+  got.clear();
+  ASSERT_EQ(0, db->get_inline_data(hoid2, path, &got));
+  ASSERT_EQ(0u, got.length());
+}
+
 TEST_F(ObjectMapTest, OddEvenClone) {
   hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
   hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
@@ -4,4 +4,6 @@
      --export-crush <file>   write osdmap's crush map to <file>
      --import-crush <file>   replace osdmap's crush map with <file>
      --test-map-pg <pgid>    map a pgid to osds
+     --test-map-pgs          build the pg mapping table and check it against crush
+     --mapping-threads <n>   threads to build the pg mapping table with
   [1]
@@ -0,0 +1,13 @@
+  $ osdmaptool --createsimple 40 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  osdmaptool: writing epoch 1 to myosdmap
+
+  $ osdmaptool --test-map-pgs myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  pg mapping table: 7680 pgs, \d+ bytes, built in \d+\.\d+ with 1 threads (re)
+  mapped 7680 pgs: crush \d+\.\d+, table \d+\.\d+ (re)
+
+  $ osdmaptool --test-map-pgs --mapping-threads 4 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  pg mapping table: 7680 pgs, \d+ bytes, built in \d+\.\d+ with 4 threads (re)
+  mapped 7680 pgs: crush \d+\.\d+, table \d+\.\d+ (re)
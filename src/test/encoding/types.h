@@ -41,6 +41,7 @@ TYPE(pg_pool_t)
 TYPE(object_stat_sum_t)
 TYPE(object_stat_collection_t)
 TYPE(pg_stat_t)
+TYPE(pg_stat_delta_t)
 TYPE(pool_stat_t)
 TYPE(pg_history_t)
 TYPE(pg_info_t)
@@ -56,6 +57,8 @@ TYPE(object_info_t)
 TYPE(SnapSet)
 TYPE(ObjectRecoveryInfo)
 TYPE(ObjectRecoveryProgress)
+TYPE(object_copy_cursor_t)
+TYPE(object_copy_data_t)
 TYPE(ScrubMap::object)
 TYPE(ScrubMap)
 TYPE(osd_peer_stat_t)
@@ -256,6 +259,8 @@ MESSAGE(MOSDScrub)
 MESSAGE(MOSDSubOp)
 #include "messages/MOSDSubOpReply.h"
 MESSAGE(MOSDSubOpReply)
+#include "messages/MOSDSubOpBatch.h"
+MESSAGE(MOSDSubOpBatch)
 #include "messages/MPGStats.h"
 MESSAGE(MPGStats)
 #include "messages/MPGStatsAck.h"
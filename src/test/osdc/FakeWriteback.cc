@@ -0,0 +1,42 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "common/debug.h"
+#include "FakeWriteback.h"
+
+#define DOUT_SUBSYS objectcacher
+#undef dout_prefix
+#define dout_prefix *_dout << "FakeWriteback "
+
+FakeWriteback::FakeWriteback(CephContext *cct, Mutex *lock, double delay)
+  : cct(cct), lock(lock), timer(cct, *lock), delay(delay), last_tid(0)
+{
+  timer.init();
+}
+
+FakeWriteback::~FakeWriteback()
+{
+  lock->Lock();
+  timer.shutdown();
+  lock->Unlock();
+}
+
+void FakeWriteback::read(const object_t& oid, const object_locator_t& oloc,
+			 loff_t off, uint64_t len, snapid_t snapid,
+			 bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+			 Context *onfinish)
+{
+  ldout(cct, 20) << "read " << oid << " " << off << "~" << len << dendl;
+  timer.add_event_after(delay, onfinish);
+}
+
+tid_t FakeWriteback::write(const object_t& oid, const object_locator_t& oloc,
+			   loff_t off, uint64_t len, const SnapContext& snapc,
+			   const bufferlist &bl, utime_t mtime,
+			   uint64_t trunc_size, __u32 trunc_seq,
+			   Context *oncommit)
+{
+  ldout(cct, 20) << "write " << oid << " " << off << "~" << len << dendl;
+  timer.add_event_after(delay, oncommit);
+  return ++last_tid;
+}
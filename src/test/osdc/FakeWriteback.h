@@ -0,0 +1,41 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_TEST_OSDC_FAKEWRITEBACK_H
+#define CEPH_TEST_OSDC_FAKEWRITEBACK_H
+
+#include "common/Mutex.h"
+#include "common/Timer.h"
+#include "osdc/WritebackHandler.h"
+
+/*
+ * WritebackHandler that completes every read and write after a fixed
+ * delay without going anywhere.  Reads come back as holes.
+ *
+ * Completions run from a SafeTimer on the cache lock, and all ops take
+ * the same delay, so commits for an object arrive in tid order.
+ */
+class FakeWriteback : public WritebackHandler {
+public:
+  FakeWriteback(CephContext *cct, Mutex *lock, double delay);
+  virtual ~FakeWriteback();
+
+  virtual void read(const object_t& oid, const object_locator_t& oloc,
+		    loff_t off, uint64_t len, snapid_t snapid,
+		    bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+		    Context *onfinish);
+
+  virtual tid_t write(const object_t& oid, const object_locator_t& oloc,
+		      loff_t off, uint64_t len, const SnapContext& snapc,
+		      const bufferlist &bl, utime_t mtime,
+		      uint64_t trunc_size, __u32 trunc_seq,
+		      Context *oncommit);
+
+private:
+  CephContext *cct;
+  Mutex *lock;
+  SafeTimer timer;
+  double delay;
+  tid_t last_tid;
+};
+
+#endif
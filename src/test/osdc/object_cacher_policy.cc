@@ -0,0 +1,122 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Replay a hot working set interleaved with a one-pass scan against the
+ * ObjectCacher, and check how much of the working set each clean-data
+ * replacement policy keeps.
+ */
+
+#include <sstream>
+
+#include "common/config.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "osdc/ObjectCacher.h"
+#include "test/unit.h"
+
+#include "FakeWriteback.h"
+
+static const uint64_t CHUNK = 64 << 10;
+static const uint64_t CACHE_SIZE = 16 * CHUNK;
+static const int WORKING_SET = 10;  // chunks
+
+class C_Done : public Context {
+  Cond *cond;
+  bool *done;
+public:
+  C_Done(Cond *c, bool *d) : cond(c), done(d) {
+    *done = false;
+  }
+  void finish(int r) {
+    *done = true;
+    cond->Signal();
+  }
+};
+
+// true if the read was served from cache
+static bool cache_read(ObjectCacher& oc, ObjectCacher::ObjectSet& oset,
+		       Mutex& lock, const string& oid, uint64_t off)
+{
+  ObjectExtent ex(object_t(oid), off, CHUNK);
+  ex.oloc = object_locator_t(oset.poolid);
+  ex.buffer_extents[0] = CHUNK;
+
+  bufferlist bl;
+  ObjectCacher::OSDRead *rd = oc.prepare_read(CEPH_NOSNAP, &bl, 0);
+  rd->extents.push_back(ex);
+
+  Mutex::Locker l(lock);
+  Cond cond;
+  bool done;
+  Context *onfinish = new C_Done(&cond, &done);
+  if (oc.readx(rd, &oset, onfinish) > 0) {
+    delete onfinish;
+    return true;
+  }
+  while (!done)
+    cond.Wait(lock);
+  return false;
+}
+
+/*
+ * each working-set access is followed by a chunk of a scan that never
+ * comes back.  the working set's reuse distance (in chunks) is larger
+ * than the cache, so plain lru loses all of it to the scan.  chunks are
+ * spaced out so the cache can't merge them into larger bhs.
+ */
+static void set_policy(const char *policy)
+{
+  md_config_t *conf = g_ceph_context->_conf;
+  std::ostringstream size;
+  size << CACHE_SIZE;
+
+  // string options can only be changed before threads start
+  ASSERT_EQ(0, conf->set_val("internal_safe_to_start_threads", "false"));
+  ASSERT_EQ(0, conf->set_val("client_oc_policy", policy));
+  ASSERT_EQ(0, conf->set_val("client_oc_size", size.str().c_str()));
+  conf->apply_changes(NULL);
+  ASSERT_EQ(0, conf->set_val("internal_safe_to_start_threads", "true"));
+}
+
+static int replay(const string& name)
+{
+
+  Mutex lock("object_cacher_policy::lock");
+  FakeWriteback writeback(g_ceph_context, &lock, 0);
+  ObjectCacher oc(g_ceph_context, name, writeback, lock, NULL, NULL);
+  ObjectCacher::ObjectSet oset(NULL, 0, 0);
+  oc.start();
+
+  int scan = 0;
+  int hits = 0;
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < WORKING_SET; ++i) {
+      bool hit = cache_read(oc, oset, lock, "working_set", i * 2 * CHUNK);
+      if (round >= 10 && hit)
+	hits++;
+
+      std::ostringstream oss;
+      oss << "scan_" << scan / 64;
+      cache_read(oc, oset, lock, oss.str(), (scan % 64) * 2 * CHUNK);
+      scan++;
+    }
+  }
+
+  lock.Lock();
+  oc.release_set(&oset);
+  lock.Unlock();
+  oc.stop();
+  return hits;
+}
+
+TEST(ObjectCacherPolicy, ScanResistance) {
+  int total = 10 * WORKING_SET;
+  set_policy("lru");
+  int lru_hits = replay("policy_lru");
+  set_policy("2q");
+  int twoq_hits = replay("policy_2q");
+
+  ASSERT_EQ(0, lru_hits);
+  ASSERT_GT(twoq_hits, total * 9 / 10);
+}
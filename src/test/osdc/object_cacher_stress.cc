@@ -0,0 +1,247 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Drive an ObjectCacher against a FakeWriteback with a configurable mix
+ * of random and sequential reads and writes from several threads, and
+ * report throughput and read hit ratio.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "common/ceph_argparse.h"
+#include "common/config.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "global/global_init.h"
+#include "include/atomic.h"
+#include "osdc/ObjectCacher.h"
+
+#include "FakeWriteback.h"
+
+using std::cerr;
+using std::cout;
+
+struct stress_config_t {
+  int ops;
+  int threads;
+  int num_objs;
+  uint64_t obj_size;
+  uint64_t max_op_len;
+  int percent_reads;
+  int percent_sequential;
+  double delay;
+};
+
+struct stress_stats_t {
+  atomic_t reads, read_hits, writes;
+  atomic_t bytes_read, bytes_written;
+};
+
+// called with the cache lock held
+class C_Done : public Context {
+  Cond *cond;
+  bool *done;
+public:
+  C_Done(Cond *c, bool *d) : cond(c), done(d) {
+    *done = false;
+  }
+  void finish(int r) {
+    *done = true;
+    cond->Signal();
+  }
+};
+
+class StressThread : public Thread {
+  const stress_config_t& conf;
+  stress_stats_t& stats;
+  ObjectCacher& cache;
+  ObjectCacher::ObjectSet& oset;
+  Mutex& lock;
+  unsigned seed;
+
+public:
+  StressThread(const stress_config_t& c, stress_stats_t& s, ObjectCacher& oc,
+	       ObjectCacher::ObjectSet& os, Mutex& l, unsigned sd)
+    : conf(c), stats(s), cache(oc), oset(os), lock(l), seed(sd) {}
+
+  void *entry() {
+    int obj = 0;
+    uint64_t pos = 0;
+    bufferptr bp(conf.max_op_len);
+    bp.zero();
+
+    for (int i = 0; i < conf.ops; ++i) {
+      uint64_t len = 1 + rand_r(&seed) % conf.max_op_len;
+      if ((int)(rand_r(&seed) % 100) < conf.percent_sequential) {
+	// continue this thread's stream, moving on to the next object
+	// when we run off the end of this one
+	if (pos + len > conf.obj_size) {
+	  obj = (obj + 1) % conf.num_objs;
+	  pos = 0;
+	}
+      } else {
+	obj = rand_r(&seed) % conf.num_objs;
+	pos = rand_r(&seed) % conf.obj_size;
+      }
+      if (pos + len > conf.obj_size)
+	len = conf.obj_size - pos;
+
+      std::ostringstream oss;
+      oss << "stress_" << obj;
+      ObjectExtent ex(object_t(oss.str()), pos, len);
+      ex.oloc = object_locator_t(oset.poolid);
+      ex.buffer_extents[0] = len;
+      pos += len;
+
+      Mutex::Locker l(lock);
+      if ((int)(rand_r(&seed) % 100) < conf.percent_reads) {
+	bufferlist bl;
+	ObjectCacher::OSDRead *rd = cache.prepare_read(CEPH_NOSNAP, &bl, 0);
+	rd->extents.push_back(ex);
+	Cond cond;
+	bool done;
+	Context *onfinish = new C_Done(&cond, &done);
+	int r = cache.readx(rd, &oset, onfinish);
+	if (r > 0) {
+	  stats.read_hits.inc();
+	  delete onfinish;
+	} else {
+	  while (!done)
+	    cond.Wait(lock);
+	}
+	stats.reads.inc();
+	stats.bytes_read.add(len);
+      } else {
+	bufferlist bl;
+	bl.append(bp.c_str(), len);
+	ObjectCacher::OSDWrite *wr = cache.prepare_write(SnapContext(), bl,
+							 utime_t(), 0);
+	wr->extents.push_back(ex);
+	cache.wait_for_write(len, lock);
+	cache.writex(wr, &oset);
+	stats.writes.inc();
+	stats.bytes_written.add(len);
+      }
+    }
+    return 0;
+  }
+};
+
+static void usage()
+{
+  cerr << "usage: test_objectcacher_stress [options]\n"
+       << "  --ops N                   ops per thread (default 1000)\n"
+       << "  --threads N               concurrent streams (default 1)\n"
+       << "  --objects N               objects to spread ops over (default 10)\n"
+       << "  --object-size BYTES       (default 4MB)\n"
+       << "  --max-op-size BYTES       (default 64KB)\n"
+       << "  --percent-read N          (default 50)\n"
+       << "  --percent-sequential N    ops continuing a stream rather than seeking (default 0)\n"
+       << "  --delay SECONDS           simulated backend latency (default 0.001)\n"
+       << "cache limits come from the usual client_oc_* options\n";
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  stress_config_t conf;
+  conf.ops = 1000;
+  conf.threads = 1;
+  conf.num_objs = 10;
+  conf.obj_size = 4 << 20;
+  conf.max_op_len = 64 << 10;
+  conf.percent_reads = 50;
+  conf.percent_sequential = 0;
+  conf.delay = .001;
+
+  std::string val;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--ops", (char*)NULL)) {
+      conf.ops = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--threads", (char*)NULL)) {
+      conf.threads = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--objects", (char*)NULL)) {
+      conf.num_objs = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--object-size", (char*)NULL)) {
+      conf.obj_size = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--max-op-size", (char*)NULL)) {
+      conf.max_op_len = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--percent-read", (char*)NULL)) {
+      conf.percent_reads = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--percent-sequential", (char*)NULL)) {
+      conf.percent_sequential = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--delay", (char*)NULL)) {
+      conf.delay = strtod(val.c_str(), NULL);
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  if (conf.ops <= 0 || conf.threads <= 0 || conf.num_objs <= 0 ||
+      conf.obj_size == 0 || conf.max_op_len == 0 ||
+      conf.max_op_len > conf.obj_size) {
+    usage();
+    return 1;
+  }
+
+  Mutex lock("object_cacher_stress::lock");
+  FakeWriteback writeback(g_ceph_context, &lock, conf.delay);
+  ObjectCacher cache(g_ceph_context, "stress", writeback, lock, NULL, NULL);
+  ObjectCacher::ObjectSet oset(NULL, 0, 0);
+  stress_stats_t stats;
+  cache.start();
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  vector<StressThread*> threads;
+  for (int i = 0; i < conf.threads; ++i) {
+    threads.push_back(new StressThread(conf, stats, cache, oset, lock, i + 1));
+    threads.back()->create();
+  }
+  for (int i = 0; i < conf.threads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  utime_t ops_done = ceph_clock_now(g_ceph_context);
+
+  // drain dirty data so the flush time is part of the picture
+  lock.Lock();
+  Cond cond;
+  bool done;
+  Context *onfinish = new C_Done(&cond, &done);
+  if (cache.flush_set(&oset, onfinish))
+    delete onfinish;
+  else
+    while (!done)
+      cond.Wait(lock);
+  cache.release_set(&oset);
+  lock.Unlock();
+  cache.stop();
+  utime_t end = ceph_clock_now(g_ceph_context);
+
+  double elapsed = end - start;
+  uint64_t total_ops = stats.reads.read() + stats.writes.read();
+  uint64_t total_bytes = stats.bytes_read.read() + stats.bytes_written.read();
+  cout << "ops " << total_ops << " (" << stats.reads.read() << " reads, "
+       << stats.writes.read() << " writes)\n"
+       << "ops time " << (double)(ops_done - start)
+       << "s, flush time " << (double)(end - ops_done) << "s\n"
+       << "throughput " << (double)total_ops / elapsed << " ops/s, "
+       << (double)total_bytes / elapsed / (1024 * 1024) << " MB/s\n"
+       << "read hits " << stats.read_hits.read() << "/" << stats.reads.read()
+       << std::endl;
+  return 0;
+}
@@ -1,4 +1,6 @@
+#include "common/ceph_context.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
 #include "include/rados/librados.h"
 #include "test/rados-api/test.h"
 
@@ -691,3 +693,282 @@ TEST(LibRadosAio, RoundTripWriteFullPP) {
   delete my_completion2;
   delete my_completion3;
 }
+
+struct ThreadedAioArgs {
+  IoCtx *ioctx;
+  int id;
+  int ops;
+  int r;
+};
+
+static void *threaded_aio_round_trip(void *arg)
+{
+  ThreadedAioArgs *a = (ThreadedAioArgs*)arg;
+  char buf[128];
+  memset(buf, 'a' + a->id, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+
+  std::vector<AioCompletion*> completions;
+  for (int i = 0; i < a->ops; ++i) {
+    ostringstream oss;
+    oss << "threaded." << a->id << "." << i;
+    AioCompletion *c = librados::Rados::aio_create_completion();
+    a->r = a->ioctx->aio_write(oss.str(), c, bl, sizeof(buf), 0);
+    if (a->r < 0)
+      return NULL;
+    completions.push_back(c);
+  }
+  for (int i = 0; i < a->ops; ++i) {
+    completions[i]->wait_for_safe();
+    a->r = completions[i]->get_return_value();
+    completions[i]->release();
+    if (a->r < 0)
+      return NULL;
+  }
+
+  for (int i = 0; i < a->ops; ++i) {
+    ostringstream oss;
+    oss << "threaded." << a->id << "." << i;
+    bufferlist bl2;
+    AioCompletion *c = librados::Rados::aio_create_completion();
+    a->r = a->ioctx->aio_read(oss.str(), c, &bl2, sizeof(buf), 0);
+    if (a->r < 0)
+      return NULL;
+    c->wait_for_complete();
+    a->r = c->get_return_value();
+    c->release();
+    if (a->r != (int)sizeof(buf) || memcmp(buf, bl2.c_str(), sizeof(buf))) {
+      a->r = -EIO;
+      return NULL;
+    }
+  }
+  a->r = 0;
+  return NULL;
+}
+
+TEST(LibRadosAio, MultiThreadedRoundTripPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  const int num_threads = 8;
+  pthread_t threads[num_threads];
+  ThreadedAioArgs args[num_threads];
+  for (int i = 0; i < num_threads; ++i) {
+    args[i].ioctx = &test_data.m_ioctx;
+    args[i].id = i;
+    args[i].ops = 32;
+    args[i].r = -1;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+				threaded_aio_round_trip, &args[i]));
+  }
+  {
+    TestAlarm alarm;
+    for (int i = 0; i < num_threads; ++i)
+      pthread_join(threads[i], NULL);
+  }
+  for (int i = 0; i < num_threads; ++i)
+    ASSERT_EQ(0, args[i].r);
+}
+
+struct SyncFromCallbackData {
+  AioTestDataPP *test_data;
+  int r;
+};
+
+static void sync_read_from_callback(rados_completion_t cb, void *arg)
+{
+  // aio callbacks run on their own threads, so they may wait for
+  // other io to finish without stalling the messenger
+  SyncFromCallbackData *d = (SyncFromCallbackData*)arg;
+  bufferlist bl;
+  d->r = d->test_data->m_ioctx.read("foo", bl, 128, 0);
+  sem_post(&d->test_data->m_sem);
+}
+
+TEST(LibRadosAio, SyncOpFromCallbackPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  SyncFromCallbackData d;
+  d.test_data = &test_data;
+  d.r = -1;
+  AioCompletion *my_completion = test_data.m_cluster.aio_create_completion(
+	  (void*)&d, sync_read_from_callback, NULL);
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl1;
+  bl1.append(buf, sizeof(buf));
+  ASSERT_EQ(0, test_data.m_ioctx.aio_write("foo", my_completion,
+					   bl1, sizeof(buf), 0));
+  {
+    TestAlarm alarm;
+    sem_wait(&test_data.m_sem);
+  }
+  ASSERT_EQ((int)sizeof(buf), d.r);
+  delete my_completion;
+}
+
+TEST(LibRadosAio, StatRemovePP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl1;
+  bl1.append(buf, sizeof(buf));
+  ASSERT_EQ(0, test_data.m_ioctx.write_full("foo", bl1));
+
+  uint64_t psize;
+  time_t pmtime;
+  AioCompletion *my_completion = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_stat("foo", my_completion, &psize, &pmtime));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, my_completion->wait_for_complete());
+  }
+  ASSERT_EQ(0, my_completion->get_return_value());
+  ASSERT_EQ(sizeof(buf), psize);
+
+  AioCompletion *my_completion2 = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_remove("foo", my_completion2));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, my_completion2->wait_for_safe());
+  }
+  ASSERT_EQ(0, my_completion2->get_return_value());
+
+  AioCompletion *my_completion3 = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_stat("foo", my_completion3, &psize, &pmtime));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, my_completion3->wait_for_complete());
+  }
+  ASSERT_EQ(-ENOENT, my_completion3->get_return_value());
+  delete my_completion;
+  delete my_completion2;
+  delete my_completion3;
+}
+
+TEST(LibRadosAio, XattrsPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  bufferlist val;
+  val.append("bar");
+  ASSERT_EQ(0, test_data.m_ioctx.write_full("foo", val));
+
+  AioCompletion *my_completion = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_setxattr("foo", my_completion, "attr", val));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, my_completion->wait_for_safe());
+  }
+  ASSERT_EQ(0, my_completion->get_return_value());
+
+  bufferlist got;
+  AioCompletion *my_completion2 = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_getxattr("foo", my_completion2, "attr", got));
+  std::map<std::string, bufferlist> attrs;
+  AioCompletion *my_completion3 = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_getxattrs("foo", my_completion3, attrs));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, my_completion2->wait_for_complete());
+    ASSERT_EQ(0, my_completion3->wait_for_complete());
+  }
+  ASSERT_EQ((int)val.length(), my_completion2->get_return_value());
+  ASSERT_EQ(0, memcmp(got.c_str(), "bar", 3));
+  ASSERT_EQ(0, my_completion3->get_return_value());
+  ASSERT_EQ(1u, attrs.size());
+  ASSERT_EQ(0, memcmp(attrs["attr"].c_str(), "bar", 3));
+
+  AioCompletion *my_completion4 = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_rmxattr("foo", my_completion4, "attr"));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, my_completion4->wait_for_safe());
+  }
+  ASSERT_EQ(0, my_completion4->get_return_value());
+  delete my_completion;
+  delete my_completion2;
+  delete my_completion3;
+  delete my_completion4;
+}
+
+TEST(LibRadosAio, GetXattrTooSmall) {
+  AioTestData test_data;
+  rados_completion_t my_completion;
+  ASSERT_EQ("", test_data.init());
+  const char val[] = "a longish value";
+  ASSERT_EQ(0, rados_setxattr(test_data.m_ioctx, "foo", "attr", val, sizeof(val)));
+  char buf[4];
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &my_completion));
+  ASSERT_EQ(0, rados_aio_getxattr(test_data.m_ioctx, "foo", my_completion,
+				  "attr", buf, sizeof(buf)));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, rados_aio_wait_for_complete(my_completion));
+  }
+  ASSERT_EQ(-ERANGE, rados_aio_get_return_value(my_completion));
+  rados_aio_release(my_completion);
+}
+
+// read one of the objecter's perf counters for this cluster handle
+static uint64_t objecter_counter(Rados& cluster, const char *name)
+{
+  CephContext *cct = (CephContext *)cluster.cct();
+  std::vector<char> buf;
+  cct->get_perfcounters_collection()->write_json_to_buf(buf, false);
+  std::string json(buf.begin(), buf.end());
+  size_t pos = json.find("\"objecter\":{");
+  if (pos == std::string::npos)
+    return 0;
+  pos = json.find(std::string("\"") + name + "\":", pos);
+  if (pos == std::string::npos)
+    return 0;
+  pos += strlen(name) + 3;
+  return strtoull(json.c_str() + pos, NULL, 10);
+}
+
+TEST(LibRadosAio, BatchedReadsPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  ASSERT_EQ(0, test_data.m_cluster.conf_set("objecter_batch_window", "0.05"));
+  char buf[8192];
+  for (unsigned i = 0; i < sizeof(buf); i++)
+    buf[i] = i % 251;
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  ASSERT_EQ(0, test_data.m_ioctx.write_full("foo", bl));
+  uint64_t batch_ops = objecter_counter(test_data.m_cluster, "batch_ops");
+
+  // adjacent reads, the last running past the end of the object
+  const int num = 5;
+  bufferlist out[num];
+  AioCompletion *c[num];
+  for (int i = 0; i < num; i++) {
+    c[i] = test_data.m_cluster.aio_create_completion();
+    ASSERT_EQ(0, test_data.m_ioctx.aio_read("foo", c[i], &out[i], 2048, i * 2048));
+  }
+  // a failing op in the same batch doesn't take the others down with it
+  bufferlist attr;
+  AioCompletion *xc = test_data.m_cluster.aio_create_completion();
+  ASSERT_EQ(0, test_data.m_ioctx.aio_getxattr("foo", xc, "nosuchattr", attr));
+  {
+    TestAlarm alarm;
+    for (int i = 0; i < num; i++)
+      ASSERT_EQ(0, c[i]->wait_for_complete());
+    ASSERT_EQ(0, xc->wait_for_complete());
+  }
+  for (int i = 0; i < 4; i++) {
+    ASSERT_LE(0, c[i]->get_return_value());
+    ASSERT_EQ(2048u, out[i].length());
+    ASSERT_EQ(0, memcmp(out[i].c_str(), buf + i * 2048, 2048));
+  }
+  ASSERT_LE(0, c[4]->get_return_value());
+  ASSERT_EQ(0u, out[4].length());
+  ASSERT_GT(0, xc->get_return_value());
+  // the reads went out together rather than one op each
+  ASSERT_LT(batch_ops + 1, objecter_counter(test_data.m_cluster, "batch_ops"));
+  for (int i = 0; i < num; i++)
+    delete c[i];
+  delete xc;
+  ASSERT_EQ(0, test_data.m_cluster.conf_set("objecter_batch_window", "0"));
+}
@@ -5,6 +5,8 @@
 #include "gtest/gtest.h"
 #include <errno.h>
 #include <string>
+#include <set>
+#include <sstream>
 
 using namespace librados;
 
@@ -47,3 +49,69 @@ TEST(LibRadosList, ListObjectsPP) {
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
+
+TEST(LibRadosList, ListObjectsShardsPP) {
+  std::string pool_name = get_temp_pool_name();
+  Rados cluster;
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  bufferlist bl;
+  bl.append("data");
+  std::set<std::string> written;
+  for (int i = 0; i < 64; i++) {
+    std::ostringstream oss;
+    oss << "obj" << i;
+    ASSERT_EQ(0, ioctx.write_full(oss.str(), bl));
+    written.insert(oss.str());
+  }
+
+  // every object shows up in exactly one shard
+  std::set<std::string> listed;
+  for (uint32_t shard = 0; shard < 4; shard++) {
+    for (ObjectIterator iter = ioctx.objects_begin(shard, 4);
+	 iter != ioctx.objects_end(); ++iter) {
+      ASSERT_TRUE(listed.insert(iter->first).second);
+    }
+  }
+  ASSERT_TRUE(written == listed);
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
+TEST(LibRadosList, ListObjectsSeekPP) {
+  std::string pool_name = get_temp_pool_name();
+  Rados cluster;
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  bufferlist bl;
+  bl.append("data");
+  std::set<std::string> written;
+  for (int i = 0; i < 64; i++) {
+    std::ostringstream oss;
+    oss << "obj" << i;
+    ASSERT_EQ(0, ioctx.write_full(oss.str(), bl));
+    written.insert(oss.str());
+  }
+
+  // stop half way, then resume from the saved position
+  std::set<std::string> listed;
+  ObjectIterator iter = ioctx.objects_begin();
+  for (int i = 0; i < 32; i++, ++iter) {
+    ASSERT_TRUE(iter != ioctx.objects_end());
+    listed.insert(iter->first);
+  }
+  ASSERT_TRUE(iter != ioctx.objects_end());
+  uint32_t pos = iter.get_pg_position();
+
+  ObjectIterator resumed = ioctx.objects_begin();
+  ASSERT_EQ(pos, resumed.seek(pos));
+  for (; resumed != ioctx.objects_end(); ++resumed)
+    listed.insert(resumed->first);
+  ASSERT_TRUE(written == listed);
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
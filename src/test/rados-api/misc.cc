@@ -305,6 +305,38 @@ TEST(LibRadosMisc, CloneRangePP) {
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
 
+TEST(LibRadosMisc, CopyFromPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+  char buf[64];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl, xbl;
+  bl.append(buf, sizeof(buf));
+  xbl.append("bar");
+  ASSERT_EQ(sizeof(buf), (size_t)ioctx.write("foo", bl, sizeof(buf), 0));
+  ASSERT_EQ((int)xbl.length(), ioctx.setxattr("foo", "attr", xbl));
+
+  ObjectWriteOperation op;
+  op.copy_from("foo", ioctx, 0);
+  ASSERT_EQ(0, ioctx.operate("bar", &op));
+  bufferlist bl2, xbl2;
+  ASSERT_EQ(sizeof(buf), (size_t)ioctx.read("bar", bl2, sizeof(buf) * 2, 0));
+  ASSERT_EQ(0, memcmp(buf, bl2.c_str(), sizeof(buf)));
+  ASSERT_EQ((int)xbl.length(), ioctx.getxattr("bar", "attr", xbl2));
+  ASSERT_TRUE(xbl == xbl2);
+
+  // a missing source fails the copy and leaves the target alone
+  ObjectWriteOperation op2;
+  op2.copy_from("nonexistent", ioctx, 0);
+  ASSERT_EQ(-ENOENT, ioctx.operate("bar", &op2));
+  ASSERT_EQ(sizeof(buf), (size_t)ioctx.read("bar", bl2, sizeof(buf), 0));
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
 TEST(LibRadosMisc, CloneRange) {
   char buf[128];
   rados_t cluster;
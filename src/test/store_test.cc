@@ -638,6 +638,109 @@ TEST_F(StoreTest, OMapTest) {
   store->apply_transaction(t);
 }
 
+TEST_F(StoreTest, InlineObjectTest) {
+  // remount with small objects kept inline
+  store->umount();
+  g_ceph_context->_conf->set_val("filestore_inline_max_bytes", "100");
+  g_ceph_context->_conf->apply_changes(NULL);
+  store.reset(new FileStore(string("store_test_temp_dir"), string("store_test_temp_journal")));
+  ASSERT_EQ(0, store->mount());
+
+  coll_t cid("inline");
+  hobject_t hoid("tesinline", "", CEPH_NOSNAP, 0);
+  hobject_t hoid2("tesinline2", "", CEPH_NOSNAP, 0);
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  bufferlist small, big, got;
+  small.append(string(10, 'a'));
+  big.append(string(200, 'b'));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, small.length(), small);
+    t.write(cid, hoid, 20, small.length(), small);
+    map<string, bufferlist> keys;
+    keys["key"] = small;
+    t.omap_setkeys(cid, hoid, keys);
+    t.omap_clear(cid, hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  struct stat st;
+  ASSERT_EQ(0, store->stat(cid, hoid, &st));
+  ASSERT_EQ(30, st.st_size);
+  ASSERT_EQ(30, store->read(cid, hoid, 0, 0, got));
+  ASSERT_EQ(string(10, 'a') + string(10, '\0') + string(10, 'a'),
+	    string(got.c_str(), got.length()));
+  got.clear();
+  ASSERT_EQ(5, store->read(cid, hoid, 25, 100, got));
+
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, hoid, hoid2);
+    t.truncate(cid, hoid, 5);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(0, store->stat(cid, hoid, &st));
+  ASSERT_EQ(5, st.st_size);
+  ASSERT_EQ(0, store->stat(cid, hoid2, &st));
+  ASSERT_EQ(30, st.st_size);
+
+  // growing past the limit moves it into the file
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 5, big.length(), big);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  got.clear();
+  ASSERT_EQ(205, store->read(cid, hoid, 0, 0, got));
+  ASSERT_EQ(string(5, 'a') + string(200, 'b'), string(got.c_str(), got.length()));
+  got.clear();
+  ASSERT_EQ(30, store->read(cid, hoid2, 0, 0, got));
+
+  // once promoted, small overwrites land in the file
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, small.length(), small);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  got.clear();
+  ASSERT_EQ(205, store->read(cid, hoid, 0, 0, got));
+  ASSERT_EQ(string(10, 'a') + string(195, 'b'), string(got.c_str(), got.length()));
+
+  // a clone_range running off the end of an inline source gets zeros
+  hobject_t hoid3("tesinline3", "", CEPH_NOSNAP, 0);
+  {
+    ObjectStore::Transaction t;
+    t.clone_range(cid, hoid2, hoid3, 25, 10, 0);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  got.clear();
+  ASSERT_EQ(10, store->read(cid, hoid3, 0, 0, got));
+  ASSERT_EQ(string(5, 'a') + string(5, '\0'), string(got.c_str(), got.length()));
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove(cid, hoid3);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("filestore_inline_max_bytes", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -0,0 +1,127 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software 
+ * Foundation.  See file COPYING.
+ * 
+ */
+
+/*
+ * Time a full sweep of collection_list_partial over one large
+ * collection, the way backfill (scan_range) and pgls walk a PG.
+ *
+ * With --same-hash every object shares one hash (as objects sharing a
+ * locator key do), so they all land in a single leaf directory.
+ */
+
+#include <iostream>
+#include "os/FileStore.h"
+#include "global/global_init.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "include/ceph_hash.h"
+
+void usage()
+{
+  cerr << "usage: test_filestore_list [--objects N] [--batch N] [--same-hash] [--reuse] dir journal" << std::endl;
+  exit(1);
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num_objects = 1000000;
+  int batch = 512;
+  bool same_hash = false;
+  bool reuse = false;
+  std::string val;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--objects", (char*)NULL)) {
+      num_objects = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--batch", (char*)NULL)) {
+      batch = atoi(val.c_str());
+    } else if (ceph_argparse_flag(args, i, "--same-hash", (char*)NULL)) {
+      same_hash = true;
+    } else if (ceph_argparse_flag(args, i, "--reuse", (char*)NULL)) {
+      reuse = true;
+    } else {
+      ++i;
+    }
+  }
+  if (args.size() < 2)
+    usage();
+
+  FileStore *fs = new FileStore(args[0], args[1]);
+  coll_t coll("list_bench");
+
+  if (!reuse && fs->mkfs() < 0) {
+    cerr << "mkfs failed" << std::endl;
+    return 1;
+  }
+  if (fs->mount() < 0) {
+    cerr << "mount failed" << std::endl;
+    return 1;
+  }
+
+  if (!reuse) {
+    ObjectStore::Transaction t;
+    t.create_collection(coll);
+    fs->apply_transaction(t);
+
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (int i = 0; i < num_objects; ) {
+      ObjectStore::Transaction t;
+      for (int j = 0; j < 1000 && i < num_objects; ++j, ++i) {
+	char buf[40];
+	snprintf(buf, sizeof(buf), "obj.%08d", i);
+	hobject_t hoid(object_t(buf), string(), CEPH_NOSNAP,
+		       same_hash ? 0x1234 : ceph_str_hash_linux(buf, strlen(buf)));
+	t.touch(coll, hoid);
+      }
+      fs->apply_transaction(t);
+      if (i % 100000 == 0)
+	cout << "created " << i << std::endl;
+    }
+    cout << "created " << num_objects << " objects in "
+	 << (ceph_clock_now(g_ceph_context) - start) << " s" << std::endl;
+  }
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  hobject_t cur, next;
+  uint64_t listed = 0, calls = 0;
+  while (true) {
+    vector<hobject_t> ls;
+    int r = fs->collection_list_partial(coll, cur, batch, batch, 0, &ls, &next);
+    if (r < 0) {
+      cerr << "collection_list_partial: " << cpp_strerror(r) << std::endl;
+      return 1;
+    }
+    listed += ls.size();
+    calls++;
+    if (next.is_max())
+      break;
+    cur = next;
+  }
+  utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+  cout << "listed " << listed << " objects in " << calls << " calls, "
+       << elapsed << " s (" << (listed / (double)elapsed) << " objects/s)"
+       << std::endl;
+
+  fs->umount();
+  delete fs;
+  return listed == (uint64_t)num_objects || reuse ? 0 : 1;
+}
@@ -642,6 +642,235 @@ TEST(LibRBD, TestIO)
   ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
 }
 
+TEST(LibRBD, TestIOWithCache)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  // writeback, then write-through
+  const char *max_dirty[] = { "4096", "0" };
+  for (int mode = 0; mode < 2; ++mode) {
+    ASSERT_EQ(0, rados_conf_set(cluster, "rbd_cache", "true"));
+    ASSERT_EQ(0, rados_conf_set(cluster, "rbd_cache_max_dirty", max_dirty[mode]));
+    ASSERT_EQ(0, rados_conf_set(cluster, "rbd_cache_target_dirty", "1024"));
+
+    rbd_image_t image;
+    int order = 16;  // so a resize leaves the first objects alone
+    const char *name = "testimg";
+    uint64_t size = 2 << 20;
+
+    ASSERT_EQ(0, rbd_create(ioctx, name, size, &order));
+    ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+
+    // each open of an image gets a cache of its own
+    rbd_image_t image2;
+    ASSERT_EQ(0, rbd_open(ioctx, name, &image2, NULL));
+    ASSERT_EQ(0, rbd_close(image2));
+
+    char test_data[TEST_IO_SIZE + 1];
+    char zero_data[TEST_IO_SIZE + 1];
+    int i;
+
+    for (i = 0; i < TEST_IO_SIZE; ++i)
+      test_data[i] = (char) (rand() % (126 - 33) + 33);
+    test_data[TEST_IO_SIZE] = '\0';
+    memset(zero_data, 0, sizeof(zero_data));
+
+    // more than max dirty, so some of it has to be written back
+    for (i = 0; i < 10; ++i)
+      write_test_data(image, test_data, TEST_IO_SIZE * i, TEST_IO_SIZE);
+    for (i = 10; i < 20; ++i)
+      aio_write_test_data(image, test_data, TEST_IO_SIZE * i, TEST_IO_SIZE);
+    ASSERT_EQ(0, rbd_flush(image));
+
+    for (i = 0; i < 10; ++i)
+      read_test_data(image, test_data, TEST_IO_SIZE * i, TEST_IO_SIZE);
+    for (i = 10; i < 20; ++i)
+      aio_read_test_data(image, test_data, TEST_IO_SIZE * i, TEST_IO_SIZE);
+
+    // a hole reads back as zeroes, from the osds and then from cache
+    read_test_data(image, zero_data, size - TEST_IO_SIZE, TEST_IO_SIZE);
+    aio_read_test_data(image, zero_data, size - TEST_IO_SIZE, TEST_IO_SIZE);
+
+    // shrinking drops the cached tail; growing back must not bring it back
+    write_test_data(image, test_data, size - TEST_IO_SIZE, TEST_IO_SIZE);
+    ASSERT_EQ(0, rbd_resize(image, size / 2));
+    ASSERT_EQ(0, rbd_resize(image, size));
+    read_test_data(image, zero_data, size - TEST_IO_SIZE, TEST_IO_SIZE);
+    read_test_data(image, test_data, 0, TEST_IO_SIZE);
+
+    // dirty data is in the snapshot, later writes are not
+    write_test_data(image, zero_data, 0, TEST_IO_SIZE);
+    ASSERT_EQ(0, rbd_snap_create(image, "snap"));
+    write_test_data(image, test_data, 0, TEST_IO_SIZE);
+    ASSERT_EQ(0, rbd_snap_set(image, "snap"));
+    read_test_data(image, zero_data, 0, TEST_IO_SIZE);
+    ASSERT_EQ(-EROFS, rbd_write(image, 0, TEST_IO_SIZE, test_data));
+    ASSERT_EQ(0, rbd_snap_set(image, NULL));
+    read_test_data(image, test_data, 0, TEST_IO_SIZE);
+
+    // data still dirty in the cache at rollback is rolled back too
+    write_test_data(image, test_data, 100 * TEST_IO_SIZE, TEST_IO_SIZE);
+    ASSERT_EQ(0, rbd_snap_rollback(image, "snap"));
+    read_test_data(image, zero_data, 0, TEST_IO_SIZE);
+    read_test_data(image, zero_data, 100 * TEST_IO_SIZE, TEST_IO_SIZE);
+    ASSERT_EQ(0, rbd_snap_remove(image, "snap"));
+
+    ASSERT_EQ(0, rbd_close(image));
+    ASSERT_EQ(0, rbd_remove(ioctx, name));
+  }
+
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_cache", "false"));
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRBD, TestObjectMap)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_object_map", "true"));
+
+  rbd_image_t image;
+  int order = 16;
+  uint64_t obj_size = 1 << order;
+  uint64_t size = 16 * obj_size;
+  const char *name = "testimg";
+  uint64_t used;
+
+  ASSERT_EQ(0, rbd_create(ioctx, name, size, &order));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  ASSERT_EQ(0, rbd_used_size(image, &used));
+  ASSERT_EQ(0u, used);
+
+  char test_data[TEST_IO_SIZE + 1];
+  char zero_data[TEST_IO_SIZE + 1];
+  for (int i = 0; i < TEST_IO_SIZE; ++i)
+    test_data[i] = (char) (rand() % (126 - 33) + 33);
+  test_data[TEST_IO_SIZE] = '\0';
+  memset(zero_data, 0, sizeof(zero_data));
+
+  write_test_data(image, test_data, 0, TEST_IO_SIZE);
+  aio_write_test_data(image, test_data, 5 * obj_size, TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_used_size(image, &used));
+  ASSERT_EQ(2 * obj_size, used);
+  read_test_data(image, zero_data, 3 * obj_size, TEST_IO_SIZE);
+  read_test_data(image, test_data, 5 * obj_size, TEST_IO_SIZE);
+
+  // rolling back drops objects created since the snapshot
+  ASSERT_EQ(0, rbd_snap_create(image, "snap"));
+  write_test_data(image, test_data, 9 * obj_size, TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_used_size(image, &used));
+  ASSERT_EQ(3 * obj_size, used);
+  ASSERT_EQ(0, rbd_snap_rollback(image, "snap"));
+  ASSERT_EQ(0, rbd_used_size(image, &used));
+  ASSERT_EQ(2 * obj_size, used);
+  read_test_data(image, zero_data, 9 * obj_size, TEST_IO_SIZE);
+  read_test_data(image, test_data, 5 * obj_size, TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_snap_remove(image, "snap"));
+
+  // shrinking removes objects, growing back doesn't bring them back
+  ASSERT_EQ(0, rbd_resize(image, 4 * obj_size));
+  ASSERT_EQ(0, rbd_resize(image, size));
+  ASSERT_EQ(0, rbd_used_size(image, &used));
+  ASSERT_EQ(obj_size, used);
+  read_test_data(image, zero_data, 5 * obj_size, TEST_IO_SIZE);
+
+  // a copy gets only the objects that exist
+  ASSERT_EQ(0, rbd_copy(image, ioctx, "testcopy"));
+  rbd_image_t copy;
+  ASSERT_EQ(0, rbd_open(ioctx, "testcopy", &copy, NULL));
+  ASSERT_EQ(0, rbd_used_size(copy, &used));
+  ASSERT_EQ(obj_size, used);
+  read_test_data(copy, test_data, 0, TEST_IO_SIZE);
+  read_test_data(copy, zero_data, 5 * obj_size, TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_close(copy));
+  ASSERT_EQ(0, rbd_remove(ioctx, "testcopy"));
+
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rbd_remove(ioctx, name));
+
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_object_map", "false"));
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRBD, TestIOStriped)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  rbd_image_t image;
+  int order = 16;
+  uint64_t stripe_unit = 4096, stripe_count = 4;
+  uint64_t set_size = (1 << order) * stripe_count;
+  uint64_t size = 4 * set_size;
+  const char *name = "testimg";
+  uint64_t val;
+
+  ASSERT_EQ(-EINVAL, rbd_create_striped(ioctx, name, size, &order, 3000, 4));
+  ASSERT_EQ(0, rbd_create_striped(ioctx, name, size, &order,
+				  stripe_unit, stripe_count));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  ASSERT_EQ(0, rbd_get_stripe_unit(image, &val));
+  ASSERT_EQ(stripe_unit, val);
+  ASSERT_EQ(0, rbd_get_stripe_count(image, &val));
+  ASSERT_EQ(stripe_count, val);
+
+  // two rows of stripe units, starting and ending mid-unit
+  size_t len = 2 * stripe_unit * stripe_count;
+  char *test_data = (char *)malloc(len + 1);
+  char *zero_data = (char *)calloc(len + 1, 1);
+  for (size_t i = 0; i < len; ++i)
+    test_data[i] = (char) (rand() % (126 - 33) + 33);
+  test_data[len] = '\0';
+
+  write_test_data(image, test_data, stripe_unit / 2, len);
+  read_test_data(image, test_data, stripe_unit / 2, len);
+  aio_write_test_data(image, test_data, 2 * set_size - stripe_unit, len);
+  aio_read_test_data(image, test_data, 2 * set_size - stripe_unit, len);
+  read_test_data(image, zero_data, set_size, stripe_unit);
+
+  // shrinking into the middle of a set keeps what is below the new
+  // size, in every object of the set
+  write_test_data(image, test_data, set_size, len);
+  uint64_t newsize = set_size + stripe_count * stripe_unit + 10;
+  ASSERT_EQ(0, rbd_resize(image, newsize));
+  ASSERT_EQ(0, rbd_resize(image, size));
+  read_test_data(image, test_data, set_size, newsize - set_size);
+  read_test_data(image, zero_data, newsize, set_size + len - newsize);
+  read_test_data(image, test_data, stripe_unit / 2, len);
+
+  // a copy is striped the same way
+  ASSERT_EQ(0, rbd_copy(image, ioctx, "testcopy"));
+  rbd_image_t copy;
+  ASSERT_EQ(0, rbd_open(ioctx, "testcopy", &copy, NULL));
+  ASSERT_EQ(0, rbd_get_stripe_unit(copy, &val));
+  ASSERT_EQ(stripe_unit, val);
+  ASSERT_EQ(0, rbd_get_stripe_count(copy, &val));
+  ASSERT_EQ(stripe_count, val);
+  read_test_data(copy, test_data, stripe_unit / 2, len);
+  read_test_data(copy, zero_data, newsize, set_size + len - newsize);
+  ASSERT_EQ(0, rbd_close(copy));
+  ASSERT_EQ(0, rbd_remove(ioctx, "testcopy"));
+
+  free(test_data);
+  free(zero_data);
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rbd_remove(ioctx, name));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
 
 void simple_write_cb_pp(librbd::completion_t cb, void *arg)
 {
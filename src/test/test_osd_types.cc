@@ -122,3 +122,84 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(pg_log_entry_t, dirty_extents)
+{
+  hobject_t oid(object_t("objname"), "key", 123, 456);
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, oid, eversion_t(1,3), eversion_t(1,2),
+		   osd_reqid_t(), utime_t());
+  e.dirty_extents.insert(0, 4096);
+  e.dirty_extents.insert(1 << 20, 512);
+  e.dirty_extents_valid = true;
+
+  bufferlist bl;
+  ::encode(e, bl);
+  bufferlist::iterator p = bl.begin();
+  pg_log_entry_t d;
+  ::decode(d, p);
+  ASSERT_TRUE(d.dirty_extents_valid);
+  ASSERT_EQ(2, d.dirty_extents.num_intervals());
+  ASSERT_TRUE(d.dirty_extents.contains(1 << 20, 512));
+
+  // entries that did not record extents decode as unknown
+  pg_log_entry_t f(pg_log_entry_t::DELETE, oid, eversion_t(1,4), eversion_t(1,3),
+		   osd_reqid_t(), utime_t());
+  bl.clear();
+  ::encode(f, bl);
+  p = bl.begin();
+  ::decode(d, p);
+  ASSERT_FALSE(d.dirty_extents_valid);
+  ASSERT_TRUE(d.dirty_extents.empty());
+}
+
+TEST(pg_stat_delta_t, apply)
+{
+  pg_stat_t a;
+  a.version = eversion_t(3, 10);
+  a.reported = eversion_t(3, 7);
+  a.state = PG_STATE_ACTIVE;
+  a.stats.sum.num_objects = 10;
+  a.stats.sum.num_wr = 100;
+  a.up.push_back(0);
+  a.acting.push_back(0);
+  a.last_fresh = utime_t(100, 0);
+
+  // counters only
+  pg_stat_t b = a;
+  b.version = eversion_t(3, 12);
+  b.reported = eversion_t(3, 8);
+  b.stats.sum.num_wr = 102;
+  b.last_fresh = utime_t(105, 0);
+  pg_stat_delta_t d(a, b);
+  ASSERT_EQ(a.reported, d.base);
+  ASSERT_EQ((unsigned)(pg_stat_delta_t::SUM | pg_stat_delta_t::STAMPS), d.fields);
+
+  bufferlist bl, full;
+  ::encode(d, bl);
+  ::encode(b, full);
+  ASSERT_LT(bl.length(), full.length());
+
+  bufferlist::iterator p = bl.begin();
+  pg_stat_delta_t e;
+  ::decode(e, p);
+  pg_stat_t c = a;
+  e.apply(c);
+  bufferlist cbl;
+  ::encode(c, cbl);
+  ASSERT_EQ(full.length(), cbl.length());
+  ASSERT_EQ(0, memcmp(full.c_str(), cbl.c_str(), full.length()));
+
+  // state and mapping
+  pg_stat_t f = b;
+  f.reported = eversion_t(4, 1);
+  f.state = PG_STATE_ACTIVE | PG_STATE_CLEAN;
+  f.acting.push_back(1);
+  d.build(b, f);
+  ASSERT_EQ((unsigned)(pg_stat_delta_t::STATE | pg_stat_delta_t::MAPPING), d.fields);
+  c = b;
+  d.apply(c);
+  ASSERT_EQ(f.state, c.state);
+  ASSERT_EQ(f.acting, c.acting);
+  ASSERT_EQ(f.reported, c.reported);
+  ASSERT_EQ(b.stats.sum.num_wr, c.stats.sum.num_wr);
+}
@@ -0,0 +1,218 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/types.h"
+#include "osd/OSDMap.h"
+#include "global/global_context.h"
+#include "test/unit.h"
+
+static const int num_osds = 12;
+
+static void apply(OSDMap& m, OSDMap::Incremental& inc)
+{
+  inc.fsid = m.get_fsid();
+  inc.epoch = m.get_epoch() + 1;
+  ASSERT_EQ(0, m.apply_incremental(inc));
+}
+
+// every table lookup must agree with crush
+static void check_mapping(OSDMap& m)
+{
+  ASSERT_TRUE(m.has_pg_mapping());
+  unsigned num = 0;
+  for (map<int64_t,pg_pool_t>::const_iterator p = m.get_pools().begin();
+       p != m.get_pools().end();
+       ++p) {
+    for (ps_t ps = 0; ps < p->second.get_pg_num(); ps++, num++) {
+      pg_t pg(ps, p->first, -1);
+      vector<int> raw, up, acting, traw, tup, tacting, tacting2;
+      m.calc_pg_mapping(pg, raw, up, acting);
+      m.pg_to_osds(pg, traw);
+      m.pg_to_up_acting_osds(pg, tup, tacting);
+      m.pg_to_acting_osds(pg, tacting2);
+      ASSERT_EQ(raw, traw) << pg;
+      ASSERT_EQ(up, tup) << pg;
+      ASSERT_EQ(acting, tacting) << pg;
+      ASSERT_EQ(acting, tacting2) << pg;
+    }
+  }
+  ASSERT_EQ(num, m.get_pg_mapping_num_pgs());
+}
+
+static void boot_all(OSDMap& m)
+{
+  uuid_d fsid;
+  memset(&fsid, 0, sizeof(fsid));
+  OSDMap simple;
+  simple.build_simple(g_ceph_context, 0, fsid, num_osds, 4, 4, 0);
+  bufferlist bl;
+  simple.encode(bl);
+  m.decode(bl);  // (re)calculates the pg masks
+  m.enable_pg_mapping(2);
+
+  OSDMap::Incremental inc;
+  for (int i = 0; i < num_osds; i++) {
+    inc.new_up_client[i] = entity_addr_t();
+    inc.new_weight[i] = CEPH_OSD_IN;
+  }
+  apply(m, inc);
+}
+
+TEST(OSDMap, pg_mapping_build)
+{
+  OSDMap m;
+  boot_all(m);
+  check_mapping(m);
+  ASSERT_GT(m.get_pg_mapping_bytes(), 0u);
+
+  // a decoded copy rebuilds the same table
+  bufferlist bl;
+  m.encode(bl);
+  OSDMap c;
+  c.enable_pg_mapping(1);
+  c.decode(bl);
+  check_mapping(c);
+}
+
+TEST(OSDMap, pg_mapping_incremental)
+{
+  OSDMap m;
+  boot_all(m);
+
+  // osds going down only touch up/acting
+  {
+    OSDMap::Incremental inc;
+    inc.new_state[1] = CEPH_OSD_UP;
+    inc.new_state[5] = CEPH_OSD_UP;
+    apply(m, inc);
+    check_mapping(m);
+  }
+
+  // pg_temp, including one wider than the pool
+  pg_t a(3, 0, -1), b(7, 1, -1);
+  {
+    OSDMap::Incremental inc;
+    inc.new_pg_temp[a].push_back(2);
+    inc.new_pg_temp[a].push_back(3);
+    for (int i = 0; i < num_osds; i++)
+      inc.new_pg_temp[b].push_back(i);
+    apply(m, inc);
+    check_mapping(m);
+  }
+
+  // an osd in a pg_temp going down, and coming back
+  {
+    OSDMap::Incremental inc;
+    inc.new_state[2] = CEPH_OSD_UP;
+    apply(m, inc);
+    check_mapping(m);
+  }
+  {
+    OSDMap::Incremental inc;
+    inc.new_up_client[2] = entity_addr_t();
+    inc.new_up_client[5] = entity_addr_t();
+    inc.new_pg_temp[a];  // remove
+    apply(m, inc);
+    check_mapping(m);
+  }
+
+  // pool resize and removal
+  {
+    OSDMap::Incremental inc;
+    pg_pool_t pool = *m.get_pg_pool(1);
+    pool.pg_num *= 2;
+    pool.pgp_num *= 2;
+    pool.calc_pg_masks();
+    inc.new_pools[1] = pool;
+    inc.old_pools.insert(2);
+    apply(m, inc);
+    check_mapping(m);
+  }
+
+  // weight changes
+  {
+    OSDMap::Incremental inc;
+    inc.new_weight[4] = CEPH_OSD_OUT;
+    inc.new_weight[6] = CEPH_OSD_IN / 2;
+    apply(m, inc);
+    check_mapping(m);
+  }
+
+  // direct mutation invalidates the table until the next incremental
+  m.set_weight(4, CEPH_OSD_IN);
+  ASSERT_FALSE(m.has_pg_mapping());
+  {
+    OSDMap::Incremental inc;
+    apply(m, inc);
+    check_mapping(m);
+  }
+}
+
+TEST(OSDMap, shared_copy)
+{
+  OSDMap m;
+  boot_all(m);
+
+  // a copy shares everything until one side changes it
+  OSDMap c(m);
+  ASSERT_EQ(m.crush, c.crush);
+  ASSERT_EQ(&m.get_pools(), &c.get_pools());
+  {
+    OSDMap::Incremental inc;
+    inc.new_state[3] = CEPH_OSD_UP;
+    apply(c, inc);
+  }
+  ASSERT_EQ(m.crush, c.crush);
+  ASSERT_EQ(&m.get_pools(), &c.get_pools());
+  ASSERT_TRUE(m.is_up(3));
+  ASSERT_FALSE(c.is_up(3));
+  check_mapping(c);
+
+  {
+    OSDMap::Incremental inc;
+    pg_pool_t pool = *c.get_pg_pool(0);
+    pool.set_snap_epoch(c.get_epoch() + 1);
+    inc.new_pools[0] = pool;
+    apply(c, inc);
+  }
+  ASSERT_NE(&m.get_pools(), &c.get_pools());
+  ASSERT_NE(m.get_pg_pool(0)->get_snap_epoch(),
+	    c.get_pg_pool(0)->get_snap_epoch());
+  check_mapping(m);
+  check_mapping(c);
+}
+
+TEST(OSDMap, dedup)
+{
+  OSDMap m;
+  boot_all(m);
+
+  bufferlist bl;
+  m.encode(bl);
+  OSDMap c;
+  c.enable_pg_mapping(1);
+  c.decode(bl);
+  ASSERT_NE(m.crush, c.crush);
+
+  set<const void*> seen;
+  uint64_t alone = c.get_mem_usage(&seen);
+  c.dedup(m);
+  ASSERT_EQ(m.crush, c.crush);
+  ASSERT_EQ(&m.get_pools(), &c.get_pools());
+  check_mapping(c);
+
+  // the shared parts are only counted once
+  seen.clear();
+  m.get_mem_usage(&seen);
+  uint64_t shared = c.get_mem_usage(&seen);
+  ASSERT_LT(shared, alone);
+}
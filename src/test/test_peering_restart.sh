@@ -0,0 +1,76 @@
+#!/bin/bash -x
+
+#
+# Measure how long peering takes after an osd restarts, having missed
+# a long run of osdmap epochs while it was down.
+#
+# Environment variables:
+# NUM_EPOCHS                    Number of map epochs to create while the
+#                               osd is down (default 1000)
+#
+
+# Includes
+source "`dirname $0`/test_common.sh"
+
+NUM_EPOCHS=${NUM_EPOCHS:-1000}
+
+# Functions
+setup() {
+        export CEPH_NUM_OSD=$1
+        vstart_config=$2
+
+        # Start ceph
+        ./stop.sh
+
+        ./vstart.sh -d -n -o "$vstart_config" || die "vstart failed"
+}
+
+# Seconds until no pg is in anything but active+clean
+wait_for_clean() {
+        start=`date +%s`
+        while true; do
+                ./ceph -c ./ceph.conf pg stat -o - | grep -q 'peering\|down\|creating'
+                [ $? -ne 0 ] && break
+                now=`date +%s`
+                [ $(($now-$start)) -lt 600 ] || die "pgs never finished peering"
+                sleep 1
+        done
+        now=`date +%s`
+        echo $(($now-$start))
+}
+
+restart_impl() {
+        poll_cmd "./ceph osd stat -o -" "$CEPH_NUM_OSD up, $CEPH_NUM_OSD in" 3 240
+        [ $? -eq 1 ] || die "didn't start $CEPH_NUM_OSD osds"
+
+        write_objects 1 1 100 4000 data
+
+        stop_osd 0
+        ./ceph -c ./ceph.conf osd down 0
+
+        # Churn the map; every out/in moves pgs around
+        for i in `seq 1 $(($NUM_EPOCHS/2))`; do
+                ./ceph -c ./ceph.conf osd out 1 || die "osd out failed"
+                ./ceph -c ./ceph.conf osd in 1 || die "osd in failed"
+        done
+
+        restart_osd 0
+        poll_cmd "./ceph osd stat -o -" "$CEPH_NUM_OSD up, $CEPH_NUM_OSD in" 1 240
+        [ $? -eq 1 ] || die "osd.0 didn't come back up"
+
+        secs=`wait_for_clean`
+        echo "peering after restart over $NUM_EPOCHS epochs took $secs seconds"
+        grep "build_past_intervals" out/osd.0.log | tail -1
+}
+
+peering_restart() {
+        setup 3 'osd map cache max = 100
+        debug osd = 1'
+        restart_impl
+}
+
+run() {
+        peering_restart || die "test failed"
+}
+
+$@
@@ -0,0 +1,83 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/types.h"
+#include "osd/SnapMapper.h"
+#include "test/unit.h"
+
+static hobject_t make_clone(const char *name, const char *key, snapid_t snap,
+			    uint32_t hash)
+{
+  return hobject_t(object_t(name), key, snap, hash);
+}
+
+TEST(SnapMapper, parse)
+{
+  hobject_t o = make_clone("foo", "", 12, 0xdeadbeef);
+  snapid_t snaps[] = { 0, 1, 0xa, 0x10, 0xfffffff0ull, CEPH_MAXSNAP };
+  for (unsigned i = 0; i < sizeof(snaps) / sizeof(snaps[0]); i++) {
+    string key = SnapMapper::to_raw_key(snaps[i], o);
+    snapid_t s;
+    ASSERT_TRUE(SnapMapper::parse_raw_key(key, &s)) << key;
+    ASSERT_EQ(snaps[i], s) << key;
+  }
+
+  snapid_t s;
+  ASSERT_FALSE(SnapMapper::parse_raw_key("", &s));
+  ASSERT_FALSE(SnapMapper::parse_raw_key("SNA_", &s));
+  ASSERT_FALSE(SnapMapper::parse_raw_key("OBJ_0000000000000001_", &s));
+  ASSERT_FALSE(SnapMapper::parse_raw_key("SNA_000000000000000g_", &s));
+}
+
+TEST(SnapMapper, range)
+{
+  // every key for a snap falls in its prefix range, and the ranges
+  // are ordered by snap, so a lower_bound scan finds exactly one snap
+  hobject_t objs[] = {
+    make_clone("a", "", 1, 0),
+    make_clone("a", "", 2, 0),
+    make_clone("b", "", 2, 0xffffffff),
+    make_clone("\xff\xff", "", 2, 0xffffffff),
+    make_clone("c", "loc", 3, 7),
+  };
+  unsigned num = sizeof(objs) / sizeof(objs[0]);
+  snapid_t snaps[] = { 3, 9, 0xa, 0x10, 0x100 };
+  for (unsigned i = 0; i < sizeof(snaps) / sizeof(snaps[0]); i++) {
+    string prefix = SnapMapper::get_prefix(snaps[i]);
+    string next = SnapMapper::get_prefix(snaps[i] + 1);
+    ASSERT_LT(prefix, next);
+    for (unsigned j = 0; j < num; j++) {
+      string key = SnapMapper::to_raw_key(snaps[i], objs[j]);
+      ASSERT_EQ(0, key.compare(0, prefix.length(), prefix)) << key;
+      ASSERT_LT(prefix, key);
+      ASSERT_LT(key, next);
+    }
+  }
+}
+
+TEST(SnapMapper, unique)
+{
+  // (name, key) pairs that concatenate to the same string, and clones
+  // differing only in hash or snap, all get their own keys
+  hobject_t objs[] = {
+    make_clone("ab", "c", 2, 1),
+    make_clone("a", "bc", 2, 1),
+    make_clone("a", "bc", 3, 1),
+    make_clone("a", "bc", 3, 2),
+    make_clone("abc", "", 2, 1),
+  };
+  unsigned num = sizeof(objs) / sizeof(objs[0]);
+  set<string> keys;
+  for (unsigned j = 0; j < num; j++)
+    keys.insert(SnapMapper::to_raw_key(5, objs[j]));
+  ASSERT_EQ(num, keys.size());
+}